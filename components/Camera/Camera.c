@@ -3,11 +3,16 @@
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "camera_pins.h"
+#include "driver/gpio.h"
 
 #define TAG "Camera"
 
 #define NVS_SENSOR_KEY "nvs_sen"
 
+// 夜间预设
+#define NIGHT_GAINCEILING GAINCEILING_16X // 夜间增益上限
+#define NIGHT_QUALITY_OFFSET 4            // 夜间JPEG质量值增加多少，抵消噪点带来的帧大小增长
+
 static framesize_t l_frameSize = FRAMESIZE_FHD;
 
 // indexed by frame size - needs to be consistent with sensor.h framesize_t enum
@@ -172,6 +177,65 @@ void get_camera_frame_dimension(int *width, int *height)
     }
 }
 
+static bool l_nightMode = false;
+typedef struct
+{
+    uint8_t aec2;
+    uint8_t gainceiling;
+    uint8_t quality;
+} nightPreset;
+static nightPreset l_dayPreset;   // 白天切到夜间时的设置，切回白天时恢复
+static nightPreset l_nightPreset; // 夜间预设实际写入的值
+
+// 切换日夜画质预设：夜间打开AEC夜间模式、提高增益上限、适当降低JPEG质量，有补光灯的板子同时开灯
+// 预设不保存到NVS。白天设置只在白天切到夜间时记录；夜间被用户改过的项切回白天时保留用户的值
+esp_err_t set_camera_night_mode(bool night)
+{
+    if (night == l_nightMode) {
+        return ESP_OK;
+    }
+    sensor_t *sen = esp_camera_sensor_get();
+    if (!sen) {
+        ESP_LOGE(TAG, "Sensor not found");
+        return ESP_FAIL;
+    }
+    camera_status_t *status = &(sen->status);
+    if (night) {
+        l_dayPreset.aec2 = status->aec2;
+        l_dayPreset.gainceiling = status->gainceiling;
+        l_dayPreset.quality = status->quality;
+        int quality = status->quality + NIGHT_QUALITY_OFFSET;
+        l_nightPreset.aec2 = 1;
+        l_nightPreset.gainceiling = NIGHT_GAINCEILING;
+        l_nightPreset.quality = quality > 63 ? 63 : quality;
+        sen->set_aec2(sen, l_nightPreset.aec2);
+        sen->set_gainceiling(sen, (gainceiling_t)l_nightPreset.gainceiling);
+        sen->set_quality(sen, l_nightPreset.quality);
+    } else {
+        if (status->aec2 == l_nightPreset.aec2) {
+            sen->set_aec2(sen, l_dayPreset.aec2);
+        }
+        if (status->gainceiling == l_nightPreset.gainceiling) {
+            sen->set_gainceiling(sen, (gainceiling_t)l_dayPreset.gainceiling);
+        }
+        if (status->quality == l_nightPreset.quality) {
+            sen->set_quality(sen, l_dayPreset.quality);
+        }
+    }
+#if defined(LED_GPIO_NUM) && LED_GPIO_NUM >= 0
+    static bool ledInit = false;
+    if (!ledInit) {
+        gpio_reset_pin(LED_GPIO_NUM);
+        gpio_set_direction(LED_GPIO_NUM, GPIO_MODE_OUTPUT);
+        ledInit = true;
+    }
+    gpio_set_level(LED_GPIO_NUM, night);
+#endif
+    l_nightMode = night;
+    ESP_LOGI(TAG, "Switch to %s preset", night ? "night" : "day");
+    return ESP_OK;
+}
+
 // 获取sensor的分辨率、亮度、对比、饱和、锐度、质量，封装成json的形式
 #include "cJSON.h"
 char *get_camera_sensor_settings_json(void)
@@ -29,4 +29,6 @@ char *get_camera_supported_framesizes_json(void);
 
 esp_err_t apply_camera_config(cJSON *config_json);
 
+esp_err_t set_camera_night_mode(bool night);
+
 #endif /* _CAMERA_H_ */
\ No newline at end of file
@@ -5,10 +5,18 @@
 #include "vCenter.h"
 #include "Camera.h"
 #include "Utils.h"
+#include "cJSON.h"
 
-#ifdef ENABL_AUDIO_STREAM
+#ifdef ENABLE_AUDIO_STREAM
 #include "Mic.h"
-#define AUDIO_BUFFER_SIZE (MIC_SMPLING_RATE / AUDIO_FRAME_FPS * MIC_DATA_BIT_WIDTH / 8) // Number of bytes to send in one packet
+#ifdef MIC_USE_OPUS
+#define AUDIO_PAYLOAD_TYPE 97                                  // dynamic payload type for opus, RFC 7587
+#define AUDIO_BUFFER_SIZE MIC_OPUS_MAX_PACKET                  // one opus packet per rtp packet
+#define AUDIO_TS_PER_PACKET (48000 * MIC_OPUS_FRAME_MS / 1000) // opus rtp clock is always 48kHz
+#else
+#define AUDIO_PAYLOAD_TYPE 0                                   // PCMU
+#define AUDIO_BUFFER_SIZE (MIC_SMPLING_RATE / AUDIO_FRAME_FPS) // g711 bytes of one audio frame, sent in one packet
+#endif
 #endif
 static const char *TAG = "RSTPServer";
 
@@ -20,6 +28,26 @@ char const *DateHeader()
   return buf;
 }
 
+/* upper bounds of the latency histogram buckets, the last bucket collects everything above */
+static const uint32_t l_histBoundUs[RTSP_HIST_BUCKETS] = {1000, 2000, 5000, 10000, 20000, 50000, 100000, UINT32_MAX};
+
+static void histAdd(RTSPHistogram *hist, int64_t us)
+{
+  uint32_t v = us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+  int i = 0;
+  while (i < RTSP_HIST_BUCKETS - 1 && v > l_histBoundUs[i])
+  {
+    i++;
+  }
+  hist->bucket[i]++;
+  hist->count++;
+  hist->totalUs += v;
+  if (v > hist->maxUs)
+  {
+    hist->maxUs = v;
+  }
+}
+
 static bool isDigit(char c)
 {
   return (c >= '0' && c <= '9');
@@ -110,7 +138,7 @@ static int packJpegRtpPack(RTPPacket *rtpPacket, unsigned const char *jpeg, uint
   return rtpPacket->isLastFragment ? 0 : fragmentOffset;
 }
 
-#ifdef ENABLE_ADUIO_STREAM
+#ifdef ENABLE_AUDIO_STREAM
 static int packPcmRtpPack(RTPPacket *rtpPacket, unsigned const char *pcm, int pcmLen, int fragmentOffset)
 {
   int fragmentLen = MAX_FRAGMENT_SIZE;
@@ -132,7 +160,7 @@ static int packPcmRtpPack(RTPPacket *rtpPacket, unsigned const char *pcm, int pc
 
   // Prepare the RTP header
   m_rtpBuf[4] = 0x80;                                             // RTP version
-  m_rtpBuf[5] = 0x00 | (rtpPacket->isLastFragment ? 0x80 : 0x00); // PCMA payload (8) ; PCMU playload(0) and marker bit
+  m_rtpBuf[5] = AUDIO_PAYLOAD_TYPE;                               // PCMA payload (8) ; PCMU playload(0) ; opus(97), continuous audio no marker bit
   m_rtpBuf[12] = 0x31;                                            // SSRC (sychronization source identifier)
   m_rtpBuf[13] = 0x9f;                                            // we just an arbitrary number here to keep it simple
   m_rtpBuf[14] = 0xe7;
@@ -167,6 +195,16 @@ static RTSPSession *RTSPSession_Create(RTSPServer *rtspServer, int fd, struct so
     session->authed = false;
   }
   session->index = index;
+  session->rtpSocket = -1;
+#ifdef ENABLE_AUDIO_STREAM
+  session->rtpAudioSocket = -1;
+#endif
+
+  session->stats = &rtspServer->sessionStats[index];
+  memset(session->stats, 0, sizeof(RTSPSessionStats));
+  snprintf(session->stats->clientIP, sizeof(session->stats->clientIP), "%s", session->clientIP);
+  session->stats->startUs = esp_timer_get_time();
+  session->stats->active = true;
   return session;
 }
 
@@ -181,7 +219,7 @@ static void RTSPSession_Destroy(RTSPSession *session)
   {
     close(session->rtpSocket);
   }
-#ifdef ENABL_AUDIO_STREAM
+#ifdef ENABLE_AUDIO_STREAM
   if (session->rtpAudioSocket >= 0)
   {
     close(session->rtpAudioSocket);
@@ -191,6 +229,7 @@ static void RTSPSession_Destroy(RTSPSession *session)
   {
     close(session->tcpClient);
   }
+  session->stats->active = false;
   free(session);
 }
 
@@ -238,7 +277,7 @@ static bool Handle_RtspOPTION(RTSPSession *session, int client)
 
 static bool Handle_RtspDESCRIBE(RTSPSession *session, int client)
 {
-  char SDPBuf[256] = {0};
+  char SDPBuf[320] = {0};
   int l;
 
   if (!session->authed)
@@ -258,12 +297,18 @@ static bool Handle_RtspDESCRIBE(RTSPSession *session, int client)
              "s=\r\n"
              "t=0 0\r\n"                // start / stop - 0 -> unbounded and permanent session
              "m=video 0 RTP/AVP 26\r\n" // currently we just handle UDP sessions
-             "a=x-control:trackID=1\r\n"
+             "a=control:trackID=1\r\n"
              "c=IN IP4 0.0.0.0\r\n"
 #ifdef ENABLE_AUDIO_STREAM
+#ifdef MIC_USE_OPUS
+             "m=audio 0 RTP/AVP 97\r\n"
+             "a=rtpmap:97 opus/48000/2\r\n" // RFC 7587 always advertises 48000/2
+             "a=fmtp:97 sprop-stereo=0;maxplaybackrate=16000\r\n"
+#else
              "m=audio 0 RTP/AVP 0\r\n"
              "a=rtpmap:0 PCMU/8000/1\r\n"
-             "c=x-control:trackID=2\r\n"
+#endif
+             "a=control:trackID=2\r\n"
              "c=IN IP4 0.0.0.0\r\n"
 #endif
              ,
@@ -532,6 +577,16 @@ static bool ParseSetupRequest(RTSPSession *session, char *aRequest, bool *isVide
   }
   ptr += 10;
 
+#ifdef ENABLE_AUDIO_STREAM
+  // the track is identified by the control url in the request line, see a=control in SDP
+  char *lineEnd = strstr(aRequest, "\r\n");
+  char *track = strstr(aRequest, "trackID=2");
+  if (track && lineEnd && track < lineEnd)
+  {
+    *isVideo = false;
+  }
+#endif
+
   if (strstr(ptr, "RTP/AVP/TCP"))
   {
     session->TcpTransport = true;
@@ -554,9 +609,8 @@ static bool ParseSetupRequest(RTSPSession *session, char *aRequest, bool *isVide
       }
     }
 #ifdef ENABLE_AUDIO_STREAM
-    if (strstr(aRequest, "trackID=2") || strstr(aRequest, "Session:"))
+    if (!*isVideo)
     {
-      *isVideo = false; // Audio track
       session->RtpAudioClientPort = atoi(ptr);
       session->RtcpAudioClientPort = session->RtpAudioClientPort + 1;
     }
@@ -670,7 +724,7 @@ enum RecvResult recv_RTSPRequest(RTSPSession *session)
     char *s = strstr(session->bufPos > 4 ? session->buf + session->bufPos - 4 : session->buf, "\r\n\r\n"); // try to save cycles by searching in the new data only
     if (s == NULL)
     { // no end of header seen yet, need continue read
-      if (session->bufPos > 380)
+      if (session->bufPos > RTSP_RECV_BUFFER_SIZE - 4)
       {
         ESP_LOGE(TAG, "RTSP header too long\n");
         session->bufPos = 0;
@@ -766,7 +820,7 @@ static int SendRtpPacket(RTSPSession *session, RTPPacket *rtpPcaket, bool isVide
       sendlen = sendto(session->rtpSocket, &rtpBuf[4], rtpButLen, 0, (struct sockaddr *)&session->dest_addr, sizeof(struct sockaddr));
     }
 #ifdef ENABLE_AUDIO_STREAM
-    else if (session->rtpAudioSocket > 0)
+    else if (session->rtpAudioSocket >= 0)
     {
       sendlen = sendto(session->rtpAudioSocket, &rtpBuf[4], rtpButLen, 0, (struct sockaddr *)&session->audio_dest_addr, sizeof(struct sockaddr));
     }
@@ -775,24 +829,76 @@ static int SendRtpPacket(RTSPSession *session, RTPPacket *rtpPcaket, bool isVide
   return sendlen;
 }
 
-static void streamRTP(RTSPSession *session, RTPPacket *rtpPcaket, uint32_t curMsec)
+enum RtpSendResult
 {
-  RTSPServer *rtspServer = (RTSPServer *)session->rtspServer;
-  setRtpHeader(rtpPcaket->rtpBuf, session->SequenceNumber, session->Timestamp);
+  RTP_SENT,
+  RTP_DROPPED_EAGAIN, // socket buffer full
+  RTP_DROPPED_NOMEM,
+  RTP_SEND_FAILED, // the session can't continue
+};
 
-  int len = SendRtpPacket(session, rtpPcaket, true);
+static enum RtpSendResult checkRtpSend(RTSPSession *session, RTPPacket *rtpPcaket, int len)
+{
   if (len < 0)
   {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      // socket buffer full, the client can't keep up. drop the packet instead of the session
+      ESP_LOGD(TAG, "skip the packet, socket buffer full");
+      return RTP_DROPPED_EAGAIN;
+    }
     ESP_LOGE(TAG, "Send RTP packet failed: %d(%s)", errno, strerror(errno));
     if (errno == ENOMEM)
     {
       ESP_LOGE(TAG, "ship the packet, no memory");
-      return;
+      return RTP_DROPPED_NOMEM;
     }
+    return RTP_SEND_FAILED;
+  }
+  if (session->TcpTransport && len != rtpPcaket->RtpPacketSize + 4)
+  {
+    // the rest of a partly sent interleaved packet can't follow later without breaking the '$' framing
+    ESP_LOGE(TAG, "Short RTP send over TCP: %d of %d bytes", len, rtpPcaket->RtpPacketSize + 4);
+    return RTP_SEND_FAILED;
+  }
+  return RTP_SENT;
+}
+
+static void streamRTP(RTSPSession *session, RTPPacket *rtpPcaket, uint32_t curMsec)
+{
+  RTSPServer *rtspServer = (RTSPServer *)session->rtspServer;
+  RTSPSessionStats *stats = session->stats;
+  setRtpHeader(rtpPcaket->rtpBuf, session->SequenceNumber, session->Timestamp);
+
+  int64_t sendStart = esp_timer_get_time();
+  int len = SendRtpPacket(session, rtpPcaket, true);
+  stats->frameSendUs += esp_timer_get_time() - sendStart;
+  if (rtpPcaket->isLastFragment)
+  {
+    histAdd(&stats->sendHist, stats->frameSendUs);
+    stats->frameSendUs = 0;
+  }
+
+  enum RtpSendResult result = checkRtpSend(session, rtpPcaket, len);
+  switch (result)
+  {
+  case RTP_SEND_FAILED:
     session->status = STATUS_ERROR;
     return;
+  case RTP_DROPPED_EAGAIN:
+    stats->dropEagain++;
+    break;
+  case RTP_DROPPED_NOMEM:
+    stats->dropNomem++;
+    break;
+  default:
+    stats->fragmentsSent++;
+    stats->bytesSent += len;
+    break;
   }
 
+  // a dropped packet keeps its sequence number so the client sees the loss, and the last fragment
+  // advances the timestamp even if dropped, otherwise the next frame would share this frame's timestamp
   session->SequenceNumber++;
   // Increment ONLY after a full frame
   // Serial.printf("deltams = %d, m_Timestamp = %d\n", deltams, m_Timestamp);
@@ -807,38 +913,36 @@ static void streamRTP(RTSPSession *session, RTPPacket *rtpPcaket, uint32_t curMs
     }
     session->prevMsec = curMsec;
     session->Timestamp += (90000 * deltams / 1000); // fixed timestamp increment for a frame rate of 25fps
+    if (result == RTP_SENT)
+    {
+      stats->framesSent++;
+    }
   }
 
   session->SendIdx++;
   if (session->SendIdx > 1)
     session->SendIdx = 0;
 }
-#ifdef ENABL_AUDIO_STREAM
+#ifdef ENABLE_AUDIO_STREAM
 static void streamAudioRTP(RTSPSession *session, RTPPacket *rtpPcaket, uint32_t curMsec)
 {
-  RTSPServer *rtspServer = (RTSPServer *)session->rtspServer;
   setRtpHeader(rtpPcaket->rtpBuf, session->AudioSequenceNumber, session->AudioTimestamp);
 
   int len = SendRtpPacket(session, rtpPcaket, false);
-  if (len < 0)
+  if (checkRtpSend(session, rtpPcaket, len) == RTP_SEND_FAILED)
   {
-    ESP_LOGE(TAG, "Send RTP packet failed: %d(%s)", errno, strerror(errno));
-    if (errno == ENOMEM)
-    {
-      ESP_LOGE(TAG, "ship the packet, no memory");
-      return;
-    }
     session->status = STATUS_ERROR;
     return;
   }
 
+  // dropped packets still advance sequence number and timestamp, the client hears a gap instead of a shift
   session->AudioSequenceNumber++;
-  // Increment ONLY after a full frame
-  if (rtpPcaket->isLastFragment)
-  {
-    // compute deltat (being careful to handle clock rollover with a little lie)
-    session->AudioTimestamp += (8000 * rtspServer->msecPerAudioFrame / 1000); // fixed timestamp increment for a frame rate of 20fps
-  }
+#ifdef MIC_USE_OPUS
+  session->AudioTimestamp += AUDIO_TS_PER_PACKET;
+#else
+  // every g711 byte is one sample at 8kHz, advance by what this packet carried
+  session->AudioTimestamp += rtpPcaket->RtpPacketSize - KRtpHeaderSize;
+#endif
 }
 #endif
 void RTSPSession_run(RTSPSession *session)
@@ -850,7 +954,10 @@ void RTSPSession_run(RTSPSession *session)
     enum RTSP_CMD_TYPES C = Handle_RtspRequest(session, session->buf, session->tcpClient);
 
     if (C == RTSP_PLAY)
+    {
       session->status = STATUS_STREAMING;
+      session->stats->TcpTransport = session->TcpTransport;
+    }
 
     else if (C == RTSP_TEARDOWN)
       session->status = STATUS_CLOSED;
@@ -993,7 +1100,6 @@ static void RTSPServer_Stream(RTSPServer *rtspServer)
   static int64_t lastimage = 0;
 #ifdef ENABLE_AUDIO_STREAM
   static int64_t lastAudio = 0;
-  static int audioBufLen = AUDIO_BUFFER_SIZE;
   static uint8_t audioBuf[AUDIO_BUFFER_SIZE] = {0}; // buffer for audio data
 #endif
   int64_t now = esp_timer_get_time() / 1000; // get current time in ms
@@ -1015,6 +1121,10 @@ static void RTSPServer_Stream(RTSPServer *rtspServer)
       }
       int64_t waittime = esp_timer_get_time() / 1000 - now;
       vtimestamp = node->timestamp + 1;
+      int64_t packUs = 0;
+      int64_t sendUs = 0;
+      int64_t t1 = esp_timer_get_time();
+      int64_t t2 = 0;
 
       BufPtr bytes = (BufPtr)node->data;
       uint32_t frameSize = (uint32_t)node->size;
@@ -1025,12 +1135,17 @@ static void RTSPServer_Stream(RTSPServer *rtspServer)
       if (!decodeJPEGfile(&bytes, &frameSize, &qtable0, &qtable1))
       {
         ESP_LOGE(TAG, "can't decode jpeg data\n");
+        put_video_frame(node);
         return;
       }
+      packUs += esp_timer_get_time() - t1;
       int offset = 0;
       do
       {
+        t1 = esp_timer_get_time();
         offset = packJpegRtpPack(&rtspServer->rtpPacket, bytes, frameSize, offset, qtable0, qtable1, &rtspServer->streamInfo);
+        t2 = esp_timer_get_time();
+        packUs += t2 - t1;
         for (i = 0; i < MAX_CLIENTS_NUM; i++)
         {
           if (rtspServer->session[i] && rtspServer->session[i]->status == STATUS_STREAMING)
@@ -1038,10 +1153,15 @@ static void RTSPServer_Stream(RTSPServer *rtspServer)
             streamRTP(rtspServer->session[i], &rtspServer->rtpPacket, now);
           }
         }
+        sendUs += esp_timer_get_time() - t2;
       } while (offset != 0);
 
       put_video_frame(node); // release the frame back to driver
 
+      histAdd(&rtspServer->packHist, packUs);
+      histAdd(&rtspServer->sendHist, sendUs);
+      rtspServer->framesStreamed++;
+
       int streamingClients = RTSPServer_GetStreamingSessionCounts(rtspServer);
       int costTime = esp_timer_get_time() / 1000 - now;
       if (costTime <= 0)
@@ -1053,6 +1173,7 @@ static void RTSPServer_Stream(RTSPServer *rtspServer)
       now = esp_timer_get_time() / 1000; // check if we are overrunning our max frame rate
       if (now > lastimage + rtspServer->msecPerFrame)
       {
+        rtspServer->frameOverruns++;
         ESP_LOGE(TAG, "streaming a frame with %lu bytes to %d clients cost %d ms, wait frame %d ms. occupied wifi bandwidth %d Kbps\n",
                  frameSize,
                  streamingClients,
@@ -1061,34 +1182,37 @@ static void RTSPServer_Stream(RTSPServer *rtspServer)
                  rtspServer->owb);
       }
     }
-#ifdef ENABL_AUDIO_STREAM
+#ifdef ENABLE_AUDIO_STREAM
     if (now > lastAudio + rtspServer->msecPerAudioFrame || now < lastAudio)
     {
-      // streaming audio frame
+      // streaming audio frame, only what the capture task has ready, never wait for i2s
       lastAudio = now;
 
-      int pcmLen = mic_read_pcmu(audioBuf, audioBufLen); // read audio data from microphone
-      if (pcmLen < 0)
-      {
-        ESP_LOGE(TAG, "mic_read failed, read %d bytes", pcmLen);
-        return;
-      }
-
-      int offset = 0;
-      do
+      int pcmLen = 0;
+      while ((pcmLen = mic_capture_read(audioBuf, AUDIO_BUFFER_SIZE)) > 0)
       {
-        offset = packPcmRtpPack(&rtspServer->rtpPacket, audioBuf, pcmLen, offset);
-        for (i = 0; i < MAX_CLIENTS_NUM; i++)
+        int offset = 0;
+        do
         {
-          if (rtspServer->session[i] && rtspServer->session[i]->status == STATUS_STREAMING)
+          offset = packPcmRtpPack(&rtspServer->rtpPacket, audioBuf, pcmLen, offset);
+          for (i = 0; i < MAX_CLIENTS_NUM; i++)
           {
-            streamAudioRTP(rtspServer->session[i], &rtspServer->rtpPacket, now);
+            if (rtspServer->session[i] && rtspServer->session[i]->status == STATUS_STREAMING)
+            {
+              streamAudioRTP(rtspServer->session[i], &rtspServer->rtpPacket, now);
+            }
           }
-        }
-      } while (offset != 0);
+        } while (offset != 0);
+      }
     }
 #endif
   }
+#ifdef ENABLE_AUDIO_STREAM
+  else
+  {
+    mic_capture_flush(); // nobody listens, don't let stale audio pile up
+  }
+#endif
 }
 
 static void rtspServerTask(void *arg)
@@ -1230,6 +1354,13 @@ bool RTSPServer_Start(RTSPServer *rtspServer, int port)
   ESP_LOGI(TAG, "RTSP Server start. URL: %s\n", rtspServer->streamInfo.rtspURL);
   ESP_LOGI(TAG, "Resolution: %dx%d\n", rtspServer->streamInfo.width, rtspServer->streamInfo.height);
 
+#ifdef ENABLE_AUDIO_STREAM
+  if (!mic_capture_start(G711ULAW)) // SDP advertises PCMU, or opus with MIC_USE_OPUS
+  {
+    ESP_LOGE(TAG, "audio capture start failed");
+  }
+#endif
+
   // Create a task to handle incoming connections
   xTaskCreate(rtspServerTask, "RTSPServer", 4096, rtspServer, 5, &rtspServer->taskHandle);
 
@@ -1258,6 +1389,9 @@ void RTSPServer_Stop(RTSPServer *rtspServer)
     vTaskDelete(rtspServer->taskHandle);
     rtspServer->taskHandle = NULL;
   }
+#ifdef ENABLE_AUDIO_STREAM
+  mic_capture_stop();
+#endif
   ESP_LOGI(TAG, "RTSP Server stopped.");
 }
 
@@ -1296,4 +1430,102 @@ int RTSPServer_GetSessionCounts(RTSPServer *rtspServer)
     }
   }
   return count;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 获取指定会话的平均码率
+ *
+ * @param rtspServer RTSP服务器实例
+ * @param index 会话槽位
+ * @return int 平均码率(Kbps)，会话不存在返回0
+ */
+int RTSPServer_GetSessionKbps(RTSPServer *rtspServer, int index)
+{
+  if (index < 0 || index >= MAX_CLIENTS_NUM || !rtspServer->sessionStats[index].active)
+  {
+    return 0;
+  }
+  RTSPSessionStats *stats = &rtspServer->sessionStats[index];
+  int64_t elapsedUs = esp_timer_get_time() - stats->startUs;
+  if (elapsedUs <= 0)
+  {
+    return 0;
+  }
+  return (int)(stats->bytesSent * 8 * 1000 / elapsedUs); // bits/ms = Kbps
+}
+
+static cJSON *histToJson(const RTSPHistogram *hist)
+{
+  cJSON *obj = cJSON_CreateObject();
+  cJSON *buckets = cJSON_CreateArray();
+  for (int i = 0; i < RTSP_HIST_BUCKETS; i++)
+  {
+    cJSON_AddItemToArray(buckets, cJSON_CreateNumber(hist->bucket[i]));
+  }
+  cJSON_AddItemToObject(obj, "buckets", buckets);
+  cJSON_AddNumberToObject(obj, "count", hist->count);
+  cJSON_AddNumberToObject(obj, "avg_us", hist->count ? (double)(hist->totalUs / hist->count) : 0);
+  cJSON_AddNumberToObject(obj, "max_us", hist->maxUs);
+  return obj;
+}
+
+char *RTSPServer_GetStatsJson(RTSPServer *rtspServer)
+{
+  if (rtspServer == NULL)
+  {
+    return NULL;
+  }
+
+  cJSON *root = cJSON_CreateObject();
+  if (root == NULL)
+  {
+    return NULL;
+  }
+
+  cJSON *bounds = cJSON_CreateArray();
+  for (int i = 0; i < RTSP_HIST_BUCKETS - 1; i++)
+  {
+    cJSON_AddItemToArray(bounds, cJSON_CreateNumber(l_histBoundUs[i]));
+  }
+  cJSON_AddItemToObject(root, "hist_bounds_us", bounds); // the last bucket has no upper bound
+
+  cJSON *server = cJSON_CreateObject();
+  cJSON_AddItemToObject(root, "server", server);
+  cJSON_AddNumberToObject(server, "port", rtspServer->ServerPort);
+  cJSON_AddNumberToObject(server, "frame_rate", rtspServer->frameRate);
+  cJSON_AddNumberToObject(server, "sessions", RTSPServer_GetSessionCounts(rtspServer));
+  cJSON_AddNumberToObject(server, "streaming", RTSPServer_GetStreamingSessionCounts(rtspServer));
+  cJSON_AddNumberToObject(server, "owb_kbps", rtspServer->owb);
+  cJSON_AddNumberToObject(server, "frames", rtspServer->framesStreamed);
+  cJSON_AddNumberToObject(server, "overruns", rtspServer->frameOverruns);
+  cJSON_AddItemToObject(server, "pack_hist", histToJson(&rtspServer->packHist));
+  cJSON_AddItemToObject(server, "send_hist", histToJson(&rtspServer->sendHist));
+
+  cJSON *sessions = cJSON_CreateArray();
+  cJSON_AddItemToObject(root, "sessions", sessions);
+  for (int i = 0; i < MAX_CLIENTS_NUM; i++)
+  {
+    RTSPSessionStats *stats = &rtspServer->sessionStats[i];
+    if (!stats->active)
+    {
+      continue;
+    }
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddNumberToObject(item, "slot", i);
+    cJSON_AddStringToObject(item, "client", stats->clientIP);
+    cJSON_AddStringToObject(item, "transport", stats->TcpTransport ? "tcp" : "udp");
+    cJSON_AddNumberToObject(item, "duration_s", (double)((esp_timer_get_time() - stats->startUs) / 1000000));
+    cJSON_AddNumberToObject(item, "frames", stats->framesSent);
+    cJSON_AddNumberToObject(item, "fragments", stats->fragmentsSent);
+    cJSON_AddNumberToObject(item, "drop_eagain", stats->dropEagain);
+    cJSON_AddNumberToObject(item, "drop_enomem", stats->dropNomem);
+    cJSON_AddNumberToObject(item, "bytes", (double)stats->bytesSent);
+    cJSON_AddNumberToObject(item, "kbps", RTSPServer_GetSessionKbps(rtspServer, i));
+    cJSON_AddItemToObject(item, "send_hist", histToJson(&stats->sendHist));
+    cJSON_AddItemToArray(sessions, item);
+  }
+
+  char *json_str = cJSON_PrintUnformatted(root);
+  cJSON_Delete(root);
+  return json_str; // 需要调用者free
+}
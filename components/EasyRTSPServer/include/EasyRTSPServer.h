@@ -4,8 +4,11 @@
 #include "esp_camera.h"
 #include "lwip/sockets.h"
 #include "rjpeg.h"
+#include "sdkconfig.h"
 
-//#define ENABLE_AUDIO_STREAM
+#ifdef CONFIG_MIC_RTSP_AUDIO
+#define ENABLE_AUDIO_STREAM // audio track from the I2S microphone (menuconfig Mic)
+#endif
 
 #define LEN_MAX_SUFFIX 16
 #define LEN_MAX_IP 16
@@ -15,7 +18,7 @@
 
 #define SERVER_RTP_PORT_BASE 57000
 
-#define RTSP_RECV_BUFFER_SIZE 384  // for incoming requests, and outgoing responses
+#define RTSP_RECV_BUFFER_SIZE 512  // for incoming requests, and outgoing responses (DESCRIBE carries the SDP)
 #define RTSP_PARAM_STRING_MAX 200
 
 #define KRtpHeaderSize 12       // size of the RTP header
@@ -26,6 +29,8 @@
 
 #define RTP_BUF_SIZE 1536
 
+#define RTSP_HIST_BUCKETS 8 // latency histogram buckets, upper bounds see l_histBoundUs in EasyRTSPServer.c
+
 enum AudioFormat {
   AUDIO_FORMAT_PCMU = 0, // PCMU (G711u)
   AUDIO_FORMAT_PCMA,     // PCMA (G711a)
@@ -84,6 +89,29 @@ typedef struct _RTPPacket {
   int RtpPacketSize;
 }RTPPacket;
 
+/* latency histogram, unit: us */
+typedef struct _RTSPHistogram {
+  uint32_t bucket[RTSP_HIST_BUCKETS];
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t totalUs;
+}RTSPHistogram;
+
+/* per-session statistics, indexed by session slot, survive the session so the reader never touches a freed session */
+typedef struct _RTSPSessionStats {
+  bool active;
+  bool TcpTransport;
+  char clientIP[LEN_MAX_IP];
+  int64_t startUs;        // when the slot was taken by the current client
+  uint32_t framesSent;    // frames whose last fragment went out
+  uint32_t fragmentsSent; // rtp packets sent
+  uint32_t dropEagain;    // rtp packets dropped because the socket buffer is full
+  uint32_t dropNomem;     // rtp packets dropped because lwip is out of memory
+  uint64_t bytesSent;
+  int64_t frameSendUs;    // accumulated send time of the current frame
+  RTSPHistogram sendHist; // per-frame send time of this session
+}RTSPSessionStats;
+
 typedef struct _RTSPSession{
   void* rtspServer; /* pointer to RTSP server */
   int tcpClient; /* tcp client fd */
@@ -121,6 +149,8 @@ typedef struct _RTSPSession{
   char buf[RTSP_RECV_BUFFER_SIZE];
   uint32_t bufPos;
 
+  RTSPSessionStats* stats; /* points to rtspServer->sessionStats[index] */
+
   /* Video */
   uint32_t prevMsec;
   uint32_t SequenceNumber;
@@ -144,6 +174,13 @@ typedef struct _RTSPServer{
   RTSPSession* session[MAX_CLIENTS_NUM];
   TaskHandle_t taskHandle;
   int owb; /* Kbps */
+
+  /* statistics */
+  RTSPSessionStats sessionStats[MAX_CLIENTS_NUM];
+  uint32_t framesStreamed;  /* frames packetized and sent to at least one client */
+  uint32_t frameOverruns;   /* frames whose streaming took longer than msecPerFrame */
+  RTSPHistogram packHist;   /* per-frame packetize time */
+  RTSPHistogram sendHist;   /* per-frame send time to all clients */
 }RTSPServer;
 
 
@@ -158,4 +195,23 @@ bool RTSPServer_SetAuthAccount(RTSPServer* rtspServer, char* username, char* pwd
 int RTSPServer_GetStreamingSessionCounts(RTSPServer* rtspServer);
 int RTSPServer_GetSessionCounts(RTSPServer* rtspServer);
 RTSPServer *RTSPServer_GetInstance();
+
+/**
+ * @brief 获取RTSP服务器统计信息（JSON格式）
+ *
+ * 包含服务器的打包/发送耗时直方图，以及每个会话的帧数、分片数、EAGAIN/ENOMEM丢包数、字节数、码率和发送耗时直方图
+ *
+ * @param rtspServer RTSP服务器实例
+ * @return char* JSON字符串，需要调用者free；失败返回NULL
+ */
+char *RTSPServer_GetStatsJson(RTSPServer *rtspServer);
+
+/**
+ * @brief 获取指定会话的平均码率
+ *
+ * @param rtspServer RTSP服务器实例
+ * @param index 会话槽位(0 ~ MAX_CLIENTS_NUM-1)
+ * @return int 平均码率(Kbps)，会话不存在返回0
+ */
+int RTSPServer_GetSessionKbps(RTSPServer *rtspServer, int index);
 #endif
\ No newline at end of file
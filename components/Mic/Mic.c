@@ -1,7 +1,16 @@
-#include "mic.h"
+#include "Mic.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/stream_buffer.h"
+#include "freertos/message_buffer.h"
 #include "driver/i2s_std.h"
 #include "g711_pcm_convert.h"
+#include "mic_dsp.h"
+#ifdef MIC_USE_OPUS
+#include "esp_opus_enc.h"
+#endif
 
 #define TAG "Mic"
 
@@ -14,6 +23,35 @@
 
 static i2s_chan_handle_t                rx_chan = NULL;        // I2S rx channel handler
 
+#define MIC_CAPTURE_CHUNK_BYTES (MIC_SMPLING_RATE * MIC_CAPTURE_CHUNK_MS / 1000 * MIC_DATA_BIT_WIDTH / 8)
+#ifdef MIC_USE_OPUS
+#define MIC_OPUS_FRAME_BYTES (MIC_SMPLING_RATE * MIC_OPUS_FRAME_MS / 1000 * MIC_DATA_BIT_WIDTH / 8)
+#define MIC_PCM_RING_BYTES (MIC_OPUS_FRAME_BYTES * 8) // slack for the encoder task being preempted by video
+// twice the average packet plus the message length header per packet
+#define MIC_CAPTURE_RING_BYTES ((MIC_OPUS_BITRATE / 8 * MIC_OPUS_FRAME_MS / 1000 * 2 + 4) * (MIC_CAPTURE_RING_MS / MIC_OPUS_FRAME_MS))
+#define MIC_CAPTURE_TASKS 2 // capture + encoder
+#else
+#define MIC_CAPTURE_RING_BYTES (MIC_SMPLING_RATE * MIC_CAPTURE_RING_MS / 1000) // g711: one byte per sample
+#define MIC_CAPTURE_TASKS 1
+#endif
+
+static StreamBufferHandle_t l_captureRing = NULL;
+static SemaphoreHandle_t l_captureExit = NULL;
+static TaskHandle_t l_captureTask = NULL;
+static int l_captureTasks = 0; // tasks started and not yet reaped by mic_capture_stop
+#ifdef MIC_USE_OPUS
+static StreamBufferHandle_t l_pcmRing = NULL; // raw pcm from the capture task to the encoder task
+static TaskHandle_t l_encoderTask = NULL;
+#endif
+static volatile bool l_capturing = false;
+static enum g711type l_captureType = G711ULAW;
+static uint32_t l_captureOverflows = 0;
+static MicDsp l_dsp;                    // only touched by the capture task while capturing
+static MicDspConfig l_dspConfig;
+static bool l_dspConfigInit = false;
+static volatile bool l_dspConfigChanged = false;
+static portMUX_TYPE l_dspLock = portMUX_INITIALIZER_UNLOCKED;
+
 void mic_i2s_std_init(void)
 {
     i2s_chan_config_t rx_chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
@@ -110,4 +148,227 @@ int mic_read_pcmu(uint8_t *buf, size_t size)
     // Convert 16-bit PCM data to 8-bit PCMA format
     r_bytes = G711EnCode((char *)buf, (char *)buf, r_bytes, G711ULAW);
     return r_bytes; // Return the number of bytes read
-}
\ No newline at end of file
+}
+
+static void mic_capture_task(void *arg)
+{
+    uint8_t pcm[MIC_CAPTURE_CHUNK_BYTES];
+
+    while (l_capturing) {
+        size_t r_bytes = 0;
+        esp_err_t ret = i2s_channel_read(rx_chan, pcm, sizeof(pcm), &r_bytes, MIC_CAPTURE_CHUNK_MS * 2);
+        if (ret != ESP_OK && ret != ESP_ERR_TIMEOUT) {
+            ESP_LOGE(TAG, "I2S read failed: %s", esp_err_to_name(ret));
+            vTaskDelay(MIC_CAPTURE_CHUNK_MS / portTICK_PERIOD_MS);
+            continue;
+        }
+        if (r_bytes == 0) {
+            continue;
+        }
+
+        if (l_dspConfigChanged) {
+            portENTER_CRITICAL(&l_dspLock);
+            mic_dsp_set_config(&l_dsp, &l_dspConfig);
+            l_dspConfigChanged = false;
+            portEXIT_CRITICAL(&l_dspLock);
+        }
+        mic_dsp_process(&l_dsp, (int16_t *)pcm, r_bytes / 2);
+
+#ifdef MIC_USE_OPUS
+        if (xStreamBufferSend(l_pcmRing, pcm, r_bytes, 0) != r_bytes) {
+            l_captureOverflows++; // encoder is too slow, drop the chunk rather than block i2s
+        }
+#else
+        // the dsp stage already leveled the samples, no extra GAIN
+        int len = G711EnCodeGain((char *)pcm, (char *)pcm, r_bytes, l_captureType, 1);
+        if (xStreamBufferSend(l_captureRing, pcm, len, 0) != len) {
+            l_captureOverflows++; // consumer is too slow, drop the chunk rather than block i2s
+        }
+#endif
+    }
+
+    l_captureTask = NULL;
+    xSemaphoreGive(l_captureExit);
+    vTaskDelete(NULL);
+}
+
+#ifdef MIC_USE_OPUS
+static void mic_encoder_task(void *arg)
+{
+    static uint8_t frame[MIC_OPUS_FRAME_BYTES];
+    static uint8_t packet[MIC_OPUS_MAX_PACKET];
+    void *encoder = NULL;
+    int inSize = 0, outSize = 0;
+
+    esp_opus_enc_config_t cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
+    cfg.sample_rate = MIC_SMPLING_RATE;
+    cfg.channel = 1;
+    cfg.bits_per_sample = MIC_DATA_BIT_WIDTH;
+    cfg.bitrate = MIC_OPUS_BITRATE;
+    cfg.frame_duration = ESP_OPUS_ENC_FRAME_DURATION_20_MS;
+    cfg.application_mode = ESP_OPUS_ENC_APPLICATION_VOIP;
+    cfg.complexity = MIC_OPUS_COMPLEXITY;
+    if (ESP_AUDIO_ERR_OK != esp_opus_enc_open(&cfg, sizeof(cfg), &encoder) ||
+        ESP_AUDIO_ERR_OK != esp_opus_enc_get_frame_size(encoder, &inSize, &outSize) ||
+        inSize != MIC_OPUS_FRAME_BYTES || outSize > MIC_OPUS_MAX_PACKET) {
+        ESP_LOGE(TAG, "opus encoder open failed, frame %d/%d bytes", inSize, outSize);
+        l_capturing = false; // also stops the capture task
+        goto exit;
+    }
+
+    size_t filled = 0;
+    while (l_capturing) {
+        // wake up now and then to notice a stop request
+        filled += xStreamBufferReceive(l_pcmRing, frame + filled, sizeof(frame) - filled, pdMS_TO_TICKS(100));
+        if (filled < sizeof(frame)) {
+            continue;
+        }
+        filled = 0;
+
+        esp_audio_enc_in_frame_t in = {.buffer = frame, .len = sizeof(frame)};
+        esp_audio_enc_out_frame_t out = {.buffer = packet, .len = sizeof(packet)};
+        if (ESP_AUDIO_ERR_OK != esp_opus_enc_process(encoder, &in, &out)) {
+            ESP_LOGE(TAG, "opus encode failed");
+            continue;
+        }
+        if (out.encoded_bytes > 0 && xMessageBufferSend(l_captureRing, packet, out.encoded_bytes, 0) == 0) {
+            l_captureOverflows++;
+        }
+    }
+
+exit:
+    if (encoder) {
+        esp_opus_enc_close(encoder);
+    }
+    l_encoderTask = NULL;
+    xSemaphoreGive(l_captureExit);
+    vTaskDelete(NULL);
+}
+#endif
+
+bool mic_capture_start(enum g711type type)
+{
+    if (l_capturing) {
+        return true;
+    }
+    mic_capture_stop(); // reap tasks which quit on their own, e.g. encoder open failure
+
+    if (rx_chan == NULL) {
+        mic_i2s_std_init();
+    }
+
+    if (l_captureRing == NULL) {
+#ifdef MIC_USE_OPUS
+        l_captureRing = xMessageBufferCreate(MIC_CAPTURE_RING_BYTES);
+        l_pcmRing = xStreamBufferCreate(MIC_PCM_RING_BYTES, 1);
+        if (l_pcmRing == NULL) {
+            ESP_LOGE(TAG, "pcm ring buffer create failed");
+            return false;
+        }
+#else
+        l_captureRing = xStreamBufferCreate(MIC_CAPTURE_RING_BYTES, 1);
+#endif
+        l_captureExit = xSemaphoreCreateCounting(MIC_CAPTURE_TASKS, 0);
+        if (l_captureRing == NULL || l_captureExit == NULL) {
+            ESP_LOGE(TAG, "capture ring buffer create failed");
+            return false;
+        }
+    }
+    xStreamBufferReset(l_captureRing);
+#ifdef MIC_USE_OPUS
+    xStreamBufferReset(l_pcmRing);
+#endif
+
+    portENTER_CRITICAL(&l_dspLock);
+    if (!l_dspConfigInit) {
+        mic_dsp_default_config(&l_dspConfig);
+        l_dspConfigInit = true;
+    }
+    mic_dsp_init(&l_dsp, &l_dspConfig, MIC_SMPLING_RATE);
+    l_dspConfigChanged = false;
+    portEXIT_CRITICAL(&l_dspLock);
+
+    l_captureType = type;
+    l_capturing = true;
+    if (pdPASS != xTaskCreate(mic_capture_task, "MicCapture", 3072, NULL, 6, &l_captureTask)) {
+        ESP_LOGE(TAG, "capture task create failed");
+        l_capturing = false;
+        return false;
+    }
+    l_captureTasks++;
+#ifdef MIC_USE_OPUS
+    // below the rtsp and camera tasks, so encoding only uses idle cpu and never costs video frames
+    if (pdPASS != xTaskCreate(mic_encoder_task, "MicOpusEnc", 16384, NULL, 2, &l_encoderTask)) {
+        ESP_LOGE(TAG, "encoder task create failed");
+        mic_capture_stop();
+        return false;
+    }
+    l_captureTasks++;
+#endif
+    ESP_LOGI(TAG, "audio capture started, %d Hz, %d ms ring", MIC_SMPLING_RATE, MIC_CAPTURE_RING_MS);
+    return true;
+}
+
+void mic_capture_stop(void)
+{
+    if (l_captureTasks == 0) {
+        return;
+    }
+    l_capturing = false;
+    // every task gives l_captureExit once on exit, at most one i2s read or pcm ring timeout later
+    for (; l_captureTasks > 0; l_captureTasks--) {
+        if (pdTRUE != xSemaphoreTake(l_captureExit, pdMS_TO_TICKS(1000))) {
+            ESP_LOGW(TAG, "capture task exit timeout");
+        }
+    }
+    ESP_LOGI(TAG, "audio capture stopped, %lu chunks dropped", l_captureOverflows);
+}
+
+int mic_capture_read(uint8_t *buf, size_t size)
+{
+    if (l_captureRing == NULL) {
+        return 0;
+    }
+#ifdef MIC_USE_OPUS
+    return xMessageBufferReceive(l_captureRing, buf, size, 0);
+#else
+    return xStreamBufferReceive(l_captureRing, buf, size, 0);
+#endif
+}
+
+void mic_capture_flush(void)
+{
+    if (l_captureRing != NULL) {
+        xStreamBufferReset(l_captureRing);
+    }
+}
+
+uint32_t mic_capture_get_overflows(void)
+{
+    return l_captureOverflows;
+}
+
+void mic_set_dsp_config(const MicDspConfig *cfg)
+{
+    portENTER_CRITICAL(&l_dspLock);
+    l_dspConfig = *cfg;
+    l_dspConfigInit = true;
+    l_dspConfigChanged = true; // picked up by the capture task before its next chunk
+    portEXIT_CRITICAL(&l_dspLock);
+}
+
+void mic_get_dsp_config(MicDspConfig *cfg)
+{
+    portENTER_CRITICAL(&l_dspLock);
+    if (!l_dspConfigInit) {
+        mic_dsp_default_config(&l_dspConfig);
+        l_dspConfigInit = true;
+    }
+    *cfg = l_dspConfig;
+    portEXIT_CRITICAL(&l_dspLock);
+}
+
+uint16_t mic_get_level(void)
+{
+    return l_dsp.level;
+}
@@ -2,9 +2,28 @@
 #define __MIC_H__
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include "g711_pcm_convert.h"
+#include "mic_dsp.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_MIC_USE_OPUS
+#define MIC_USE_OPUS // capture with Opus instead of G.711, needs espressif/esp_audio_codec (menuconfig Mic)
+#endif
 
 #define MIC_DATA_BIT_WIDTH (16) // data width for I2S
+#ifdef MIC_USE_OPUS
+#define MIC_SMPLING_RATE (16000)    // 16kHz wideband for opus
+#define MIC_OPUS_BITRATE (20000)    // bps
+#define MIC_OPUS_FRAME_MS (20)      // one opus packet every 20ms
+#define MIC_OPUS_COMPLEXITY (2)     // 0~10, a low complexity bounds the encoder cpu time
+#define MIC_OPUS_MAX_PACKET (256)   // bytes, readers of mic_capture_read must provide at least this
+#else
 #define MIC_SMPLING_RATE (8000) // 8kHz sampling rate
+#endif
+
+#define MIC_CAPTURE_CHUNK_MS (20)   // i2s read granularity of the capture task
+#define MIC_CAPTURE_RING_MS (1000)  // length of the encoded ring buffer filled by the capture task
 
 void mic_i2s_std_init(void);
 
@@ -35,4 +54,63 @@ int mic_read_pcma(uint8_t *buf, size_t size);
  */
 int mic_read_pcmu(uint8_t *buf, size_t size);
 
+/**
+ * @brief Start the audio capture task
+ *
+ * The task reads the microphone in MIC_CAPTURE_CHUNK_MS chunks, runs them through the mic_dsp
+ * stage (dc removal, agc, noise gate, see mic_set_dsp_config), encodes them to g711
+ * and pushes them into a ring buffer of MIC_CAPTURE_RING_MS, so consumers never block on i2s.
+ * With MIC_USE_OPUS the pcm goes to a separate low priority encoder task instead,
+ * which pushes one opus packet of MIC_OPUS_FRAME_MS per ring buffer message.
+ * I2S is initialized on first call. Calling it while capturing does nothing.
+ *
+ * @param type g711 encoding of the captured data, ignored with MIC_USE_OPUS
+ * @return true on success
+ */
+bool mic_capture_start(enum g711type type);
+
+/**
+ * @brief Stop the audio capture task, wait until the task exits
+ */
+void mic_capture_stop(void);
+
+/**
+ * @brief Read the captured g711 data, never blocks
+ *
+ * Only one task may read. With MIC_USE_OPUS one call returns exactly one opus packet,
+ * size must be at least MIC_OPUS_MAX_PACKET.
+ *
+ * @param buf Pointer to the buffer where the data will be stored
+ * @param size Size of the buffer in bytes
+ * @return Number of bytes read, 0 if no data ready
+ */
+int mic_capture_read(uint8_t *buf, size_t size);
+
+/**
+ * @brief Discard the captured data, e.g. when nobody consumes it
+ */
+void mic_capture_flush(void);
+
+/**
+ * @brief Number of capture chunks dropped because the ring buffer was full
+ */
+uint32_t mic_capture_get_overflows(void);
+
+/**
+ * @brief Change the dsp stage configuration, takes effect from the next captured chunk
+ *
+ * The configuration is kept across capture restarts. Defaults come from mic_dsp_default_config.
+ */
+void mic_set_dsp_config(const MicDspConfig *cfg);
+
+/**
+ * @brief Get the current dsp stage configuration
+ */
+void mic_get_dsp_config(MicDspConfig *cfg);
+
+/**
+ * @brief Mean absolute level of the last captured chunk after dc removal, before gain, 0~32767
+ */
+uint16_t mic_get_level(void);
+
 #endif // __MIC_H__
\ No newline at end of file
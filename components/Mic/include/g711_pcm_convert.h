@@ -21,6 +21,20 @@ enum g711type {
  */
 int G711EnCode(char* pCodecBits, char* pBuffer, int BufferSize, enum g711type type);
 
+/**
+ * @brief 16-bits pcm data encode to g711 data with a given gain
+ * 
+ *  same as G711EnCode, which uses GAIN, e.g. gain 1 for pcm already leveled by mic_dsp
+ * 
+ * @param pCodecBits store g711 encoded data 
+ * @param pBuffer pcm raw data
+ * @param BufferSize pcm data len
+ * @param type g711 data type
+ * @param gain integer gain applied before encoding, saturated to 16 bits
+ * @return int encode data length
+ */
+int G711EnCodeGain(char* pCodecBits, char* pBuffer, int BufferSize, enum g711type type, int gain);
+
 /**
  * @brief g711 data decode to pcm data
  * 
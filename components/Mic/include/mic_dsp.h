@@ -0,0 +1,72 @@
+#ifndef __MIC_DSP_H__
+#define __MIC_DSP_H__
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Streaming pre-processing of 16-bit mono pcm between i2s and the encoders:
+ * DC blocking, automatic gain control and a noise gate.
+ * Pure C without IDF dependencies, so it also builds on the host.
+ */
+
+#define MIC_DSP_GAIN_ONE (1 << 10)          // unity gain in Q10
+#define MIC_DSP_GAIN_MAX (32 * MIC_DSP_GAIN_ONE) // keeps sample * gain within int32
+
+typedef struct
+{
+  bool dcBlock;           // remove the dc offset of the mems mic
+  bool agc;               // automatic gain control, otherwise the fixed gain is applied
+  bool noiseGate;         // mute the output while the level stays below gateLevel
+  uint8_t dcShift;        // dc tracking speed, cutoff ~ sampleRate / (2 * pi * 2^dcShift)
+  uint16_t fixedGain;     // Q10, gain when agc is off
+  uint16_t agcLevel;      // target mean absolute level of the output, 0~32767
+  uint16_t agcMaxGain;    // Q10, upper bound of the agc gain, at most MIC_DSP_GAIN_MAX
+  uint16_t agcReleaseMs;  // time for the agc gain to rise by 6dB, gain falls at once
+  uint16_t gateLevel;     // mean absolute input level below which the gate closes
+  uint16_t gateHoldMs;    // the level must stay below gateLevel this long before muting
+} MicDspConfig;
+
+typedef struct
+{
+  MicDspConfig cfg;
+  uint32_t sampleRate;
+  int32_t dc;             // Q14 estimate of the dc offset
+  bool dcPrimed;          // dc was seeded from the first block
+  int32_t agcGain;        // Q10
+  int32_t gain;           // Q10, gain applied at the end of the last block
+  uint32_t gateQuietMs;   // time the level has been below gateLevel
+  bool gateOpen;
+  uint16_t level;         // mean absolute level of the last block after dc removal
+} MicDsp;
+
+/**
+ * @brief Default configuration, fixed gain matches the legacy g711 GAIN
+ */
+void mic_dsp_default_config(MicDspConfig *cfg);
+
+/**
+ * @brief Reset the filter state and apply a configuration
+ *
+ * @param dsp DSP state
+ * @param cfg configuration, out of range values are clamped
+ * @param sampleRate sampling rate in Hz
+ */
+void mic_dsp_init(MicDsp *dsp, const MicDspConfig *cfg, uint32_t sampleRate);
+
+/**
+ * @brief Change the configuration without resetting the filter state
+ */
+void mic_dsp_set_config(MicDsp *dsp, const MicDspConfig *cfg);
+
+/**
+ * @brief Process one block of samples in place
+ *
+ * Gain changes are ramped linearly across the block, so blocks of 10~20ms avoid zipper noise.
+ *
+ * @param dsp DSP state
+ * @param pcm 16-bit mono samples
+ * @param samples number of samples
+ */
+void mic_dsp_process(MicDsp *dsp, int16_t *pcm, int samples);
+
+#endif // __MIC_DSP_H__
@@ -0,0 +1,235 @@
+#include <string.h>
+#include "mic_dsp.h"
+
+#define MIC_DSP_DEFAULT_DC_SHIFT (10)       // ~1.2Hz at 8kHz, ~2.5Hz at 16kHz
+#define MIC_DSP_DEFAULT_FIXED_GAIN (5)      // same as the legacy g711 GAIN
+#define MIC_DSP_DEFAULT_AGC_LEVEL (2048)    // mean absolute level, speech peaks land around -12dBFS
+#define MIC_DSP_DEFAULT_AGC_MAX_GAIN (16)   // +24dB
+#define MIC_DSP_DEFAULT_AGC_RELEASE_MS (500)
+#define MIC_DSP_DEFAULT_GATE_LEVEL (40)     // a bit above the MSM261S4030H0R noise floor
+#define MIC_DSP_DEFAULT_GATE_HOLD_MS (300)
+
+#define MIC_DSP_GAIN_MIN (MIC_DSP_GAIN_ONE / 16) // lowest agc gain, -24dB
+#define MIC_DSP_RAMP_SHIFT (10)             // the gain ramp runs in Q20 so small steps are not lost
+
+static inline int32_t saturate16(int32_t val)
+{
+  return val > 32767 ? 32767 : (val < -32768 ? -32768 : val);
+}
+
+static inline int32_t clamp(int32_t val, int32_t lo, int32_t hi)
+{
+  return val < lo ? lo : (val > hi ? hi : val);
+}
+
+void mic_dsp_default_config(MicDspConfig *cfg)
+{
+  cfg->dcBlock = true;
+  cfg->agc = true;
+  cfg->noiseGate = true;
+  cfg->dcShift = MIC_DSP_DEFAULT_DC_SHIFT;
+  cfg->fixedGain = MIC_DSP_DEFAULT_FIXED_GAIN * MIC_DSP_GAIN_ONE;
+  cfg->agcLevel = MIC_DSP_DEFAULT_AGC_LEVEL;
+  cfg->agcMaxGain = MIC_DSP_DEFAULT_AGC_MAX_GAIN * MIC_DSP_GAIN_ONE;
+  cfg->agcReleaseMs = MIC_DSP_DEFAULT_AGC_RELEASE_MS;
+  cfg->gateLevel = MIC_DSP_DEFAULT_GATE_LEVEL;
+  cfg->gateHoldMs = MIC_DSP_DEFAULT_GATE_HOLD_MS;
+}
+
+void mic_dsp_set_config(MicDsp *dsp, const MicDspConfig *cfg)
+{
+  dsp->cfg = *cfg;
+  dsp->cfg.dcShift = clamp(cfg->dcShift, 4, 14);
+  dsp->cfg.fixedGain = clamp(cfg->fixedGain, 0, MIC_DSP_GAIN_MAX - 1);
+  dsp->cfg.agcLevel = clamp(cfg->agcLevel, 1, 32767);
+  dsp->cfg.agcMaxGain = clamp(cfg->agcMaxGain, MIC_DSP_GAIN_ONE, MIC_DSP_GAIN_MAX - 1);
+  dsp->cfg.agcReleaseMs = clamp(cfg->agcReleaseMs, 10, 60000);
+  dsp->agcGain = clamp(dsp->agcGain, MIC_DSP_GAIN_MIN, dsp->cfg.agcMaxGain);
+}
+
+void mic_dsp_init(MicDsp *dsp, const MicDspConfig *cfg, uint32_t sampleRate)
+{
+  dsp->sampleRate = sampleRate;
+  dsp->dc = 0;
+  dsp->dcPrimed = false;
+  dsp->agcGain = MIC_DSP_GAIN_ONE;
+  dsp->gain = 0; // fade in the first block
+  dsp->gateQuietMs = 0;
+  dsp->gateOpen = false;
+  dsp->level = 0;
+  mic_dsp_set_config(dsp, cfg);
+}
+
+/*
+ * DC blocker: dc tracks the input with a one pole low pass, y = x - dc.
+ * dc is kept in Q14 so (x - dc) never overflows int32 and the tracking does not stall
+ * on small differences. Also measures the mean absolute and peak level of the output.
+ */
+static int32_t dc_block(MicDsp *dsp, int16_t *pcm, int samples, int32_t *peak)
+{
+  const int shift = dsp->cfg.dcShift;
+  uint32_t sumAbs = 0;
+  int32_t maxAbs = 0;
+
+  if (!dsp->dcPrimed)
+  {
+    // start from the mean of the first block instead of settling from 0 for several hundred ms
+    int32_t sum = 0;
+    for (int i = 0; i < samples; i++)
+    {
+      sum += pcm[i];
+    }
+    dsp->dc = (sum / samples) << 14;
+    dsp->dcPrimed = true;
+  }
+
+  int32_t dc = dsp->dc;
+
+  for (int i = 0; i < samples; i++)
+  {
+    int32_t x = (int32_t)pcm[i] << 14;
+    dc += (x - dc) >> shift;
+    int32_t y = saturate16((x - dc) >> 14);
+    pcm[i] = y;
+    int32_t a = y < 0 ? -y : y;
+    sumAbs += a;
+    maxAbs = a > maxAbs ? a : maxAbs;
+  }
+  dsp->dc = dc;
+  *peak = maxAbs;
+  return sumAbs / samples;
+}
+
+static int32_t measure(const int16_t *pcm, int samples, int32_t *peak)
+{
+  uint32_t sumAbs = 0;
+  int32_t maxAbs = 0;
+
+  for (int i = 0; i < samples; i++)
+  {
+    int32_t a = pcm[i] < 0 ? -pcm[i] : pcm[i];
+    sumAbs += a;
+    maxAbs = a > maxAbs ? a : maxAbs;
+  }
+  *peak = maxAbs;
+  return sumAbs / samples;
+}
+
+/* gate state of this block, from the level before any gain */
+static bool update_gate(MicDsp *dsp, int32_t level, uint32_t blockMs)
+{
+  if (!dsp->cfg.noiseGate || level >= dsp->cfg.gateLevel)
+  {
+    dsp->gateOpen = true;
+    dsp->gateQuietMs = 0;
+  }
+  else if (dsp->gateOpen)
+  {
+    dsp->gateQuietMs += blockMs;
+    if (dsp->gateQuietMs >= dsp->cfg.gateHoldMs)
+    {
+      dsp->gateOpen = false;
+    }
+  }
+  return dsp->gateOpen;
+}
+
+/* agc gain for this block: drop at once to avoid clipping, rise slowly to avoid pumping */
+static int32_t update_agc(MicDsp *dsp, int32_t level, int32_t peak, uint32_t blockMs)
+{
+  const MicDspConfig *cfg = &dsp->cfg;
+  int32_t gain = dsp->agcGain;
+
+  if (level == 0)
+  {
+    return gain;
+  }
+
+  int32_t want = clamp((int32_t)cfg->agcLevel * MIC_DSP_GAIN_ONE / level, MIC_DSP_GAIN_MIN, cfg->agcMaxGain);
+  if (peak > 0 && want > 32767 * MIC_DSP_GAIN_ONE / peak)
+  {
+    want = 32767 * MIC_DSP_GAIN_ONE / peak; // never clip the peak of this block
+  }
+
+  if (want < gain)
+  {
+    gain = want;
+  }
+  else
+  {
+    // gain * ln2 * blockMs / releaseMs per block: about 6dB per agcReleaseMs
+    int32_t step = (gain * (int32_t)blockMs / cfg->agcReleaseMs * 709) >> 10;
+    gain += clamp(step, 1, want - gain);
+  }
+  dsp->agcGain = gain;
+  return gain;
+}
+
+/*
+ * Apply a gain which ramps linearly from the previous block's gain.
+ * The common constant gain case runs 4 samples per iteration with all loads ahead of
+ * the stores, which lets the compiler keep them in registers and pipeline the multiplies.
+ */
+static void apply_gain(MicDsp *dsp, int16_t *pcm, int samples, int32_t target)
+{
+  int i = 0;
+
+  if (target == dsp->gain)
+  {
+    if (target == MIC_DSP_GAIN_ONE)
+    {
+      return;
+    }
+    if (target == 0)
+    {
+      memset(pcm, 0, samples * sizeof(int16_t));
+      return;
+    }
+    for (; i + 4 <= samples; i += 4)
+    {
+      int32_t s0 = pcm[i] * target;
+      int32_t s1 = pcm[i + 1] * target;
+      int32_t s2 = pcm[i + 2] * target;
+      int32_t s3 = pcm[i + 3] * target;
+      pcm[i] = saturate16(s0 >> 10);
+      pcm[i + 1] = saturate16(s1 >> 10);
+      pcm[i + 2] = saturate16(s2 >> 10);
+      pcm[i + 3] = saturate16(s3 >> 10);
+    }
+    for (; i < samples; i++)
+    {
+      pcm[i] = saturate16((pcm[i] * target) >> 10);
+    }
+    return;
+  }
+
+  int32_t g = dsp->gain << MIC_DSP_RAMP_SHIFT;
+  int32_t step = ((target - dsp->gain) << MIC_DSP_RAMP_SHIFT) / samples;
+  for (; i < samples; i++)
+  {
+    g += step;
+    pcm[i] = saturate16((pcm[i] * (g >> MIC_DSP_RAMP_SHIFT)) >> 10);
+  }
+  dsp->gain = target;
+}
+
+void mic_dsp_process(MicDsp *dsp, int16_t *pcm, int samples)
+{
+  if (samples <= 0)
+  {
+    return;
+  }
+
+  int32_t peak = 0;
+  int32_t level = dsp->cfg.dcBlock ? dc_block(dsp, pcm, samples, &peak) : measure(pcm, samples, &peak);
+  uint32_t blockMs = (uint32_t)samples * 1000 / dsp->sampleRate;
+  dsp->level = level;
+
+  // the agc gain is held while the gate is closed, the noise floor must not pull it up
+  int32_t gain = 0;
+  if (update_gate(dsp, level, blockMs))
+  {
+    gain = dsp->cfg.agc ? update_agc(dsp, level, peak, blockMs) : dsp->cfg.fixedGain;
+  }
+  apply_gain(dsp, pcm, samples, gain);
+}
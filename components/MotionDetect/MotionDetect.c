@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
 #include <math.h>
 
 #include "freertos/FreeRTOS.h"
@@ -12,7 +14,8 @@
 #include "Camera.h"
 #include "ChipInfo.h"
 #include "vCenter.h"
-#include "esp_jpeg_dec.h"
+#include "jpeg_luma.h"
+#include "motion_kernel.h"
 
 #define ps_malloc(size) heap_caps_malloc((size), MALLOC_CAP_SPIRAM)
 
@@ -22,76 +25,177 @@
 #define RESIZE_DIM_SQ (RESIZE_DIM * RESIZE_DIM) // pixels in bitmap
 #define INACTIVE_COLOR 96                       // color for inactive motion pixel
 #define JPEG_QUAL 80                            // % quality for generated motion detect jpeg
-#define RGB888_BYTES 3                          // number of bytes per pixel
-#define GRAYSCALE_BYTES 1                       // number of bytes per pixel
-#define MOTION_DETECT_COLOR_DEPTH RGB888_BYTES  // GRAYSCALE_BYTES or RGB888_BYTES
-#define RESIZE_DIM_LEN (RESIZE_DIM_SQ * MOTION_DETECT_COLOR_DEPTH)
-static const int resizeDim_sq = RESIZE_DIM_SQ;
-static const int resizeDimLen = RESIZE_DIM_LEN;
-
-/* 亮度检测相关参数 */
-#define DETECT_NIGHT_FRAMES 10 // frames of sequential darkness to avoid spurious day / night switching
+#define DC_THUMB_MIN_WIDTH 80                   // 帧宽/8不小于此值时直接用DC缩略图（每个8x8块的均值）检测，不做IDCT
 
 // 运动检测相关参数
 #define DETECT_MOTION_FRAMES 3     // 连续帧数检测到运动才认为有运动
-#define DETECT_NUM_BANDS 10      // 检测区域划分成几个部分，划分成10部分（10行），则每部分的像素数为RESIZE_DIM*RESIZE_DIM/detectNumBands
-#define DETECT_START_BAND 1        // 检测区域起始行，从1开始计数，1表示最顶部，10表示最底部
-#define DETECT_END_BAND 9          // 检测区域结束行，从1开始计数
 #define DETECT_CHANGE_THRESHOLD 15 // 像素变化阈值，大于此值认为是运动
+#define DETECT_SIGMA_K 3           // 偏离背景超过几倍标准差认为是运动，噪声大的像素（树叶、水面）阈值自动升高
+#define DETECT_LEARN_SHIFT 4       // 背景学习速率 1/16 每次检测，缓慢移动的物体不会很快并入背景
+#define DETECT_ABSORB_SHIFT 6      // 前景像素学习速率 1/64 每次检测，停下的物体最终并入背景
+#define DETECT_MIN_BLOB_PERMILLE 2 // 连通域面积小于检测分辨率像素数的千分之几时当作噪点丢弃
+
+// JPEG大小预筛选，画面静止时不解码
+#define PREFILTER_K 3              // 帧大小偏离上次完整检测超过几倍平均抖动才解码
+#define PREFILTER_REFRESH_MS 1000  // 最长多久必须完整检测一次，大小变化不明显的运动最多延迟这么久，背景模型也能跟上光照变化
 
 static bool useMotion = false;          // 是否使用摄像头进行运动检测
 static uint8_t motionVal = 8;          // 运动检测灵敏度，数值越大越敏感
 
-static uint8_t *prevBuff = NULL;
-
-/* 亮度检测相关变量 */
-static uint8_t l_cur_luma = 0;     // current luma value
-static uint8_t l_nightSwitch = 20; // luma threshold for night time detection
-static bool nightTime = false;
+static uint8_t *currBuff = NULL; // 当前帧亮度图，DC缩略图或RESIZE_DIM x RESIZE_DIM
+static void *l_bgBuff = NULL;    // 背景模型缓冲区，每像素3字节
+static JpegLuma *l_luma = NULL;   // 运动检测任务的解码上下文，测光任务有自己的
+static MotionBg l_bg;            // 背景模型，尺寸变化后重新学习
+static uint8_t *l_fgMask = NULL; // 前景掩码，检测分辨率
+static void *l_blobWork = NULL;  // 连通域分析工作缓冲区
+static size_t l_motionBufSize = 0; // 以上缓冲区按多少像素分配
+static size_t l_blobWorkSize = 0;
+static bool l_dcThumb = false;     // 当前是否使用DC缩略图，此时每帧都检测运动开始
+
+/* 检测区域，MOTION_GRID_COLS x MOTION_GRID_ROWS的网格，默认屏蔽最下面一行（时间水印） */
+static uint16_t l_zoneMask[MOTION_GRID_ROWS] = {0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF,
+                                                0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0x0000};
+static bool l_zonesChanged = true;  // 网格变化后要重新光栅化并重新学习背景
+static portMUX_TYPE l_zoneLock = portMUX_INITIALIZER_UNLOCKED;
+static MotionZones l_zones;         // 光栅化到检测分辨率的检测区域
+
+/* 最近一次检测到的运动区域，坐标为原始帧坐标，无运动时为空 */
+static MotionBlob l_blobs[MOTION_MAX_BLOBS];
+static int l_blobCount = 0;
+static int l_blobFrameWidth = 0;
+static int l_blobFrameHeight = 0;
+static portMUX_TYPE l_blobLock = portMUX_INITIALIZER_UNLOCKED;
+#define MOTION_EVENT_CB_MAX 4     // 最多几个运动事件订阅者（MQTT、录像等）
+static motion_event_cb_t l_motionCbs[MOTION_EVENT_CB_MAX] = {NULL};
+static bool l_motionReported = false; // 订阅者是否收到了运动开始，停止检测时要补发运动停止
+
+/* JPEG大小预筛选相关变量 */
+static uint32_t l_refSize = 0;      // 上次完整检测时的帧大小
+static uint32_t l_prevSize = 0;     // 上一帧大小
+static uint32_t l_sizeJitter = 0;   // 相邻帧大小差的滑动平均，Q4
+static int64_t l_lastFullCheck = 0; // 上次完整检测的时间 us
 
 /* 是否画面静止，经对比前后两帧 */
 static bool l_still = false;
 
-/**
- * @brief 获取当前亮度值
- *
- * @return uint8_t 返回当前计算的亮度值（0-255）
- */
-uint8_t getLuma()
+/* 设置运动检测灵敏度 */
+void setDetectSensitivity(uint8_t sensitivity)
 {
-  return l_cur_luma;
+  motionVal = sensitivity;
 }
-/**
- * @brief 获取当前是否为夜间状态
- *
- * @return bool 返回true表示夜间，false表示白天
- */
-bool getNightStatus()
+
+/* 获取运动检测灵敏度 */
+uint8_t getDetectSensitivity()
 {
-  return nightTime;
+  return motionVal;
 }
 
-/* 设置日夜检测阈值 */
-void setNightSwitch(uint8_t nightSwitch)
+bool setMotionZones(const char *zones)
 {
-  l_nightSwitch = nightSwitch;
+  uint16_t mask[MOTION_GRID_ROWS];
+  size_t len = zones ? strlen(zones) : 0;
+  if (len == 0)
+  {
+    // 空字符串表示整个画面
+    memset(mask, 0xFF, sizeof(mask));
+  }
+  else if (len == MOTION_ZONES_STR_LEN)
+  {
+    for (int r = 0; r < MOTION_GRID_ROWS; r++)
+    {
+      char row[5] = {0};
+      char *end = NULL;
+      memcpy(row, zones + r * 4, 4);
+      mask[r] = (uint16_t)strtoul(row, &end, 16);
+      if (end != row + 4)
+      {
+        ESP_LOGE(TAG, "Invalid motion zones: %s", zones);
+        return false;
+      }
+    }
+  }
+  else
+  {
+    ESP_LOGE(TAG, "Invalid motion zones length %u", (unsigned)len);
+    return false;
+  }
+
+  portENTER_CRITICAL(&l_zoneLock);
+  memcpy(l_zoneMask, mask, sizeof(mask));
+  l_zonesChanged = true;
+  portEXIT_CRITICAL(&l_zoneLock);
+  return true;
+}
+
+bool addMotionEventCallback(motion_event_cb_t cb)
+{
+  for (int i = 0; i < MOTION_EVENT_CB_MAX; i++)
+  {
+    if (l_motionCbs[i] == cb)
+    {
+      return true;
+    }
+    if (l_motionCbs[i] == NULL)
+    {
+      l_motionCbs[i] = cb;
+      return true;
+    }
+  }
+  ESP_LOGE(TAG, "Too many motion event callbacks");
+  return false;
 }
 
-uint8_t getNightSwitch()
+int getMotionBlobs(MotionBlob *blobs, int maxBlobs, int *frameWidth, int *frameHeight)
 {
-  return l_nightSwitch;
+  portENTER_CRITICAL(&l_blobLock);
+  int count = l_blobCount < maxBlobs ? l_blobCount : maxBlobs;
+  memcpy(blobs, l_blobs, count * sizeof(MotionBlob));
+  if (frameWidth)
+    *frameWidth = l_blobFrameWidth;
+  if (frameHeight)
+    *frameHeight = l_blobFrameHeight;
+  portEXIT_CRITICAL(&l_blobLock);
+  return count;
 }
 
-/* 设置运动检测灵敏度 */
-void setDetectSensitivity(uint8_t sensitivity)
+/* 运动区域从检测分辨率映射到原始帧坐标后保存，供网页、MQTT读取 */
+static void publishBlobs(const MotionBlob *blobs, int count, int width, int height, int frameWidth, int frameHeight)
 {
-  motionVal = sensitivity;
+  MotionBlob scaled[MOTION_MAX_BLOBS];
+  for (int i = 0; i < count; i++)
+  {
+    scaled[i].x = blobs[i].x * frameWidth / width;
+    scaled[i].y = blobs[i].y * frameHeight / height;
+    scaled[i].w = (blobs[i].x + blobs[i].w) * frameWidth / width - scaled[i].x;
+    scaled[i].h = (blobs[i].y + blobs[i].h) * frameHeight / height - scaled[i].y;
+    scaled[i].w = scaled[i].x + scaled[i].w > frameWidth ? frameWidth - scaled[i].x : scaled[i].w;
+    scaled[i].h = scaled[i].y + scaled[i].h > frameHeight ? frameHeight - scaled[i].y : scaled[i].h;
+    scaled[i].cx = (2 * blobs[i].cx + 1) * frameWidth / (2 * width);
+    scaled[i].cy = (2 * blobs[i].cy + 1) * frameHeight / (2 * height);
+    scaled[i].area = (uint64_t)blobs[i].area * frameWidth * frameHeight / (width * height);
+  }
+  portENTER_CRITICAL(&l_blobLock);
+  memcpy(l_blobs, scaled, count * sizeof(MotionBlob));
+  l_blobCount = count;
+  l_blobFrameWidth = frameWidth;
+  l_blobFrameHeight = frameHeight;
+  portEXIT_CRITICAL(&l_blobLock);
 }
 
-/* 获取运动检测灵敏度 */
-uint8_t getDetectSensitivity()
+/* 运动期间每次检测都通知订阅者，运动停止时再通知一次 */
+static void notifyMotion(bool motion)
 {
-  return motionVal;
+  if (motion || l_motionReported)
+  {
+    MotionBlob scaled[MOTION_MAX_BLOBS];
+    int frameWidth, frameHeight;
+    int count = getMotionBlobs(scaled, MOTION_MAX_BLOBS, &frameWidth, &frameHeight);
+    for (int i = 0; i < MOTION_EVENT_CB_MAX && l_motionCbs[i]; i++)
+    {
+      l_motionCbs[i](motion, scaled, count, frameWidth, frameHeight);
+    }
+  }
+  l_motionReported = motion;
 }
 
 /* 获取是否启用运动检测 */
@@ -120,202 +224,82 @@ void changeMotionDetectStatus(bool status)
   else
   {
     stopMotionDetectTask();
+    // 检测任务已删除，补发运动停止，避免录像一直不结束
+    publishBlobs(NULL, 0, 1, 1, l_blobFrameWidth, l_blobFrameHeight);
+    notifyMotion(false);
   }
   useMotion = status;
 }
 
-/* 亮度检测函数 */
-static bool isNight(uint8_t luma)
+/* 帧大小相对上次完整检测的变化是否超过自适应阈值，或者已经太久没有完整检测 */
+static bool sizeChanged(uint32_t size, int64_t now)
 {
-  // check if night time for suspending recording
-  // or for switching on lamp if enabled
-  static uint16_t nightCnt = 0;
-  l_cur_luma = luma;
-  if (nightTime)
+  uint32_t step = size > l_prevSize ? size - l_prevSize : l_prevSize - size;
+  l_prevSize = size;
+  // 单次大跳变（运动、曝光突变）限幅后再计入抖动，避免阈值被拉高
+  uint32_t maxStep = (4 * l_sizeJitter) >> 4;
+  if (l_sizeJitter && step > maxStep)
   {
-    if (l_cur_luma > l_nightSwitch)
-    {
-      // light image
-      nightCnt--;
-      // signal day time after given sequence of light frames
-      if (nightCnt == 0)
-      {
-        nightTime = false;
-        ESP_LOGI(TAG, "Switch to Day time");
-      }
-    }
-  }
-  else
-  {
-    if (l_cur_luma < l_nightSwitch)
-    {
-      // dark image
-      nightCnt++;
-      // signal night time after given sequence of dark frames
-      if (nightCnt > DETECT_NIGHT_FRAMES)
-      {
-        nightTime = true;
-        ESP_LOGI(TAG, "Switch to Night time");
-      }
-    }
+    step = maxStep;
   }
-  return nightTime;
+  l_sizeJitter += ((int32_t)(step << 4) - (int32_t)l_sizeJitter) >> 3;
+
+  uint32_t delta = size > l_refSize ? size - l_refSize : l_refSize - size;
+  return !l_refSize || now - l_lastFullCheck >= PREFILTER_REFRESH_MS * 1000LL ||
+         delta > ((PREFILTER_K * l_sizeJitter) >> 4);
 }
 
-/**
- * @brief 将JPEG图像解码为RGB888格式
- *
- * 该函数将输入的JPEG格式图像数据解码并转换为RGB888格式的图像数据。
- * 使用静态变量缓存解码器句柄和输出缓冲区以提高性能，仅在图像尺寸变化时重新初始化。
- * 输出图像将被缩放到RESIZE_DIM x RESIZE_DIM尺寸。
- *
- * @param input_buf 输入的JPEG数据缓冲区指针
- * @param len JPEG数据的长度
- * @param output_buf 输出RGB888数据缓冲区指针的指针（函数内部分配内存）
- * @param out_len 输出数据长度的指针
- * @param input_width 输入图像的宽度
- * @param input_height 输入图像的高度
- *
- * @return jpeg_error_t 返回解码状态码，JPEG_ERR_OK表示成功
- */
-jpeg_error_t jgp2rgb888(uint8_t *input_buf, int len, uint8_t **output_buf, int *out_len, int input_width, int input_height)
+/* 按检测分辨率分配缓冲区，只在变大时重新分配 */
+static bool allocMotionBuffers(int width, int height)
 {
-  static uint8_t *out_buf = NULL;
-  static size_t out_buf_size = 0;
-  static jpeg_dec_handle_t jpeg_dec = NULL;
-  static jpeg_dec_io_t *jpeg_io = NULL;
-  static jpeg_dec_header_info_t *out_info = NULL;
-  static int last_input_width = 0;
-  static int last_input_height = 0;
-  static int last_out_len = 0;
-  static bool initialized = false;
-
-  jpeg_error_t ret = JPEG_ERR_OK;
-
-  if (input_width != last_input_width || input_height != last_input_height)
+  size_t pixels = width * height;
+  size_t blobWorkSize = motion_blob_work_size(width, height);
+  if (!l_luma && !(l_luma = jpeg_luma_create()))
   {
-    initialized = false;
-    if (jpeg_dec)
-    {
-      jpeg_dec_close(jpeg_dec);
-      jpeg_dec = NULL;
-    }
-    if (jpeg_io)
-    {
-      free(jpeg_io);
-      jpeg_io = NULL;
-    }
-    if (out_info)
-    {
-      free(out_info);
-      out_info = NULL;
-    }
-    last_input_width = input_width;
-    last_input_height = input_height;
-
-    // Generate default configuration
-    jpeg_dec_config_t config = DEFAULT_JPEG_DEC_CONFIG();
-    config.scale.width = RESIZE_DIM;
-    config.scale.height = RESIZE_DIM;
-
-    // Create jpeg_dec handle
-    ret = jpeg_dec_open(&config, &jpeg_dec);
-    if (ret != JPEG_ERR_OK)
-    {
-      return ret;
-    }
-
-    // Create io_callback handle
-    jpeg_io = calloc(1, sizeof(jpeg_dec_io_t));
-    if (jpeg_io == NULL)
-    {
-      ret = JPEG_ERR_NO_MEM;
-      return ret;
-    }
-
-    // Create out_info handle
-    out_info = calloc(1, sizeof(jpeg_dec_header_info_t));
-    if (out_info == NULL)
-    {
-      ret = JPEG_ERR_NO_MEM;
-      return ret;
-    }
-
-    // Set input buffer and buffer len to io_callback
-    jpeg_io->inbuf = input_buf;
-    jpeg_io->inbuf_len = len;
-
-    // Parse jpeg picture header and get picture for user and decoder
-    ret = jpeg_dec_parse_header(jpeg_dec, jpeg_io, out_info);
-    if (ret != JPEG_ERR_OK)
-    {
-      return ret;
-    }
-
-    *out_len = out_info->width * out_info->height * 3;
-    // Calloc out_put data buffer and update inbuf ptr and inbuf_len
-    if (config.output_type == JPEG_PIXEL_FORMAT_RGB565_LE || config.output_type == JPEG_PIXEL_FORMAT_RGB565_BE || config.output_type == JPEG_PIXEL_FORMAT_CbYCrY)
-    {
-      *out_len = out_info->width * out_info->height * 2;
-    }
-    else if (config.output_type == JPEG_PIXEL_FORMAT_RGB888)
-    {
-      *out_len = out_info->width * out_info->height * 3;
-    }
-    else
-    {
-      ret = JPEG_ERR_INVALID_PARAM;
-      return ret;
-    }
-
-    if (*out_len > out_buf_size)
-    {
-      if (out_buf)
-      {
-        free(out_buf);
-      }
-      out_buf = jpeg_calloc_align(*out_len, 16);
-      if (out_buf == NULL)
-      {
-        ret = JPEG_ERR_NO_MEM;
-        return ret;
-      }
-      out_buf_size = *out_len;
-    }
-
-    jpeg_io->outbuf = out_buf;
-    *output_buf = out_buf;
-    last_out_len = *out_len;
-
-    initialized = true;
+    return false;
   }
-  else
+  if (pixels <= l_motionBufSize && blobWorkSize <= l_blobWorkSize)
   {
-    // Set input buffer and buffer len to io_callback
-    jpeg_io->inbuf = input_buf;
-    jpeg_io->inbuf_len = len;
-    jpeg_dec_parse_header(jpeg_dec, jpeg_io, out_info);
-
-    *output_buf = out_buf;
-    *out_len = last_out_len;
+    return true;
   }
-
-  if (!initialized)
+  free(l_bgBuff);
+  free(currBuff);
+  free(l_fgMask);
+  free(l_blobWork);
+  l_bgBuff = ps_malloc(motion_bg_buffer_size(pixels));
+  currBuff = (uint8_t *)ps_malloc(pixels);
+  l_fgMask = (uint8_t *)ps_malloc(pixels);
+  l_blobWork = ps_malloc(blobWorkSize);
+  l_bg.width = l_bg.height = 0;
+  if (l_bgBuff == NULL || currBuff == NULL || l_fgMask == NULL || l_blobWork == NULL)
   {
-    return JPEG_ERR_FAIL;
+    free(l_bgBuff);
+    free(currBuff);
+    free(l_fgMask);
+    free(l_blobWork);
+    l_bgBuff = NULL;
+    currBuff = NULL;
+    l_fgMask = NULL;
+    l_blobWork = NULL;
+    l_motionBufSize = 0;
+    l_blobWorkSize = 0;
+    return false;
   }
-
-  // Start decode jpeg
-  ret = jpeg_dec_process(jpeg_dec, jpeg_io);
-
-  return ret;
+  l_motionBufSize = pixels;
+  l_blobWorkSize = blobWorkSize;
+  return true;
 }
 
 /**
  * @brief 检测图像中的运动
  *
- * 通过比较当前帧与前一帧的差异来检测运动。将JPEG图像转换为RGB888或灰度位图，
- * 进行缩放处理，然后比较像素差异来判断是否有运动发生。
+ * 通过比较当前帧与背景模型的差异来检测运动。只解码JPEG图像的亮度分量（见jpeg_luma_decode），
+ * 帧宽/8不小于DC_THUMB_MIN_WIDTH时直接取每个8x8亮度块的DC系数作为(W/8)x(H/8)缩略图，
+ * 不做IDCT，开销低到可以每帧检测；较小的帧则缩放为RESIZE_DIM x RESIZE_DIM灰度图。
+ * 然后与背景模型（逐像素滑动平均和方差，带全局光照补偿，见motion_bg_update）比较，
+ * 缓慢移动的物体会累积差异，自动曝光引起的整体亮度变化不会误报。
+ * 无运动时先比较JPEG帧大小与上次完整检测的差值，小于自适应阈值（PREFILTER_K倍平均抖动）时
+ * 不解码直接跳过，至少每PREFILTER_REFRESH_MS完整检测一次。
  *
  * @param motionStatus 当前运动状态（true表示运动正在进行中，false表示无运动）
  *
@@ -329,15 +313,12 @@ jpeg_error_t jgp2rgb888(uint8_t *input_buf, int len, uint8_t **output_buf, int *
  */
 bool checkMotion(bool motionStatus)
 {
-  // check difference between current and previous image
+  // check difference between current image and background
   int64_t tm1 = esp_timer_get_time();
   int64_t tm2 = 0;
-  uint32_t lux = 0;
   static uint32_t motionCnt = 0;
-  uint8_t *rgb_buf = NULL;
-  int rgb_buf_len = 0;
-  video_node *node = get_latest_video_frame();
 
+  video_node *node = get_latest_video_frame();
   if (!node)
   {
     ESP_LOGW(TAG, "No video frame available for motion detection");
@@ -345,67 +326,83 @@ bool checkMotion(bool motionStatus)
   }
   int originWidth = node->width;
   int originHeight = node->height;
+  int originSize = node->size;
 
-  if (PIXFORMAT_JPEG == node->format)
+  if (PIXFORMAT_JPEG != node->format)
   {
-    if (JPEG_ERR_OK != jgp2rgb888(node->data, node->size, &rgb_buf, &rgb_buf_len, originWidth, originHeight)) // convert image from JPEG to downscaled RGB888
-    {
-      ESP_LOGE(TAG, "jgp2raw() failure");
-      return motionStatus;
-    }
+    ESP_LOGE(TAG, "Unsupported pixel format %d for motion detection", node->format);
+    put_video_frame(node);
+    return motionStatus;
   }
-  else
+  // while idle, frames whose jpeg size stays close to the last checked frame are skipped without decoding
+  bool sizeChange = sizeChanged(originSize, tm1);
+  if (!motionStatus && !motionCnt && !sizeChange)
   {
-    ESP_LOGE(TAG, "Unsupported pixel format %d for motion detection", node->format);
+    put_video_frame(node);
     return motionStatus;
   }
+  l_refSize = originSize;
+  l_lastFullCheck = tm1;
+  // 1/8 of the frame decodes only the dc terms, jpeg_luma_decode picks the smallest idct covering the output
+  l_dcThumb = originWidth / 8 >= DC_THUMB_MIN_WIDTH;
+  int width = l_dcThumb ? (originWidth + 7) / 8 : RESIZE_DIM;
+  int height = l_dcThumb ? (originHeight + 7) / 8 : RESIZE_DIM;
+  int pixels = width * height;
+  if (!allocMotionBuffers(width, height))
+  {
+    ESP_LOGE(TAG, "No memory for motion detection buffers");
+    put_video_frame(node);
+    return motionStatus;
+  }
+
+  // convert image from JPEG to downscaled luma, chroma is never decoded
+  esp_err_t ret = jpeg_luma_decode(l_luma, node->data, node->size, currBuff, width, height);
   put_video_frame(node);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGE(TAG, "jpeg_luma_decode() failure: %s", esp_err_to_name(ret));
+    return motionStatus;
+  }
 
   tm2 = esp_timer_get_time();
   int dt = tm2 - tm1;
-  ESP_LOGD(TAG, "JPEG(%dx%d)[%d] convert to raw(%dx%d)[%d] in %lu us",
-           originWidth, originHeight, node->size,
-           RESIZE_DIM, RESIZE_DIM, rgb_buf_len,
+  ESP_LOGD(TAG, "JPEG(%dx%d)[%d] convert to luma(%dx%d) in %lu us",
+           originWidth, originHeight, originSize,
+           width, height,
            dt);
 
-  if (prevBuff == NULL)
+  if (l_zonesChanged || width != l_bg.width || height != l_bg.height)
   {
-    prevBuff = (uint8_t *)ps_malloc(resizeDim_sq);
+    // frame size or zones changed, rasterize the zones once and learn the background again from this frame
+    uint16_t mask[MOTION_GRID_ROWS];
+    portENTER_CRITICAL(&l_zoneLock);
+    memcpy(mask, l_zoneMask, sizeof(mask));
+    l_zonesChanged = false;
+    portEXIT_CRITICAL(&l_zoneLock);
+    motion_zones_init(&l_zones, mask, width, height);
+    motion_bg_init(&l_bg, l_bgBuff, width, height);
   }
 
   tm1 = esp_timer_get_time();
-  // compare each pixel in current frame with previous frame
-  int changeCount = 0;
-  // set horizontal region of interest in image
-  uint32_t startPixel = resizeDimLen * (DETECT_START_BAND - 1) / DETECT_NUM_BANDS;
-  uint32_t endPixel = resizeDimLen * (DETECT_END_BAND) / DETECT_NUM_BANDS;
-  int moveThreshold = ((endPixel - startPixel) / MOTION_DETECT_COLOR_DEPTH) * (11 - motionVal) / 100; // number of changed pixels that constitute a movement
-  for (int i = 0; i < resizeDimLen; i += MOTION_DETECT_COLOR_DEPTH)
-  {
-    uint16_t currPix = 0;
-    uint16_t prePos = i / MOTION_DETECT_COLOR_DEPTH;
-    for (int j = 0; j < MOTION_DETECT_COLOR_DEPTH; j++)
-    {
-      currPix += rgb_buf[i + j];
-    }
-    currPix /= MOTION_DETECT_COLOR_DEPTH;
-
-    lux += currPix; // for calculating light level
-
-    // determine pixel change status
-    if (abs((int)currPix - (int)prevBuff[prePos]) > DETECT_CHANGE_THRESHOLD)
-    {
-      if (i > startPixel && i < endPixel)
-      {
-        changeCount++; // number of changed pixels
-      }
-    }
-    prevBuff[prePos] = currPix; // save current pixel for next comparison
-  }
-  uint8_t luma = (lux * 100) / (resizeDim_sq * 255); // light value as a %
-  nightTime = isNight(luma);
+  // compare current frame with the background model inside the zones and update it, foreground pixels go to the mask
+  static const MotionBgConfig bgConfig = {
+      .threshold = DETECT_CHANGE_THRESHOLD,
+      .sigmaK = DETECT_SIGMA_K,
+      .learnShift = DETECT_LEARN_SHIFT,
+      .absorbShift = DETECT_ABSORB_SHIFT,
+  };
+  motion_bg_update(&l_bg, &bgConfig, currBuff, &l_zones, l_fgMask);
+  // group changed pixels into blobs, scattered noise below the minimum blob size does not count as change
+  MotionBlob blobs[MOTION_MAX_BLOBS];
+  uint32_t blobArea = 0;
+  uint32_t minBlobArea = pixels * DETECT_MIN_BLOB_PERMILLE / 1000;
+  int blobCount = motion_blob_find(l_fgMask, width, height, l_blobWork, minBlobArea ? minBlobArea : 1,
+                                   blobs, MOTION_MAX_BLOBS, &blobArea);
+  int changeCount = blobArea; // number of changed pixels in the zones that belong to a blob
+  int moveThreshold = l_zones.activePixels * (11 - motionVal) / 100; // number of changed pixels that constitute a movement
   tm2 = esp_timer_get_time();
-  ESP_LOGD(TAG, "Detected %u changes, threshold %u, light level %u, in %lu us", changeCount, moveThreshold, luma, tm2 - tm1);
+  ESP_LOGD(TAG, "Detected %u changes in %d blobs, threshold %u, gain %u/256, in %lld us",
+           changeCount, blobCount, moveThreshold, l_bg.gain, tm2 - tm1);
 
   if (changeCount > moveThreshold)
   {
@@ -434,8 +431,11 @@ bool checkMotion(bool motionStatus)
   if (motionStatus)
     ESP_LOGI(TAG, "*** Motion - ongoing %u frames", motionCnt);
 
-  // 晚上时间段不检测移动
-  return nightTime ? false : motionStatus;
+  // 晚上时间段不检测移动，日夜状态由测光任务更新
+  bool motion = getNightStatus() ? false : motionStatus;
+  publishBlobs(blobs, motion ? blobCount : 0, width, height, originWidth, originHeight);
+  notifyMotion(motion);
+  return motion;
 }
 
 // motion detection parameters
@@ -448,7 +448,7 @@ uint8_t FPS = 15;
  *
  * 根据当前是否正在捕获视频，动态调整运动检测的调用频率：
  * - 捕获状态下：每 moveStopSecs 秒检查一次运动停止
- * - 非捕获状态下：每秒检查 moveStartChecks 次运动开始
+ * - 非捕获状态下：每秒检查 moveStartChecks 次运动开始，使用DC缩略图时每帧都检查
  *
  * @param[in] motioning 是否处于运动状态
  * @return bool 返回 true 表示需要调用 checkMotion() 进行运动检测，false 表示跳过本次检测
@@ -458,7 +458,7 @@ bool doMonitor(bool motioning)
   // monitor incoming frames for motion
   static uint8_t motionCnt = 0;
   // ratio for monitoring stop during capture / movement prior to capture
-  uint8_t checkRate = (motioning) ? FPS * moveStopSecs : FPS / moveStartChecks;
+  uint8_t checkRate = (motioning) ? FPS * moveStopSecs : (l_dcThumb ? 1 : FPS / moveStartChecks);
   if (!checkRate)
     checkRate = 1;
   if (++motionCnt / checkRate)
@@ -0,0 +1,155 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "exposure.h"
+#include "vCenter.h"
+#include "jpeg_luma.h"
+
+#define TAG "Exposure"
+
+#define EXPOSURE_PERIOD_MS 1000 // 测光周期
+#define NIGHT_SWITCH_COUNT 10   // 连续多少次测光暗/亮才切换日夜，避免误切换
+#define DAY_SWITCH_MARGIN 15    // 切回白天的阈值比夜间阈值高多少，夜间预设提高增益、开补光灯后画面变亮，不能用同一个阈值
+#define NIGHT_SETTLE_MS 5000    // 切换预设后等待自动曝光稳定，期间不测光
+#define METER_WIDTH 32          // 测光缩略图尺寸，帧宽不小于256时只用DC系数，不做IDCT
+#define METER_HEIGHT 24
+#define NIGHT_EVENT_CB_MAX 4
+
+static uint8_t l_cur_luma = 0;     // current luma value
+static uint8_t l_nightSwitch = 20; // luma threshold for night time detection
+static bool nightTime = false;
+static night_event_cb_t l_nightCbs[NIGHT_EVENT_CB_MAX] = {NULL};
+static TaskHandle_t l_meterHandle = NULL;
+
+uint8_t getLuma()
+{
+  return l_cur_luma;
+}
+
+bool getNightStatus()
+{
+  return nightTime;
+}
+
+void setNightSwitch(uint8_t nightSwitch)
+{
+  l_nightSwitch = nightSwitch;
+}
+
+uint8_t getNightSwitch()
+{
+  return l_nightSwitch;
+}
+
+bool addNightEventCallback(night_event_cb_t cb)
+{
+  for (int i = 0; i < NIGHT_EVENT_CB_MAX; i++)
+  {
+    if (l_nightCbs[i] == cb)
+    {
+      return true;
+    }
+    if (l_nightCbs[i] == NULL)
+    {
+      l_nightCbs[i] = cb;
+      return true;
+    }
+  }
+  ESP_LOGE(TAG, "Too many night event callbacks");
+  return false;
+}
+
+/* 亮度检测函数，白天低于l_nightSwitch、夜间高于l_nightSwitch + DAY_SWITCH_MARGIN，连续多次才切换 */
+static bool isNight(uint8_t luma)
+{
+  // check if night time for suspending recording
+  // or for switching on lamp if enabled
+  static uint16_t switchCnt = 0;
+  l_cur_luma = luma;
+  bool cross = nightTime ? l_cur_luma > l_nightSwitch + DAY_SWITCH_MARGIN : l_cur_luma < l_nightSwitch;
+  switchCnt = cross ? switchCnt + 1 : 0;
+  // signal day / night time after given sequence of light / dark frames
+  if (switchCnt > NIGHT_SWITCH_COUNT)
+  {
+    switchCnt = 0;
+    nightTime = !nightTime;
+    ESP_LOGI(TAG, "Switch to %s time", nightTime ? "Night" : "Day");
+  }
+  return nightTime;
+}
+
+/* 最新帧的平均亮度百分比，失败返回false */
+static bool meterLatestFrame(uint8_t *luma)
+{
+  static uint8_t thumb[METER_WIDTH * METER_HEIGHT];
+  static JpegLuma *ctx = NULL; // 与运动检测任务各用一个解码上下文，两个任务可能同时解码
+  if (!ctx && !(ctx = jpeg_luma_create()))
+  {
+    return false;
+  }
+  video_node *node = get_latest_video_frame();
+  if (!node)
+  {
+    return false;
+  }
+  esp_err_t ret = ESP_ERR_NOT_SUPPORTED;
+  if (PIXFORMAT_JPEG == node->format)
+  {
+    ret = jpeg_luma_decode(ctx, node->data, node->size, thumb, METER_WIDTH, METER_HEIGHT);
+  }
+  put_video_frame(node);
+  if (ret != ESP_OK)
+  {
+    return false;
+  }
+  uint32_t sum = 0;
+  for (int i = 0; i < METER_WIDTH * METER_HEIGHT; i++)
+  {
+    sum += thumb[i];
+  }
+  *luma = (sum * 100) / (METER_WIDTH * METER_HEIGHT * 255);
+  return true;
+}
+
+static void exposureTask(void *pvParameters)
+{
+  while (1)
+  {
+    uint8_t luma;
+    int64_t tm = esp_timer_get_time();
+    if (meterLatestFrame(&luma))
+    {
+      bool wasNight = nightTime;
+      bool night = isNight(luma);
+      ESP_LOGD(TAG, "Light level %u in %lld us", luma, esp_timer_get_time() - tm);
+      for (int i = 0; night != wasNight && i < NIGHT_EVENT_CB_MAX && l_nightCbs[i]; i++)
+      {
+        l_nightCbs[i](night, luma);
+      }
+      if (night != wasNight)
+      {
+        // 预设和补光灯改变后的帧不代表环境亮度，等自动曝光稳定后再测
+        vTaskDelay(pdMS_TO_TICKS(NIGHT_SETTLE_MS));
+      }
+    }
+    vTaskDelay(pdMS_TO_TICKS(EXPOSURE_PERIOD_MS));
+  }
+}
+
+bool startExposureMeter(void)
+{
+  if (l_meterHandle)
+  {
+    return true;
+  }
+  if (xTaskCreate(exposureTask, "exposure", 4096, NULL, 1, &l_meterHandle) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create exposure task");
+    return false;
+  }
+  return true;
+}
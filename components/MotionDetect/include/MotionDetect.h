@@ -2,32 +2,58 @@
 #define _MOTIONDETECT_H_
 
 #include "esp_camera.h"
+#include "motion_kernel.h"
+#include "motion_blob.h"
+#include "exposure.h"
+
+#define MOTION_ZONES_STR_LEN (MOTION_GRID_ROWS * 4) // 检测区域字符串长度，每行4个十六进制字符
+
+/* 设置运动检测灵敏度 */
+void setDetectSensitivity(uint8_t sensitivity);
+
+/* 获取运动检测灵敏度 */
+uint8_t getDetectSensitivity();
 
 /**
- * @brief 获取当前亮度值
- * 
- * @return uint8_t 返回当前计算的亮度值（0-255）
+ * @brief 设置运动检测区域
+ *
+ * 画面分为MOTION_GRID_COLS x MOTION_GRID_ROWS的网格，每行用4个十六进制字符表示，
+ * 从上到下共MOTION_ZONES_STR_LEN个字符，最高位对应最左边的格子，1表示检测，0表示屏蔽。
+ * 下一次检测时光栅化到检测分辨率，屏蔽的格子不做任何计算。
+ *
+ * @param zones 检测区域字符串，空字符串表示整个画面
+ * @return true 成功
+ * @return false 格式错误
  */
-uint8_t getLuma();
+bool setMotionZones(const char *zones);
 
-/*
- * 获取当前是否为夜间状态的标志
+/**
+ * @brief 运动事件回调
  *
- * @return bool 返回true表示夜间，false表示白天
+ * 在运动检测任务中调用：运动持续期间每次检测调用一次，运动结束时以motion=false再调用一次。
+ * 回调里不要做耗时操作。
+ *
+ * @param motion 是否有运动
+ * @param blobs 运动区域，按面积从大到小排列，坐标为原始帧坐标
+ * @param count 运动区域数量
+ * @param frameWidth 原始帧宽度
+ * @param frameHeight 原始帧高度
  */
-bool getNightStatus();
-
-/* 设置日夜检测阈值 */
-void setNightSwitch(uint8_t nightSwitch);
-
-/* 获取日夜检测阈值 */
-uint8_t getNightSwitch();
+typedef void (*motion_event_cb_t)(bool motion, const MotionBlob *blobs, int count, int frameWidth, int frameHeight);
 
-/* 设置运动检测灵敏度 */
-void setDetectSensitivity(uint8_t sensitivity);
+/* 添加运动事件回调，各订阅者（MQTT、录像）在检测任务中依次调用，不能阻塞；重复添加忽略 */
+bool addMotionEventCallback(motion_event_cb_t cb);
 
-/* 获取运动检测灵敏度 */
-uint8_t getDetectSensitivity();
+/**
+ * @brief 获取当前运动区域
+ *
+ * @param blobs 输出，按面积从大到小排列，坐标为原始帧坐标
+ * @param maxBlobs blobs的长度
+ * @param frameWidth 输出原始帧宽度，可以为NULL
+ * @param frameHeight 输出原始帧高度，可以为NULL
+ * @return int 运动区域数量，无运动时为0
+ */
+int getMotionBlobs(MotionBlob *blobs, int maxBlobs, int *frameWidth, int *frameHeight);
 
 /* 获取是否启用运动检测 */
 bool getMotionDetectStatus();
@@ -41,7 +67,7 @@ bool getStillStatus();
 /**
  * @brief 检测图像中的运动
  * 
- * 通过比较当前帧与前一帧的差异来检测运动。将JPEG图像转换为RGB888或灰度位图，
+ * 通过比较当前帧与背景模型的差异来检测运动。将JPEG图像转换为RGB888或灰度位图，
  * 进行缩放处理，然后比较像素差异来判断是否有运动发生。
  * 
  * @param fb 摄像头帧缓冲区指针，包含当前帧的JPEG图像数据
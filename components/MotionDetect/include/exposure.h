@@ -0,0 +1,51 @@
+#ifndef _EXPOSURE_H_
+#define _EXPOSURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief 日夜切换回调，在测光任务中调用，不能阻塞
+ *
+ * @param night true切换到夜间，false切换到白天
+ * @param luma 当前亮度（0-100）
+ */
+typedef void (*night_event_cb_t)(bool night, uint8_t luma);
+
+/**
+ * @brief 启动测光任务
+ *
+ * 独立于运动检测，低频率（每EXPOSURE_PERIOD_MS一次）取最新JPEG帧，
+ * 只解码亮度DC系数得到很小的缩略图求平均亮度，连续多次低于夜间阈值后切到夜间，
+ * 连续多次高于夜间阈值加DAY_SWITCH_MARGIN后切回白天，并通知订阅者（补光灯、画质预设、运动检测等）。
+ * 切换后等自动曝光稳定再继续测光。运动检测关闭时日夜状态照常更新。
+ *
+ * @return true - 启动成功
+ * @return false - 创建任务失败
+ */
+bool startExposureMeter(void);
+
+/* 添加日夜切换回调，重复添加忽略 */
+bool addNightEventCallback(night_event_cb_t cb);
+
+/**
+ * @brief 获取当前亮度值
+ *
+ * @return uint8_t 返回最近一次测光的亮度百分比（0-100）
+ */
+uint8_t getLuma();
+
+/*
+ * 获取当前是否为夜间状态的标志
+ *
+ * @return bool 返回true表示夜间，false表示白天
+ */
+bool getNightStatus();
+
+/* 设置日夜检测阈值，切回白天的阈值比它高DAY_SWITCH_MARGIN */
+void setNightSwitch(uint8_t nightSwitch);
+
+/* 获取日夜检测阈值 */
+uint8_t getNightSwitch();
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _JPEG_LUMA_H_
+#define _JPEG_LUMA_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+/*
+ * 解码上下文，保存量化表、Huffman表和行缓冲区，不能在多个任务间共享，
+ * 每个调用jpeg_luma_decode的任务各自创建一个。
+ */
+typedef struct JpegLuma JpegLuma;
+
+/* 创建解码上下文，内存不足返回NULL */
+JpegLuma *jpeg_luma_create(void);
+
+/* 释放解码上下文及其缓冲区 */
+void jpeg_luma_destroy(JpegLuma *ctx);
+
+/**
+ * @brief 只解码JPEG图像的亮度(Y)分量，并缩放到指定尺寸
+ *
+ * 仅支持baseline顺序编码（SOF0/SOF1，单个交织扫描或灰度图）。
+ * 色度块只做Huffman解码跳过，不反量化、不做IDCT，也不做颜色转换。
+ * 亮度块按输出尺寸选择1/1、1/2、1/4、1/8的缩减IDCT（1/8时只取DC系数），
+ * 再以最近邻方式映射到outWidth x outHeight，输出直接写入out，没有中间整帧缓冲。
+ * 输出尺寸为((W+7)/8) x ((H+7)/8)时即DC缩略图：每个像素是一个8x8亮度块的均值，
+ * AC系数全部只跳过，完全不做IDCT。
+ *
+ * @param ctx 调用任务自己的解码上下文
+ * @param jpeg JPEG数据
+ * @param len JPEG数据长度
+ * @param out 输出灰度图，大小为outWidth * outHeight字节
+ * @param outWidth 输出宽度
+ * @param outHeight 输出高度
+ *
+ * @return esp_err_t
+ *         - ESP_OK: 成功
+ *         - ESP_ERR_NOT_SUPPORTED: 非baseline或不支持的采样格式
+ *         - ESP_ERR_INVALID_ARG: JPEG数据损坏
+ *         - ESP_ERR_NO_MEM: 内存不足
+ */
+esp_err_t jpeg_luma_decode(JpegLuma *ctx, const uint8_t *jpeg, size_t len, uint8_t *out, int outWidth, int outHeight);
+
+#endif
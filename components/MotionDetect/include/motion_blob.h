@@ -0,0 +1,50 @@
+#ifndef _MOTION_BLOB_H_
+#define _MOTION_BLOB_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MOTION_MAX_BLOBS 8 // 每次检测最多报告的运动区域数
+
+/* 一个运动区域（连通域） */
+typedef struct
+{
+  uint16_t x;    // 外接矩形左上角
+  uint16_t y;
+  uint16_t w;    // 外接矩形宽高
+  uint16_t h;
+  uint16_t cx;   // 质心
+  uint16_t cy;
+  uint32_t area; // 像素数
+} MotionBlob;
+
+/**
+ * @brief 连通域分析需要的工作缓冲区大小
+ *
+ * @param width 宽度
+ * @param height 高度
+ *
+ * @return size_t 字节数
+ */
+size_t motion_blob_work_size(int width, int height);
+
+/**
+ * @brief 对前景掩码做8连通域分析（两遍扫描+并查集），输出面积最大的几个连通域
+ *
+ * 面积小于minArea的连通域（零散噪点）被丢弃。
+ *
+ * @param mask 前景掩码，非0为前景
+ * @param width 宽度
+ * @param height 高度
+ * @param work 工作缓冲区，至少motion_blob_work_size(width, height)字节，4字节对齐
+ * @param minArea 最小面积
+ * @param blobs 输出，按面积从大到小排列
+ * @param maxBlobs blobs的长度
+ * @param totalArea 输出所有不小于minArea的连通域的面积之和，可以为NULL
+ *
+ * @return int 输出的连通域数量
+ */
+int motion_blob_find(const uint8_t *mask, int width, int height, void *work, uint32_t minArea,
+                     MotionBlob *blobs, int maxBlobs, uint32_t *totalArea);
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef _MOTION_KERNEL_H_
+#define _MOTION_KERNEL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* 背景模型参数 */
+typedef struct
+{
+  uint8_t threshold;   // 像素变化下限，|归一化像素 - 背景| 不大于此值时总是背景
+  uint8_t sigmaK;      // 偏离背景超过sigmaK倍标准差才算前景
+  uint8_t learnShift;  // 背景像素的学习速率 2^-learnShift
+  uint8_t absorbShift; // 前景像素的学习速率 2^-absorbShift，停下来的物体最终并入背景
+} MotionBgConfig;
+
+/*
+ * 逐像素指数滑动平均背景，带自适应方差。
+ * 每像素3字节：均值Q8(uint16) + 方差/4(uint8)，缓冲区由调用者分配，本模块不依赖IDF。
+ */
+typedef struct
+{
+  int width;
+  int height;
+  uint16_t *mean;     // Q8背景均值
+  uint8_t *var;       // 方差/MOTION_BG_VAR_SCALE
+  bool primed;        // 已用一帧初始化
+  uint64_t meanSum;   // 检测区域内背景均值之和(Q8)，用于全局光照补偿
+  uint16_t gain;      // 最近一帧的光照补偿增益Q8
+} MotionBg;
+
+#define MOTION_BG_VAR_SCALE 4
+
+/* 检测区域网格 */
+#define MOTION_GRID_COLS 16
+#define MOTION_GRID_ROWS 12
+#define MOTION_ZONE_BIT(c) (0x8000u >> (c)) // 行掩码的最高位是最左边的格子
+
+typedef struct
+{
+  uint16_t mask[MOTION_GRID_ROWS];      // 每行的格子掩码
+  uint16_t cellX[MOTION_GRID_COLS + 1]; // 格子列在检测分辨率下的像素边界
+  uint16_t cellY[MOTION_GRID_ROWS + 1]; // 格子行的像素边界
+  uint32_t activePixels;                // 参与检测的像素数
+} MotionZones;
+
+/**
+ * @brief 亮度之和，按32位字一次处理4个像素（SWAR）
+ *
+ * @param p 亮度图
+ * @param n 像素数
+ *
+ * @return uint32_t 像素亮度之和
+ */
+uint32_t motion_luma_sum(const uint8_t *p, int n);
+
+/**
+ * @brief 背景模型需要的缓冲区大小
+ *
+ * @param pixels 像素数
+ *
+ * @return size_t 字节数
+ */
+size_t motion_bg_buffer_size(int pixels);
+
+/**
+ * @brief 绑定缓冲区，下一帧用于初始化背景
+ *
+ * @param bg 背景模型
+ * @param buf 缓冲区，至少motion_bg_buffer_size(width * height)字节
+ * @param width 宽度
+ * @param height 高度
+ */
+void motion_bg_init(MotionBg *bg, void *buf, int width, int height);
+
+/**
+ * @brief 把检测区域网格光栅化到检测分辨率
+ *
+ * 画面均分为MOTION_GRID_COLS x MOTION_GRID_ROWS个格子，格子的像素边界只在尺寸或区域变化时计算一次。
+ *
+ * @param zones 输出
+ * @param mask 每行一个16位掩码，MOTION_ZONE_BIT(c)为1表示第c列的格子参与检测
+ * @param width 检测分辨率宽度
+ * @param height 检测分辨率高度
+ */
+void motion_zones_init(MotionZones *zones, const uint16_t mask[MOTION_GRID_ROWS], int width, int height);
+
+/**
+ * @brief 与背景比较并更新背景，输出前景掩码
+ *
+ * 当前帧先按检测区域内的平均亮度归一化到背景的平均亮度（全局光照补偿），
+ * 自动曝光或开关灯造成的整体亮度变化不会被当成运动；增益超出[1/2, 2]时重新学习背景。
+ * 前景判定：|d| > threshold 且 d^2 > sigmaK^2 * 方差。
+ * 屏蔽的格子完全跳过，既不比较也不更新背景；检测区域变化后需要重新motion_bg_init。
+ *
+ * @param bg 背景模型
+ * @param cfg 参数
+ * @param cur 当前帧亮度图，尺寸与背景相同
+ * @param zones 检测区域，尺寸与背景相同
+ * @param fgMask 输出前景掩码，尺寸与背景相同，前景为1，背景和屏蔽的格子为0
+ *
+ * @return uint32_t 检测区域内的前景像素数，本帧重新学习背景时为0
+ */
+uint32_t motion_bg_update(MotionBg *bg, const MotionBgConfig *cfg, const uint8_t *cur,
+                          const MotionZones *zones, uint8_t *fgMask);
+
+#endif
@@ -0,0 +1,911 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "jpeg_luma.h"
+
+#define HUFF_LUT_BITS 9   // codes up to this length are decoded by a single table lookup
+#define MAX_COMPONENTS 3
+#define MAX_TABLES 2      // baseline allows 2 dc and 2 ac tables
+#define COEF_LIMIT 2048   // |dequantized coefficient| of 8-bit samples, also keeps the idct within int32
+#define IDCT_BITS 11      // precision of the idct tables
+#define IDCT_PASS1_SHIFT 8
+#define SKIP_EOB 0x200    // skipAc flag for end of block
+
+typedef struct
+{
+  uint16_t lut[1 << HUFF_LUT_BITS]; // (length << 8) | symbol, 0 for longer codes
+  int16_t fastAc[1 << HUFF_LUT_BITS]; // (value << 8) | (run << 4) | (length + size) when code and value fit the lookup,
+                                      // just the length for end of block
+  uint16_t skipAc[1 << HUFF_LUT_BITS]; // SKIP_EOB | (run << 5) | (length + size) for codes that fit the lookup, value ignored
+  int32_t maxcode[17];              // largest code of each length, -1 if none
+  int32_t valoffset[17];            // huffval index = code + valoffset[length]
+  uint8_t huffval[256];
+  bool valid;
+} HuffTable;
+
+typedef struct
+{
+  uint8_t id;
+  uint8_t h, v;   // sampling factors
+  uint8_t tq;     // quantization table
+  uint8_t td, ta; // dc / ac huffman tables of the scan
+  int dcPred;
+} Component;
+
+typedef struct
+{
+  const uint8_t *p, *end;
+  uint32_t bits; // msb aligned bit buffer
+  int nbits;
+  bool marker;   // reached a marker, zeros are fed from now on
+} BitReader;
+
+struct JpegLuma
+{
+  uint16_t qt[4][64]; // zigzag order
+  HuffTable dc[MAX_TABLES];
+  HuffTable ac[MAX_TABLES];
+  Component comp[MAX_COMPONENTS];
+  int ncomp;
+  int width, height;
+  int hmax, vmax;
+  int restartInterval;
+  uint8_t *strip;     // one mcu row of scaled luma
+  size_t stripSize;
+  uint16_t *xmap;     // output column -> strip column
+  int xmapSize;
+};
+
+/* zigzag index -> natural (row * 8 + col) index */
+static const uint8_t l_zigzag[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10,
+    17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63};
+
+/*
+ * l_idct[k][x][u]: n = 8 >> k point reduced idct, lround(C(u) / 2 * cos((2x + 1) * u * pi / 2n) * 2^11).
+ * Feeding it the top left n x n coefficients of the 8x8 block yields the block downscaled by 8 / n,
+ * the same scaled idct libjpeg uses. Constant so decoders in several tasks share it without setup.
+ */
+static const int16_t l_idct[3][8][8] = {
+    {
+        {724, 1004, 946, 851, 724, 569, 392, 200},
+        {724, 851, 392, -200, -724, -1004, -946, -569},
+        {724, 569, -392, -1004, -724, 200, 946, 851},
+        {724, 200, -946, -569, 724, 851, -392, -1004},
+        {724, -200, -946, 569, 724, -851, -392, 1004},
+        {724, -569, -392, 1004, -724, -200, 946, -851},
+        {724, -851, 392, 200, -724, 1004, -946, 569},
+        {724, -1004, 946, -851, 724, -569, 392, -200},
+    },
+    {
+        {724, 946, 724, 392},
+        {724, 392, -724, -946},
+        {724, -392, -724, 946},
+        {724, -946, 724, -392},
+    },
+    {
+        {724, 724},
+        {724, -724},
+    },
+};
+
+static inline int clamp_pixel(int v)
+{
+  return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static inline int32_t clamp_coef(int32_t v)
+{
+  return v < -COEF_LIMIT ? -COEF_LIMIT : (v > COEF_LIMIT ? COEF_LIMIT : v);
+}
+
+static inline uint16_t read16(const uint8_t *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+/* ---------------- bit reader ---------------- */
+
+static inline void fill_bits(BitReader *br)
+{
+  while (br->nbits <= 24)
+  {
+    uint32_t b = 0;
+    if (!br->marker && br->p < br->end)
+    {
+      b = *br->p++;
+      if (b == 0xFF)
+      {
+        if (br->p < br->end && *br->p == 0x00)
+        {
+          br->p++; // stuffed zero
+        }
+        else
+        {
+          br->p--; // leave the marker for restart handling
+          br->marker = true;
+          b = 0;
+        }
+      }
+    }
+    br->bits |= b << (24 - br->nbits);
+    br->nbits += 8;
+  }
+}
+
+static inline uint32_t get_bits(BitReader *br, int n)
+{
+  fill_bits(br);
+  uint32_t v = br->bits >> (32 - n);
+  br->bits <<= n;
+  br->nbits -= n;
+  return v;
+}
+
+static inline void skip_bits(BitReader *br, int n)
+{
+  fill_bits(br);
+  br->bits <<= n;
+  br->nbits -= n;
+}
+
+static inline int extend(uint32_t v, int s)
+{
+  return v < (1u << (s - 1)) ? (int)v - (1 << s) + 1 : (int)v;
+}
+
+static inline int huff_decode(BitReader *br, const HuffTable *h)
+{
+  fill_bits(br);
+  uint16_t e = h->lut[br->bits >> (32 - HUFF_LUT_BITS)];
+  if (e)
+  {
+    int len = e >> 8;
+    br->bits <<= len;
+    br->nbits -= len;
+    return e & 0xFF;
+  }
+  for (int len = HUFF_LUT_BITS + 1; len <= 16; len++)
+  {
+    int32_t code = br->bits >> (32 - len);
+    if (code <= h->maxcode[len])
+    {
+      br->bits <<= len;
+      br->nbits -= len;
+      return h->huffval[code + h->valoffset[len]];
+    }
+  }
+  return -1; // corrupt data
+}
+
+/* skip to the RSTn marker, reset the bit buffer and the dc predictors */
+static bool restart(JpegLuma *j, BitReader *br)
+{
+  const uint8_t *p = br->p;
+  while (p + 1 < br->end && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7))
+  {
+    p++;
+  }
+  if (p + 1 >= br->end)
+  {
+    return false;
+  }
+  br->p = p + 2;
+  br->bits = 0;
+  br->nbits = 0;
+  br->marker = false;
+  for (int c = 0; c < j->ncomp; c++)
+  {
+    j->comp[c].dcPred = 0;
+  }
+  return true;
+}
+
+/* ---------------- headers ---------------- */
+
+static bool build_huffman(HuffTable *h, const uint8_t *counts, const uint8_t *vals, int nvals)
+{
+  int32_t code = 0;
+  int k = 0;
+
+  memset(h->lut, 0, sizeof(h->lut));
+  memcpy(h->huffval, vals, nvals);
+  for (int len = 1; len <= 16; len++)
+  {
+    h->valoffset[len] = k - code;
+    for (int i = 0; i < counts[len - 1]; i++, k++, code++)
+    {
+      // too many codes for this length, a corrupt table would index past the lookup
+      if (code >= (1 << len))
+      {
+        return false;
+      }
+      if (len <= HUFF_LUT_BITS)
+      {
+        int shift = HUFF_LUT_BITS - len;
+        for (int f = 0; f < (1 << shift); f++)
+        {
+          h->lut[(code << shift) | f] = (len << 8) | vals[k];
+        }
+      }
+    }
+    h->maxcode[len] = counts[len - 1] ? code - 1 : -1;
+    code <<= 1;
+  }
+
+  // ac codes whose value bits also fit the lookup are decoded completely in one step, the common case
+  for (int i = 0; i < (1 << HUFF_LUT_BITS); i++)
+  {
+    h->fastAc[i] = 0;
+    int len = h->lut[i] >> 8;
+    int rs = h->lut[i] & 0xFF;
+    int run = rs >> 4, size = rs & 15;
+    // the value bits are not needed to skip a coefficient, at most 9 + 15 bits which one fill_bits covers
+    h->skipAc[i] = len ? ((rs == 0 ? SKIP_EOB : 0) | (run << 5) | (len + size)) : 0;
+    if (len && rs == 0)
+    {
+      h->fastAc[i] = len; // end of block
+    }
+    else if (len && size && len + size <= HUFF_LUT_BITS)
+    {
+      int v = (i << len) & ((1 << HUFF_LUT_BITS) - 1);
+      v = extend(v >> (HUFF_LUT_BITS - size), size);
+      if (v >= -128 && v <= 127)
+      {
+        h->fastAc[i] = (int16_t)((v * 256) + (run << 4) + len + size);
+      }
+    }
+  }
+  h->valid = true;
+  return true;
+}
+
+static bool parse_dqt(JpegLuma *j, const uint8_t *p, int len)
+{
+  while (len > 0)
+  {
+    int pq = p[0] >> 4, tq = p[0] & 15;
+    int size = 1 + 64 * (pq ? 2 : 1);
+    if (tq > 3 || len < size)
+    {
+      return false;
+    }
+    for (int i = 0; i < 64; i++)
+    {
+      j->qt[tq][i] = pq ? read16(p + 1 + i * 2) : p[1 + i];
+    }
+    p += size;
+    len -= size;
+  }
+  return true;
+}
+
+static bool parse_dht(JpegLuma *j, const uint8_t *p, int len)
+{
+  while (len > 17)
+  {
+    int tc = p[0] >> 4, th = p[0] & 15;
+    int nvals = 0;
+    for (int i = 0; i < 16; i++)
+    {
+      nvals += p[1 + i];
+    }
+    if (tc > 1 || th >= MAX_TABLES || nvals > 256 || len < 17 + nvals)
+    {
+      return false;
+    }
+    if (!build_huffman(tc ? &j->ac[th] : &j->dc[th], p + 1, p + 17, nvals))
+    {
+      return false;
+    }
+    p += 17 + nvals;
+    len -= 17 + nvals;
+  }
+  return true;
+}
+
+static esp_err_t parse_sof(JpegLuma *j, const uint8_t *p, int len)
+{
+  if (len < 6 || p[0] != 8)
+  {
+    return ESP_ERR_NOT_SUPPORTED; // 12-bit precision
+  }
+  j->height = read16(p + 1);
+  j->width = read16(p + 3);
+  j->ncomp = p[5];
+  if (j->ncomp != 1 && j->ncomp != 3)
+  {
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  if (len < 6 + j->ncomp * 3 || j->width == 0 || j->height == 0)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  j->hmax = j->vmax = 1;
+  for (int c = 0; c < j->ncomp; c++)
+  {
+    Component *comp = &j->comp[c];
+    comp->id = p[6 + c * 3];
+    comp->h = p[7 + c * 3] >> 4;
+    comp->v = p[7 + c * 3] & 15;
+    comp->tq = p[8 + c * 3] & 3;
+    if (comp->h < 1 || comp->h > 2 || comp->v < 1 || comp->v > 2)
+    {
+      return ESP_ERR_NOT_SUPPORTED;
+    }
+    j->hmax = comp->h > j->hmax ? comp->h : j->hmax;
+    j->vmax = comp->v > j->vmax ? comp->v : j->vmax;
+  }
+  if (j->ncomp == 1)
+  {
+    j->comp[0].h = j->comp[0].v = j->hmax = j->vmax = 1; // a single component scan is never interleaved
+  }
+  else if (j->comp[0].h != j->hmax || j->comp[0].v != j->vmax)
+  {
+    return ESP_ERR_NOT_SUPPORTED; // subsampled luma
+  }
+  return ESP_OK;
+}
+
+static esp_err_t parse_sos(JpegLuma *j, const uint8_t *p, int len)
+{
+  int ns = p[0];
+  if (ns != j->ncomp || len < 1 + ns * 2 + 3)
+  {
+    return ESP_ERR_NOT_SUPPORTED; // non interleaved multi scan
+  }
+  for (int i = 0; i < ns; i++)
+  {
+    Component *comp = &j->comp[i];
+    if (comp->id != p[1 + i * 2])
+    {
+      return ESP_ERR_NOT_SUPPORTED;
+    }
+    comp->td = p[2 + i * 2] >> 4;
+    comp->ta = p[2 + i * 2] & 15;
+    if (comp->td >= MAX_TABLES || comp->ta >= MAX_TABLES || !j->dc[comp->td].valid || !j->ac[comp->ta].valid)
+    {
+      return ESP_ERR_INVALID_ARG;
+    }
+    comp->dcPred = 0;
+  }
+  return ESP_OK;
+}
+
+/* ---------------- blocks ---------------- */
+
+/* skip the ac coefficients of a block, for chroma and for the dc only thumbnail */
+static bool skip_ac(BitReader *br, const HuffTable *ac)
+{
+  for (int k = 1; k < 64; k++)
+  {
+    fill_bits(br);
+    int e = ac->skipAc[br->bits >> (32 - HUFF_LUT_BITS)];
+    if (e)
+    {
+      br->bits <<= e & 31;
+      br->nbits -= e & 31;
+      if (e & SKIP_EOB)
+      {
+        return true;
+      }
+      k += (e >> 5) & 15;
+      continue;
+    }
+
+    int rs = huff_decode(br, ac);
+    if (rs < 0)
+    {
+      return false;
+    }
+    if ((rs & 15) == 0)
+    {
+      if (rs != 0xF0)
+      {
+        return true; // end of block
+      }
+      k += 15;
+      continue;
+    }
+    k += rs >> 4;
+    skip_bits(br, rs & 15);
+  }
+  return true;
+}
+
+/*
+ * Decode one block. With coef == NULL (chroma) the coefficients are only skipped.
+ * Otherwise the top left n x n coefficients are dequantized into coef, natural order,
+ * the return value has bit v set when row v holds a non zero ac coefficient, 0 for a flat block.
+ */
+static int decode_block(JpegLuma *j, BitReader *reader, Component *c, int32_t *coef, int n)
+{
+  BitReader local = *reader; // a local copy lets the compiler keep the bit buffer in registers
+  BitReader *br = &local;
+  const HuffTable *dc = &j->dc[c->td];
+  const HuffTable *ac = &j->ac[c->ta];
+  const uint16_t *qt = j->qt[c->tq];
+  int rows = 0;
+
+  int s = huff_decode(br, dc);
+  if (s < 0 || s > 11)
+  {
+    return -1;
+  }
+  if (s)
+  {
+    c->dcPred += extend(get_bits(br, s), s);
+  }
+  if (coef)
+  {
+    coef[0] = clamp_coef(c->dcPred * qt[0]);
+  }
+  if (!coef || n == 1)
+  {
+    rows = skip_ac(br, ac) ? 0 : -1;
+    *reader = local;
+    return rows;
+  }
+
+  for (int k = 1; k < 64; k++)
+  {
+    fill_bits(br);
+    int fast = ac->fastAc[br->bits >> (32 - HUFF_LUT_BITS)];
+    if (fast)
+    {
+      br->bits <<= fast & 15;
+      br->nbits -= fast & 15;
+      if ((fast >> 8) == 0)
+      {
+        break; // end of block
+      }
+      k += (fast >> 4) & 15;
+      if (k > 63)
+      {
+        return -1;
+      }
+      int z = l_zigzag[k];
+      if (coef && (z & 7) < n && (z >> 3) < n)
+      {
+        coef[z] = clamp_coef((fast >> 8) * qt[k]);
+        rows |= 1 << (z >> 3);
+      }
+      continue;
+    }
+
+    int rs = huff_decode(br, ac);
+    if (rs < 0)
+    {
+      return -1;
+    }
+    int r = rs >> 4;
+    s = rs & 15;
+    if (s == 0)
+    {
+      if (r != 15)
+      {
+        break; // end of block
+      }
+      k += 15;
+      continue;
+    }
+    k += r;
+    if (k > 63)
+    {
+      return -1;
+    }
+    int z = l_zigzag[k];
+    if (coef && (z & 7) < n && (z >> 3) < n)
+    {
+      coef[z] = clamp_coef(extend(get_bits(br, s), s) * qt[k]);
+      rows |= 1 << (z >> 3);
+    }
+    else
+    {
+      skip_bits(br, s);
+    }
+  }
+  *reader = local;
+  return rows;
+}
+
+/*
+ * Reduced idct of the n x n coefficients into dst, k = log2(8 / n).
+ * Always inlined with a constant k so the loops unroll, all zero coefficient rows are skipped.
+ */
+static inline __attribute__((always_inline)) void idct_block(const int32_t *coef, const int k, int rows, uint8_t *dst, int stride)
+{
+  const int n = 8 >> k;
+  int32_t tmp[8 * 8];
+
+  rows |= 1; // dc
+  // rows: tmp[v][x] = sum_u T[x][u] * coef[v][u]
+  for (int v = 0; v < n; v++)
+  {
+    if (!(rows & (1 << v)))
+    {
+      memset(tmp + v * 8, 0, n * sizeof(int32_t));
+      continue;
+    }
+    const int32_t *in = coef + v * 8;
+    for (int x = 0; x < n; x++)
+    {
+      const int16_t *t = l_idct[k][x];
+      int32_t sum = 0;
+      for (int u = 0; u < n; u++)
+      {
+        sum += t[u] * in[u];
+      }
+      tmp[v * 8 + x] = sum >> IDCT_PASS1_SHIFT;
+    }
+  }
+  // columns: out[y][x] = sum_v T[y][v] * tmp[v][x]
+  const int shift = 2 * IDCT_BITS - IDCT_PASS1_SHIFT;
+  for (int y = 0; y < n; y++)
+  {
+    const int16_t *t = l_idct[k][y];
+    for (int x = 0; x < n; x++)
+    {
+      int32_t sum = 0;
+      for (int v = 0; v < n; v++)
+      {
+        sum += t[v] * tmp[v * 8 + x];
+      }
+      dst[y * stride + x] = clamp_pixel(((sum + (1 << (shift - 1))) >> shift) + 128);
+    }
+  }
+}
+
+/*
+ * Full size 8x8 idct, the LLM algorithm of libjpeg's jpeg_idct_islow with 12 multiplies per 1-D pass,
+ * the matrix form would need 1024 multiply-adds per block.
+ */
+#define ISLOW_CONST_BITS 13
+#define ISLOW_PASS1_BITS 2
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+#define DESCALE(x, n) (((x) + (1 << ((n)-1))) >> (n))
+
+/* one 8-point pass, in and out with the given element strides */
+static inline __attribute__((always_inline)) void islow_1d(const int32_t *in, int inStep, int32_t *out, int outStep, int shift)
+{
+  int32_t z1, z2, z3, z4, z5;
+  int32_t tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+
+  // even part
+  z2 = in[2 * inStep];
+  z3 = in[6 * inStep];
+  z1 = (z2 + z3) * FIX_0_541196100;
+  tmp2 = z1 - z3 * FIX_1_847759065;
+  tmp3 = z1 + z2 * FIX_0_765366865;
+  tmp0 = (in[0] + in[4 * inStep]) * (1 << ISLOW_CONST_BITS);
+  tmp1 = (in[0] - in[4 * inStep]) * (1 << ISLOW_CONST_BITS);
+  tmp10 = tmp0 + tmp3;
+  tmp13 = tmp0 - tmp3;
+  tmp11 = tmp1 + tmp2;
+  tmp12 = tmp1 - tmp2;
+
+  // odd part
+  tmp0 = in[7 * inStep];
+  tmp1 = in[5 * inStep];
+  tmp2 = in[3 * inStep];
+  tmp3 = in[1 * inStep];
+  z1 = tmp0 + tmp3;
+  z2 = tmp1 + tmp2;
+  z3 = tmp0 + tmp2;
+  z4 = tmp1 + tmp3;
+  z5 = (z3 + z4) * FIX_1_175875602;
+  tmp0 *= FIX_0_298631336;
+  tmp1 *= FIX_2_053119869;
+  tmp2 *= FIX_3_072711026;
+  tmp3 *= FIX_1_501321110;
+  z1 *= -FIX_0_899976223;
+  z2 *= -FIX_2_562915447;
+  z3 = z3 * -FIX_1_961570560 + z5;
+  z4 = z4 * -FIX_0_390180644 + z5;
+  tmp0 += z1 + z3;
+  tmp1 += z2 + z4;
+  tmp2 += z2 + z3;
+  tmp3 += z1 + z4;
+
+  out[0] = DESCALE(tmp10 + tmp3, shift);
+  out[7 * outStep] = DESCALE(tmp10 - tmp3, shift);
+  out[1 * outStep] = DESCALE(tmp11 + tmp2, shift);
+  out[6 * outStep] = DESCALE(tmp11 - tmp2, shift);
+  out[2 * outStep] = DESCALE(tmp12 + tmp1, shift);
+  out[5 * outStep] = DESCALE(tmp12 - tmp1, shift);
+  out[3 * outStep] = DESCALE(tmp13 + tmp0, shift);
+  out[4 * outStep] = DESCALE(tmp13 - tmp0, shift);
+}
+
+static void idct_islow(const int32_t *coef, uint8_t *dst, int stride)
+{
+  int32_t ws[64];
+  int32_t row[8];
+
+  // columns
+  for (int u = 0; u < 8; u++)
+  {
+    const int32_t *in = coef + u;
+    if (!(in[8] | in[16] | in[24] | in[32] | in[40] | in[48] | in[56]))
+    {
+      int32_t dc = in[0] * (1 << ISLOW_PASS1_BITS);
+      for (int v = 0; v < 8; v++)
+      {
+        ws[v * 8 + u] = dc;
+      }
+      continue;
+    }
+    islow_1d(in, 8, ws + u, 8, ISLOW_CONST_BITS - ISLOW_PASS1_BITS);
+  }
+  // rows
+  for (int y = 0; y < 8; y++)
+  {
+    islow_1d(ws + y * 8, 1, row, 1, ISLOW_CONST_BITS + ISLOW_PASS1_BITS + 3);
+    for (int x = 0; x < 8; x++)
+    {
+      dst[y * stride + x] = clamp_pixel(row[x] + 128);
+    }
+  }
+}
+
+static void idct_scaled(const int32_t *coef, int k, int rows, uint8_t *dst, int stride)
+{
+  switch (k)
+  {
+  case 0:
+    idct_islow(coef, dst, stride);
+    break;
+  case 1:
+    idct_block(coef, 1, rows, dst, stride);
+    break;
+  default:
+    idct_block(coef, 2, rows, dst, stride);
+    break;
+  }
+}
+
+static void fill_block(int32_t dc, int n, uint8_t *dst, int stride)
+{
+  uint8_t val = clamp_pixel(((dc + 4) >> 3) + 128);
+  for (int y = 0; y < n; y++)
+  {
+    memset(dst + y * stride, val, n);
+  }
+}
+
+static bool ensure_buffers(JpegLuma *j, size_t stripSize, int outWidth)
+{
+  if (stripSize > j->stripSize)
+  {
+    free(j->strip);
+    j->strip = malloc(stripSize);
+    j->stripSize = j->strip ? stripSize : 0;
+    if (!j->strip)
+    {
+      return false;
+    }
+  }
+  if (outWidth > j->xmapSize)
+  {
+    free(j->xmap);
+    j->xmap = malloc(outWidth * sizeof(uint16_t));
+    j->xmapSize = j->xmap ? outWidth : 0;
+    if (!j->xmap)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static esp_err_t decode_scan(JpegLuma *j, const uint8_t *p, const uint8_t *end, uint8_t *out, int outWidth, int outHeight)
+{
+  // smallest idct that still gives at least the output size, 1/8 is the dc only
+  int k = 3;
+  while (k > 0 && (((j->width * (8 >> k) + 7) >> 3) < outWidth || ((j->height * (8 >> k) + 7) >> 3) < outHeight))
+  {
+    k--;
+  }
+  const int n = 8 >> k;
+  const int scaledW = (j->width * n + 7) >> 3;
+  const int scaledH = (j->height * n + 7) >> 3;
+  const int mcuW = 8 * j->hmax, mcuH = 8 * j->vmax;
+  const int mcusX = (j->width + mcuW - 1) / mcuW;
+  const int mcusY = (j->height + mcuH - 1) / mcuH;
+  const int stripStride = mcusX * j->hmax * n;
+  const int stripRows = j->vmax * n;
+
+  if (!ensure_buffers(j, stripStride * stripRows, outWidth))
+  {
+    return ESP_ERR_NO_MEM;
+  }
+  for (int x = 0; x < outWidth; x++)
+  {
+    j->xmap[x] = (2 * x + 1) * scaledW / (2 * outWidth);
+  }
+
+  BitReader br = {.p = p, .end = end, .bits = 0, .nbits = 0, .marker = false};
+  int32_t coef[64];
+  int outY = 0;
+  int mcus = 0;
+
+  for (int my = 0; my < mcusY && outY < outHeight; my++)
+  {
+    for (int mx = 0; mx < mcusX; mx++)
+    {
+      if (j->restartInterval && mcus && mcus % j->restartInterval == 0 && !restart(j, &br))
+      {
+        return ESP_ERR_INVALID_ARG;
+      }
+      mcus++;
+      for (int c = 0; c < j->ncomp; c++)
+      {
+        Component *comp = &j->comp[c];
+        for (int bv = 0; bv < comp->v; bv++)
+        {
+          for (int bh = 0; bh < comp->h; bh++)
+          {
+            if (c != 0)
+            {
+              if (decode_block(j, &br, comp, NULL, n) < 0)
+              {
+                return ESP_ERR_INVALID_ARG;
+              }
+              continue;
+            }
+            for (int v = 0; v < n; v++)
+            {
+              memset(coef + v * 8, 0, n * sizeof(int32_t)); // only the n x n corner is ever read
+            }
+            int rows = decode_block(j, &br, comp, coef, n);
+            if (rows < 0)
+            {
+              return ESP_ERR_INVALID_ARG;
+            }
+            uint8_t *dst = j->strip + bv * n * stripStride + (mx * j->hmax + bh) * n;
+            if (rows)
+            {
+              idct_scaled(coef, k, rows, dst, stripStride);
+            }
+            else
+            {
+              fill_block(coef[0], n, dst, stripStride);
+            }
+          }
+        }
+      }
+    }
+
+    // nearest neighbour rows of this mcu row into the output
+    int stripTop = my * stripRows;
+    while (outY < outHeight)
+    {
+      int sy = (2 * outY + 1) * scaledH / (2 * outHeight);
+      if (sy >= stripTop + stripRows)
+      {
+        break;
+      }
+      const uint8_t *src = j->strip + (sy - stripTop) * stripStride;
+      uint8_t *dst = out + outY * outWidth;
+      for (int x = 0; x < outWidth; x++)
+      {
+        dst[x] = src[j->xmap[x]];
+      }
+      outY++;
+    }
+  }
+  return ESP_OK;
+}
+
+JpegLuma *jpeg_luma_create(void)
+{
+  return calloc(1, sizeof(JpegLuma));
+}
+
+void jpeg_luma_destroy(JpegLuma *j)
+{
+  if (j)
+  {
+    free(j->strip);
+    free(j->xmap);
+    free(j);
+  }
+}
+
+esp_err_t jpeg_luma_decode(JpegLuma *j, const uint8_t *jpeg, size_t len, uint8_t *out, int outWidth, int outHeight)
+{
+  if (!j || !jpeg || !out || len < 4 || outWidth <= 0 || outHeight <= 0 || read16(jpeg) != 0xFFD8)
+  {
+    return ESP_ERR_INVALID_ARG;
+  }
+  j->restartInterval = 0;
+  j->ncomp = 0;
+  for (int i = 0; i < MAX_TABLES; i++)
+  {
+    j->dc[i].valid = j->ac[i].valid = false;
+  }
+
+  const uint8_t *p = jpeg + 2;
+  const uint8_t *end = jpeg + len;
+  while (p + 4 <= end)
+  {
+    if (p[0] != 0xFF)
+    {
+      return ESP_ERR_INVALID_ARG;
+    }
+    uint8_t marker = p[1];
+    if (marker == 0xFF)
+    {
+      p++; // fill byte
+      continue;
+    }
+    int segLen = read16(p + 2);
+    const uint8_t *seg = p + 4;
+    if (segLen < 2 || seg + segLen - 2 > end)
+    {
+      return ESP_ERR_INVALID_ARG;
+    }
+    segLen -= 2;
+
+    esp_err_t ret = ESP_OK;
+    switch (marker)
+    {
+    case 0xC0: // baseline
+    case 0xC1: // extended sequential, huffman
+      ret = parse_sof(j, seg, segLen);
+      break;
+    case 0xC4:
+      ret = parse_dht(j, seg, segLen) ? ESP_OK : ESP_ERR_INVALID_ARG;
+      break;
+    case 0xDB:
+      ret = parse_dqt(j, seg, segLen) ? ESP_OK : ESP_ERR_INVALID_ARG;
+      break;
+    case 0xDD:
+      j->restartInterval = segLen >= 2 ? read16(seg) : 0;
+      break;
+    case 0xDA:
+      if (j->ncomp == 0)
+      {
+        return ESP_ERR_INVALID_ARG;
+      }
+      ret = parse_sos(j, seg, segLen);
+      if (ret == ESP_OK)
+      {
+        ret = decode_scan(j, seg + segLen, end, out, outWidth, outHeight);
+      }
+      return ret;
+    case 0xD9:
+      return ESP_ERR_INVALID_ARG; // no scan
+    default:
+      if ((marker & 0xF0) == 0xC0 && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+      {
+        return ESP_ERR_NOT_SUPPORTED; // progressive, lossless or arithmetic coding
+      }
+      break; // APPn, COM ...
+    }
+    if (ret != ESP_OK)
+    {
+      return ret;
+    }
+    p = seg + segLen;
+  }
+  return ESP_ERR_INVALID_ARG;
+}
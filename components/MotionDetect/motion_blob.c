@@ -0,0 +1,220 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "motion_blob.h"
+
+/*
+ * Two-pass 8-connected labelling. Provisional labels are merged with a union-find whose
+ * roots are always the smallest label, so one forward sweep flattens every tree.
+ * With 8-connectivity a new label needs a gap of one pixel in both directions,
+ * which bounds the provisional labels by ceil(w/2) * ceil(h/2).
+ * Work buffer layout: area uint32[maxLabels] | parent uint16[maxLabels] | labels uint16[w*h]
+ */
+
+static int max_labels(int width, int height)
+{
+  return ((width + 1) / 2) * ((height + 1) / 2) + 1; // label 0 is background
+}
+
+size_t motion_blob_work_size(int width, int height)
+{
+  size_t n = max_labels(width, height);
+  return n * (sizeof(uint32_t) + sizeof(uint16_t)) + (size_t)width * height * sizeof(uint16_t);
+}
+
+static inline uint16_t uf_find(uint16_t *parent, uint16_t x)
+{
+  while (parent[x] != x)
+  {
+    parent[x] = parent[parent[x]]; // path halving
+    x = parent[x];
+  }
+  return x;
+}
+
+static inline void uf_union(uint16_t *parent, uint16_t a, uint16_t b)
+{
+  a = uf_find(parent, a);
+  b = uf_find(parent, b);
+  if (a < b)
+  {
+    parent[b] = a;
+  }
+  else if (b < a)
+  {
+    parent[a] = b;
+  }
+}
+
+/* first pass, returns the number of provisional labels plus one */
+static int label_pass(const uint8_t *mask, int width, int height, uint16_t *labels, uint16_t *parent, uint32_t *area)
+{
+  int next = 1;
+  for (int y = 0; y < height; y++)
+  {
+    const uint8_t *m = mask + y * width;
+    uint16_t *l = labels + y * width;
+    const uint16_t *up = l - width;
+    for (int x = 0; x < width; x++)
+    {
+      if (!m[x])
+      {
+        l[x] = 0;
+        continue;
+      }
+      uint16_t n = y > 0 ? up[x] : 0;
+      uint16_t nw = (y > 0 && x > 0) ? up[x - 1] : 0;
+      uint16_t ne = (y > 0 && x + 1 < width) ? up[x + 1] : 0;
+      uint16_t w = x > 0 ? l[x - 1] : 0;
+      uint16_t label;
+      // N touches NW, NE and W, and W touches NW, so only NE may join two trees
+      if (n)
+      {
+        label = n;
+      }
+      else if (ne)
+      {
+        label = ne;
+        if (nw)
+        {
+          uf_union(parent, ne, nw);
+        }
+        else if (w)
+        {
+          uf_union(parent, ne, w);
+        }
+      }
+      else if (nw)
+      {
+        label = nw;
+      }
+      else if (w)
+      {
+        label = w;
+      }
+      else
+      {
+        label = next++;
+        parent[label] = label;
+        area[label] = 0;
+      }
+      l[x] = label;
+      area[label]++;
+    }
+  }
+  return next;
+}
+
+int motion_blob_find(const uint8_t *mask, int width, int height, void *work, uint32_t minArea,
+                     MotionBlob *blobs, int maxBlobs, uint32_t *totalArea)
+{
+  int maxLabel = max_labels(width, height);
+  uint32_t *area = (uint32_t *)work;
+  uint16_t *parent = (uint16_t *)(area + maxLabel);
+  uint16_t *labels = parent + maxLabel;
+  uint16_t roots[MOTION_MAX_BLOBS];
+  int count = 0;
+  uint32_t total = 0;
+
+  if (maxBlobs > MOTION_MAX_BLOBS)
+  {
+    maxBlobs = MOTION_MAX_BLOBS;
+  }
+
+  int next = label_pass(mask, width, height, labels, parent, area);
+
+  // flatten, roots are smaller than their children so parent[parent[l]] is already final
+  for (int l = 1; l < next; l++)
+  {
+    parent[l] = parent[parent[l]];
+    if (parent[l] != l)
+    {
+      area[parent[l]] += area[l];
+    }
+  }
+
+  // keep the largest components above minArea
+  for (int l = 1; l < next; l++)
+  {
+    if (parent[l] != l || area[l] < minArea)
+    {
+      continue;
+    }
+    total += area[l];
+    int i = count < maxBlobs ? count++ : maxBlobs;
+    while (i > 0 && area[roots[i - 1]] < area[l])
+    {
+      if (i < maxBlobs)
+      {
+        roots[i] = roots[i - 1];
+      }
+      i--;
+    }
+    if (i < maxBlobs)
+    {
+      roots[i] = l;
+    }
+  }
+  if (totalArea)
+  {
+    *totalArea = total;
+  }
+  if (count == 0)
+  {
+    return 0;
+  }
+
+  // area[] now maps a root to its output slot + 1
+  uint32_t sumX[MOTION_MAX_BLOBS] = {0};
+  uint32_t sumY[MOTION_MAX_BLOBS] = {0};
+  uint16_t x1[MOTION_MAX_BLOBS];
+  uint16_t y1[MOTION_MAX_BLOBS];
+  for (int i = 0; i < count; i++)
+  {
+    blobs[i].area = area[roots[i]];
+    blobs[i].x = width;
+    blobs[i].y = height;
+    x1[i] = y1[i] = 0;
+  }
+  memset(area, 0, next * sizeof(uint32_t));
+  for (int i = 0; i < count; i++)
+  {
+    area[roots[i]] = i + 1;
+  }
+
+  for (int y = 0; y < height; y++)
+  {
+    const uint16_t *l = labels + y * width;
+    for (int x = 0; x < width; x++)
+    {
+      if (!l[x])
+      {
+        continue;
+      }
+      uint32_t slot = area[parent[l[x]]];
+      if (!slot)
+      {
+        continue;
+      }
+      MotionBlob *b = &blobs[--slot];
+      if (x < b->x)
+        b->x = x;
+      if (x > x1[slot])
+        x1[slot] = x;
+      if (y < b->y)
+        b->y = y;
+      y1[slot] = y;
+      sumX[slot] += x;
+      sumY[slot] += y;
+    }
+  }
+
+  for (int i = 0; i < count; i++)
+  {
+    blobs[i].w = x1[i] - blobs[i].x + 1;
+    blobs[i].h = y1[i] - blobs[i].y + 1;
+    blobs[i].cx = sumX[i] / blobs[i].area;
+    blobs[i].cy = sumY[i] / blobs[i].area;
+  }
+  return count;
+}
@@ -0,0 +1,271 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "motion_kernel.h"
+
+/*
+ * SWAR layout: a 32-bit word holds 4 pixels, split into even and odd bytes each widened to
+ * two 16-bit lanes (mask 0x00FF00FF), so lane arithmetic never carries into the next lane.
+ * All per-lane accumulators are flushed before they can overflow 16 bits.
+ */
+#define LANE_MASK 0x00FF00FFu
+#define LUMA_FLUSH_WORDS 128    // 128 words * 2 * 255 per lane < 65536
+
+#define GAIN_SHIFT 8               // illumination gain is Q8
+#define GAIN_ONE (1 << GAIN_SHIFT)
+#define GAIN_MIN (GAIN_ONE / 2)    // beyond [1/2, 2] the background is relearned
+#define GAIN_MAX (GAIN_ONE * 2)
+#define DARK_LEVEL 8               // mean luma below which no compensation is applied
+#define VAR_MIN 4                  // floor of the stored variance, sigma 4
+
+static inline uint32_t load32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v)); // a single aligned load, sum_span keeps p 4-byte aligned
+  return v;
+}
+
+static inline uint32_t lanes_sum(uint32_t acc)
+{
+  return (acc & 0xFFFF) + (acc >> 16);
+}
+
+static uint32_t sum_scalar(const uint8_t *p, int n)
+{
+  uint32_t sum = 0;
+  for (int i = 0; i < n; i++)
+  {
+    sum += p[i];
+  }
+  return sum;
+}
+
+/* luma sum of n pixels, p 4-byte aligned */
+static uint32_t sum_words(const uint8_t *p, int n)
+{
+  uint32_t sum = 0;
+  int words = n >> 2;
+
+  while (words > 0)
+  {
+    int chunk = words < LUMA_FLUSH_WORDS ? words : LUMA_FLUSH_WORDS;
+    uint32_t acc = 0;
+    for (int w = 0; w < chunk; w++, p += 4)
+    {
+      uint32_t a = load32(p);
+      acc += (a & LANE_MASK) + ((a >> 8) & LANE_MASK);
+    }
+    sum += lanes_sum(acc);
+    words -= chunk;
+  }
+  return sum + sum_scalar(p, n & 3);
+}
+
+static uint32_t sum_span(const uint8_t *p, int n)
+{
+  int head = (4 - ((uintptr_t)p & 3)) & 3;
+  head = head < n ? head : n;
+  return sum_scalar(p, head) + sum_words(p + head, n - head);
+}
+
+uint32_t motion_luma_sum(const uint8_t *p, int n)
+{
+  return sum_span(p, n);
+}
+
+size_t motion_bg_buffer_size(int pixels)
+{
+  return (size_t)pixels * (sizeof(uint16_t) + sizeof(uint8_t));
+}
+
+void motion_bg_init(MotionBg *bg, void *buf, int width, int height)
+{
+  bg->width = width;
+  bg->height = height;
+  bg->mean = (uint16_t *)buf;
+  bg->var = (uint8_t *)(bg->mean + width * height);
+  bg->primed = false;
+  bg->meanSum = 0;
+  bg->gain = GAIN_ONE;
+}
+
+/* initial variance puts sigmaK * sigma at the threshold, so a fresh background behaves like frame differencing */
+static uint8_t initial_var(const MotionBgConfig *cfg)
+{
+  int k2 = cfg->sigmaK ? cfg->sigmaK * cfg->sigmaK : 1;
+  int v = cfg->threshold * cfg->threshold / (k2 * MOTION_BG_VAR_SCALE);
+  return v < VAR_MIN ? VAR_MIN : (v > 255 ? 255 : v);
+}
+
+static void bg_prime(MotionBg *bg, const MotionBgConfig *cfg, const uint8_t *cur, uint32_t zoneSum)
+{
+  int pixels = bg->width * bg->height;
+  uint8_t v = initial_var(cfg);
+  for (int i = 0; i < pixels; i++)
+  {
+    bg->mean[i] = cur[i] << 8;
+  }
+  memset(bg->var, v, pixels);
+  bg->meanSum = (uint64_t)zoneSum << 8;
+  bg->gain = GAIN_ONE;
+  bg->primed = true;
+}
+
+void motion_zones_init(MotionZones *zones, const uint16_t mask[MOTION_GRID_ROWS], int width, int height)
+{
+  zones->activePixels = 0;
+  for (int c = 0; c <= MOTION_GRID_COLS; c++)
+  {
+    zones->cellX[c] = width * c / MOTION_GRID_COLS;
+  }
+  for (int r = 0; r <= MOTION_GRID_ROWS; r++)
+  {
+    zones->cellY[r] = height * r / MOTION_GRID_ROWS;
+  }
+  for (int r = 0; r < MOTION_GRID_ROWS; r++)
+  {
+    zones->mask[r] = mask[r];
+    for (int c = 0; c < MOTION_GRID_COLS; c++)
+    {
+      if (mask[r] & MOTION_ZONE_BIT(c))
+      {
+        zones->activePixels += (zones->cellX[c + 1] - zones->cellX[c]) * (zones->cellY[r + 1] - zones->cellY[r]);
+      }
+    }
+  }
+}
+
+/* light level inside the active cells, runs of adjacent cells are summed as one span */
+static uint32_t zone_luma_sum(const uint8_t *cur, const MotionZones *zones, int width)
+{
+  uint32_t sum = 0;
+  for (int r = 0; r < MOTION_GRID_ROWS; r++)
+  {
+    uint16_t mask = zones->mask[r];
+    for (int c = 0; c < MOTION_GRID_COLS && mask; c++)
+    {
+      if (!(mask & MOTION_ZONE_BIT(c)))
+      {
+        continue;
+      }
+      int first = c;
+      while (c + 1 < MOTION_GRID_COLS && (mask & MOTION_ZONE_BIT(c + 1)))
+      {
+        c++;
+      }
+      int x0 = zones->cellX[first];
+      int n = zones->cellX[c + 1] - x0;
+      for (int y = zones->cellY[r]; y < zones->cellY[r + 1]; y++)
+      {
+        sum += sum_span(cur + y * width + x0, n);
+      }
+    }
+  }
+  return sum;
+}
+
+/*
+ * Compare n pixels against the background and update it in place.
+ * Background pixels follow the frame at 2^-learnShift and update their variance,
+ * foreground pixels only drift at 2^-absorbShift so a subject that stops is absorbed eventually.
+ *
+ * This supersedes the SWAR frame difference (motion_diff_bands). Every pixel has to learn each frame,
+ * so a word-wide |p - mean| > threshold pre-screen cannot skip any work here: it was bit-exact but
+ * 10-25% slower than this loop (test/host/motion_bg). Only the light level pass stays SWAR.
+ */
+static uint32_t bg_span(MotionBg *bg, const MotionBgConfig *cfg, const uint8_t *cur, uint8_t *fg, int offset, int n,
+                        uint32_t gain, uint64_t *meanSum)
+{
+  uint16_t *mean = bg->mean + offset;
+  uint8_t *var = bg->var + offset;
+  const int minDiff = cfg->threshold;
+  const uint32_t k2 = (uint32_t)cfg->sigmaK * cfg->sigmaK * MOTION_BG_VAR_SCALE;
+  const int learn = cfg->learnShift;
+  const int absorb = cfg->absorbShift;
+  uint32_t changes = 0;
+  uint64_t sum = 0;
+
+  cur += offset;
+  fg += offset;
+  for (int i = 0; i < n; i++)
+  {
+    int p = (cur[i] * gain + (GAIN_ONE >> 1)) >> GAIN_SHIFT;
+    p = p > 255 ? 255 : p;
+    int m = mean[i];
+    int dq = (p << 8) - m;         // Q8
+    int d = (dq + 128) >> 8;
+    uint32_t d2 = d * d;
+    int v = var[i];
+    if ((d > minDiff || d < -minDiff) && d2 > k2 * v)
+    {
+      changes++;
+      fg[i] = 1;
+      m += dq >> absorb;
+    }
+    else
+    {
+      m += dq >> learn;
+      v += ((int)(d2 / MOTION_BG_VAR_SCALE) - v) >> learn;
+      var[i] = v < VAR_MIN ? VAR_MIN : (v > 255 ? 255 : v);
+    }
+    mean[i] = m;
+    sum += m;
+  }
+  *meanSum += sum;
+  return changes;
+}
+
+uint32_t motion_bg_update(MotionBg *bg, const MotionBgConfig *cfg, const uint8_t *cur,
+                          const MotionZones *zones, uint8_t *fgMask)
+{
+  const int width = bg->width;
+
+  // first pass: light level of the active cells for illumination compensation
+  uint32_t zoneSum = zone_luma_sum(cur, zones, width);
+
+  memset(fgMask, 0, width * bg->height);
+  if (!bg->primed || zones->activePixels == 0)
+  {
+    bg_prime(bg, cfg, cur, zoneSum);
+    return 0;
+  }
+
+  // normalize the frame to the background light level, too dark frames are taken as they are
+  uint32_t gain = GAIN_ONE;
+  if (zoneSum >= zones->activePixels * DARK_LEVEL)
+  {
+    gain = (uint32_t)((bg->meanSum + zoneSum / 2) / zoneSum); // meanSum is Q8, so is the ratio
+  }
+  if (gain < GAIN_MIN || gain > GAIN_MAX)
+  {
+    // lights switched, the old background is useless
+    bg_prime(bg, cfg, cur, zoneSum);
+    return 0;
+  }
+  bg->gain = gain;
+
+  // masked cells are skipped entirely, their background is neither compared nor updated
+  uint64_t meanSum = 0;
+  uint32_t changes = 0;
+  for (int r = 0; r < MOTION_GRID_ROWS; r++)
+  {
+    uint16_t mask = zones->mask[r];
+    if (!mask)
+    {
+      continue;
+    }
+    for (int y = zones->cellY[r]; y < zones->cellY[r + 1]; y++)
+    {
+      for (int c = 0; c < MOTION_GRID_COLS; c++)
+      {
+        if (mask & MOTION_ZONE_BIT(c))
+        {
+          int x0 = zones->cellX[c];
+          changes += bg_span(bg, cfg, cur, fgMask, y * width + x0, zones->cellX[c + 1] - x0, gain, &meanSum);
+        }
+      }
+    }
+  }
+  bg->meanSum = meanSum;
+  return changes;
+}
@@ -3,10 +3,17 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/param.h>
+#include <strings.h>
+#include <limits.h>
 
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_mac.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
 
 #include "Utils.h"
 
@@ -238,15 +245,207 @@ esp_err_t sendChunks(const char *fname, FILE *df, httpd_req_t *req, bool endChun
   return res;
 }
 
+#define DOWNLOAD_BUF_SIZE (16 * 1024) // 每个读缓冲区字节数，SD卡扇区的整数倍
+#define SECTOR_SIZE 512
+#define READ_AHEAD_STACK_SIZE (1024 * 4)
+#define READ_AHEAD_PRI 5               // 与HTTP服务器任务相同
+
+typedef struct
+{
+  FILE *fp;
+  uint8_t *buf;
+  size_t want; // 要读的字节数
+  size_t len;  // 实际读到的字节数
+} readBlock;
+
+static uint8_t *l_dlBuf[2] = {NULL, NULL}; // 双缓冲，一个发送时预读另一个
+static QueueHandle_t l_readQueue = NULL;   // 等待预读的块
+static QueueHandle_t l_doneQueue = NULL;   // 已读完的块，按提交顺序返回
+
+/* 预读任务，发送上一块的同时从SD卡读下一块 */
+static void readAheadTask(void *parameter)
+{
+  readBlock block;
+  while (true)
+  {
+    xQueueReceive(l_readQueue, &block, portMAX_DELAY);
+    block.len = fread(block.buf, 1, block.want, block.fp);
+    xQueueSend(l_doneQueue, &block, portMAX_DELAY);
+  }
+  vTaskDelete(NULL);
+}
+
+/* 第一次下载时分配缓冲区并创建预读任务，优先用可DMA的内部RAM，SD卡驱动可以直接多扇区读入 */
+static bool initReadAhead(void)
+{
+  if (l_readQueue)
+  {
+    return true;
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    if (!l_dlBuf[i])
+    {
+      l_dlBuf[i] = heap_caps_malloc(DOWNLOAD_BUF_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    }
+    if (!l_dlBuf[i])
+    {
+      l_dlBuf[i] = ps_malloc(DOWNLOAD_BUF_SIZE);
+    }
+    if (!l_dlBuf[i])
+    {
+      ESP_LOGE(TAG, "Failed to allocate download buffer");
+      return false;
+    }
+  }
+  if (!l_doneQueue)
+  {
+    l_doneQueue = xQueueCreate(2, sizeof(readBlock));
+  }
+  QueueHandle_t readQueue = xQueueCreate(2, sizeof(readBlock));
+  if (!l_doneQueue || !readQueue)
+  {
+    ESP_LOGE(TAG, "Failed to create read ahead queue");
+    if (readQueue)
+    {
+      vQueueDelete(readQueue);
+    }
+    return false;
+  }
+  l_readQueue = readQueue;
+  if (xTaskCreate(&readAheadTask, "readAhead", READ_AHEAD_STACK_SIZE, NULL, READ_AHEAD_PRI, NULL) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create read ahead task");
+    vQueueDelete(l_readQueue);
+    l_readQueue = NULL;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief 解析Range请求头，只支持单个范围
+ *
+ * @param req HTTP请求句柄
+ * @param size 文件字节数
+ * @param start 输出范围第一个字节
+ * @param end 输出范围最后一个字节
+ * @return 1 - 有效范围；0 - 没有Range或格式不支持，发送整个文件；-1 - 范围超出文件，返回416
+ */
+static int parseRange(httpd_req_t *req, uint32_t size, uint32_t *start, uint32_t *end)
+{
+  char range[64];
+  if (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) != ESP_OK ||
+      strncmp(range, "bytes=", 6) || strchr(range, ','))
+    return 0;
+  char *first = range + 6;
+  char *dash = strchr(first, '-');
+  char *stop;
+  if (!dash)
+    return 0;
+  if (dash == first)
+  {
+    // bytes=-N，最后N个字节
+    unsigned long count = strtoul(dash + 1, &stop, 10);
+    if (stop == dash + 1 || *stop)
+      return 0;
+    if (!count || !size)
+      return -1;
+    *start = count >= size ? 0 : size - count;
+    *end = size - 1;
+    return 1;
+  }
+  unsigned long from = strtoul(first, &stop, 10);
+  if (stop != dash)
+    return 0;
+  unsigned long to = ULONG_MAX;
+  if (dash[1])
+  {
+    to = strtoul(dash + 1, &stop, 10);
+    if (*stop || to < from)
+      return 0;
+  }
+  if (from >= size)
+    return -1;
+  *start = from;
+  *end = to >= size ? size - 1 : to;
+  return 1;
+}
+
+static const char *mimeType(const char *path)
+{
+  const char *ext = strrchr(path, '.');
+  if (ext && !strcasecmp(ext, ".avi"))
+    return "video/x-msvideo";
+  if (ext && !strcasecmp(ext, ".mp4"))
+    return "video/mp4";
+  if (ext && !strcasecmp(ext, ".jpg"))
+    return "image/jpeg";
+  return "application/octet-stream";
+}
+
+/* 直接写socket，不经过分块编码 */
+static esp_err_t sendRaw(httpd_req_t *req, const char *buf, size_t len)
+{
+  while (len)
+  {
+    int sent = httpd_send(req, buf, len);
+    if (sent <= 0)
+      return ESP_FAIL;
+    buf += sent;
+    len -= sent;
+  }
+  return ESP_OK;
+}
+
+/* 发送文件中从start开始的length字节，预读任务读下一块时发送当前块 */
+static esp_err_t sendRange(httpd_req_t *req, FILE *df, uint32_t start, uint32_t length)
+{
+  if (fseek(df, start, SEEK_SET))
+    return ESP_FAIL;
+  esp_err_t res = ESP_OK;
+  uint32_t toRead = length;
+  int pending = 0;
+  readBlock block = {df};
+  // 第一块读到扇区边界，之后每块都是整扇区，FATFS不再经过扇区缓存
+  size_t want = DOWNLOAD_BUF_SIZE - start % SECTOR_SIZE;
+  for (int i = 0; i < 2 && toRead; i++)
+  {
+    block.buf = l_dlBuf[i];
+    block.want = MIN(want, toRead);
+    toRead -= block.want;
+    want = DOWNLOAD_BUF_SIZE;
+    xQueueSend(l_readQueue, &block, portMAX_DELAY);
+    pending++;
+  }
+  // 出错后仍等待已提交的块读完，关闭文件时预读任务不再访问它
+  while (pending)
+  {
+    xQueueReceive(l_doneQueue, &block, portMAX_DELAY);
+    pending--;
+    if (res == ESP_OK)
+      res = block.len == block.want ? sendRaw(req, (const char *)block.buf, block.len) : ESP_FAIL;
+    if (res == ESP_OK && toRead)
+    {
+      block.want = MIN(DOWNLOAD_BUF_SIZE, toRead);
+      toRead -= block.want;
+      xQueueSend(l_readQueue, &block, portMAX_DELAY);
+      pending++;
+    }
+  }
+  return res;
+}
+
 /**
  * @brief 下载文件并发送HTTP响应
  *
- * 将指定文件通过HTTP响应发送给客户端，设置响应头信息并记录下载统计信息。
+ * 带Content-Length直接发送，不用分块编码；支持单个Range请求，返回206，播放器和NVR可以跳转。
+ * 由预读任务双缓冲读SD卡，发送和读卡同时进行。只在HTTP服务器任务中调用，同一时间只有一个下载。
  *
  * @param filePath 文件完整路径
- * @param df 已打开的文件指针
+ * @param df 已打开的文件指针，返回前关闭
  * @param req HTTP请求句柄
- * @return esp_err_t 下载结果状态码
+ * @return esp_err_t 下载结果状态码，发送失败时返回ESP_FAIL，由HTTP服务器关闭连接
  */
 esp_err_t downloadFile(const char *filePath, FILE *df, httpd_req_t *req)
 {
@@ -254,28 +453,58 @@ esp_err_t downloadFile(const char *filePath, FILE *df, httpd_req_t *req)
   char downloadName[IN_FILE_NAME_LEN];
   char *ptr = strrchr(filePath, '/');
   ptr++;
-  strcpy(downloadName, ptr);
+  strncpy(downloadName, ptr, sizeof(downloadName) - 1);
+  downloadName[sizeof(downloadName) - 1] = 0;
 
   struct stat df_stat;
   fstat(fileno(df), &df_stat);
-  size_t downloadSize = df_stat.st_size;
+  uint32_t downloadSize = df_stat.st_size;
+  uint32_t start = 0, end = downloadSize - 1;
+  int range = parseRange(req, downloadSize, &start, &end);
+  if (range < 0)
+  {
+    fclose(df);
+    // header field values must remain valid until first send
+    char contentRange[24];
+    snprintf(contentRange, sizeof(contentRange), "bytes */%lu", downloadSize);
+    httpd_resp_set_status(req, "416 Range Not Satisfiable");
+    httpd_resp_set_hdr(req, "Content-Range", contentRange);
+    httpd_resp_send(req, NULL, 0);
+    return ESP_OK;
+  }
+  if (!initReadAhead())
+  {
+    fclose(df);
+    httpd_resp_send_500(req);
+    return ESP_FAIL;
+  }
+  uint32_t length = range ? end - start + 1 : downloadSize;
 
   // create http header
-  ESP_LOGI(TAG, "Begin download file: %s, size: %s", downloadName, fmtSize(downloadSize));
-  httpd_resp_set_type(req, "application/octet-stream");
-  // header field values must remain valid until first send
-  char contentDisp[FILE_NAME_LEN];
-  snprintf(contentDisp, sizeof(contentDisp) - 1, "attachment; filename=%s", downloadName);
-  httpd_resp_set_hdr(req, "Content-Disposition", contentDisp);
-  char contentLength[10];
-  snprintf(contentLength, sizeof(contentLength) - 1, "%i", downloadSize);
-  httpd_resp_set_hdr(req, "Content-Length", contentLength);
+  ESP_LOGI(TAG, "Begin download file: %s, size: %s, range %d", downloadName, fmtSize(downloadSize), range);
+  char header[FILE_NAME_LEN + 256];
+  int len = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nAccept-Ranges: bytes\r\n"
+                     "Content-Disposition: attachment; filename=\"%s\"\r\n",
+                     range ? "206 Partial Content" : "200 OK", mimeType(downloadName), length, downloadName);
+  if (range)
+    len += snprintf(header + len, sizeof(header) - len, "Content-Range: bytes %lu-%lu/%lu\r\n", start, end, downloadSize);
+  len += snprintf(header + len, sizeof(header) - len, "\r\n");
 
   uint32_t start_time = esp_timer_get_time() / 1000;
-  res = sendChunks(filePath, df, req, true); // send AVI
+  setvbuf(df, NULL, _IONBF, 0); // 整块读入下载缓冲区，不经过stdio缓冲
+  res = sendRaw(req, header, len);
+  if (res == ESP_OK && length)
+    res = sendRange(req, df, start, length);
+  fclose(df);
   uint32_t cost = esp_timer_get_time() / 1000 - start_time;
-  uint32_t speed = downloadSize / cost;
-  ESP_LOGI(TAG, "Finished download, cost time: %ums, speed %u kB/s", cost, speed);
+  if (res != ESP_OK)
+  {
+    snprintf(startupFailure, SF_LEN, "Failed to send to browser: %s", filePath);
+    ESP_LOGW(TAG, "%s", startupFailure);
+    return res;
+  }
+  ESP_LOGI(TAG, "Finished download, cost time: %lums, speed %lu kB/s", cost, cost ? length / cost : 0);
   return res;
 }
 
@@ -158,12 +158,13 @@ void netLocalIP(char ipAddr[16], char ipMask[16], char gwIp[16]);
 /**
  * @brief 下载文件并发送HTTP响应
  *
- * 将指定文件通过HTTP响应发送给客户端，设置响应头信息并记录下载统计信息。
+ * 带Content-Length直接发送，不用分块编码；支持单个Range请求，返回206，播放器和NVR可以跳转。
+ * 由预读任务双缓冲读SD卡，发送和读卡同时进行。只在HTTP服务器任务中调用，同一时间只有一个下载。
  *
  * @param filePath 文件完整路径
- * @param df 已打开的文件指针
+ * @param df 已打开的文件指针，返回前关闭
  * @param req HTTP请求句柄
- * @return esp_err_t 下载结果状态码
+ * @return esp_err_t 下载结果状态码，发送失败时返回ESP_FAIL，由HTTP服务器关闭连接
  */
 esp_err_t downloadFile(const char *filePath, FILE *df, httpd_req_t *req);
 #endif
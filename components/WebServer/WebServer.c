@@ -29,10 +29,13 @@
 #include "vCenter.h"
 #include "utilsFS.h"
 #include "storage.h"
+#include "catalog.h"
+#include "snapshot.h"
 #include "WebServer.h"
 #include "Utils.h"
 #include "paramCenter.h"
 #include "MotionDetect.h"
+#include "EasyRTSPServer.h"
 
 static const char *TAG = "WebServer";
 
@@ -407,6 +410,7 @@ static esp_err_t set_config_html_handler(httpd_req_t *req)
                     cJSON *enable = cJSON_GetObjectItem(motion, "enable");
                     cJSON *sensitivity = cJSON_GetObjectItem(motion, "sensitivity");
                     cJSON *night_switch = cJSON_GetObjectItem(motion, "night_switch");
+                    cJSON *zones = cJSON_GetObjectItem(motion, "zones");
 
                     if (enable && cJSON_IsBool(enable))
                     {
@@ -441,6 +445,22 @@ static esp_err_t set_config_html_handler(httpd_req_t *req)
                         }
                     }
 
+                    if (zones && cJSON_IsString(zones))
+                    {
+                        if (strcmp(zones->valuestring, get_param_string(CONFIG_MOTION, MD_ZONES)) != 0)
+                        {
+                            if (setMotionZones(zones->valuestring))
+                            {
+                                ESP_LOGI(TAG, "Motion zones changed: %s", zones->valuestring);
+                                set_param_str(CONFIG_MOTION, MD_ZONES, zones->valuestring, false);
+                            }
+                            else
+                            {
+                                result = ESP_ERR_INVALID_ARG;
+                            }
+                        }
+                    }
+
                     save_config(CONFIG_MOTION);
                     ESP_LOGI(TAG, "Motion detect config saved");
                 }
@@ -1153,6 +1173,169 @@ static esp_err_t storage_info_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+/**
+ * @brief 按时间范围分页查询录像目录，从新到旧排列
+ * GET /api/catalog?from=1735660800&to=1735747200&offset=0&limit=50
+ * from/to为epoch秒，省略表示不限制；返回 {"total":..,"offset":..,"items":[{"path":..,"type":"avi","start":..,"duration":..,"size":..,"width":..,"height":..,"motion":..}]}
+ */
+static esp_err_t catalog_query_handler(httpd_req_t *req)
+{
+    static const char *types[] = {"", "avi", "mp4", "jpg"};
+    char query[128] = {0};
+    char value[16];
+    uint32_t from = 0, to = 0, offset = 0, limit = 50;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK)
+            from = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK)
+            to = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "offset", value, sizeof(value)) == ESP_OK)
+            offset = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK)
+            limit = strtoul(value, NULL, 10);
+    }
+    limit = MIN(limit, CATALOG_PAGE_MAX);
+
+    catalogEntry *entries = malloc(limit * sizeof(catalogEntry) + 1);
+    if (!entries)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    uint32_t total = 0;
+    int count = catalogQuery(from, to, offset, entries, limit, &total);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "total", total);
+    cJSON_AddNumberToObject(root, "offset", offset);
+    cJSON *items = cJSON_AddArrayToObject(root, "items");
+    char path[CATALOG_PATH_LEN + 8];
+    for (int i = 0; i < count; i++)
+    {
+        cJSON *item = cJSON_CreateObject();
+        snprintf(path, sizeof(path), "%s%s", SD_MOUNT_POINT, entries[i].path);
+        cJSON_AddStringToObject(item, "path", path);
+        cJSON_AddStringToObject(item, "type", types[entries[i].type < 4 ? entries[i].type : 0]);
+        cJSON_AddNumberToObject(item, "start", entries[i].start);
+        cJSON_AddNumberToObject(item, "duration", entries[i].duration);
+        cJSON_AddNumberToObject(item, "size", entries[i].size);
+        cJSON_AddNumberToObject(item, "width", entries[i].width);
+        cJSON_AddNumberToObject(item, "height", entries[i].height);
+        cJSON_AddNumberToObject(item, "motion", entries[i].motion);
+        cJSON_AddItemToArray(items, item);
+    }
+    free(entries);
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+
+    cJSON_Delete(root);
+    free(json_str);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief 扫描日期文件夹重建录像目录
+ * POST /api/catalog/rebuild
+ */
+static esp_err_t catalog_rebuild_handler(httpd_req_t *req)
+{
+    bool ok = catalogRebuild();
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, ok ? "{\"success\":true}" : "{\"success\":false}");
+    return ESP_OK;
+}
+
+/**
+ * @brief 连拍，按采集帧率保存count张图片，不等待写入完成
+ * POST /api/snapshot?count=10
+ */
+static esp_err_t snapshot_handler(httpd_req_t *req)
+{
+    char query[32] = {0};
+    char value[8];
+    uint32_t count = 1;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "count", value, sizeof(value)) == ESP_OK)
+    {
+        count = strtoul(value, NULL, 10);
+    }
+    bool ok = snapshotBurst(MIN(count, SNAPSHOT_BURST_MAX));
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, ok ? "{\"success\":true}" : "{\"success\":false}");
+    return ESP_OK;
+}
+
+/**
+ * @brief 获取RTSP服务器统计信息
+ * GET /api/rtsp/stats
+ */
+static esp_err_t rtsp_stats_handler(httpd_req_t *req)
+{
+    RTSPServer *server = RTSPServer_GetInstance();
+    if (server == NULL)
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "RTSP server not running");
+        return ESP_OK;
+    }
+
+    char *json_str = RTSPServer_GetStatsJson(server);
+    if (json_str == NULL)
+    {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+    free(json_str);
+
+    return ESP_OK;
+}
+
+/**
+ * @brief 获取当前运动区域
+ * GET /api/motion
+ * 返回 {"motion":true,"width":1600,"height":1200,"blobs":[{"x":..,"y":..,"w":..,"h":..,"cx":..,"cy":..,"area":..}]}
+ */
+static esp_err_t motion_blobs_handler(httpd_req_t *req)
+{
+    MotionBlob blobs[MOTION_MAX_BLOBS];
+    int width = 0, height = 0;
+    int count = getMotionBlobs(blobs, MOTION_MAX_BLOBS, &width, &height);
+
+    cJSON *root = cJSON_CreateObject();
+    cJSON_AddBoolToObject(root, "motion", count > 0);
+    cJSON_AddNumberToObject(root, "width", width);
+    cJSON_AddNumberToObject(root, "height", height);
+    cJSON *arr = cJSON_AddArrayToObject(root, "blobs");
+    for (int i = 0; i < count; i++)
+    {
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "x", blobs[i].x);
+        cJSON_AddNumberToObject(item, "y", blobs[i].y);
+        cJSON_AddNumberToObject(item, "w", blobs[i].w);
+        cJSON_AddNumberToObject(item, "h", blobs[i].h);
+        cJSON_AddNumberToObject(item, "cx", blobs[i].cx);
+        cJSON_AddNumberToObject(item, "cy", blobs[i].cy);
+        cJSON_AddNumberToObject(item, "area", blobs[i].area);
+        cJSON_AddItemToArray(arr, item);
+    }
+
+    char *json_str = cJSON_PrintUnformatted(root);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json_str, strlen(json_str));
+
+    cJSON_Delete(root);
+    free(json_str);
+
+    return ESP_OK;
+}
+
 /**
  * @brief HTTP通用处理函数
  * 负责分发请求到对应的sustain任务
@@ -1240,7 +1423,7 @@ httpd_handle_t web_server_start(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     httpd_handle_t stream_httpd = NULL;
-    config.max_uri_handlers = 16; // 增加URI处理器数量以支持更多功能
+    config.max_uri_handlers = 20; // 增加URI处理器数量以支持更多功能
     config.stack_size = 8192;     // 增加堆栈大小以处理更复杂的请求
 
     httpd_uri_t uri_get = {
@@ -1327,6 +1510,36 @@ httpd_handle_t web_server_start(void)
         .handler = storage_info_handler,
         .user_ctx = NULL};
 
+    httpd_uri_t api_rtsp_stats = {
+        .uri = "/api/rtsp/stats",
+        .method = HTTP_GET,
+        .handler = rtsp_stats_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t api_motion = {
+        .uri = "/api/motion",
+        .method = HTTP_GET,
+        .handler = motion_blobs_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t api_catalog = {
+        .uri = "/api/catalog",
+        .method = HTTP_GET,
+        .handler = catalog_query_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t api_catalog_rebuild = {
+        .uri = "/api/catalog/rebuild",
+        .method = HTTP_POST,
+        .handler = catalog_rebuild_handler,
+        .user_ctx = NULL};
+
+    httpd_uri_t api_snapshot = {
+        .uri = "/api/snapshot",
+        .method = HTTP_POST,
+        .handler = snapshot_handler,
+        .user_ctx = NULL};
+
     if (httpd_start(&stream_httpd, &config) == ESP_OK)
     {
         httpd_register_uri_handler(stream_httpd, &uri_get);
@@ -1345,6 +1558,12 @@ httpd_handle_t web_server_start(void)
         httpd_register_uri_handler(stream_httpd, &api_files_delete);
         httpd_register_uri_handler(stream_httpd, &api_files_mkdir);
         httpd_register_uri_handler(stream_httpd, &api_storage_info);
+        httpd_register_uri_handler(stream_httpd, &api_catalog);
+        httpd_register_uri_handler(stream_httpd, &api_catalog_rebuild);
+        httpd_register_uri_handler(stream_httpd, &api_snapshot);
+
+        httpd_register_uri_handler(stream_httpd, &api_rtsp_stats);
+        httpd_register_uri_handler(stream_httpd, &api_motion);
 
         start_sustainTasks();
 
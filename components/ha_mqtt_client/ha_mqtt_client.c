@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "ha_mqtt_client.h"
 
@@ -8,14 +9,25 @@
 #include "esp_wifi.h"
 #include "mqtt_client.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_jpg_decode.h"
 
 #include "vCenter.h"
+#include "EasyRTSPServer.h"
+#include "MotionDetect.h"
 
 #define TAG "HA_MQTT"
 
 #define EXAMPLE_ESP_MQTT_HOST "192.168.31.158" // MQTT服务器IP地址
 #define EXAMPLE_ESP_MQTT_PORT 1883             // MQTT服务器端口（默认非加密端口）
 
+#define RTSP_STATE_TOPIC "homeassistant/sensor/%s/rtsp/state"
+#define MOTION_STATE_TOPIC "homeassistant/binary_sensor/%s/motion/state"
+
+#define CROP_MARGIN_PERCENT 10 // 裁剪快照时运动区域四周留出的边距
+#define CROP_MAX_PERCENT 70    // 运动区域超过画面的这个比例时直接发送整帧
+#define CROP_MIN_WIDTH 320     // 缩小解码时裁剪结果至少保留的宽度
+
 static uint8_t l_mac[6] = {0};
 static esp_mqtt_client_handle_t l_client = NULL;
 static char unique_id[32] = {0};
@@ -28,12 +40,235 @@ static void log_error_if_nonzero(const char *message, int error_code)
     }
 }
 
+// 发布一个RTSP统计传感器的发现配置，状态统一从 homeassistant/sensor/<unique_id>/rtsp/state 的json中取值
+static void mqtt_broadcast_sensor(const char *object_id, const char *name, const char *unit)
+{
+    char payload_buf[512] = {0};
+    char topic[96] = {0};
+
+    snprintf(topic, sizeof(topic), "homeassistant/sensor/%s/%s/config", unique_id, object_id);
+    snprintf(payload_buf, sizeof(payload_buf),
+             "{\"name\":\"%s\",\"state_topic\":\"" RTSP_STATE_TOPIC "\",\"unit_of_measurement\":\"%s\","
+             "\"value_template\":\"{{ value_json.%s }}\",\"state_class\":\"measurement\",\"unique_id\":\"%s_%s\","
+             "\"device\":{\"identifiers\":[\"ESPCamera\"],\"name\":\"Camera\"}}",
+             name, unique_id, unit, object_id, unique_id, object_id);
+    esp_mqtt_client_publish(l_client, topic, payload_buf, 0, 1, 1);
+}
+
+// 广播RTSP统计传感器：总占用带宽、推流客户端数、超时帧数，以及每个会话槽位的码率和丢包数
+static void mqtt_broadcast_rtsp_discovery()
+{
+    char object_id[24] = {0};
+    char name[32] = {0};
+
+    mqtt_broadcast_sensor("rtsp_owb_kbps", "RTSP Bandwidth", "kbps");
+    mqtt_broadcast_sensor("rtsp_streaming", "RTSP Clients", "clients");
+    mqtt_broadcast_sensor("rtsp_overruns", "RTSP Frame Overruns", "frames");
+    for (int i = 0; i < MAX_CLIENTS_NUM; i++)
+    {
+        snprintf(object_id, sizeof(object_id), "rtsp_s%d_kbps", i);
+        snprintf(name, sizeof(name), "RTSP Session%d Bitrate", i);
+        mqtt_broadcast_sensor(object_id, name, "kbps");
+        snprintf(object_id, sizeof(object_id), "rtsp_s%d_drops", i);
+        snprintf(name, sizeof(name), "RTSP Session%d Drops", i);
+        mqtt_broadcast_sensor(object_id, name, "packets");
+    }
+}
+
+// 广播运动检测二值传感器，运动区域（外接矩形、质心、面积）作为属性
+static void mqtt_broadcast_motion_discovery()
+{
+    char payload_buf[512] = {0};
+    char topic[96] = {0};
+
+    snprintf(topic, sizeof(topic), "homeassistant/binary_sensor/%s/motion/config", unique_id);
+    snprintf(payload_buf, sizeof(payload_buf),
+             "{\"name\":\"Motion\",\"device_class\":\"motion\",\"state_topic\":\"" MOTION_STATE_TOPIC "\","
+             "\"value_template\":\"{{ 'ON' if value_json.motion else 'OFF' }}\","
+             "\"json_attributes_topic\":\"" MOTION_STATE_TOPIC "\",\"unique_id\":\"%s_motion\","
+             "\"device\":{\"identifiers\":[\"ESPCamera\"],\"name\":\"Camera\"}}",
+             unique_id, unique_id, unique_id);
+    esp_mqtt_client_publish(l_client, topic, payload_buf, 0, 1, 1);
+}
+
+// 运动事件回调，在运动检测任务中执行，只放入发送队列不等待网络
+static void mqtt_publish_motion(bool motion, const MotionBlob *blobs, int count, int frameWidth, int frameHeight)
+{
+    char payload[640] = {0};
+    char topic[96] = {0};
+    int len = snprintf(payload, sizeof(payload), "{\"motion\":%s,\"width\":%d,\"height\":%d,\"blobs\":[",
+                       motion ? "true" : "false", frameWidth, frameHeight);
+    for (int i = 0; i < count && len < sizeof(payload); i++)
+    {
+        len += snprintf(payload + len, sizeof(payload) - len,
+                        "%s{\"x\":%u,\"y\":%u,\"w\":%u,\"h\":%u,\"cx\":%u,\"cy\":%u,\"area\":%lu}",
+                        i ? "," : "", blobs[i].x, blobs[i].y, blobs[i].w, blobs[i].h, blobs[i].cx, blobs[i].cy, blobs[i].area);
+    }
+    if (len >= sizeof(payload) - 2)
+    {
+        return;
+    }
+    strcat(payload, "]}");
+
+    snprintf(topic, sizeof(topic), MOTION_STATE_TOPIC, unique_id);
+    esp_mqtt_client_enqueue(l_client, topic, payload, 0, 0, 0, true);
+}
+
+// 运动区域的外接矩形加边距，覆盖画面大部分时返回false发送整帧
+static bool motion_crop_rect(int *x, int *y, int *w, int *h)
+{
+    MotionBlob blobs[MOTION_MAX_BLOBS];
+    int frameWidth = 0, frameHeight = 0;
+    int count = getMotionBlobs(blobs, MOTION_MAX_BLOBS, &frameWidth, &frameHeight);
+    if (count == 0)
+    {
+        return false;
+    }
+
+    int x0 = frameWidth, y0 = frameHeight, x1 = 0, y1 = 0;
+    for (int i = 0; i < count; i++)
+    {
+        x0 = blobs[i].x < x0 ? blobs[i].x : x0;
+        y0 = blobs[i].y < y0 ? blobs[i].y : y0;
+        x1 = blobs[i].x + blobs[i].w > x1 ? blobs[i].x + blobs[i].w : x1;
+        y1 = blobs[i].y + blobs[i].h > y1 ? blobs[i].y + blobs[i].h : y1;
+    }
+    int mx = (x1 - x0) * CROP_MARGIN_PERCENT / 100 + 8;
+    int my = (y1 - y0) * CROP_MARGIN_PERCENT / 100 + 8;
+    x0 = x0 > mx ? (x0 - mx) & ~1 : 0;
+    y0 = y0 > my ? (y0 - my) & ~1 : 0;
+    x1 = x1 + mx < frameWidth ? x1 + mx : frameWidth;
+    y1 = y1 + my < frameHeight ? y1 + my : frameHeight;
+    if ((x1 - x0) * (y1 - y0) * 100 > frameWidth * frameHeight * CROP_MAX_PERCENT)
+    {
+        return false;
+    }
+    *x = x0;
+    *y = y0;
+    *w = x1 - x0;
+    *h = y1 - y0;
+    return true;
+}
+
+typedef struct
+{
+    const uint8_t *jpeg;
+    int x, y, w, h; // 裁剪区域，按解码缩放后的坐标
+    uint8_t *rgb;   // w * h * 3
+} cropDecoder;
+
+static size_t crop_read(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    cropDecoder *crop = (cropDecoder *)arg;
+    if (buf)
+    {
+        memcpy(buf, crop->jpeg + index, len);
+    }
+    return len;
+}
+
+// 解码器按MCU块输出，只拷贝与裁剪区域相交的部分，不需要整帧的RGB缓冲
+static bool crop_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    cropDecoder *crop = (cropDecoder *)arg;
+    if (!data)
+    {
+        return true; // 解码开始和结束
+    }
+    int x0 = x > crop->x ? x : crop->x;
+    int x1 = x + w < crop->x + crop->w ? x + w : crop->x + crop->w;
+    int y0 = y > crop->y ? y : crop->y;
+    int y1 = y + h < crop->y + crop->h ? y + h : crop->y + crop->h;
+    for (int row = y0; row < y1; row++)
+    {
+        const uint8_t *src = data + ((row - y) * w + x0 - x) * 3;
+        uint8_t *dst = crop->rgb + ((row - crop->y) * crop->w + x0 - crop->x) * 3;
+        for (int i = 0; i < (x1 - x0) * 3; i += 3)
+        {
+            // 与jpg2rgb888相同的字节顺序，fmt2jpg按这个顺序读取RGB888
+            dst[i] = src[i + 2];
+            dst[i + 1] = src[i + 1];
+            dst[i + 2] = src[i];
+        }
+    }
+    return true;
+}
+
+// 只把运动区域重新编码为JPEG，JPEG帧按裁剪宽度缩小解码且只保留裁剪区域
+static bool crop_frame_to_jpeg(const uint8_t *data, size_t size, pixformat_t format, int width, int height,
+                               int x, int y, int w, int h, uint8_t **out, size_t *out_len)
+{
+    if (x + w > width || y + h > height)
+    {
+        return false;
+    }
+    uint8_t *rgb = NULL;
+    if (format == PIXFORMAT_JPEG)
+    {
+        // 缩小到裁剪宽度不低于CROP_MIN_WIDTH为止，最多1/4
+        int shift = 0;
+        while (shift < JPG_SCALE_4X && (w >> (shift + 1)) >= CROP_MIN_WIDTH)
+        {
+            shift++;
+        }
+        cropDecoder crop = {data, x >> shift, y >> shift, w >> shift, h >> shift, NULL};
+        crop.rgb = rgb = (uint8_t *)heap_caps_malloc(crop.w * crop.h * 3, MALLOC_CAP_SPIRAM);
+        if (rgb == NULL || esp_jpg_decode(size, (jpg_scale_t)shift, crop_read, crop_write, &crop) != ESP_OK)
+        {
+            free(rgb);
+            return false;
+        }
+        w = crop.w;
+        h = crop.h;
+    }
+    else
+    {
+        // 非JPEG帧分辨率不高，整帧转换后裁剪
+        rgb = (uint8_t *)heap_caps_malloc(width * height * 3, MALLOC_CAP_SPIRAM);
+        if (rgb == NULL || !fmt2rgb888(data, size, format, rgb))
+        {
+            free(rgb);
+            return false;
+        }
+        // 裁剪区域的各行依次前移，目标位置总在源位置之前，可以原地进行
+        for (int row = 0; row < h; row++)
+        {
+            memmove(rgb + row * w * 3, rgb + ((y + row) * width + x) * 3, w * 3);
+        }
+    }
+    bool ok = fmt2jpg(rgb, w * h * 3, w, h, PIXFORMAT_RGB888, 80, out, out_len);
+    free(rgb);
+    return ok;
+}
+
+// 拷贝帧后立即归还，解码和重新编码期间不占用vCenter的帧
+static bool crop_latest_frame(int x, int y, int w, int h, uint8_t **out, size_t *out_len)
+{
+    video_node *node = get_latest_video_frame();
+    if (!node)
+    {
+        return false;
+    }
+    size_t size = node->size;
+    pixformat_t format = node->format;
+    int width = node->width, height = node->height;
+    uint8_t *copy = (uint8_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (copy)
+    {
+        memcpy(copy, node->data, size);
+    }
+    put_video_frame(node);
+    bool ok = copy && crop_frame_to_jpeg(copy, size, format, width, height, x, y, w, h, out, out_len);
+    free(copy);
+    return ok;
+}
+
 // 广播设备，homeassistant的设备发现协议，用于在homeassistant中自动发现设备
 // 发布到主题：homeassistant/sensor/hum_sensor/config
 void mqtt_broadcast_discovery()
 {
    
-    char *payload = "{\"topic\":\"homeassistant/camera/%s/jpeg\",\"unique_id\":\"%s\",\"device\":{\"identifiers\":[\"ESPCamera\"],\"name\":\"Camera\"}}"
+    char *payload = "{\"topic\":\"homeassistant/camera/%s/jpeg\",\"unique_id\":\"%s\",\"device\":{\"identifiers\":[\"ESPCamera\"],\"name\":\"Camera\"}}";
     char payload_buf[256] = {0};
     char topic[64] = {0};
 
@@ -42,6 +277,9 @@ void mqtt_broadcast_discovery()
     int msg_id = esp_mqtt_client_publish(l_client, topic, payload_buf, 0, 1, 0);
 
     ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+
+    mqtt_broadcast_rtsp_discovery();
+    mqtt_broadcast_motion_discovery();
 }
 
 void mqtt_publish_data()
@@ -56,32 +294,47 @@ void mqtt_publish_data()
     snprintf(topic, sizeof(topic), "homeassistant/camera/%s/jpeg", unique_id);
 
 
-    video_node *node = get_latest_video_frame();
-    if (!node)
+    // 有运动时只发送运动区域
+    int cx = 0, cy = 0, cw = 0, ch = 0;
+    bool converted = motion_crop_rect(&cx, &cy, &cw, &ch) && crop_latest_frame(cx, cy, cw, ch, &_jpg_buf, &_jpg_buf_len);
+    video_node *node = NULL;
+    if (converted)
     {
-        ESP_LOGE(TAG, "Camera capture failed");
-        return;
+        ESP_LOGI(TAG, "snapshot cropped to motion %dx%d+%d+%d", cw, ch, cx, cy);
     }
-
-    if (node->format != PIXFORMAT_JPEG)
+    else
     {
-        bool jpeg_converted = fmt2jpg(node->data, node->size, width, height, node->format, 80, &_jpg_buf, &_jpg_buf_len);
-        if (!jpeg_converted)
+        node = get_latest_video_frame();
+        if (!node)
         {
-            ESP_LOGE(TAG, "JPEG compression failed");
+            ESP_LOGE(TAG, "Camera capture failed");
             return;
         }
-    }
-    else
-    {
-        _jpg_buf_len = node->size;
-        _jpg_buf = node->data;
+        if (node->format != PIXFORMAT_JPEG)
+        {
+            converted = fmt2jpg(node->data, node->size, width, height, node->format, 80, &_jpg_buf, &_jpg_buf_len);
+            put_video_frame(node);
+            node = NULL;
+            if (!converted)
+            {
+                ESP_LOGE(TAG, "JPEG compression failed");
+                return;
+            }
+        }
+        else
+        {
+            _jpg_buf_len = node->size;
+            _jpg_buf = node->data;
+        }
     }
 
     int msg_id = esp_mqtt_client_publish(l_client, topic, (const char *)_jpg_buf, _jpg_buf_len, 1, 0);
 
-    put_video_frame(node);
-    if (node->format != PIXFORMAT_JPEG)
+    if (node)
+    {
+        put_video_frame(node);
+    }
+    if (converted)
     {
         free(_jpg_buf);
     }
@@ -89,6 +342,36 @@ void mqtt_publish_data()
     ESP_LOGI(TAG, "mqtt send picture JPG: %uKB %ums, msg_id=%d", _jpg_buf_len/ 1024, (t2 - t1) / 1000, msg_id);
 }
 
+// 发布RTSP统计传感器的状态
+void mqtt_publish_rtsp_stats()
+{
+    RTSPServer *server = RTSPServer_GetInstance();
+    if (server == NULL)
+    {
+        return;
+    }
+
+    char payload[256] = {0};
+    char topic[64] = {0};
+    int len = snprintf(payload, sizeof(payload), "{\"rtsp_owb_kbps\":%d,\"rtsp_streaming\":%d,\"rtsp_overruns\":%lu",
+                       server->owb, RTSPServer_GetStreamingSessionCounts(server), server->frameOverruns);
+    for (int i = 0; i < MAX_CLIENTS_NUM && len < sizeof(payload); i++)
+    {
+        RTSPSessionStats *stats = &server->sessionStats[i];
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"rtsp_s%d_kbps\":%d,\"rtsp_s%d_drops\":%lu",
+                        i, RTSPServer_GetSessionKbps(server, i),
+                        i, stats->active ? stats->dropEagain + stats->dropNomem : 0);
+    }
+    if (len < sizeof(payload) - 1)
+    {
+        strcat(payload, "}");
+    }
+
+    snprintf(topic, sizeof(topic), RTSP_STATE_TOPIC, unique_id);
+    int msg_id = esp_mqtt_client_publish(l_client, topic, payload, 0, 0, 0);
+    ESP_LOGI(TAG, "publish rtsp stats %s, msg_id=%d", payload, msg_id);
+}
+
 /*
  * @brief Event handler registered to receive MQTT events
  *
@@ -170,5 +453,6 @@ void mqtt_app_start()
     /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
     esp_mqtt_client_register_event(l_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
     esp_mqtt_client_start(l_client);
+    addMotionEventCallback(mqtt_publish_motion);
 }
 #endif /* CONFIG_ENABLE_MQTT  */
@@ -8,6 +8,7 @@
 void mqtt_app_start();
 void mqtt_broadcast_discovery();
 void mqtt_publish_data();
+void mqtt_publish_rtsp_stats();
 
 #endif
 
@@ -6,6 +6,7 @@ enum MOTION_DETECT_PARAM
     MD_ENABLE,
     MD_SENSITIVITY,
     MD_NIGHT_SWITCH,
+    MD_ZONES,
     MD_MAX,
 };
 
@@ -13,6 +14,19 @@ enum STORAGE_PARAM
 {
     STORAGE_AUTO_UPLOAD,
     STORAGE_AUTO_DELETE,
+    STORAGE_RECORD,
+    STORAGE_RECORD_FPS,
+    STORAGE_POST_ROLL,
+    STORAGE_MAX_SECONDS,
+    STORAGE_PRE_ROLL,
+    STORAGE_PRE_ROLL_KB,
+    STORAGE_RECORD_MP4,
+    STORAGE_MP4_FRAGMENT,
+    STORAGE_CONTINUOUS,
+    STORAGE_MIN_FREE_MB,
+    STORAGE_KEEP_DAYS,
+    STORAGE_TL_INTERVAL,
+    STORAGE_TL_FPS,
     STORAGE_MAX,
 };
 
@@ -29,16 +29,38 @@ static RANGE sen_range = {1, 10};
 static RANGE min_seconds_range = {0, 20};
 static RANGE night_switch_range = {0, 100};
 static RANGE rtsp_port_range = {554, 65535};
+static RANGE record_fps_range = {1, 30};
+static RANGE record_seconds_range = {10, 3600};
+static RANGE pre_roll_range = {0, 10};
+static RANGE pre_roll_kb_range = {0, 4096};
+static RANGE mp4_fragment_range = {1, 10};
+static RANGE min_free_range = {10, 10240};
+static RANGE keep_days_range = {0, 365};
+static RANGE tl_interval_range = {0, 3600};
 
 static PARAM_DEF MOTION_DETECT_PARAM[] = {
     {"enable", PARAM_TYPE_BOOL, {.b = true}, NULL, NULL, 0},
     {"sensitivity", PARAM_TYPE_UINT8, {.u8 = 7}, rangeCheck, &sen_range, 0},
     {"night_switch", PARAM_TYPE_UINT8, {.u8 = 10}, rangeCheck, &night_switch_range, 0},
+    {"zones", PARAM_TYPE_STRING, {.str = "ffffffffffffffffffffffffffffffffffffffffffff0000"}, NULL, NULL, 49}, // 16x12检测网格，每行4个十六进制字符，默认屏蔽最下面一行
 };
 
 static PARAM_DEF STORAGE_PARAM[] = {
     {"auto_upload", PARAM_TYPE_BOOL, {.b = false}, NULL, NULL, 0},
     {"auto_delete", PARAM_TYPE_BOOL, {.b = true}, NULL, NULL, 0},
+    {"record", PARAM_TYPE_BOOL, {.b = true}, NULL, NULL, 0}, // 检测到运动时录像
+    {"record_fps", PARAM_TYPE_UINT8, {.u8 = 10}, rangeCheck, &record_fps_range, 0}, // 录像帧率
+    {"post_roll", PARAM_TYPE_UINT8, {.u8 = 5}, rangeCheck, &min_seconds_range, 0}, // 运动停止后继续录制秒数
+    {"max_seconds", PARAM_TYPE_INT32, {.i32 = 300}, rangeCheck, &record_seconds_range, 0}, // 单个文件最长秒数
+    {"pre_roll", PARAM_TYPE_UINT8, {.u8 = 3}, rangeCheck, &pre_roll_range, 0}, // 预录秒数
+    {"pre_roll_kb", PARAM_TYPE_INT32, {.i32 = 1024}, rangeCheck, &pre_roll_kb_range, 0}, // 预录缓冲区大小KB（PSRAM）
+    {"record_mp4", PARAM_TYPE_BOOL, {.b = false}, NULL, NULL, 0}, // 录制分片MP4而不是AVI
+    {"mp4_fragment", PARAM_TYPE_UINT8, {.u8 = 2}, rangeCheck, &mp4_fragment_range, 0}, // MP4分片秒数
+    {"continuous", PARAM_TYPE_BOOL, {.b = false}, NULL, NULL, 0}, // 连续录像，按max_seconds分段
+    {"min_free_mb", PARAM_TYPE_INT32, {.i32 = 100}, rangeCheck, &min_free_range, 0}, // 剩余空间低于此值时删除最旧的文件
+    {"keep_days", PARAM_TYPE_INT32, {.i32 = 0}, rangeCheck, &keep_days_range, 0}, // 录像保存天数，0不限制
+    {"tl_interval", PARAM_TYPE_INT32, {.i32 = 360}, rangeCheck, &tl_interval_range, 0}, // 延时摄影帧间隔秒数，0关闭延时摄影
+    {"tl_fps", PARAM_TYPE_UINT8, {.u8 = 10}, rangeCheck, &record_fps_range, 0}, // 延时摄影播放帧率
 };
 
 static PARAM_DEF RTSP_SERVER_PARAM[] = {
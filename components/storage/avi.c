@@ -5,9 +5,10 @@ Generate AVI format for recorded videos
 s60sc 2020, 2022
 */
 
-/* AVI file format:
+/* AVI file format (OpenDML / AVI 2.0):
 header:
- 310 uint8_ts
+ AVI_HEADER_LEN uint8_ts, AVI 1.0 header with video super index (indx)
+ in the video strl and extended header (odml/dmlh) at end of hdrl
 per jpeg:
  4 uint8_t 00dc marker
  4 uint8_t jpeg size
@@ -18,21 +19,18 @@ per PCM (audio file)
  4 uint8_t pcm size
  pcm content
  0-3 uint8_ts filler to align on DWORD boundary
-footer:
- 4 uint8_t idx1 marker
- 4 uint8_t index size
- per jpeg:
-  4 uint8_t 00dc marker
-  4 uint8_t 0000
-  4 uint8_t jpeg location
-  4 uint8_t jpeg size
- per pcm:
-  4 uint8_t 01wb marker
-  4 uint8_t 0000
-  4 uint8_t pcm location
-  4 uint8_t pcm size
+every ODML_IX_ENTRIES frames and at end of each RIFF:
+ ix00 standard index chunk, inline in movi list
+  32 uint8_t header, qwBaseOffset is 0
+  per jpeg:
+   4 uint8_t jpeg location in file
+   4 uint8_t jpeg size
+every ODML_RIFF_MAX uint8_ts:
+ RIFF AVIX + LIST movi, 24 uint8_ts, continues the movi data
+no idx1, super index in header refers to each ix00 chunk
 
   //https://blog.csdn.net/weixin_47852035/article/details/121577751
+  //OpenDML AVI File Format Extensions 1.02
 */
 #include "avi.h"
 #include <stdio.h>
@@ -46,17 +44,25 @@ footer:
 
 #define ps_malloc(size) heap_caps_malloc((size), MALLOC_CAP_SPIRAM)
 
-#define IDX_ENTRY 16 // uint8_ts per index entry
-
 // avi header data
 
 const uint8_t wbBuf[4] = {0x30, 0x31, 0x77, 0x62};   // 01wb
-static const uint8_t idx1Buf[4] = {0x69, 0x64, 0x78, 0x31}; // idx1
 static const uint8_t zeroBuf[4] = {0x00, 0x00, 0x00, 0x00}; // 0000
-static uint8_t* idxBuf[2] = {NULL, NULL};
 const uint8_t dcBuf[4] = {0x30, 0x30, 0x64, 0x63};
+static const uint8_t ix00Buf[4] = {0x69, 0x78, 0x30, 0x30}; // ix00
+static const uint8_t indxBuf[4] = {0x69, 0x6E, 0x64, 0x78}; // indx
+static const uint8_t riffBuf[ODML_RIFF_HDR] = { // start of each extra RIFF, sizes filled on close
+  0x52, 0x49, 0x46, 0x46, 0x00, 0x00, 0x00, 0x00, 0x41, 0x56, 0x49, 0x58, // RIFF size AVIX
+  0x4C, 0x49, 0x53, 0x54, 0x00, 0x00, 0x00, 0x00, 0x6D, 0x6F, 0x76, 0x69  // LIST size movi
+};
+static const uint8_t odmlBuf[20] = { // extended avi header, followed by zeros
+  0x4C, 0x49, 0x53, 0x54, 0x00, 0x00, 0x00, 0x00, 0x6F, 0x64, 0x6D, 0x6C, // LIST size odml
+  0x64, 0x6D, 0x6C, 0x68, 0xF8, 0x00, 0x00, 0x00                          // dmlh 248
+};
 
-uint8_t aviHeader[AVI_HEADER_LEN] = { // AVI header template
+uint8_t aviHeader[AVI_HEADER_LEN];
+
+static const uint8_t aviTemplate[AVI_V1_HEADER_LEN] = { // AVI 1.0 header template
   0x52, 0x49, 0x46, 0x46, //"RIFF"
   0x00, 0x00, 0x00, 0x00, //size
   0x41, 0x56, 0x49, 0x20, //"AVI" 0x20 is space
@@ -144,36 +150,92 @@ uint8_t aviHeader[AVI_HEADER_LEN] = { // AVI header template
   0x6D, 0x6F, 0x76, 0x69, //"movi"
 };
 
+// positions in AVI 1.0 template where OpenDML chunks are inserted
+#define VSTRL_END 0xCC // end of video strl, super index goes here
+#define HDRL_END 0x12A // end of hdrl, odml list goes here, followed by movi list
+#define AUD_OFF(x) ((x) + ODML_INDX_LEN) // audio strl is after super index
+#define AVI_INDEX_OF_INDEXES 0
+#define AVI_INDEX_OF_CHUNKS 1
+
 // separate index for motion capture and timelapse
-static uint32_t idxPtr[2];
-static uint32_t idxOffset[2];
-static uint32_t moviSize[2];
+typedef struct {
+  uint8_t* ixBuf[2];    // standard index chunks, previous one is kept for the journal while next is filled
+  uint32_t ixFirst[2];  // frame number of first entry in each chunk
+  uint32_t ixCount[2];  // entries in each chunk
+  uint8_t ixCur;        // chunk being filled
+  uint32_t frames;      // frames indexed
+  uint32_t filePos;     // file position of next chunk
+  uint32_t superCnt;    // super index entries
+  uint32_t superPos[ODML_SUPER_ENTRIES];
+  uint32_t superLen[ODML_SUPER_ENTRIES];
+  uint8_t riffCnt;      // RIFF segments
+  uint32_t riffStart[ODML_MAX_RIFFS];
+  uint32_t riffFrames;  // frames in first RIFF, once the second one is started
+} odmlIndex;
+
+static odmlIndex odml[2];
 static uint32_t audSize;
-static uint32_t indexLen[2];
 static FILE* wavFile;
 bool haveSoundFile = false;
 
 void prepAviIndex(bool isTL) {
-  // prep buffer to store index data, gets appended to end of file
-  if (idxBuf[isTL] == NULL) idxBuf[isTL] = (uint8_t*)ps_malloc((MAXFRAMES+1)*IDX_ENTRY); // include some space for audio index
-  memcpy(idxBuf[isTL], idx1Buf, 4); // index header
-  idxPtr[isTL] = CHUNK_HDR;  // leave 4 uint8_ts for index size
-  moviSize[isTL] = indexLen[isTL] = 0;
-  idxOffset[isTL] = 4; // 4 uint8_t offset
+  // prep buffers for standard index chunks, written into movi as they fill
+  odmlIndex* ix = &odml[isTL];
+  for (int i = 0; i < 2; i++) {
+    if (ix->ixBuf[i] == NULL) ix->ixBuf[i] = (uint8_t*)ps_malloc(ODML_IX_LEN(ODML_IX_ENTRIES));
+    ix->ixFirst[i] = ix->ixCount[i] = 0;
+  }
+  ix->ixCur = 0;
+  ix->frames = ix->superCnt = ix->riffFrames = 0;
+  ix->filePos = AVI_HEADER_LEN;
+  ix->riffCnt = 1;
+  ix->riffStart[0] = 0;
 }
 
-void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL) {
-  // update AVI header template with file specific details
-  uint32_t aviSize = moviSize[isTL] + AVI_HEADER_LEN + ((CHUNK_HDR+IDX_ENTRY) * (frameCnt+(haveSoundFile?1:0))); // AVI content size 
-  // update aviHeader with relevant stats
-  memcpy(aviHeader+4, &aviSize, 4);
+static uint32_t riffEnd(odmlIndex* ix, uint8_t seg) {
+  return seg + 1 < ix->riffCnt ? ix->riffStart[seg+1] : ix->filePos;
+}
+
+static void buildSuperIdx(uint8_t* buf, bool isTL) {
+  // super index in video strl, one entry per ix00 chunk
+  odmlIndex* ix = &odml[isTL];
+  uint32_t cb = ODML_INDX_LEN - CHUNK_HDR;
+  memset(buf, 0, ODML_INDX_LEN);
+  memcpy(buf, indxBuf, 4);
+  memcpy(buf+4, &cb, 4);
+  buf[8] = 4; // wLongsPerEntry
+  buf[11] = AVI_INDEX_OF_INDEXES;
+  memcpy(buf+12, &ix->superCnt, 4);
+  memcpy(buf+16, dcBuf, 4);
+  for (uint32_t i = 0; i < ix->superCnt; i++) {
+    uint8_t* entry = buf + 32 + i*16;
+    memcpy(entry, &ix->superPos[i], 4); // qwOffset, high part 0 on FAT
+    uint32_t duration = (ix->superLen[i] - ODML_IX_LEN(0)) / ODML_IX_ENTRY; // in frames
+    memcpy(entry+8, &ix->superLen[i], 4);
+    memcpy(entry+12, &duration, 4);
+  }
+}
+
+void buildAviHdr(uint8_t FPS, uint8_t frameType, uint32_t frameCnt, bool isTL) {
+  // assemble AVI header from template and OpenDML chunks, update with file specific details
+  memcpy(aviHeader, aviTemplate, VSTRL_END);
+  buildSuperIdx(aviHeader+VSTRL_END, isTL);
+  memcpy(aviHeader+VSTRL_END+ODML_INDX_LEN, aviTemplate+VSTRL_END, HDRL_END-VSTRL_END);
+  uint8_t* odmlList = aviHeader + HDRL_END + ODML_INDX_LEN;
+  memset(odmlList, 0, ODML_LIST_LEN);
+  memcpy(odmlList, odmlBuf, sizeof(odmlBuf));
+  uint32_t listSize = ODML_LIST_LEN - CHUNK_HDR;
+  memcpy(odmlList+4, &listSize, 4);
+  memcpy(aviHeader+AVI_HEADER_LEN-12, aviTemplate+HDRL_END, 12); // movi list
+  listSize = HDRL_END - 0x14 + ODML_INDX_LEN + ODML_LIST_LEN;
+  memcpy(aviHeader+0x10, &listSize, 4); // hdrl size
+  listSize = VSTRL_END - 0x60 + ODML_INDX_LEN;
+  memcpy(aviHeader+0x5C, &listSize, 4); // video strl size
+  updateAviHdr(aviHeader, frameCnt, odml[isTL].filePos, isTL);
+
   uint32_t usecs = (uint32_t)round(1000000.0f / FPS); // usecs_per_frame 
   memcpy(aviHeader+0x20, &usecs, 4); 
-  memcpy(aviHeader+0x30, &frameCnt, 2);
-  memcpy(aviHeader+0x8C, &frameCnt, 2);
   memcpy(aviHeader+0x84, &FPS, 1);
-  uint32_t dataSize = moviSize[isTL] + ((frameCnt+(haveSoundFile?1:0)) * CHUNK_HDR) + 4; 
-  memcpy(aviHeader+0x12E, &dataSize, 4); // data size 
 
   // apply video framesize to avi header
   uint8_t words[2];
@@ -188,65 +250,152 @@ void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL) {
 
 #if INCLUDE_AUDIO
   uint8_t withAudio = 2; // increase number of streams for audio
-  if (isTL) memcpy(aviHeader+0x100, zeroBuf, 4); // no audio for timelapse
+  if (isTL) memcpy(aviHeader+AUD_OFF(0x100), zeroBuf, 4); // no audio for timelapse
   else {
     if (haveSoundFile) memcpy(aviHeader+0x38, &withAudio, 1); 
-    memcpy(aviHeader+0x100, &audSize, 4); // audio data size
+    memcpy(aviHeader+AUD_OFF(0x100), &audSize, 4); // audio data size
   }
   // apply audio details to avi header
-  memcpy(aviHeader+0xF8, &SAMPLE_RATE, 4);
+  memcpy(aviHeader+AUD_OFF(0xF8), &SAMPLE_RATE, 4);
   uint32_t uint8_tsPerSec = SAMPLE_RATE * 2;
-  memcpy(aviHeader+0x104, &uint8_tsPerSec, 4); // suggested buffer size
-  memcpy(aviHeader+0x11C, &SAMPLE_RATE, 4);
-  memcpy(aviHeader+0x120, &uint8_tsPerSec, 4); // uint8_ts per sec
+  memcpy(aviHeader+AUD_OFF(0x104), &uint8_tsPerSec, 4); // suggested buffer size
+  memcpy(aviHeader+AUD_OFF(0x11C), &SAMPLE_RATE, 4);
+  memcpy(aviHeader+AUD_OFF(0x120), &uint8_tsPerSec, 4); // uint8_ts per sec
 #else
-  memcpy(aviHeader+0x100, zeroBuf, 4);
+  memcpy(aviHeader+AUD_OFF(0x100), zeroBuf, 4);
 #endif
-
-  // reset state for next recording
-  moviSize[isTL] = idxPtr[isTL] = 0;
-  idxOffset[isTL] = 4; // 4 uint8_t offset
 }
 
 void buildAviIdx(uint32_t dataSize, bool isVid, bool isTL) {
-  // build AVI video index into buffer - 16 uint8_ts per frame
-  // called from saveFrame() for each frame
-  moviSize[isTL] += dataSize;
-  if (isVid) memcpy(idxBuf[isTL]+idxPtr[isTL], dcBuf, 4);
-  else memcpy(idxBuf[isTL]+idxPtr[isTL], wbBuf, 4);
-  
-  memcpy(idxBuf[isTL]+idxPtr[isTL]+4, zeroBuf, 4);
-  memcpy(idxBuf[isTL]+idxPtr[isTL]+8, &idxOffset[isTL], 4); 
-  memcpy(idxBuf[isTL]+idxPtr[isTL]+12, &dataSize, 4); 
-  idxOffset[isTL] += dataSize + CHUNK_HDR;
-  idxPtr[isTL] += IDX_ENTRY; 
+  // add video frame to standard index chunk - 8 uint8_ts per frame
+  // called from saveFrame() for each frame, audio is not indexed
+  odmlIndex* ix = &odml[isTL];
+  if (isVid) {
+    uint8_t cur = ix->ixCur;
+    uint8_t* entry = ix->ixBuf[cur] + ODML_IX_LEN(ix->ixCount[cur]);
+    uint32_t offset = ix->filePos + CHUNK_HDR; // relative to qwBaseOffset 0
+    memcpy(entry, &offset, 4);
+    memcpy(entry+4, &dataSize, 4); // all frames are key frames
+    ix->ixCount[cur]++;
+    ix->frames++;
+  }
+  ix->filePos += CHUNK_HDR + dataSize;
 }
 
-uint32_t writeAviIndex(uint8_t* clientBuf, uint32_t buffSize, bool isTL) {
-  // write completed index to avi file
-  // called repeatedly from closeAvi() until return 0
-  if (idxPtr[isTL] < indexLen[isTL]) {
-    if (indexLen[isTL]-idxPtr[isTL] > buffSize) {
-      memcpy(clientBuf, idxBuf[isTL]+idxPtr[isTL], buffSize);
-      idxPtr[isTL] += buffSize;
-      return buffSize;
-    } else {
-      // final part of index
-      uint32_t final = indexLen[isTL]-idxPtr[isTL];
-      memcpy(clientBuf, idxBuf[isTL]+idxPtr[isTL], final);
-      idxPtr[isTL] = indexLen[isTL];
-      return final;    
+bool aviIndexFull(bool isTL) {
+  return odml[isTL].ixCount[odml[isTL].ixCur] >= ODML_IX_ENTRIES;
+}
+
+uint32_t aviIndexLen(bool isTL) {
+  // length of pending standard index chunk, 0 if no entries
+  uint32_t count = odml[isTL].ixCount[odml[isTL].ixCur];
+  return count ? ODML_IX_LEN(count) : 0;
+}
+
+uint32_t aviIndexChunk(const uint8_t** chunk, bool isTL) {
+  // complete current standard index chunk to be written at current file position
+  // buffer stays valid until the next chunk is completed
+  odmlIndex* ix = &odml[isTL];
+  uint8_t cur = ix->ixCur;
+  uint32_t count = ix->ixCount[cur];
+  if (!count) return 0;
+  uint8_t* buf = ix->ixBuf[cur];
+  uint32_t len = ODML_IX_LEN(count);
+  uint32_t cb = len - CHUNK_HDR;
+  memset(buf, 0, ODML_IX_LEN(0));
+  memcpy(buf, ix00Buf, 4);
+  memcpy(buf+4, &cb, 4);
+  buf[8] = 2; // wLongsPerEntry
+  buf[11] = AVI_INDEX_OF_CHUNKS;
+  memcpy(buf+12, &count, 4);
+  memcpy(buf+16, dcBuf, 4);
+  if (ix->superCnt < ODML_SUPER_ENTRIES) {
+    ix->superPos[ix->superCnt] = ix->filePos;
+    ix->superLen[ix->superCnt] = len;
+    ix->superCnt++;
+  }
+  ix->filePos += len;
+  // next chunk reuses the older buffer
+  cur ^= 1;
+  ix->ixCount[cur] = 0;
+  ix->ixFirst[cur] = ix->frames;
+  ix->ixCur = cur;
+  *chunk = buf;
+  return len;
+}
+
+bool aviRiffFull(uint32_t dataLen, bool isTL) {
+  // whether appending dataLen and the index chunk would exceed the RIFF size limit
+  odmlIndex* ix = &odml[isTL];
+  uint32_t riffLen = ix->filePos - ix->riffStart[ix->riffCnt-1];
+  return riffLen + dataLen + ODML_IX_LEN(ix->ixCount[ix->ixCur] + 1) > ODML_RIFF_MAX;
+}
+
+bool aviNewRiff(uint8_t* hdr, bool isTL) {
+  // start AVIX segment at current file position, index chunk must be written before
+  odmlIndex* ix = &odml[isTL];
+  if (ix->riffCnt >= ODML_MAX_RIFFS) return false;
+  if (ix->riffCnt == 1) ix->riffFrames = ix->frames;
+  ix->riffStart[ix->riffCnt++] = ix->filePos;
+  ix->filePos += ODML_RIFF_HDR;
+  memcpy(hdr, riffBuf, ODML_RIFF_HDR);
+  return true;
+}
+
+uint32_t aviRiffHdr(uint8_t seg, uint8_t* hdr, bool isTL) {
+  // completed header of extra RIFF segment, returns its file position or 0 if none
+  odmlIndex* ix = &odml[isTL];
+  if (seg == 0 || seg >= ix->riffCnt) return 0;
+  uint32_t riffSize = riffEnd(ix, seg) - ix->riffStart[seg] - CHUNK_HDR;
+  uint32_t moviSize = riffSize - 12;
+  memcpy(hdr, riffBuf, ODML_RIFF_HDR);
+  memcpy(hdr+4, &riffSize, 4);
+  memcpy(hdr+16, &moviSize, 4);
+  return ix->riffStart[seg];
+}
+
+uint32_t aviFileLen(bool isTL) {
+  return odml[isTL].filePos;
+}
+
+void updateAviHdr(uint8_t* hdr, uint32_t frameCnt, uint32_t fileLen, bool isTL) {
+  // update sizes and frame counts of a header, first RIFF ends at fileLen or at start of second RIFF
+  odmlIndex* ix = &odml[isTL];
+  uint32_t firstEnd = ix->riffCnt > 1 ? ix->riffStart[1] : fileLen;
+  uint32_t firstFrames = ix->riffCnt > 1 ? ix->riffFrames : frameCnt;
+  uint32_t aviSize = firstEnd - CHUNK_HDR;
+  memcpy(hdr+4, &aviSize, 4);
+  memcpy(hdr+0x30, &firstFrames, 4); // avih counts first RIFF only
+  memcpy(hdr+0x8C, &frameCnt, 4);
+  memcpy(hdr+HDRL_END+ODML_INDX_LEN+20, &frameCnt, 4); // dmlh
+  uint32_t dataSize = firstEnd - AVI_HEADER_LEN + 4;
+  memcpy(hdr+AVI_HEADER_LEN-8, &dataSize, 4);
+}
+
+const uint8_t* aviIndexEntries(uint32_t first, uint32_t* count, bool isTL) {
+  // standard index entries from given frame, up to count entries held in one chunk buffer
+  // NULL if the frame is no longer held
+  odmlIndex* ix = &odml[isTL];
+  for (int i = 0; i < 2; i++) {
+    if (first >= ix->ixFirst[i] && first < ix->ixFirst[i] + ix->ixCount[i]) {
+      uint32_t avail = ix->ixFirst[i] + ix->ixCount[i] - first;
+      if (*count > avail) *count = avail;
+      return ix->ixBuf[i] + ODML_IX_LEN(first - ix->ixFirst[i]);
     }
   }
-  return idxPtr[isTL] = 0;
+  return NULL;
 }
-  
-void finalizeAviIndex(uint16_t frameCnt, bool isTL) {
-  // update index with size
-  uint32_t sizeOfIndex = (frameCnt+(haveSoundFile?1:0))*IDX_ENTRY;
-  memcpy(idxBuf[isTL]+4, &sizeOfIndex, 4); // size of index 
-  indexLen[isTL] = sizeOfIndex + CHUNK_HDR;
-  idxPtr[isTL] = 0; // pointer to index buffer
+
+uint32_t aviMoviStart(FILE* fp) {
+  // position of first chunk in movi list, for AVI 1.0 and OpenDML headers
+  uint8_t hdr[12];
+  uint32_t pos = 12, size;
+  while (fseek(fp, pos, SEEK_SET) == 0 && fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr)) {
+    memcpy(&size, hdr+4, 4);
+    if (!memcmp(hdr, aviTemplate+HDRL_END, 4) && !memcmp(hdr+8, aviTemplate+HDRL_END+8, 4)) return pos + 12;
+    pos += CHUNK_HDR + size + (size & 1);
+  }
+  return AVI_V1_HEADER_LEN;
 }
 
 bool haveWavFile(bool isTL) {
@@ -0,0 +1,577 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "catalog.h"
+#include "utilsFS.h"
+
+#define ps_malloc(size) heap_caps_malloc((size), MALLOC_CAP_SPIRAM)
+#define ps_realloc(ptr, size) heap_caps_realloc((ptr), (size), MALLOC_CAP_SPIRAM)
+
+static const char *TAG = "Catalog";
+
+#define CATALOG_FILE SD_MOUNT_POINT DATA_DIR "/catalog.bin"
+#define CATALOG_TEMP SD_MOUNT_POINT DATA_DIR "/catalog.tmp"
+#define CATALOG_MAGIC 0x31544143 // "CAT1"
+#define CATALOG_VERSION 1
+#define CATALOG_GROW 256         // 内存中的记录数组每次增加的条数
+#define CATALOG_READ_BATCH 64    // 读入时每次读取的记录数
+#define CATALOG_DELETED 0x01     // 删除记录
+
+typedef struct
+{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entrySize; // sizeof(catalogEntry)，记录格式变化时重建
+  uint32_t reserved[2];
+} catalogHeader;
+
+static SemaphoreHandle_t l_catMutex = NULL;
+static bool l_ready = false;
+static catalogEntry *l_entries = NULL; // 按开始时间排序，PSRAM
+static uint32_t l_count = 0;
+static uint32_t l_capacity = 0;
+static uint32_t l_records = 0;         // 文件中的记录数，含删除记录
+
+static uint8_t entryCheck(const catalogEntry *e)
+{
+  const uint8_t *p = (const uint8_t *)e;
+  uint8_t sum = 0x5A;
+  for (size_t i = 0; i < sizeof(catalogEntry); i++)
+  {
+    if (i != offsetof(catalogEntry, check))
+    {
+      sum = sum * 31 + p[i];
+    }
+  }
+  return sum;
+}
+
+/* 去掉挂载点前缀 */
+static const char *relPath(const char *path)
+{
+  size_t len = strlen(SD_MOUNT_POINT);
+  return strncmp(path, SD_MOUNT_POINT "/", len + 1) ? path : path + len;
+}
+
+/* 按文件名填写类型、开始时间、分辨率和时长，不访问SD卡 */
+static bool parseName(const char *path, catalogEntry *e)
+{
+  const char *rel = relPath(path);
+  const char *name = strrchr(rel, '/');
+  name = name ? name + 1 : rel;
+  const char *ext = strrchr(name, '.');
+  memset(e, 0, sizeof(catalogEntry));
+  if (!ext || strlen(rel) >= CATALOG_PATH_LEN)
+  {
+    return false;
+  }
+  if (!strcasecmp(ext + 1, AVI_EXT))
+  {
+    e->type = CATALOG_AVI;
+  }
+  else if (!strcasecmp(ext + 1, MP4_EXT))
+  {
+    e->type = CATALOG_MP4;
+  }
+  else if (!strcasecmp(ext, JPG_EXT))
+  {
+    e->type = CATALOG_JPG;
+  }
+  else
+  {
+    return false;
+  }
+  struct tm tm = {0};
+  unsigned int width, height, fps;
+  unsigned long duration;
+  int n = sscanf(name, "%4d%2d%2d_%2d%2d%2d_%ux%u_%u_%lu", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                 &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &width, &height, &fps, &duration);
+  if (n < 6)
+  {
+    return false;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  time_t start = mktime(&tm);
+  if (start <= 0)
+  {
+    return false;
+  }
+  e->start = start;
+  if (n == 10)
+  {
+    e->width = width;
+    e->height = height;
+    e->duration = duration;
+  }
+  strcpy(e->path, rel);
+  return true;
+}
+
+/* 解析文件名并读取文件大小 */
+static bool parseEntry(const char *path, uint8_t motion, catalogEntry *e)
+{
+  struct stat st;
+  if (!parseName(path, e) || stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+  {
+    return false;
+  }
+  e->size = st.st_size;
+  e->motion = motion;
+  e->check = entryCheck(e);
+  return true;
+}
+
+/* 第一个开始时间不早于start的位置 */
+static uint32_t lowerBound(uint32_t start)
+{
+  uint32_t lo = 0, hi = l_count;
+  while (lo < hi)
+  {
+    uint32_t mid = (lo + hi) / 2;
+    if (l_entries[mid].start < start)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* 查找路径，开始时间相同的记录很少，只比较这一段 */
+static int32_t findEntry(const char *rel, uint32_t start)
+{
+  for (uint32_t i = lowerBound(start); i < l_count && l_entries[i].start == start; i++)
+  {
+    if (!strcmp(l_entries[i].path, rel))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static bool reserveEntries(uint32_t count)
+{
+  if (count <= l_capacity)
+  {
+    return true;
+  }
+  uint32_t capacity = (count + CATALOG_GROW - 1) / CATALOG_GROW * CATALOG_GROW;
+  catalogEntry *entries = ps_realloc(l_entries, capacity * sizeof(catalogEntry));
+  if (!entries)
+  {
+    ESP_LOGE(TAG, "Failed to allocate %lu entries", capacity);
+    return false;
+  }
+  l_entries = entries;
+  l_capacity = capacity;
+  return true;
+}
+
+/* 按开始时间插入，同一路径已存在时替换；录像按时间追加，通常插在末尾 */
+static bool insertEntry(const catalogEntry *e)
+{
+  int32_t found = findEntry(e->path, e->start);
+  if (found >= 0)
+  {
+    l_entries[found] = *e;
+    return true;
+  }
+  if (!reserveEntries(l_count + 1))
+  {
+    return false;
+  }
+  uint32_t pos = l_count;
+  while (pos > 0 && l_entries[pos - 1].start > e->start)
+  {
+    pos--;
+  }
+  memmove(&l_entries[pos + 1], &l_entries[pos], (l_count - pos) * sizeof(catalogEntry));
+  l_entries[pos] = *e;
+  l_count++;
+  return true;
+}
+
+static void removeEntry(uint32_t pos)
+{
+  l_count--;
+  memmove(&l_entries[pos], &l_entries[pos + 1], (l_count - pos) * sizeof(catalogEntry));
+}
+
+/* 读入时应用一条记录 */
+static void applyRecord(const catalogEntry *e)
+{
+  if (e->flags & CATALOG_DELETED)
+  {
+    int32_t found = findEntry(e->path, e->start);
+    if (found >= 0)
+    {
+      removeEntry(found);
+    }
+  }
+  else
+  {
+    insertEntry(e);
+  }
+}
+
+static bool appendRecord(const catalogEntry *e)
+{
+  FILE *fp = fopen(CATALOG_FILE, "ab");
+  if (!fp)
+  {
+    ESP_LOGW(TAG, "Failed to open %s", CATALOG_FILE);
+    return false;
+  }
+  bool ok = fwrite(e, sizeof(catalogEntry), 1, fp) == 1;
+  fclose(fp);
+  if (ok)
+  {
+    l_records++;
+  }
+  return ok;
+}
+
+/* 把内存中的记录写成新的目录文件，去掉所有删除记录 */
+static bool writeCatalog()
+{
+  catalogHeader hdr = {CATALOG_MAGIC, CATALOG_VERSION, sizeof(catalogEntry), {0}};
+  FILE *fp = fopen(CATALOG_TEMP, "wb");
+  if (!fp)
+  {
+    ESP_LOGE(TAG, "Failed to open %s", CATALOG_TEMP);
+    return false;
+  }
+  bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+            (!l_count || fwrite(l_entries, sizeof(catalogEntry), l_count, fp) == l_count);
+  ok = fclose(fp) == 0 && ok;
+  if (ok)
+  {
+    remove(CATALOG_FILE);
+    ok = rename(CATALOG_TEMP, CATALOG_FILE) == 0;
+  }
+  if (!ok)
+  {
+    ESP_LOGE(TAG, "Failed to write %s", CATALOG_FILE);
+    remove(CATALOG_TEMP);
+    return false;
+  }
+  l_records = l_count;
+  return true;
+}
+
+/* 读入目录文件，断电时写了一半的最后一条记录被截掉，其他损坏返回false */
+static bool loadCatalog()
+{
+  catalogHeader hdr;
+  FILE *fp = fopen(CATALOG_FILE, "r+b");
+  if (!fp)
+  {
+    ESP_LOGW(TAG, "No catalog");
+    return false;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != CATALOG_MAGIC ||
+      hdr.version != CATALOG_VERSION || hdr.entrySize != sizeof(catalogEntry))
+  {
+    ESP_LOGW(TAG, "Catalog header mismatch");
+    fclose(fp);
+    return false;
+  }
+  catalogEntry *batch = ps_malloc(CATALOG_READ_BATCH * sizeof(catalogEntry));
+  if (!batch)
+  {
+    fclose(fp);
+    return false;
+  }
+  long good = sizeof(hdr);
+  size_t n;
+  bool bad = false;
+  while (!bad && (n = fread(batch, sizeof(catalogEntry), CATALOG_READ_BATCH, fp)) > 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      if (batch[i].check != entryCheck(&batch[i]) || !memchr(batch[i].path, 0, CATALOG_PATH_LEN))
+      {
+        bad = true;
+        break;
+      }
+      applyRecord(&batch[i]);
+      l_records++;
+      good += sizeof(catalogEntry);
+    }
+  }
+  free(batch);
+  fseek(fp, 0, SEEK_END);
+  long end = ftell(fp);
+  bool ok = true;
+  if (end - good > (long)sizeof(catalogEntry))
+  {
+    ESP_LOGW(TAG, "Catalog damaged at %ld of %ld bytes", good, end);
+    ok = false;
+  }
+  else if (end != good)
+  {
+    // power was lost while the last record was being appended
+    fflush(fp);
+    if (ftruncate(fileno(fp), good) != 0)
+    {
+      ok = false;
+    }
+    ESP_LOGW(TAG, "Dropped incomplete last record");
+  }
+  fclose(fp);
+  return ok;
+}
+
+/* 最旧和最新的文件仍存在，且最新的日期文件夹中的文件数与目录一致 */
+static bool catalogMatches()
+{
+  struct stat st;
+  char path[FILE_NAME_LEN];
+  if (l_count)
+  {
+    snprintf(path, sizeof(path), "%s%s", SD_MOUNT_POINT, l_entries[0].path);
+    if (stat(path, &st) != 0)
+    {
+      ESP_LOGW(TAG, "Oldest catalog entry %s missing", path);
+      return false;
+    }
+    snprintf(path, sizeof(path), "%s%s", SD_MOUNT_POINT, l_entries[l_count - 1].path);
+    if (stat(path, &st) != 0)
+    {
+      ESP_LOGW(TAG, "Newest catalog entry %s missing", path);
+      return false;
+    }
+  }
+  char newest[16] = {0};
+  struct dirent *entry;
+  DIR *dir = opendir(SD_MOUNT_POINT);
+  if (!dir)
+  {
+    return false;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_type == DT_DIR && isDateDir(entry->d_name) && strcmp(entry->d_name, newest) > 0)
+    {
+      strcpy(newest, entry->d_name);
+    }
+  }
+  closedir(dir);
+  if (!newest[0])
+  {
+    return true;
+  }
+  // files in the newest folder, and catalog entries in it which are all at the end
+  uint32_t files = 0, entries = 0;
+  catalogEntry e;
+  snprintf(path, sizeof(path), "%s/%s", SD_MOUNT_POINT, newest);
+  dir = opendir(path);
+  while (dir && (entry = readdir(dir)) != NULL)
+  {
+    snprintf(path, sizeof(path), "/%s/%s", newest, entry->d_name);
+    if (entry->d_type == DT_REG && parseName(path, &e))
+    {
+      files++;
+    }
+  }
+  if (dir)
+  {
+    closedir(dir);
+  }
+  snprintf(path, sizeof(path), "/%s/", newest);
+  for (uint32_t i = l_count; i > 0 && !strncmp(l_entries[i - 1].path, path, strlen(path)); i--)
+  {
+    entries++;
+  }
+  if (files != entries)
+  {
+    ESP_LOGW(TAG, "Folder %s has %lu files, catalog has %lu", newest, files, entries);
+    return false;
+  }
+  return true;
+}
+
+static int compareEntries(const void *a, const void *b)
+{
+  const catalogEntry *ea = a, *eb = b;
+  if (ea->start != eb->start)
+  {
+    return ea->start < eb->start ? -1 : 1;
+  }
+  return strcmp(ea->path, eb->path);
+}
+
+/* 扫描日期文件夹重建目录，调用前已获取互斥锁 */
+static bool rebuildCatalog()
+{
+  uint32_t rTime = esp_timer_get_time() / 1000;
+  char path[FILE_NAME_LEN];
+  struct dirent *entry, *file;
+  catalogEntry e;
+  l_count = l_records = 0;
+  DIR *root = opendir(SD_MOUNT_POINT);
+  if (!root)
+  {
+    ESP_LOGE(TAG, "Unable to open directory %s", SD_MOUNT_POINT);
+    return false;
+  }
+  while ((entry = readdir(root)) != NULL)
+  {
+    if (entry->d_type != DT_DIR || !isDateDir(entry->d_name))
+    {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", SD_MOUNT_POINT, entry->d_name);
+    DIR *dir = opendir(path);
+    while (dir && (file = readdir(dir)) != NULL)
+    {
+      snprintf(path, sizeof(path), "%s/%s/%s", SD_MOUNT_POINT, entry->d_name, file->d_name);
+      // appended unsorted and sorted once at the end
+      if (file->d_type == DT_REG && parseEntry(path, 0, &e) && reserveEntries(l_count + 1))
+      {
+        l_entries[l_count++] = e;
+      }
+    }
+    if (dir)
+    {
+      closedir(dir);
+    }
+  }
+  closedir(root);
+  if (l_count)
+  {
+    qsort(l_entries, l_count, sizeof(catalogEntry), compareEntries);
+  }
+  bool ok = writeCatalog();
+  ESP_LOGI(TAG, "Rebuilt catalog with %lu files in %lu ms", l_count, esp_timer_get_time() / 1000 - rTime);
+  return ok;
+}
+
+bool catalogInit(void)
+{
+  if (!l_catMutex)
+  {
+    l_catMutex = xSemaphoreCreateMutex();
+    if (!l_catMutex)
+    {
+      ESP_LOGE(TAG, "Failed to create mutex");
+      return false;
+    }
+  }
+  const char *dataDir = SD_MOUNT_POINT DATA_DIR;
+  if (access(dataDir, F_OK) != 0 && mkdir(dataDir, 0777) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to create %s", dataDir);
+    return false;
+  }
+  uint32_t lTime = esp_timer_get_time() / 1000;
+  xSemaphoreTake(l_catMutex, portMAX_DELAY);
+  l_count = l_records = 0;
+  bool ok = loadCatalog() && catalogMatches();
+  if (ok)
+  {
+    ESP_LOGI(TAG, "Loaded %lu files, %lu records in %lu ms", l_count, l_records, esp_timer_get_time() / 1000 - lTime);
+  }
+  else
+  {
+    ok = rebuildCatalog();
+  }
+  l_ready = ok;
+  xSemaphoreGive(l_catMutex);
+  return ok;
+}
+
+bool catalogAddFile(const char *path, uint8_t motion)
+{
+  catalogEntry e;
+  if (!l_ready || !parseEntry(path, motion, &e))
+  {
+    return false;
+  }
+  xSemaphoreTake(l_catMutex, portMAX_DELAY);
+  bool ok = insertEntry(&e) && appendRecord(&e);
+  xSemaphoreGive(l_catMutex);
+  return ok;
+}
+
+void catalogRemove(const char *path)
+{
+  catalogEntry e;
+  if (!l_ready || !parseName(path, &e))
+  {
+    return;
+  }
+  xSemaphoreTake(l_catMutex, portMAX_DELAY);
+  int32_t found = findEntry(e.path, e.start);
+  if (found >= 0)
+  {
+    removeEntry(found);
+    e.flags = CATALOG_DELETED;
+    e.check = entryCheck(&e);
+    appendRecord(&e);
+    // deleted records pile up as retention removes the oldest files, rewrite without them
+    if (l_records > 2 * l_count + CATALOG_GROW)
+    {
+      writeCatalog();
+    }
+  }
+  xSemaphoreGive(l_catMutex);
+}
+
+int catalogQuery(uint32_t from, uint32_t to, uint32_t offset, catalogEntry *out, int max, uint32_t *total)
+{
+  int count = 0;
+  if (!l_ready)
+  {
+    if (total)
+    {
+      *total = 0;
+    }
+    return 0;
+  }
+  xSemaphoreTake(l_catMutex, portMAX_DELAY);
+  uint32_t lo = from ? lowerBound(from) : 0;
+  uint32_t hi = to ? lowerBound(to) : l_count;
+  uint32_t n = hi > lo ? hi - lo : 0;
+  for (uint32_t i = offset; i < n && count < max; i++)
+  {
+    out[count++] = l_entries[hi - 1 - i];
+  }
+  xSemaphoreGive(l_catMutex);
+  if (total)
+  {
+    *total = n;
+  }
+  return count;
+}
+
+bool catalogRebuild(void)
+{
+  if (!l_catMutex)
+  {
+    return false;
+  }
+  xSemaphoreTake(l_catMutex, portMAX_DELAY);
+  l_ready = rebuildCatalog();
+  xSemaphoreGive(l_catMutex);
+  return l_ready;
+}
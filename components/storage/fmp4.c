@@ -0,0 +1,329 @@
+#include <string.h>
+
+#include "fmp4.h"
+
+#define TRUN_FLAGS 0x000301       // data-offset, sample-duration, sample-size
+#define TFHD_FLAGS 0x020000       // default-base-is-moof
+#define SAMPLE_FLAGS 0x02000000   // 每帧都是关键帧，不依赖其他帧
+
+typedef struct
+{
+  uint8_t *buf;
+  size_t size;
+  size_t len;
+} boxWriter;
+
+static void put8(boxWriter *w, uint8_t v)
+{
+  if (w->len < w->size)
+  {
+    w->buf[w->len] = v;
+  }
+  w->len++;
+}
+
+static void put16(boxWriter *w, uint16_t v)
+{
+  put8(w, v >> 8);
+  put8(w, v);
+}
+
+static void put32(boxWriter *w, uint32_t v)
+{
+  put16(w, v >> 16);
+  put16(w, v);
+}
+
+static void put64(boxWriter *w, uint64_t v)
+{
+  put32(w, v >> 32);
+  put32(w, v);
+}
+
+static void putType(boxWriter *w, const char *type)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    put8(w, type[i]);
+  }
+}
+
+static void putZeros(boxWriter *w, size_t n)
+{
+  while (n--)
+  {
+    put8(w, 0);
+  }
+}
+
+/* 开始一个box，返回box起始位置，结束时用endBox回填长度 */
+static size_t startBox(boxWriter *w, const char *type)
+{
+  size_t start = w->len;
+  put32(w, 0);
+  putType(w, type);
+  return start;
+}
+
+static size_t startFullBox(boxWriter *w, const char *type, uint8_t version, uint32_t flags)
+{
+  size_t start = startBox(w, type);
+  put32(w, ((uint32_t)version << 24) | flags);
+  return start;
+}
+
+static void endBox(boxWriter *w, size_t start)
+{
+  uint32_t size = w->len - start;
+  if (w->len <= w->size)
+  {
+    w->buf[start] = size >> 24;
+    w->buf[start + 1] = size >> 16;
+    w->buf[start + 2] = size >> 8;
+    w->buf[start + 3] = size;
+  }
+}
+
+static void putMatrix(boxWriter *w)
+{
+  // unity matrix
+  static const uint32_t matrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+  for (int i = 0; i < 9; i++)
+  {
+    put32(w, matrix[i]);
+  }
+}
+
+static void putSampleEntry(boxWriter *w, uint16_t width, uint16_t height)
+{
+  size_t entry = startBox(w, "jpeg");
+  putZeros(w, 6);       // reserved
+  put16(w, 1);          // data_reference_index
+  putZeros(w, 16);      // pre_defined, reserved
+  put16(w, width);
+  put16(w, height);
+  put32(w, 0x00480000); // 72 dpi
+  put32(w, 0x00480000);
+  put32(w, 0);          // reserved
+  put16(w, 1);          // frame_count
+  static const char name[] = "Photo - JPEG";
+  put8(w, sizeof(name) - 1);
+  for (size_t i = 0; i < sizeof(name) - 1; i++)
+  {
+    put8(w, name[i]);
+  }
+  putZeros(w, 31 - (sizeof(name) - 1));
+  put16(w, 0x0018);     // depth
+  put16(w, 0xFFFF);     // pre_defined
+  endBox(w, entry);
+}
+
+size_t fmp4_init_segment(uint8_t *buf, size_t size, uint16_t width, uint16_t height)
+{
+  boxWriter w = {buf, size, 0};
+  size_t box = startBox(&w, "ftyp");
+  putType(&w, "isom");
+  put32(&w, 0x200);
+  putType(&w, "isom");
+  putType(&w, "iso5");
+  putType(&w, "iso6");
+  putType(&w, "mp41");
+  endBox(&w, box);
+
+  size_t moov = startBox(&w, "moov");
+  box = startFullBox(&w, "mvhd", 0, 0);
+  put32(&w, 0);              // creation_time
+  put32(&w, 0);              // modification_time
+  put32(&w, FMP4_TIMESCALE);
+  put32(&w, 0);              // duration, given by the fragments
+  put32(&w, 0x00010000);     // rate
+  put16(&w, 0x0100);         // volume
+  putZeros(&w, 10);          // reserved
+  putMatrix(&w);
+  putZeros(&w, 24);          // pre_defined
+  put32(&w, 2);              // next_track_ID
+  endBox(&w, box);
+
+  size_t trak = startBox(&w, "trak");
+  box = startFullBox(&w, "tkhd", 0, 3); // enabled, in movie
+  put32(&w, 0);
+  put32(&w, 0);
+  put32(&w, 1);              // track_ID
+  put32(&w, 0);              // reserved
+  put32(&w, 0);              // duration
+  putZeros(&w, 8);           // reserved
+  put16(&w, 0);              // layer
+  put16(&w, 0);              // alternate_group
+  put16(&w, 0);              // volume
+  put16(&w, 0);              // reserved
+  putMatrix(&w);
+  put32(&w, (uint32_t)width << 16);
+  put32(&w, (uint32_t)height << 16);
+  endBox(&w, box);
+
+  size_t mdia = startBox(&w, "mdia");
+  box = startFullBox(&w, "mdhd", 0, 0);
+  put32(&w, 0);
+  put32(&w, 0);
+  put32(&w, FMP4_TIMESCALE);
+  put32(&w, 0);
+  put16(&w, 0x55C4);         // language "und"
+  put16(&w, 0);
+  endBox(&w, box);
+  box = startFullBox(&w, "hdlr", 0, 0);
+  put32(&w, 0);              // pre_defined
+  putType(&w, "vide");
+  putZeros(&w, 12);          // reserved
+  static const char handler[] = "VideoHandler";
+  for (size_t i = 0; i < sizeof(handler); i++)
+  {
+    put8(&w, handler[i]);
+  }
+  endBox(&w, box);
+
+  size_t minf = startBox(&w, "minf");
+  box = startFullBox(&w, "vmhd", 0, 1);
+  putZeros(&w, 8);           // graphicsmode, opcolor
+  endBox(&w, box);
+  size_t dinf = startBox(&w, "dinf");
+  box = startFullBox(&w, "dref", 0, 0);
+  put32(&w, 1);
+  size_t url = startFullBox(&w, "url ", 0, 1); // data in this file
+  endBox(&w, url);
+  endBox(&w, box);
+  endBox(&w, dinf);
+
+  // sample tables are empty, samples are described in the fragments
+  size_t stbl = startBox(&w, "stbl");
+  box = startFullBox(&w, "stsd", 0, 0);
+  put32(&w, 1);
+  putSampleEntry(&w, width, height);
+  endBox(&w, box);
+  box = startFullBox(&w, "stts", 0, 0);
+  put32(&w, 0);
+  endBox(&w, box);
+  box = startFullBox(&w, "stsc", 0, 0);
+  put32(&w, 0);
+  endBox(&w, box);
+  box = startFullBox(&w, "stsz", 0, 0);
+  put32(&w, 0);
+  put32(&w, 0);
+  endBox(&w, box);
+  box = startFullBox(&w, "stco", 0, 0);
+  put32(&w, 0);
+  endBox(&w, box);
+  endBox(&w, stbl);
+  endBox(&w, minf);
+  endBox(&w, mdia);
+  endBox(&w, trak);
+
+  size_t mvex = startBox(&w, "mvex");
+  box = startFullBox(&w, "trex", 0, 0);
+  put32(&w, 1);              // track_ID
+  put32(&w, 1);              // default_sample_description_index
+  put32(&w, 0);              // default_sample_duration
+  put32(&w, 0);              // default_sample_size
+  put32(&w, SAMPLE_FLAGS);
+  endBox(&w, box);
+  endBox(&w, mvex);
+  endBox(&w, moov);
+  return w.len <= w.size ? w.len : 0;
+}
+
+size_t fmp4_moof(uint8_t *buf, uint32_t seq, uint64_t decodeTime, const fmp4Sample *samples, uint32_t count, uint32_t dataOffset)
+{
+  boxWriter w = {buf, FMP4_MOOF_SIZE(count), 0};
+  size_t moof = startBox(&w, "moof");
+  size_t box = startFullBox(&w, "mfhd", 0, 0);
+  put32(&w, seq);
+  endBox(&w, box);
+  size_t traf = startBox(&w, "traf");
+  box = startFullBox(&w, "tfhd", 0, TFHD_FLAGS);
+  put32(&w, 1);              // track_ID
+  endBox(&w, box);
+  box = startFullBox(&w, "tfdt", 1, 0);
+  put64(&w, decodeTime);
+  endBox(&w, box);
+  box = startFullBox(&w, "trun", 0, TRUN_FLAGS);
+  put32(&w, count);
+  put32(&w, dataOffset);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    put32(&w, samples[i].duration);
+    put32(&w, samples[i].size);
+  }
+  endBox(&w, box);
+  endBox(&w, traf);
+  endBox(&w, moof);
+  return w.len;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void fmp4_box_header(uint8_t *buf, uint32_t size, const char *type)
+{
+  boxWriter w = {buf, FMP4_BOX_HDR, 0};
+  put32(&w, size);
+  putType(&w, type);
+}
+
+uint32_t fmp4_box_size(const uint8_t *buf)
+{
+  return get32(buf);
+}
+
+/* 在[buf, buf+len)的子box中查找type，返回box内容，找不到返回NULL */
+static const uint8_t *findBox(const uint8_t *buf, size_t len, const char *type, size_t *boxLen)
+{
+  size_t pos = 0;
+  while (pos + 8 <= len)
+  {
+    uint32_t size = get32(buf + pos);
+    if (size < 8 || size > len - pos)
+    {
+      return NULL;
+    }
+    if (!memcmp(buf + pos + 4, type, 4))
+    {
+      *boxLen = size - 8;
+      return buf + pos + 8;
+    }
+    pos += size;
+  }
+  return NULL;
+}
+
+bool fmp4_moof_end_time(const uint8_t *moof, size_t len, uint64_t *endTime)
+{
+  size_t trafLen, tfdtLen, trunLen;
+  const uint8_t *traf, *tfdt, *trun;
+  if (len < 8 || get32(moof) != len || memcmp(moof + 4, "moof", 4) ||
+      !(traf = findBox(moof + 8, len - 8, "traf", &trafLen)) ||
+      !(tfdt = findBox(traf, trafLen, "tfdt", &tfdtLen)) ||
+      !(trun = findBox(traf, trafLen, "trun", &trunLen)) || tfdtLen < 8 || trunLen < 8)
+  {
+    return false;
+  }
+  uint64_t time = tfdt[0] == 1 && tfdtLen >= 12 ? ((uint64_t)get32(tfdt + 4) << 32) | get32(tfdt + 8) : get32(tfdt + 4);
+  uint32_t flags = get32(trun) & 0xFFFFFF;
+  uint32_t count = get32(trun + 4);
+  if (!(flags & 0x100))
+  {
+    return false; // durations come from trex defaults, not written by this muxer
+  }
+  size_t pos = 8 + (flags & 0x1 ? 4 : 0) + (flags & 0x4 ? 4 : 0);
+  size_t entry = 4 * (!!(flags & 0x100) + !!(flags & 0x200) + !!(flags & 0x400) + !!(flags & 0x800));
+  if (pos + (uint64_t)count * entry > trunLen)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < count; i++, pos += entry)
+  {
+    time += get32(trun + pos);
+  }
+  *endTime = time;
+  return true;
+}
@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include "frame_ring.h"
+
+typedef struct
+{
+  uint32_t timestamp;
+  uint32_t len;
+} frameHdr;
+
+/* 帧头加4字节对齐后的数据 */
+static inline size_t record_size(size_t len)
+{
+  return sizeof(frameHdr) + ((len + 3) & ~(size_t)3);
+}
+
+void frame_ring_init(FrameRing *ring, void *buf, size_t size)
+{
+  ring->buf = buf;
+  ring->size = buf ? size & ~(size_t)3 : 0;
+  frame_ring_clear(ring);
+}
+
+void frame_ring_clear(FrameRing *ring)
+{
+  ring->head = ring->tail = 0;
+  ring->wrapEnd = ring->size;
+  ring->wrapped = false;
+  ring->count = 0;
+  ring->bytes = 0;
+}
+
+void frame_ring_drop(FrameRing *ring)
+{
+  if (!ring->count)
+  {
+    return;
+  }
+  frameHdr hdr;
+  memcpy(&hdr, ring->buf + ring->head, sizeof(hdr));
+  ring->head += record_size(hdr.len);
+  ring->bytes -= hdr.len;
+  if (--ring->count == 0)
+  {
+    frame_ring_clear(ring);
+  }
+  else if (ring->wrapped && ring->head >= ring->wrapEnd)
+  {
+    // 旧的一段取完，剩下的数据从缓冲区开头开始
+    ring->head = 0;
+    ring->wrapEnd = ring->size;
+    ring->wrapped = false;
+  }
+}
+
+bool frame_ring_push(FrameRing *ring, uint32_t timestamp, const uint8_t *data, size_t len)
+{
+  size_t need = record_size(len);
+  if (need > ring->size)
+  {
+    return false;
+  }
+  while (true)
+  {
+    if (!ring->wrapped)
+    {
+      if (ring->size - ring->tail >= need)
+      {
+        break;
+      }
+      if (ring->head >= need)
+      {
+        // 尾部放不下，从开头继续写
+        ring->wrapEnd = ring->tail;
+        ring->tail = 0;
+        ring->wrapped = true;
+        break;
+      }
+    }
+    else if (ring->head - ring->tail >= need)
+    {
+      break;
+    }
+    frame_ring_drop(ring);
+  }
+
+  frameHdr hdr = {timestamp, len};
+  memcpy(ring->buf + ring->tail, &hdr, sizeof(hdr));
+  memcpy(ring->buf + ring->tail + sizeof(hdr), data, len);
+  ring->tail += need;
+  ring->count++;
+  ring->bytes += len;
+  return true;
+}
+
+const uint8_t *frame_ring_peek(const FrameRing *ring, uint32_t *timestamp, size_t *len)
+{
+  if (!ring->count)
+  {
+    return NULL;
+  }
+  frameHdr hdr;
+  memcpy(&hdr, ring->buf + ring->head, sizeof(hdr));
+  if (timestamp)
+  {
+    *timestamp = hdr.timestamp;
+  }
+  *len = hdr.len;
+  return ring->buf + ring->head + sizeof(hdr);
+}
+
+void frame_ring_trim(FrameRing *ring, uint32_t oldest)
+{
+  uint32_t timestamp;
+  size_t len;
+  while (frame_ring_peek(ring, &timestamp, &len) && (int32_t)(timestamp - oldest) < 0)
+  {
+    frame_ring_drop(ring);
+  }
+}
@@ -3,18 +3,41 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 
-#define AVI_HEADER_LEN 310 // AVI header length
 #define CHUNK_HDR 8 // uint8_ts per jpeg hdr in AVI 
-#define MAXFRAMES 20000 // maximum number of frames in video before auto close
+
+// OpenDML (AVI 2.0) index, no frame count or file size limit of idx1
+#define ODML_SUPER_ENTRIES 128 // super index entries reserved in header, one per ix00 chunk
+#define ODML_IX_ENTRIES 2048 // frames per standard index chunk (ix00)
+#define ODML_IX_ENTRY 8 // uint8_ts per standard index entry
+#define ODML_IX_LEN(n) (32 + ODML_IX_ENTRY * (n)) // uint8_ts of ix00 chunk with n entries
+#define ODML_INDX_LEN (32 + 16 * ODML_SUPER_ENTRIES) // uint8_ts of super index chunk
+#define ODML_LIST_LEN (12 + CHUNK_HDR + 248) // uint8_ts of odml list with dmlh
+#define ODML_RIFF_HDR 24 // RIFF AVIX + LIST movi opening each extra RIFF
+#define ODML_RIFF_MAX (1000 * 1024 * 1024) // RIFF size limit, first RIFF stays readable by AVI 1.0 players
+#define ODML_MAX_RIFFS 4 // keeps file within FAT32 4GB limit
+
+#define AVI_V1_HEADER_LEN 310 // AVI 1.0 header length
+#define AVI_HEADER_LEN (AVI_V1_HEADER_LEN + ODML_INDX_LEN + ODML_LIST_LEN) // AVI header length
+// maximum number of frames in video before auto close, each RIFF may end with a partial ix00 chunk
+#define MAXFRAMES ((ODML_SUPER_ENTRIES - ODML_MAX_RIFFS) * ODML_IX_ENTRIES)
 
 extern const uint8_t dcBuf[];   // 00dc
 
-void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL);
+void buildAviHdr(uint8_t FPS, uint8_t frameType, uint32_t frameCnt, bool isTL);
 void buildAviIdx(uint32_t dataSize, bool isVid, bool isTL);
+void updateAviHdr(uint8_t* hdr, uint32_t frameCnt, uint32_t fileLen, bool isTL);
+const uint8_t* aviIndexEntries(uint32_t first, uint32_t* count, bool isTL);
 void prepAviIndex(bool isTL);
-uint32_t writeAviIndex(uint8_t* clientBuf, uint32_t buffSize, bool isTL);
-void finalizeAviIndex(uint16_t frameCnt, bool isTL);
+bool aviIndexFull(bool isTL);
+uint32_t aviIndexLen(bool isTL);
+uint32_t aviIndexChunk(const uint8_t** chunk, bool isTL);
+bool aviRiffFull(uint32_t dataLen, bool isTL);
+bool aviNewRiff(uint8_t* hdr, bool isTL);
+uint32_t aviRiffHdr(uint8_t seg, uint8_t* hdr, bool isTL);
+uint32_t aviFileLen(bool isTL);
+uint32_t aviMoviStart(FILE* fp);
 bool haveWavFile(bool isTL);
 uint32_t writeWavFile(uint8_t* clientBuf, uint32_t buffSize);
 
@@ -0,0 +1,81 @@
+#ifndef __CATALOG_H__
+#define __CATALOG_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * 录像目录：SD卡数据目录下的追加写二进制文件，每个录像和图片一条定长记录，
+ * 包含开始时间、时长、大小、分辨率、运动强度和路径。
+ * 启动时整个读入PSRAM并按开始时间排序，文件页面按时间范围分页查询时不再遍历目录、逐个stat。
+ * 删除文件时追加一条删除记录，删除记录过多时重写整个文件；
+ * 文件头不匹配、中间有损坏的记录或与SD卡上的文件不一致时扫描日期文件夹重建。
+ */
+
+#define CATALOG_PATH_LEN 64  // 相对挂载点的路径最大长度，含结尾0
+#define CATALOG_PAGE_MAX 100 // 每次查询最多返回的记录数
+
+typedef enum
+{
+  CATALOG_AVI = 1,
+  CATALOG_MP4,
+  CATALOG_JPG,
+} catalogType;
+
+typedef struct
+{
+  uint32_t start;              // 开始时间 epoch s，来自文件名
+  uint32_t duration;           // 时长 s，图片为0
+  uint32_t size;               // 文件字节数
+  uint16_t width;              // 帧宽，图片为0
+  uint16_t height;             // 帧高，图片为0
+  uint8_t type;                // catalogType
+  uint8_t motion;              // 运动强度，录制期间运动区域占画面的最大百分比
+  uint8_t flags;               // 记录类型，删除记录只有path有效
+  uint8_t check;               // 校验和，检测断电时写了一半的记录
+  char path[CATALOG_PATH_LEN]; // 相对挂载点的路径，如/20250101/20250101_120000_1280x720_10_300.avi
+} catalogEntry;
+
+/**
+ * @brief 读入目录文件，需要在SD卡挂载后、开始录像前调用
+ *
+ * 文件头不匹配、中间有损坏的记录、最旧或最新的文件已不存在、
+ * 或最新的日期文件夹中的文件数与目录不一致时重建目录，文件较多时需要几秒。
+ *
+ * @return true - 目录可用
+ * @return false - 内存不足或SD卡不可用，之后的添加和查询都被忽略
+ */
+bool catalogInit(void);
+
+/**
+ * @brief 添加一个录像或图片文件
+ *
+ * 开始时间、分辨率和时长从文件名（YYYYMMDD_HHMMSS[_WxH_FPS_DUR...].ext）得到，大小用一次stat得到，
+ * 不是avi、mp4、jpg的文件被忽略。同一路径已在目录中时更新原记录。
+ *
+ * @param path 文件完整路径
+ * @param motion 运动强度（0-100）
+ * @return true - 已添加
+ * @return false - 不是录像或图片、文件名无法解析或目录不可用
+ */
+bool catalogAddFile(const char *path, uint8_t motion);
+
+/* 文件已删除，从目录中移除，不在目录中的路径忽略 */
+void catalogRemove(const char *path);
+
+/**
+ * @brief 按开始时间查询，从新到旧排列
+ *
+ * @param from 开始时间不早于from，0不限制
+ * @param to 开始时间早于to，0不限制
+ * @param offset 跳过最新的offset条
+ * @param out 输出记录，路径相对挂载点
+ * @param max out的长度
+ * @param total 输出时间范围内的总记录数，可以为NULL
+ * @return int 输出的记录数
+ */
+int catalogQuery(uint32_t from, uint32_t to, uint32_t offset, catalogEntry *out, int max, uint32_t *total);
+
+/* 扫描日期文件夹重建目录，运动强度无法恢复，记为0 */
+bool catalogRebuild(void);
+
+#endif // __CATALOG_H__
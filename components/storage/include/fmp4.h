@@ -0,0 +1,66 @@
+#ifndef __FMP4_H__
+#define __FMP4_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 分片MP4（fMP4）封装，只生成box，不做文件读写。
+ * 文件结构：ftyp + moov（不含样本表）+ 若干个 moof + mdat 分片，
+ * 每个分片自带样本大小和时长，写完一个分片即可播放，索引内存只与单个分片的帧数有关。
+ * 视频轨为MJPEG（'jpeg'样本描述），时间单位ms。
+ */
+
+#define FMP4_TIMESCALE 1000 // 时间单位 ms
+#define FMP4_BOX_HDR 8      // box头字节数
+// count帧的moof字节数：moof(8) mfhd(16) traf(8) tfhd(16) tfdt(20) trun(20 + 每帧8)
+#define FMP4_MOOF_SIZE(count) (88 + 8 * (count))
+
+typedef struct
+{
+  uint32_t size;     // JPEG字节数
+  uint32_t duration; // 时长 ms
+} fmp4Sample;
+
+/**
+ * @brief 生成初始化段（ftyp + moov）
+ *
+ * @param buf 输出缓冲区
+ * @param size 缓冲区字节数
+ * @param width 帧宽
+ * @param height 帧高
+ * @return size_t 初始化段字节数，缓冲区不足返回0
+ */
+size_t fmp4_init_segment(uint8_t *buf, size_t size, uint16_t width, uint16_t height);
+
+/**
+ * @brief 生成一个分片的moof
+ *
+ * @param buf 输出缓冲区，至少FMP4_MOOF_SIZE(count)字节
+ * @param seq 分片序号，从1开始
+ * @param decodeTime 分片第一帧的时间 ms
+ * @param samples 分片中每帧的大小和时长
+ * @param count 帧数
+ * @param dataOffset 第一帧数据相对moof开头的偏移
+ * @return size_t moof字节数
+ */
+size_t fmp4_moof(uint8_t *buf, uint32_t seq, uint64_t decodeTime, const fmp4Sample *samples, uint32_t count, uint32_t dataOffset);
+
+/* 写入box头，size为0表示box一直到文件结尾 */
+void fmp4_box_header(uint8_t *buf, uint32_t size, const char *type);
+
+/* 读取box头中的长度 */
+uint32_t fmp4_box_size(const uint8_t *buf);
+
+/**
+ * @brief 解析moof，得到分片结束时间
+ *
+ * @param moof moof数据
+ * @param len moof字节数
+ * @param endTime 输出分片最后一帧结束的时间 ms
+ * @return true - 解析成功
+ * @return false - 不是有效的moof
+ */
+bool fmp4_moof_end_time(const uint8_t *moof, size_t len, uint64_t *endTime);
+
+#endif // __FMP4_H__
@@ -0,0 +1,64 @@
+#ifndef __FRAME_RING_H__
+#define __FRAME_RING_H__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 预录环形缓冲区，按字节而不是按帧数限制大小。
+ * 每帧连续存放（帧头+JPEG数据），尾部放不下时从缓冲区开头继续写，
+ * 空间不够时丢弃最旧的帧，存取都不分配内存。
+ */
+typedef struct
+{
+  uint8_t *buf;
+  size_t size;    // 缓冲区字节数
+  size_t head;    // 最旧帧的位置
+  size_t tail;    // 下一帧写入位置
+  size_t wrapEnd; // 回绕时旧数据的结束位置
+  bool wrapped;   // 数据是否分成[head, wrapEnd)和[0, tail)两段
+  uint32_t count; // 帧数
+  size_t bytes;   // JPEG数据总字节数
+} FrameRing;
+
+/**
+ * @brief 初始化环形缓冲区
+ *
+ * @param ring 环形缓冲区
+ * @param buf 存储空间，4字节对齐，由调用者分配
+ * @param size 存储空间字节数
+ */
+void frame_ring_init(FrameRing *ring, void *buf, size_t size);
+
+/* 清空所有帧 */
+void frame_ring_clear(FrameRing *ring);
+
+/**
+ * @brief 写入一帧，空间不够时丢弃最旧的帧
+ *
+ * @param ring 环形缓冲区
+ * @param timestamp 帧时间戳 ms
+ * @param data JPEG数据
+ * @param len JPEG数据长度
+ * @return true - 写入成功
+ * @return false - 单帧超过缓冲区大小
+ */
+bool frame_ring_push(FrameRing *ring, uint32_t timestamp, const uint8_t *data, size_t len);
+
+/**
+ * @brief 查看最旧的一帧，数据保留在缓冲区中直到frame_ring_drop
+ *
+ * @param ring 环形缓冲区
+ * @param timestamp 输出帧时间戳，可以为NULL
+ * @param len 输出JPEG数据长度
+ * @return const uint8_t* JPEG数据，没有帧时返回NULL
+ */
+const uint8_t *frame_ring_peek(const FrameRing *ring, uint32_t *timestamp, size_t *len);
+
+/* 丢弃最旧的一帧 */
+void frame_ring_drop(FrameRing *ring);
+
+/* 丢弃时间戳早于oldest的帧 */
+void frame_ring_trim(FrameRing *ring, uint32_t oldest);
+
+#endif // __FRAME_RING_H__
@@ -0,0 +1,58 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 录像参数 */
+typedef struct _recordConfig
+{
+  bool enable;           // 是否录像
+  uint8_t fps;           // 录像帧率
+  uint8_t postRoll;      // 运动停止后继续录制的秒数
+  uint32_t maxSeconds;   // 单个文件最长秒数，超过后关闭并重新开一个文件，连续录像时即分段长度
+  uint8_t preRoll;       // 预录秒数，0不预录
+  uint32_t preRollBytes; // 预录缓冲区字节数（PSRAM），帧较大时实际预录时长会短于preRoll，也用于分段期间缓存帧
+  bool mp4;              // 录制分片MP4，否则录制AVI，下一个文件生效
+  uint8_t fragSeconds;   // MP4分片秒数
+  bool continuous;       // 连续录像，不依赖运动检测，按maxSeconds分段
+  uint16_t tlInterval;   // 延时摄影帧间隔秒数，0不录制延时摄影
+  uint8_t tlFPS;         // 延时摄影播放帧率
+} recordConfig;
+
+/**
+ * @brief 启动录像任务
+ *
+ * 录像任务从vCenter取最新帧，拷贝到自己的缓冲区后立即归还帧，再写入AVI或MP4，
+ * SD卡写入卡顿只会让录像丢帧，不会占用vCenter的帧缓冲或阻塞采集任务。
+ * 文件达到maxSeconds时由低优先级的分段任务在后台关闭，录像任务把这期间的帧存入预录缓冲区，
+ * 下一段打开后先写入这些帧，段之间不丢帧；分段任务还在录像期间为下一段预分配备用文件。
+ * 延时摄影由单独的任务每隔tlInterval秒追加一帧到当天的延时摄影AVI，与录像同时进行。
+ * 需要先调用storageInit()。
+ *
+ * @return true - 启动成功
+ * @return false - 创建任务失败
+ */
+bool startRecorder(void);
+
+/**
+ * @brief 更新录像参数，下一帧生效；关闭录像时正在录制的文件会被关闭
+ *
+ * @param cfg 录像参数
+ */
+void setRecordConfig(const recordConfig *cfg);
+
+/**
+ * @brief 通知录像任务运动状态，可以在运动检测回调中调用，不阻塞
+ *
+ * 运动开始时打开AVI并先写入预录缓冲区中的帧，运动停止后再录制postRoll秒后关闭。
+ * 文件关闭时把期间最大的运动强度写入录像目录。
+ *
+ * @param motion 是否有运动
+ * @param score 运动强度，运动区域占画面的百分比（0-100）
+ */
+void recorderMotion(bool motion, uint8_t score);
+
+/* 获取是否正在录像 */
+bool isRecording(void);
+
+#endif // __RECORDER_H__
@@ -0,0 +1,37 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * 拍照服务：采集任务把帧拷贝到PSRAM后立即归还vCenter的帧，由写入任务逐张保存为JPG，
+ * SD卡卡顿时帧在队列中等待，不占用vCenter的帧缓冲。
+ * 文件名为日期文件夹/YYYYMMDD_HHMMSS.jpg，连拍时加序号YYYYMMDD_HHMMSS_NN.jpg。
+ */
+
+#define SNAPSHOT_BURST_MAX 30 // 一次连拍最多帧数
+
+/**
+ * @brief 创建采集和写入任务，需要在catalogInit()之后调用
+ *
+ * @return true - 启动成功
+ * @return false - 创建任务或队列失败
+ */
+bool startSnapshot(void);
+
+/* 设置定时拍照周期 ms，0不定时拍照，只响应连拍请求 */
+void setSnapshotPeriod(uint32_t periodMs);
+
+/**
+ * @brief 按采集帧率连拍count帧，不阻塞
+ *
+ * 每个新帧都拷贝一次，采集任务错过的帧只要还在vCenter中也会被取到；
+ * 缓存的帧超过预算时丢弃之后的帧。上一次连拍未完成时合并为帧数较多的一次。
+ *
+ * @param count 帧数，超过SNAPSHOT_BURST_MAX时按SNAPSHOT_BURST_MAX
+ * @return true - 已请求
+ * @return false - 服务未启动或count为0
+ */
+bool snapshotBurst(uint8_t count);
+
+#endif // __SNAPSHOT_H__
@@ -30,23 +30,35 @@ void sdcard_deinit(void);
  * 
  * 注意：文件打开时间会随着SD卡中已有文件数量的增加而增加。
  * 
+ * @param preRollMs 随后写入的预录帧覆盖的时长，录像开始时间相应提前，保证帧率统计正确
+ * 
  * @return true - 文件打开成功并完成初始化
  * @return false - 文件打开失败或文件夹创建失败
  */
-bool openAvi();
+bool openAvi(uint32_t preRollMs);
 
 /**
  * 保存帧数据到SD卡
  * 
- * 将JPEG帧数据写入AVI文件，处理缓冲区管理和帧索引构建
+ * 将JPEG帧数据拷贝到SD写入缓冲区并构建帧索引，由写入任务异步写入AVI文件，调用方不会被SD卡阻塞
  * 
  * @param frame_buf 帧数据缓冲区指针，包含JPEG编码的图像数据
  * @param len 帧数据长度（字节数）
  * 
- * @note 函数会自动处理4字节对齐，添加AVI帧头，并管理环形缓冲区
- * @note 会记录写入SD卡的时间消耗和总处理时间
+ * @return true - 帧已进入写入队列
+ * @return false - 写入缓冲区不足（SD卡卡顿）或写入出错，整帧丢弃
+ * 
+ * @note 函数会自动处理4字节对齐，添加AVI帧头
+ * @note 每ODML_IX_ENTRIES帧在movi中插入一个标准索引块，RIFF段将超过ODML_RIFF_MAX时开始新的AVIX段
+ * @note 会记录缓冲时间，写入时间、卡顿次数、缓冲区高水位和丢帧数在closeAvi时输出
  */
-void saveFrame(uint8_t* frame_buf, size_t len);
+bool saveFrame(uint8_t* frame_buf, size_t len);
+
+/* 当前AVI文件是否已达到帧数或RIFF段数上限，需要关闭后重新打开 */
+bool isAviFull(void);
+
+/* 当前文件已写入出错或RIFF段数达到上限，之后的帧都会被拒绝，与写入缓冲区暂时不足区分 */
+bool isWriteStopped(void);
 
 /**
  * @brief 关闭AVI视频文件并完成最终处理
@@ -65,6 +77,81 @@ void saveFrame(uint8_t* frame_buf, size_t len);
  */
 bool closeAvi(char *fileName);
 
+/**
+ * @brief 打开分片MP4文件进行写入操作
+ *
+ * 与openAvi相同的文件夹、预分配和临时文件规则，写入ftyp和moov后按分片写入帧。
+ * 每个分片（moof + mdat）写完即可播放，边录边下载的文件也能播放已完成的分片，
+ * 索引内存只与单个分片的帧数有关，文件帧数不受MAXFRAMES限制。
+ *
+ * @param preRollMs 随后写入的预录帧覆盖的时长
+ *
+ * @return true - 文件打开成功
+ * @return false - 文件打开失败或文件夹创建失败
+ */
+bool openMp4(uint32_t preRollMs);
+
+/**
+ * @brief 保存一帧到MP4文件
+ *
+ * 帧时长由相邻帧的时间戳得出，分片时长达到设定值或帧数达到上限时结束当前分片。
+ *
+ * @param frame_buf JPEG数据
+ * @param len JPEG数据长度
+ * @param timestamp 帧时间戳 ms
+ *
+ * @return true - 帧已进入写入队列
+ * @return false - 写入缓冲区不足或写入出错，整帧丢弃
+ */
+bool saveMp4Frame(uint8_t *frame_buf, size_t len, uint32_t timestamp);
+
+/**
+ * @brief 结束最后一个分片并关闭MP4文件，截断到实际大小后按日期时间、帧率和时长重命名
+ *
+ * @return true - 文件成功关闭并满足最小录制时长
+ * @return false - 录制时长不足，文件已被删除
+ */
+bool closeMp4(char *fileName);
+
+/**
+ * @brief 打开延时摄影AVI文件
+ *
+ * 延时摄影使用avi.c中独立的索引（isTL），与运动录像同时进行互不影响。
+ * 每隔一段时间追加一帧，索引在内存中，每ODML_IX_ENTRIES帧写入一个标准索引块，
+ * 并定期写检查点，断电后启动时和录像一样恢复。帧直接由调用方写入，不经过SD写入任务。
+ *
+ * @param playFPS 播放帧率
+ *
+ * @return true - 文件打开成功
+ * @return false - 文件打开失败或文件夹创建失败
+ */
+bool openTimelapse(uint8_t playFPS);
+
+/**
+ * @brief 追加一帧到延时摄影文件，阻塞到写入SD卡
+ *
+ * @param frame_buf JPEG数据
+ * @param len JPEG数据长度
+ *
+ * @return true - 帧已写入
+ * @return false - 没有打开的文件、文件已满或写入出错
+ */
+bool saveTimelapseFrame(const uint8_t *frame_buf, size_t len);
+
+/* 当前延时摄影文件是否已达到帧数或RIFF段数上限，或写入出错，需要关闭后重新打开 */
+bool isTimelapseFull(void);
+
+/**
+ * @brief 写入最后的索引块和文件头，关闭延时摄影文件
+ *
+ * 按开始日期时间、分辨率、播放帧率和播放时长命名，以_T结尾，没有帧时删除。
+ *
+ * @param fileName 输出文件名，可以为NULL
+ * @return true - 文件已保存
+ * @return false - 没有打开的文件或没有帧
+ */
+bool closeTimelapse(char *fileName);
+
 /**
  * @brief 获取SD卡的总容量大小
  * 
@@ -96,6 +183,23 @@ bool storageInit();
 
 void storageSetFPS(uint8_t fps);
 
+/* 设置单个文件最长秒数，用于估算AVI文件预分配大小 */
+void storageSetMaxDuration(uint32_t seconds);
+
+/**
+ * @brief 为下一个录像文件预分配备用文件
+ *
+ * 按openAvi相同的估算大小预分配连续簇，下次打开AVI或MP4时直接改名使用，
+ * 分段录像时打开下一段不再等待分配簇。应在录像期间由低优先级任务调用，已有备用文件时直接返回。
+ *
+ * @return true - 备用文件已就绪
+ * @return false - 空间不足或预分配失败，下次打开文件时当场分配
+ */
+bool prepareSpareFile(void);
+
+/* 设置MP4分片时长，边录边播时最多落后一个分片 */
+void storageSetFragmentDuration(uint8_t seconds);
+
 bool openSDfile(const char *streamFile);
 
 fnameStruct* playbackFPS(const char *fname);
@@ -14,6 +14,7 @@
 #define CONFIG_DIR "/config"
 
 #define AVI_EXT "avi"
+#define MP4_EXT "mp4"
 #define CSV_EXT "csv"
 #define SRT_EXT "srt"
 
@@ -77,6 +78,9 @@ uint32_t getSDFreeSpace(void);
  */
 void dateFormat(char* inBuff, size_t inBuffLen, bool isFolder);
 
+/* 是否为dateFormat生成的日期文件夹名（YYYYMMDD，不含路径） */
+bool isDateDir(const char *name);
+
 /**
  * @brief 删除指定文件或文件夹
  * 
@@ -89,19 +93,32 @@ void dateFormat(char* inBuff, size_t inBuffLen, bool isFolder);
 void deleteFolderOrFile(const char *deleteThis);
 
 /**
- * 检查存储空间并确保有足够的空闲空间
+ * 检查存储空间和录像保存天数，按时间从旧到新逐个删除文件
  * 
- * 函数会检查SD卡的总空间，如果空闲空间小于设定的最小值，会根据配置模式进行处理：
+ * 函数会检查SD卡的剩余空间，如果空闲空间小于设定的最小值，会根据配置模式进行处理：
  * - 普通模式：仅记录警告日志
- * - 清理模式：删除最旧的文件夹来释放空间
- * - 传输后清理模式：先传输文件夹内容再删除
+ * - 清理模式：删除最旧的文件来释放空间
+ * - 传输后清理模式：先传输文件再删除
+ * 清理模式下同时删除超过保存天数的文件。每次最多删除几个文件，每段录像和延时摄影文件关闭时调用一次，
+ * 只在一个日期文件夹清理完后重新扫描根目录。可以在多个任务中调用，同一时间只有一个在清理。
  * 
  * @return bool 空间检查结果
- *         - true: 空间充足或已成功清理出足够空间
- *         - false: 空间不足且未启用清理模式
+ *         - true: 空间充足或仍在清理中
+ *         - false: 空间不足且未启用清理模式或没有可删除的文件
  */
 bool checkFreeStorage();
 
+/**
+ * @brief 设置录像保留策略
+ * 
+ * @param autoDelete 是否自动删除最旧的文件
+ * @param minFreeMB 最小剩余空间MB，低于此值时删除最旧的文件
+ * @param keepDays 保存天数，超过的文件在下次检查时删除，0不限制
+ *
+ * @note 需要在启动录像任务之前调用
+ */
+void setRetention(bool autoDelete, int minFreeMB, int keepDays);
+
 /**
  * @brief 列出指定目录下的所有文件和子目录
  *
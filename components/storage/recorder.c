@@ -0,0 +1,436 @@
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "recorder.h"
+#include "frame_ring.h"
+#include "storage.h"
+#include "catalog.h"
+#include "utilsFS.h"
+#include "vCenter.h"
+
+#define ps_malloc(size) heap_caps_malloc((size), MALLOC_CAP_SPIRAM)
+
+static const char *TAG = "Recorder";
+
+#define RECORD_STACK_SIZE (1024 * 6)
+#define RECORD_PRI 3          // 低于采集任务，SD卡卡顿时不影响采集
+#define SEGMENT_PRI 2         // 分段关闭和预分配在录像任务之后运行，录像任务照常取帧
+#define TIMELAPSE_PRI 2       // 延时摄影直接写SD卡，等待期间录像任务照常取帧
+#define OPEN_RETRY_MS 5000    // 打开文件失败后多久重试
+#define PRE_ROLL_WAIT_MS 2000 // 写入预录帧时每帧最多等待写入缓冲区多久
+
+bool doRecording = true;      // 最近一次检查的剩余空间是否足够，关闭文件时更新，不足时打开新文件前重新检查
+
+static recordConfig l_cfg = {true, 10, 5, 300, 3, 1024 * 1024, false, 2, false, 0, 10};
+static bool l_motion = false;
+static uint32_t l_motionStopMs = 0; // 最近一次运动停止的时间 ms
+static uint8_t l_motionScore = 0;   // 当前文件的运动强度，写入录像目录
+static portMUX_TYPE l_recLock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool l_recording = false;
+static bool l_mp4 = false;         // 当前文件是否为MP4
+static volatile bool l_closing = false; // 上一段正在由分段任务关闭
+static TaskHandle_t l_recordHandle = NULL;
+static TaskHandle_t l_segmentHandle = NULL;
+static TaskHandle_t l_timelapseHandle = NULL;
+static uint8_t *l_frameBuf = NULL; // 帧拷贝，写SD卡期间不占用vCenter的帧
+static size_t l_frameBufSize = 0;
+static FrameRing l_ring;           // 预录缓冲区，只在录像任务中访问
+static void *l_ringBuf = NULL;
+static size_t l_ringBufSize = 0;
+
+void setRecordConfig(const recordConfig *cfg)
+{
+  portENTER_CRITICAL(&l_recLock);
+  l_cfg = *cfg;
+  if (!l_cfg.fps)
+  {
+    l_cfg.fps = 1;
+  }
+  portEXIT_CRITICAL(&l_recLock);
+  if (l_recordHandle)
+  {
+    xTaskNotifyGive(l_recordHandle);
+  }
+  if (l_timelapseHandle)
+  {
+    xTaskNotifyGive(l_timelapseHandle);
+  }
+}
+
+void recorderMotion(bool motion, uint8_t score)
+{
+  portENTER_CRITICAL(&l_recLock);
+  if (l_motion && !motion)
+  {
+    l_motionStopMs = esp_timer_get_time() / 1000;
+  }
+  l_motion = motion;
+  if (motion && score > l_motionScore)
+  {
+    l_motionScore = score;
+  }
+  portEXIT_CRITICAL(&l_recLock);
+  if (motion && l_recordHandle)
+  {
+    xTaskNotifyGive(l_recordHandle);
+  }
+}
+
+bool isRecording(void)
+{
+  return l_recording || l_closing;
+}
+
+/* 取最新帧拷贝到buf，帧比buf大时重新分配，没有新帧返回0 */
+static size_t copyLatestFrame(uint8_t **buf, size_t *bufSize, unsigned int *lastTs)
+{
+  video_node *node = get_latest_video_frame();
+  if (!node)
+  {
+    return 0;
+  }
+  size_t len = 0;
+  if (node->format == PIXFORMAT_JPEG && node->timestamp != *lastTs)
+  {
+    if (node->size > *bufSize)
+    {
+      free(*buf);
+      *bufSize = 0;
+      *buf = ps_malloc(node->size);
+      if (*buf)
+      {
+        *bufSize = node->size;
+      }
+    }
+    if (*buf)
+    {
+      memcpy(*buf, node->data, node->size);
+      len = node->size;
+      *lastTs = node->timestamp;
+    }
+  }
+  put_video_frame(node);
+  return len;
+}
+
+/* 按配置分配预录缓冲区，只在大小变化时重新分配，之后存取帧不再分配内存，连续录像时用于分段期间缓存帧 */
+static void prepareRing(const recordConfig *cfg)
+{
+  size_t size = (cfg->preRoll || cfg->continuous) ? cfg->preRollBytes : 0;
+  if (size == l_ringBufSize && (l_ringBuf || !size))
+  {
+    return;
+  }
+  free(l_ringBuf);
+  l_ringBuf = size ? ps_malloc(size) : NULL;
+  l_ringBufSize = size;
+  if (size && !l_ringBuf)
+  {
+    ESP_LOGE(TAG, "Failed to allocate %u bytes for pre-roll", size);
+  }
+  frame_ring_init(&l_ring, l_ringBuf, l_ringBuf ? size : 0);
+}
+
+/* 未录像时把最新帧存入预录缓冲区，只保留最近preRoll秒，0表示只受缓冲区大小限制 */
+static void bufferLatestFrame(unsigned int *lastTs, uint8_t preRoll)
+{
+  video_node *node = get_latest_video_frame();
+  if (!node)
+  {
+    return;
+  }
+  if (node->format == PIXFORMAT_JPEG && node->timestamp != *lastTs)
+  {
+    if (preRoll)
+    {
+      frame_ring_trim(&l_ring, node->timestamp - preRoll * 1000U);
+    }
+    frame_ring_push(&l_ring, node->timestamp, node->data, node->size);
+    *lastTs = node->timestamp;
+  }
+  put_video_frame(node);
+}
+
+/* 预录帧覆盖的时长 ms */
+static uint32_t preRollSpan(unsigned int lastTs)
+{
+  uint32_t oldest;
+  size_t len;
+  if (!frame_ring_peek(&l_ring, &oldest, &len))
+  {
+    return 0;
+  }
+  return lastTs - oldest;
+}
+
+/* 按当前文件格式保存一帧 */
+static bool saveRecordFrame(const uint8_t *data, size_t len, uint32_t timestamp)
+{
+  return l_mp4 ? saveMp4Frame((uint8_t *)data, len, timestamp) : saveFrame((uint8_t *)data, len);
+}
+
+/* 新文件先写入预录帧 */
+static void flushPreRoll()
+{
+  const uint8_t *data;
+  size_t len;
+  uint32_t timestamp;
+  uint32_t count = l_ring.count;
+  while ((data = frame_ring_peek(&l_ring, &timestamp, &len)))
+  {
+    // 预录帧比写入缓冲区大得多，等写入任务腾出空间，而不是丢帧
+    for (int waitMs = 0; !saveRecordFrame(data, len, timestamp) && waitMs < PRE_ROLL_WAIT_MS; waitMs += 20)
+    {
+      if (isWriteStopped())
+      {
+        // 写入出错或文件已满，等待没有意义，剩余的预录帧全部丢弃
+        ESP_LOGW(TAG, "Pre-roll flush stopped, %lu of %lu frames discarded", l_ring.count, count);
+        frame_ring_clear(&l_ring);
+        return;
+      }
+      vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    frame_ring_drop(&l_ring);
+  }
+  if (count)
+  {
+    ESP_LOGI(TAG, "Flushed %lu pre-roll frames", count);
+  }
+}
+
+static void closeRecording()
+{
+  char fileName[FILE_NAME_LEN] = {0};
+  portENTER_CRITICAL(&l_recLock);
+  uint8_t score = l_motionScore;
+  l_motionScore = 0;
+  portEXIT_CRITICAL(&l_recLock);
+  if (l_mp4 ? closeMp4(fileName) : closeAvi(fileName))
+  {
+    ESP_LOGI(TAG, "Saved %s", fileName);
+    catalogAddFile(fileName, score);
+  }
+  l_recording = false;
+}
+
+/* 上次检查空间不足时重新检查，用户删除文件或清理模式腾出空间后恢复录像 */
+static bool haveFreeStorage(void)
+{
+  if (!doRecording)
+  {
+    doRecording = checkFreeStorage();
+  }
+  return doRecording;
+}
+
+static void recorderTask(void *parameter)
+{
+  unsigned int lastTs = 0;
+  uint32_t openMs = 0;
+  uint32_t retryMs = 0;
+  TickType_t wakeTick = xTaskGetTickCount();
+  while (true)
+  {
+    portENTER_CRITICAL(&l_recLock);
+    recordConfig cfg = l_cfg;
+    bool motion = l_motion;
+    uint32_t stopMs = l_motionStopMs;
+    portEXIT_CRITICAL(&l_recLock);
+    uint32_t now = esp_timer_get_time() / 1000;
+
+    // 连续录像，或运动中或运动停止后的postRoll秒内需要录像
+    bool wanted = cfg.enable &&
+                  (cfg.continuous || motion || ((l_recording || l_closing) && now - stopMs < cfg.postRoll * 1000U));
+    bool split = l_recording && (now - openMs >= cfg.maxSeconds * 1000U || isAviFull());
+    if (l_recording && wanted && split)
+    {
+      // 分段任务关闭当前文件，期间的帧存入预录缓冲区，下一段打开后先写入，段之间不丢帧
+      l_recording = false;
+      l_closing = true;
+      xTaskNotifyGive(l_segmentHandle);
+    }
+    else if (l_recording && !wanted)
+    {
+      closeRecording();
+    }
+    prepareRing(&cfg);
+    if (l_closing)
+    {
+      bufferLatestFrame(&lastTs, 0);
+    }
+    else if (!wanted)
+    {
+      if (!cfg.enable || !l_ring.size)
+      {
+        frame_ring_clear(&l_ring);
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        wakeTick = xTaskGetTickCount();
+        continue;
+      }
+      bufferLatestFrame(&lastTs, cfg.preRoll);
+    }
+    else if (!l_recording)
+    {
+      if (retryMs && now - retryMs < OPEN_RETRY_MS)
+      {
+        vTaskDelay(pdMS_TO_TICKS(OPEN_RETRY_MS));
+        continue;
+      }
+      if (!haveFreeStorage())
+      {
+        retryMs = now ? now : 1;
+        continue;
+      }
+      storageSetFPS(cfg.fps);
+      storageSetMaxDuration(cfg.maxSeconds);
+      storageSetFragmentDuration(cfg.fragSeconds);
+      l_mp4 = cfg.mp4;
+      if (!(l_mp4 ? openMp4(preRollSpan(lastTs)) : openAvi(preRollSpan(lastTs))))
+      {
+        ESP_LOGE(TAG, "Failed to start recording");
+        retryMs = now ? now : 1;
+        continue;
+      }
+      ESP_LOGI(TAG, "Recording started");
+      retryMs = 0;
+      openMs = now;
+      l_recording = true;
+      flushPreRoll();
+      // 录像期间为下一个文件预分配备用文件
+      xTaskNotifyGive(l_segmentHandle);
+      wakeTick = xTaskGetTickCount();
+    }
+    else
+    {
+      size_t len = copyLatestFrame(&l_frameBuf, &l_frameBufSize, &lastTs);
+      if (len)
+      {
+        saveRecordFrame(l_frameBuf, len, lastTs);
+      }
+    }
+    // 写入超过帧间隔时不补帧，直接取下一帧，实际帧率在closeAvi中统计
+    TickType_t interval = pdMS_TO_TICKS(1000 / cfg.fps);
+    if (!interval)
+    {
+      interval = 1;
+    }
+    if (xTaskGetTickCount() - wakeTick >= interval)
+    {
+      wakeTick = xTaskGetTickCount();
+    }
+    else
+    {
+      vTaskDelayUntil(&wakeTick, interval);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+/* 在录像任务之外关闭上一段文件（含保留策略清理），以及为下一个文件预分配备用文件 */
+static void segmentTask(void *parameter)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (l_closing)
+    {
+      closeRecording();
+      l_closing = false;
+    }
+    else if (l_recording)
+    {
+      prepareSpareFile();
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+/**
+ * 延时摄影：每隔tlInterval秒取一帧拷贝后追加到延时摄影文件，每天一个文件，
+ * 日期变化、文件已满、关闭延时摄影或空间不足时关闭当前文件
+ */
+static void timelapseTask(void *parameter)
+{
+  uint8_t *buf = NULL;
+  size_t bufSize = 0;
+  unsigned int lastTs = 0;
+  bool open = false;
+  bool haveFrame = false;
+  uint32_t frameMs = 0;            // 上一帧的时间 ms
+  char day[FILE_NAME_LEN] = {0};   // 当前文件的日期文件夹
+  char folder[FILE_NAME_LEN];
+  char fileName[FILE_NAME_LEN];
+  while (true)
+  {
+    portENTER_CRITICAL(&l_recLock);
+    uint16_t interval = l_cfg.tlInterval;
+    uint8_t fps = l_cfg.tlFPS;
+    portEXIT_CRITICAL(&l_recLock);
+    dateFormat(folder, sizeof(folder), true);
+    if (open && (!interval || !doRecording || strcmp(folder, day) || isTimelapseFull()))
+    {
+      if (closeTimelapse(fileName))
+      {
+        catalogAddFile(fileName, 0);
+      }
+      open = false;
+    }
+    if (!interval)
+    {
+      haveFrame = false;
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    // 配置变化时提前醒来，按新的间隔重新计算
+    int32_t waitMs = haveFrame ? (int32_t)(frameMs + interval * 1000U - esp_timer_get_time() / 1000) : 0;
+    if (waitMs > 0)
+    {
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+      continue;
+    }
+    frameMs = esp_timer_get_time() / 1000;
+    haveFrame = true;
+    if (!open)
+    {
+      // 空间不足或打开失败时下一个间隔重试
+      open = haveFreeStorage() && openTimelapse(fps);
+      strcpy(day, folder);
+    }
+    size_t len = open ? copyLatestFrame(&buf, &bufSize, &lastTs) : 0;
+    if (len)
+    {
+      saveTimelapseFrame(buf, len);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+bool startRecorder(void)
+{
+  if (l_recordHandle)
+  {
+    return true;
+  }
+  if (xTaskCreate(&segmentTask, "segment", RECORD_STACK_SIZE, NULL, SEGMENT_PRI, &l_segmentHandle) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create segment task");
+    return false;
+  }
+  if (xTaskCreate(&recorderTask, "recorder", RECORD_STACK_SIZE, NULL, RECORD_PRI, &l_recordHandle) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create recorder task");
+    return false;
+  }
+  if (xTaskCreate(&timelapseTask, "timelapse", RECORD_STACK_SIZE, NULL, TIMELAPSE_PRI, &l_timelapseHandle) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create timelapse task");
+    return false;
+  }
+  return true;
+}
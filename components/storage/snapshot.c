@@ -0,0 +1,265 @@
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "snapshot.h"
+#include "utilsFS.h"
+#include "catalog.h"
+#include "vCenter.h"
+
+#define ps_malloc(size) heap_caps_malloc((size), MALLOC_CAP_SPIRAM)
+
+static const char *TAG = "Snapshot";
+
+#define SNAPSHOT_STACK_SIZE (1024 * 6)
+#define CAPTURE_PRI 3                          // 与录像任务相同，低于采集任务
+#define SNAPWRITE_PRI 2                        // 写SD卡期间采集任务照常取帧
+#define SNAPSHOT_QUEUE_LEN SNAPSHOT_BURST_MAX  // 等待写入的最多帧数
+#define SNAPSHOT_MAX_BYTES (4 * 1024 * 1024)   // 等待写入的帧最多占用的PSRAM
+#define FRAME_POLL_MS 10                       // 连拍时等待新帧的轮询间隔
+#define FRAME_TIMEOUT_MS 2000                  // 连拍时超过这个时间没有新帧则放弃
+
+typedef struct
+{
+  uint8_t *buf;
+  size_t len;
+  time_t epoch; // 拍照时间，连拍时为第一帧的时间
+  uint8_t seq;  // 连拍序号，从1开始，0为单张
+} snapFrame;
+
+static QueueHandle_t l_snapQueue = NULL;
+static TaskHandle_t l_captureHandle = NULL;
+static TaskHandle_t l_snapWriteHandle = NULL;
+static portMUX_TYPE l_snapLock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t l_periodMs = 0;
+static uint8_t l_burstCount = 0;   // 待处理的连拍帧数
+static size_t l_queuedBytes = 0;   // 队列中的帧占用的字节数
+
+void setSnapshotPeriod(uint32_t periodMs)
+{
+  portENTER_CRITICAL(&l_snapLock);
+  l_periodMs = periodMs;
+  portEXIT_CRITICAL(&l_snapLock);
+  if (l_captureHandle)
+  {
+    xTaskNotifyGive(l_captureHandle);
+  }
+}
+
+bool snapshotBurst(uint8_t count)
+{
+  if (!l_captureHandle || !count)
+  {
+    return false;
+  }
+  portENTER_CRITICAL(&l_snapLock);
+  l_burstCount = MAX(l_burstCount, MIN(count, SNAPSHOT_BURST_MAX));
+  portEXIT_CRITICAL(&l_snapLock);
+  xTaskNotifyGive(l_captureHandle);
+  return true;
+}
+
+/* 拷贝一帧交给写入任务，拷贝完立即归还帧；返回1已排队，0没有新帧，-1超出预算或内存不足 */
+static int grabFrame(bool latest, unsigned int *lastTs, time_t epoch, uint8_t seq)
+{
+  video_node *node = latest ? get_latest_video_frame() : get_video_frame(*lastTs + 1);
+  if (!node)
+  {
+    return 0;
+  }
+  if (node->format != PIXFORMAT_JPEG)
+  {
+    put_video_frame(node);
+    return 0;
+  }
+  snapFrame frame = {NULL, node->size, epoch, seq};
+  portENTER_CRITICAL(&l_snapLock);
+  bool fits = l_queuedBytes + frame.len <= SNAPSHOT_MAX_BYTES;
+  if (fits)
+  {
+    l_queuedBytes += frame.len;
+  }
+  portEXIT_CRITICAL(&l_snapLock);
+  if (fits)
+  {
+    frame.buf = ps_malloc(frame.len);
+  }
+  if (frame.buf)
+  {
+    memcpy(frame.buf, node->data, frame.len);
+    *lastTs = node->timestamp;
+  }
+  put_video_frame(node);
+  if (frame.buf && xQueueSend(l_snapQueue, &frame, 0) == pdTRUE)
+  {
+    return 1;
+  }
+  free(frame.buf);
+  if (fits)
+  {
+    portENTER_CRITICAL(&l_snapLock);
+    l_queuedBytes -= frame.len;
+    portEXIT_CRITICAL(&l_snapLock);
+  }
+  return -1;
+}
+
+static void captureTask(void *parameter)
+{
+  unsigned int lastTs = 0;
+  uint32_t nextMs = 0; // 下一次定时拍照的时间 ms
+  while (true)
+  {
+    portENTER_CRITICAL(&l_snapLock);
+    uint32_t period = l_periodMs;
+    uint8_t count = l_burstCount;
+    l_burstCount = 0;
+    portEXIT_CRITICAL(&l_snapLock);
+    uint32_t now = esp_timer_get_time() / 1000;
+    if (!count && period && (int32_t)(now - nextMs) >= 0)
+    {
+      count = 1;
+      nextMs = now + period;
+    }
+    if (!count)
+    {
+      // 周期变化或连拍请求时提前醒来
+      ulTaskNotifyTake(pdTRUE, period ? pdMS_TO_TICKS(nextMs - now) : portMAX_DELAY);
+      continue;
+    }
+    // 第一帧取最新的，之后按时间戳依次取下一帧，不跳帧
+    time_t epoch = time(NULL);
+    uint8_t done = 0;
+    uint32_t frameMs = now; // 上一帧取到的时间 ms
+    while (done < count)
+    {
+      int ret = grabFrame(!done, &lastTs, epoch, count > 1 ? done + 1 : 0);
+      now = esp_timer_get_time() / 1000;
+      if (ret > 0)
+      {
+        done++;
+        frameMs = now;
+      }
+      else if (ret < 0 || now - frameMs > FRAME_TIMEOUT_MS)
+      {
+        break;
+      }
+      else
+      {
+        vTaskDelay(pdMS_TO_TICKS(FRAME_POLL_MS));
+      }
+    }
+    if (done < count)
+    {
+      ESP_LOGW(TAG, "Captured %u of %u frames", done, count);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+/* 打开图片文件，日期文件夹只在日期变化或打开失败时创建，不再每张检查 */
+static FILE *openPicture(const snapFrame *frame, char *day, char *fileName)
+{
+  struct tm tm;
+  localtime_r(&frame->epoch, &tm);
+  char folder[FILE_NAME_LEN];
+  strftime(folder, sizeof(folder), SD_MOUNT_POINT "/%Y%m%d", &tm);
+  size_t len = strftime(fileName, FILE_NAME_LEN, SD_MOUNT_POINT "/%Y%m%d/%Y%m%d_%H%M%S", &tm);
+  if (frame->seq)
+  {
+    len += snprintf(fileName + len, FILE_NAME_LEN - len, "_%02u", frame->seq);
+  }
+  snprintf(fileName + len, FILE_NAME_LEN - len, JPG_EXT);
+  FILE *fp = NULL;
+  for (int retry = 0; retry < 2 && !fp; retry++)
+  {
+    if (strcmp(folder, day))
+    {
+      if (mkdir(folder, 0777) != 0 && errno != EEXIST)
+      {
+        ESP_LOGE(TAG, "Failed to create folder %s", folder);
+        return NULL;
+      }
+      strcpy(day, folder);
+    }
+    fp = fopen(fileName, "wb");
+    if (!fp)
+    {
+      day[0] = 0; // 文件夹可能已被删除，重新创建后再试一次
+    }
+  }
+  return fp;
+}
+
+static void snapWriteTask(void *parameter)
+{
+  char day[FILE_NAME_LEN] = {0}; // 已创建的日期文件夹
+  char fileName[FILE_NAME_LEN];
+  snapFrame frame;
+  while (true)
+  {
+    xQueueReceive(l_snapQueue, &frame, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    FILE *fp = openPicture(&frame, day, fileName);
+    if (fp)
+    {
+      // 不经过stdio缓冲，整帧一次写入，FATFS直接按簇写SD卡
+      setvbuf(fp, NULL, _IONBF, 0);
+      size_t written = fwrite(frame.buf, 1, frame.len, fp);
+      fclose(fp);
+      if (written == frame.len)
+      {
+        catalogAddFile(fileName, 0);
+        ESP_LOGI(TAG, "Saved %s, %u bytes in %lld ms", fileName, frame.len, (esp_timer_get_time() - start) / 1000);
+      }
+      else
+      {
+        ESP_LOGE(TAG, "Failed to write %s", fileName);
+        remove(fileName);
+      }
+    }
+    else
+    {
+      ESP_LOGE(TAG, "Failed to open file for writing: %s", fileName);
+    }
+    free(frame.buf);
+    portENTER_CRITICAL(&l_snapLock);
+    l_queuedBytes -= frame.len;
+    portEXIT_CRITICAL(&l_snapLock);
+  }
+  vTaskDelete(NULL);
+}
+
+bool startSnapshot(void)
+{
+  if (l_captureHandle)
+  {
+    return true;
+  }
+  l_snapQueue = xQueueCreate(SNAPSHOT_QUEUE_LEN, sizeof(snapFrame));
+  if (!l_snapQueue)
+  {
+    ESP_LOGE(TAG, "Failed to create snapshot queue");
+    return false;
+  }
+  if (xTaskCreate(&snapWriteTask, "snapWrite", SNAPSHOT_STACK_SIZE, NULL, SNAPWRITE_PRI, &l_snapWriteHandle) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create snapshot write task");
+    return false;
+  }
+  if (xTaskCreate(&captureTask, "snapCapture", SNAPSHOT_STACK_SIZE, NULL, CAPTURE_PRI, &l_captureHandle) != pdPASS)
+  {
+    ESP_LOGE(TAG, "Failed to create snapshot capture task");
+    return false;
+  }
+  return true;
+}
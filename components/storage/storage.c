@@ -9,9 +9,14 @@
 #include "driver/sdmmc_host.h"
 #include "sdmmc_cmd.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "sd_protocol_defs.h"
 
 #include "storage.h"
+#include "catalog.h"
+#include "fmp4.h"
 #include "Camera.h"
 #include "ChipInfo.h"
 #include "Utils.h"
@@ -180,20 +185,31 @@ void sdcard_deinit(void)
 
 /************   SD storage ***********************/
 #define AVITEMP SD_MOUNT_POINT "/current.avi"
+#define AVIJOURNAL SD_MOUNT_POINT "/current.idx" // 录像中已落盘帧的索引，断电后用于恢复AVITEMP
+#define TLTEMP SD_MOUNT_POINT "/current_tl.avi"
+#define TLJOURNAL SD_MOUNT_POINT "/current_tl.idx"  // 延时摄影的索引日志，与录像的日志互不影响
 #define MIN_SECIBDS (5) // default min video length (includes POST_MOTION_TIME)
 extern uint8_t aviHeader[];
 
 // local variables for AVI file writing
 static uint8_t iSDbuffer[(RAMSIZE + CHUNK_HDR) * 2] = {0};
-static size_t highPoint = 0;
 static FILE *aviFile = NULL;
 static char partName[FILE_NAME_LEN] = {0};
 static framesize_t fsizePtr;
 static uint8_t l_FPS;
 
+// preallocation of the AVI file as one contiguous cluster run, so that writes never wait on FAT allocation
+#define PREALLOC_MIN (4 * 1024 * 1024)   // 最小预分配字节数
+#define PREALLOC_MAX (512 * 1024 * 1024) // 最大预分配字节数
+#define PREALLOC_FREE_SHARE 4            // 最多占用剩余空间的1/4
+static uint32_t l_maxSeconds = 300;      // 单个文件最长秒数，用于估算预分配大小
+static uint32_t l_avgFrameSize = 0;      // 上一个文件的平均帧大小，0表示尚未录制过
+#define RECSPARE SD_MOUNT_POINT "/spare.bin" // 录像期间为下一个文件预分配的连续簇，打开时改名为临时文件
+static SemaphoreHandle_t l_spareMutex = NULL; // 预分配备用文件期间不能改名
+
 // header and reporting info
 static uint32_t vidSize;   // 视频总大小
-uint16_t frameCnt;         // 当前文件总帧数
+uint32_t frameCnt;         // 当前文件总帧数
 static uint32_t startTime; // 打开文件完成的时间点 ms
 uint32_t dTimeTot;         // 总算法处理时间(解码+运动分析) ms
 static uint32_t fTimeTot;  // 总拷贝时间 ms
@@ -223,19 +239,514 @@ static TaskHandle_t playbackHandle = NULL;
 #define PLAYBACK_STACK_SIZE (1024 * 6)
 #define PLAY_PRI 4
 
+/************   SD writer ***********************/
+// 录像数据先写入PSRAM缓冲区，由写入任务异步写SD卡，SD卡卡顿（簇分配、卡内GC）时录像调用方不被阻塞
+#define SD_WRITE_BUF_SIZE (64 * 1024) // 每个缓冲区大小，FAT分配单元的整数倍
+#define SD_WRITE_BUF_COUNT 8          // 缓冲区个数，能吸收约 SD_WRITE_BUF_SIZE * SD_WRITE_BUF_COUNT 字节的卡顿
+#define SD_DMA_BUF_SIZE (16 * 1024)   // 内部RAM中的DMA中转缓冲区，一次写一个分配单元
+#define SD_STALL_MS 100               // 单次写入超过此时间计为一次卡顿
+#define WRITER_STACK_SIZE (1024 * 4)
+#define WRITER_PRI 4
+#define AVI_CHECKPOINT_MS 2000        // 检查点间隔，断电最多丢失这段时间内未写入SD卡的帧
+#define JOURNAL_MAGIC 0x324A5641      // "AVJ2"
+#define SD_PATCH_BUF_SIZE 2048        // 补写缓冲区大小，用于回填MP4分片头
+#define SD_PATCH_BUF_COUNT 4
+
+typedef struct
+{
+  uint8_t *data;
+  size_t len;
+  uint32_t frames; // 提交时已完整写入缓冲区的帧数
+  long offset;     // 补写的文件位置，-1表示顺序追加
+} sdWriteBuf;
+
+// 日志文件头，后面是ODML_IX_ENTRY字节的标准索引项，帧位置为文件内绝对位置
+typedef struct
+{
+  uint32_t magic;
+  uint8_t fps;
+  uint8_t frameType;
+  uint16_t reserved;
+  char partName[FILE_NAME_LEN]; // 日期时间文件名前缀
+} aviJournalHdr;
+
+static sdWriteBuf l_writeBufs[SD_WRITE_BUF_COUNT];
+static uint8_t *l_dmaBuf = NULL;          // 为NULL时直接从PSRAM写
+static QueueHandle_t l_freeQueue = NULL;  // 空闲缓冲区
+static QueueHandle_t l_fullQueue = NULL;  // 待写入缓冲区，NULL表示刷新标记
+static SemaphoreHandle_t l_flushSemaphore = NULL;
+static sdWriteBuf *l_curBuf = NULL;       // 正在填充的缓冲区
+static uint32_t l_submittedPos;           // 已提交给写入任务的字节数，当前缓冲区从这里开始
+
+// patches of data already appended, e.g. fMP4 fragment headers
+static sdWriteBuf l_patchBufs[SD_PATCH_BUF_COUNT];
+static QueueHandle_t l_patchQueue = NULL; // 空闲补写缓冲区
+static sdWriteBuf *l_pendingPatch = NULL; // 等l_patchReadyPos之前的数据都提交后再交给写入任务
+static uint32_t l_patchReadyPos;
+
+// checkpoints, separate for motion capture and timelapse like the index in avi.c
+// motion capture state is only touched by the writer task while a file is open, timelapse by the timelapse task
+typedef struct
+{
+  FILE *journal;               // 日志文件，NULL表示不做检查点
+  uint32_t frames;             // 已记录到日志的帧数
+  uint32_t lastMs;             // 上次检查点时间
+  uint8_t hdr[AVI_HEADER_LEN]; // 临时AVI头，检查点时更新帧数和长度后写入文件开头
+} aviCheckpoint;
+
+static aviCheckpoint l_ck[2];
+static const char *const l_journalPath[2] = {AVIJOURNAL, TLJOURNAL};
+
+// writer statistics, reset for each file
+static uint32_t l_droppedFrames; // 缓冲区不足丢弃的帧数
+static uint32_t l_stallCnt;      // 写入超过SD_STALL_MS的次数
+static uint32_t l_maxWriteMs;    // 最长单次写入时间
+static uint32_t l_queueHigh;     // 待写入缓冲区个数最大值
+static bool l_writeError;        // 写入失败后不再接收帧
+static uint32_t l_checkpointCnt; // 检查点次数
+static bool l_aviFull;           // RIFF段数达到上限，不再接收帧
+
+/* 写入SD卡，有DMA中转缓冲区时按分配单元拷贝后写入 */
+static size_t writeOut(const uint8_t *data, size_t len)
+{
+  if (!l_dmaBuf)
+  {
+    return fwrite(data, 1, len, aviFile);
+  }
+  size_t done = 0;
+  while (done < len)
+  {
+    size_t n = min(len - done, (size_t)SD_DMA_BUF_SIZE);
+    memcpy(l_dmaBuf, data + done, n);
+    size_t written = fwrite(l_dmaBuf, 1, n, aviFile);
+    done += written;
+    if (written != n)
+    {
+      break;
+    }
+  }
+  return done;
+}
+
+static void journalError(bool isTL)
+{
+  ESP_LOGE(TAG, "Failed to write %s, checkpoints disabled", l_journalPath[isTL]);
+  fclose(l_ck[isTL].journal);
+  l_ck[isTL].journal = NULL;
+}
+
 /**
- * @brief 打开AVI文件进行写入操作
- *
- * 根据当前日期和时间生成文件名，并在对应的日期文件夹中创建AVI文件。
- * 函数会创建日期文件夹（如果不存在），打开文件进行二进制写入，
- * 初始化相关计数器和时间统计，并准备AVI文件头和索引。
- *
- * 注意：文件打开时间会随着SD卡中已有文件数量的增加而增加。
- *
- * @return true - 文件打开成功并完成初始化
- * @return false - 文件打开失败或文件夹创建失败
+ * 检查点：已落盘帧的索引追加到日志，文件开头写入临时头，并同步文件长度和目录项。
+ * 索引项取自内存中当前和上一个标准索引块，写入任务落后不会超过一个索引块的帧数
  */
-bool openAvi()
+static bool writeCheckpoint(FILE *fp, uint32_t frames, bool isTL)
+{
+  aviCheckpoint *ck = &l_ck[isTL];
+  uint32_t n = 1;
+  const uint8_t *last = aviIndexEntries(frames - 1, &n, isTL);
+  if (!last)
+  {
+    journalError(isTL);
+    return false;
+  }
+  uint32_t offset, size;
+  memcpy(&offset, last, 4);
+  memcpy(&size, last + 4, 4);
+  // header is rewritten in place, the file stays playable without index
+  updateAviHdr(ck->hdr, frames, offset + size, isTL);
+  long pos = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  fwrite(ck->hdr, 1, AVI_HEADER_LEN, fp);
+  fseek(fp, pos, SEEK_SET);
+  fsync(fileno(fp));
+  // journal only refers to frames already on the card
+  while (ck->frames < frames)
+  {
+    n = frames - ck->frames;
+    const uint8_t *entries = aviIndexEntries(ck->frames, &n, isTL);
+    if (!entries || fwrite(entries, ODML_IX_ENTRY, n, ck->journal) != n)
+    {
+      journalError(isTL);
+      return false;
+    }
+    ck->frames += n;
+  }
+  if (fflush(ck->journal) != 0)
+  {
+    journalError(isTL);
+    return false;
+  }
+  fsync(fileno(ck->journal));
+  ck->lastMs = esp_timer_get_time() / 1000;
+  return true;
+}
+
+/* 补写之前的数据，完成后同步，补写的内容和它引用的数据一起落盘 */
+static void writePatch(const sdWriteBuf *buf)
+{
+  if (l_writeError)
+  {
+    return;
+  }
+  long pos = ftell(aviFile);
+  if (fseek(aviFile, buf->offset, SEEK_SET) != 0 || writeOut(buf->data, buf->len) != buf->len)
+  {
+    ESP_LOGE(TAG, "SD patch at %ld failed", buf->offset);
+    l_writeError = true;
+  }
+  fseek(aviFile, pos, SEEK_SET);
+  fsync(fileno(aviFile));
+}
+
+static void sdWriterTask(void *parameter)
+{
+  sdWriteBuf *buf;
+  while (true)
+  {
+    xQueueReceive(l_fullQueue, &buf, portMAX_DELAY);
+    if (buf == NULL)
+    {
+      // all earlier buffers are on the card
+      xSemaphoreGive(l_flushSemaphore);
+      continue;
+    }
+    if (buf->offset >= 0)
+    {
+      writePatch(buf);
+      xQueueSend(l_patchQueue, &buf, portMAX_DELAY);
+      continue;
+    }
+    uint32_t wTime = esp_timer_get_time() / 1000;
+    size_t written = l_writeError ? 0 : writeOut(buf->data, buf->len);
+    wTime = esp_timer_get_time() / 1000 - wTime;
+    wTimeTot += wTime;
+    if (wTime > l_maxWriteMs)
+    {
+      l_maxWriteMs = wTime;
+    }
+    if (wTime >= SD_STALL_MS)
+    {
+      l_stallCnt++;
+      ESP_LOGW(TAG, "SD write stalled %lu ms, %u buffers queued", wTime, uxQueueMessagesWaiting(l_fullQueue));
+    }
+    if (written != buf->len && !l_writeError)
+    {
+      ESP_LOGE(TAG, "SD write failed, %u of %u bytes", written, buf->len);
+      l_writeError = true;
+    }
+    uint32_t now = esp_timer_get_time() / 1000;
+    if (!l_writeError && l_ck[0].journal && buf->frames > l_ck[0].frames && now - l_ck[0].lastMs >= AVI_CHECKPOINT_MS)
+    {
+      if (writeCheckpoint(aviFile, buf->frames, false))
+      {
+        l_checkpointCnt++;
+      }
+    }
+    xQueueSend(l_freeQueue, &buf, portMAX_DELAY);
+  }
+}
+
+/* 取一个空闲缓冲区作为当前缓冲区，不等待 */
+static bool nextWriteBuf()
+{
+  if (xQueueReceive(l_freeQueue, &l_curBuf, 0) != pdTRUE)
+  {
+    l_curBuf = NULL;
+    return false;
+  }
+  l_curBuf->len = 0;
+  return true;
+}
+
+/* 当前缓冲区交给写入任务，队列能容纳所有缓冲区，不会阻塞 */
+static void submitWriteBuf()
+{
+  if (!l_curBuf || !l_curBuf->len)
+  {
+    return;
+  }
+  // saveFrame counts a frame after all of its data is appended
+  l_curBuf->frames = frameCnt;
+  l_submittedPos += l_curBuf->len;
+  xQueueSend(l_fullQueue, &l_curBuf, portMAX_DELAY);
+  l_curBuf = NULL;
+  if (l_pendingPatch && l_submittedPos >= l_patchReadyPos)
+  {
+    xQueueSend(l_fullQueue, &l_pendingPatch, portMAX_DELAY);
+    l_pendingPatch = NULL;
+  }
+  uint32_t queued = SD_WRITE_BUF_COUNT - uxQueueMessagesWaiting(l_freeQueue);
+  if (queued > l_queueHigh)
+  {
+    l_queueHigh = queued;
+  }
+}
+
+/* 当前缓冲区剩余空间加上空闲缓冲区，写入任务可能同时归还缓冲区，实际空间只会更多 */
+static size_t writeSpace()
+{
+  return (l_curBuf ? SD_WRITE_BUF_SIZE - l_curBuf->len : 0) + uxQueueMessagesWaiting(l_freeQueue) * SD_WRITE_BUF_SIZE;
+}
+
+/* 顺序追加数据，调用前已用writeSpace确认空间足够 */
+static void appendWrite(const uint8_t *data, size_t len)
+{
+  while (len)
+  {
+    if (!l_curBuf)
+    {
+      nextWriteBuf();
+    }
+    size_t n = min(len, SD_WRITE_BUF_SIZE - l_curBuf->len);
+    memcpy(l_curBuf->data + l_curBuf->len, data, n);
+    l_curBuf->len += n;
+    data += n;
+    len -= n;
+    if (l_curBuf->len == SD_WRITE_BUF_SIZE)
+    {
+      submitWriteBuf();
+    }
+  }
+}
+
+/* 已追加的字节数 */
+static uint32_t appendPos()
+{
+  return l_submittedPos + (l_curBuf ? l_curBuf->len : 0);
+}
+
+/**
+ * 修改已追加的数据：还在当前缓冲区的部分直接修改，
+ * 已提交的部分由写入任务补写，并且要等readyPos之前的数据都提交后才补写，
+ * 保证补写的内容落盘时它引用的数据已经在SD卡上
+ */
+static void patchWrite(uint32_t offset, const uint8_t *data, size_t len, uint32_t readyPos)
+{
+  if (offset + len > l_submittedPos)
+  {
+    size_t skip = offset < l_submittedPos ? l_submittedPos - offset : 0;
+    memcpy(l_curBuf->data + offset + skip - l_submittedPos, data + skip, len - skip);
+    len = skip;
+  }
+  if (!len)
+  {
+    return;
+  }
+  if (l_pendingPatch)
+  {
+    xQueueSend(l_fullQueue, &l_pendingPatch, portMAX_DELAY);
+    l_pendingPatch = NULL;
+  }
+  sdWriteBuf *patch;
+  // only waits when the writer is several patches behind
+  xQueueReceive(l_patchQueue, &patch, portMAX_DELAY);
+  memcpy(patch->data, data, len);
+  patch->len = len;
+  patch->offset = offset;
+  if (l_submittedPos >= readyPos)
+  {
+    xQueueSend(l_fullQueue, &patch, portMAX_DELAY);
+  }
+  else
+  {
+    l_pendingPatch = patch;
+    l_patchReadyPos = readyPos;
+  }
+}
+
+/* 等待所有已提交的数据写入SD卡 */
+static void flushWriter()
+{
+  sdWriteBuf *marker = NULL;
+  if (l_curBuf && !l_curBuf->len)
+  {
+    xQueueSend(l_freeQueue, &l_curBuf, 0);
+    l_curBuf = NULL;
+  }
+  submitWriteBuf();
+  xQueueSend(l_fullQueue, &marker, portMAX_DELAY);
+  xSemaphoreTake(l_flushSemaphore, portMAX_DELAY);
+}
+
+static bool sdWriterInit()
+{
+  l_freeQueue = xQueueCreate(SD_WRITE_BUF_COUNT, sizeof(sdWriteBuf *));
+  l_fullQueue = xQueueCreate(SD_WRITE_BUF_COUNT + SD_PATCH_BUF_COUNT + 1, sizeof(sdWriteBuf *));
+  l_patchQueue = xQueueCreate(SD_PATCH_BUF_COUNT, sizeof(sdWriteBuf *));
+  l_flushSemaphore = xSemaphoreCreateBinary();
+  if (!l_freeQueue || !l_fullQueue || !l_patchQueue || !l_flushSemaphore)
+  {
+    ESP_LOGE(TAG, "Failed to create SD writer queues");
+    return false;
+  }
+  for (int i = 0; i < SD_WRITE_BUF_COUNT; i++)
+  {
+    l_writeBufs[i].data = heap_caps_malloc(SD_WRITE_BUF_SIZE, MALLOC_CAP_SPIRAM);
+    if (!l_writeBufs[i].data)
+    {
+      ESP_LOGE(TAG, "Failed to allocate SD write buffer");
+      return false;
+    }
+    l_writeBufs[i].offset = -1;
+    sdWriteBuf *buf = &l_writeBufs[i];
+    xQueueSend(l_freeQueue, &buf, 0);
+  }
+  for (int i = 0; i < SD_PATCH_BUF_COUNT; i++)
+  {
+    l_patchBufs[i].data = heap_caps_malloc(SD_PATCH_BUF_SIZE, MALLOC_CAP_SPIRAM);
+    if (!l_patchBufs[i].data)
+    {
+      ESP_LOGE(TAG, "Failed to allocate SD patch buffer");
+      return false;
+    }
+    sdWriteBuf *buf = &l_patchBufs[i];
+    xQueueSend(l_patchQueue, &buf, 0);
+  }
+  l_dmaBuf = heap_caps_malloc(SD_DMA_BUF_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+  if (!l_dmaBuf)
+  {
+    ESP_LOGW(TAG, "No internal DMA buffer, writing from PSRAM");
+  }
+  return xTaskCreate(&sdWriterTask, "sdWriter", WRITER_STACK_SIZE, NULL, WRITER_PRI, NULL) == pdPASS;
+}
+
+/* 创建日志文件并写入文件头，失败时录像照常进行，只是断电后无法恢复 */
+static void openJournal(bool isTL, uint8_t fps, uint8_t frameType, const char *name)
+{
+  aviCheckpoint *ck = &l_ck[isTL];
+  ck->frames = 0;
+  ck->lastMs = esp_timer_get_time() / 1000;
+  ck->journal = fopen(l_journalPath[isTL], "wb");
+  if (ck->journal)
+  {
+    aviJournalHdr jh = {.magic = JOURNAL_MAGIC, .fps = fps, .frameType = frameType};
+    strncpy(jh.partName, name, sizeof(jh.partName) - 1);
+    if (fwrite(&jh, sizeof(jh), 1, ck->journal) == 1 && fflush(ck->journal) == 0)
+    {
+      fsync(fileno(ck->journal));
+      return;
+    }
+    fclose(ck->journal);
+    ck->journal = NULL;
+  }
+  ESP_LOGW(TAG, "No %s, recording cannot be recovered after power loss", l_journalPath[isTL]);
+}
+
+static void closeJournal(bool isTL)
+{
+  if (l_ck[isTL].journal)
+  {
+    fclose(l_ck[isTL].journal);
+    l_ck[isTL].journal = NULL;
+  }
+}
+
+/* 按帧率、最长时长和平均帧大小估算文件大小，按写入缓冲区大小（分配单元的整数倍）向上取整 */
+static size_t preallocSize()
+{
+  uint32_t frameSize = l_avgFrameSize;
+  if (!frameSize)
+  {
+    // no recording yet, assume about 1 bit per pixel
+    framesize_t fs = get_camera_frame_size();
+    frameSize = frameData[fs].frameWidth * frameData[fs].frameHeight / 8;
+  }
+  uint64_t frames = min((uint64_t)l_FPS * l_maxSeconds, (uint64_t)MAXFRAMES);
+  uint64_t size = AVI_HEADER_LEN + frames * (frameSize + CHUNK_HDR + ODML_IX_ENTRY);
+  size += size / 8; // frame size varies with scene content
+  uint64_t maxSize = (uint64_t)getSDFreeSpace() * 1024 / PREALLOC_FREE_SHARE;
+  if (maxSize > PREALLOC_MAX)
+  {
+    maxSize = PREALLOC_MAX;
+  }
+  if (size > maxSize)
+  {
+    size = maxSize;
+  }
+  if (size < PREALLOC_MIN)
+  {
+    return 0;
+  }
+  return (size + SD_WRITE_BUF_SIZE - 1) & ~(uint64_t)(SD_WRITE_BUF_SIZE - 1);
+}
+
+/* 打开临时文件，优先使用已预分配的备用文件，其次当场预分配连续簇，失败时退回普通方式 */
+static FILE *openRecordTemp(const char *path)
+{
+  remove(path);
+  FILE *fp = NULL;
+  // spare is skipped while it is still being allocated, rather than waiting for it
+  if (xSemaphoreTake(l_spareMutex, 0) == pdTRUE)
+  {
+    if (rename(RECSPARE, path) == 0)
+    {
+      fp = fopen(path, "r+b");
+      ESP_LOGI(TAG, "Using preallocated spare file");
+    }
+    xSemaphoreGive(l_spareMutex);
+    if (!fp)
+    {
+      remove(path);
+    }
+  }
+  size_t size = fp ? 0 : preallocSize();
+  if (size)
+  {
+    esp_err_t ret = esp_vfs_fat_create_contiguous_file(SD_MOUNT_POINT, path, size, true);
+    if (ret == ESP_OK)
+    {
+      // keep the allocated clusters, data is overwritten from the start and truncated on close
+      fp = fopen(path, "r+b");
+      ESP_LOGI(TAG, "Preallocated %s contiguous", fmtSize(size));
+    }
+    else
+    {
+      ESP_LOGW(TAG, "Preallocating %s failed: %s", fmtSize(size), esp_err_to_name(ret));
+      remove(path);
+    }
+  }
+  if (!fp)
+  {
+    fp = fopen(path, "wb+");
+  }
+  if (fp)
+  {
+    // writer task and index writes are large, bypass stdio so each write goes straight to whole clusters
+    setvbuf(fp, NULL, _IONBF, 0);
+  }
+  return fp;
+}
+
+bool prepareSpareFile(void)
+{
+  if (access(RECSPARE, F_OK) == 0)
+  {
+    return true;
+  }
+  size_t size = preallocSize();
+  if (!size)
+  {
+    return false;
+  }
+  uint32_t pTime = esp_timer_get_time() / 1000;
+  xSemaphoreTake(l_spareMutex, portMAX_DELAY);
+  esp_err_t ret = esp_vfs_fat_create_contiguous_file(SD_MOUNT_POINT, RECSPARE, size, true);
+  if (ret != ESP_OK)
+  {
+    remove(RECSPARE);
+  }
+  xSemaphoreGive(l_spareMutex);
+  if (ret != ESP_OK)
+  {
+    ESP_LOGW(TAG, "Preallocating spare %s failed: %s", fmtSize(size), esp_err_to_name(ret));
+    return false;
+  }
+  ESP_LOGI(TAG, "Preallocated spare %s in %lu ms", fmtSize(size), esp_timer_get_time() / 1000 - pTime);
+  return true;
+}
+
+/* 创建日期文件夹和临时文件，重置统计，取第一个写入缓冲区，AVI和MP4共用 */
+static bool openRecordFile(const char *tempPath, uint32_t preRollMs)
 {
   // derive filename from date & time, store in date folder
   // time to open a new file on SD increases with the number of files already present
@@ -254,8 +765,8 @@ bool openAvi()
     }
   }
   dateFormat(partName, sizeof(partName), false);
-  // open avi file with temporary name
-  aviFile = fopen(AVITEMP, "wb+");
+  // open file with temporary name
+  aviFile = openRecordTemp(tempPath);
   if (aviFile == NULL)
   {
     ESP_LOGE(TAG, "Failed to open file for writing");
@@ -263,76 +774,192 @@ bool openAvi()
   }
   oTime = esp_timer_get_time() / 1000 - oTime;
   ESP_LOGI(TAG, "File opening time: %ums", oTime);
+  // initialisation of counters
+  startTime = esp_timer_get_time() / 1000 - preRollMs;
+  frameCnt = fTimeTot = wTimeTot = dTimeTot = vidSize = 0;
+  l_droppedFrames = l_stallCnt = l_maxWriteMs = l_queueHigh = l_checkpointCnt = 0;
+  l_writeError = l_aviFull = false;
+  l_submittedPos = 0;
+  // allot space for file header, all buffers are free after the previous close
+  if (!nextWriteBuf())
+  {
+    ESP_LOGE(TAG, "No SD write buffer");
+    fclose(aviFile);
+    aviFile = NULL;
+    return false;
+  }
+  fsizePtr = get_camera_frame_size();
+  return true;
+}
+
+/**
+ * @brief 打开AVI文件进行写入操作
+ *
+ * 根据当前日期和时间生成文件名，并在对应的日期文件夹中创建AVI文件。
+ * 函数会创建日期文件夹（如果不存在），打开文件进行二进制写入，
+ * 初始化相关计数器和时间统计，并准备AVI文件头和索引。
+ *
+ * 临时文件按估算大小预分配为连续簇，录制过程中不再分配簇、不再更新FAT表，写入速度稳定；
+ * 空间不足或找不到连续空间时退回普通方式，closeAvi时截断到实际大小。
+ *
+ * 注意：文件打开时间会随着SD卡中已有文件数量的增加而增加。
+ *
+ * @param preRollMs 随后写入的预录帧覆盖的时长，录像开始时间相应提前，保证帧率统计正确
+ *
+ * @return true - 文件打开成功并完成初始化
+ * @return false - 文件打开失败或文件夹创建失败
+ */
+bool openAvi(uint32_t preRollMs)
+{
+  if (!openRecordFile(AVITEMP, preRollMs))
+  {
+    return false;
+  }
 #if INCLUDE_AUDIO
   startAudio();
 #endif
 #if INCLUDE_TELEM
   haveSrt = startTelemetry();
 #endif
-  // initialisation of counters
-  startTime = esp_timer_get_time() / 1000;
-  frameCnt = fTimeTot = wTimeTot = dTimeTot = vidSize = 0;
-  highPoint = AVI_HEADER_LEN; // allot space for AVI header
-  fsizePtr = get_camera_frame_size();
+  // provisional header without frames, completed by the checkpoints
   prepAviIndex(false);
+  xSemaphoreTake(aviMutex, portMAX_DELAY);
+  buildAviHdr(l_FPS, fsizePtr, 0, false);
+  memcpy(l_ck[0].hdr, aviHeader, AVI_HEADER_LEN);
+  xSemaphoreGive(aviMutex);
+  memcpy(l_curBuf->data, l_ck[0].hdr, AVI_HEADER_LEN);
+  l_curBuf->len = AVI_HEADER_LEN;
+  openJournal(false, l_FPS, fsizePtr, partName);
   return true;
 }
 
+/* 当前标准索引块追加到movi列表中，超级索引记录它的位置 */
+static void appendAviIndexChunk()
+{
+  const uint8_t *chunk;
+  uint32_t len = aviIndexChunk(&chunk, false);
+  appendWrite(chunk, len);
+}
+
+/* 结束当前RIFF段并开始新的AVIX段，段数达到上限返回false */
+static bool startAviRiff()
+{
+  uint8_t riff[ODML_RIFF_HDR];
+  appendAviIndexChunk();
+  if (!aviNewRiff(riff, false))
+  {
+    return false;
+  }
+  appendWrite(riff, ODML_RIFF_HDR);
+  return true;
+}
+
+/**
+ * 写入最后一个标准索引块，截断预分配的多余空间，再回填各AVIX段长度和文件头，
+ * closeAvi和断电恢复共用，调用前文件内容已写到aviFileLen()
+ */
+static void finishAvi(FILE *fp, uint8_t fps, uint8_t frameType, uint32_t frames, bool isTL)
+{
+  const uint8_t *chunk;
+  uint8_t riff[ODML_RIFF_HDR];
+  uint32_t pos;
+  fseek(fp, aviFileLen(isTL), SEEK_SET);
+  uint32_t len = aviIndexChunk(&chunk, isTL);
+  if (len)
+  {
+    fwrite(chunk, 1, len, fp);
+  }
+  // release preallocated clusters beyond the recorded data
+  fflush(fp);
+  if (ftruncate(fileno(fp), aviFileLen(isTL)) != 0)
+  {
+    ESP_LOGW(TAG, "Failed to truncate AVI to %lu bytes", aviFileLen(isTL));
+  }
+  for (uint8_t seg = 1; (pos = aviRiffHdr(seg, riff, isTL)) > 0; seg++)
+  {
+    fseek(fp, pos, SEEK_SET);
+    fwrite(riff, 1, ODML_RIFF_HDR, fp);
+  }
+  // save avi header at start of file
+  xSemaphoreTake(aviMutex, portMAX_DELAY);
+  buildAviHdr(fps, frameType, frames, isTL);
+  fseek(fp, 0, SEEK_SET);
+  fwrite(aviHeader, 1, AVI_HEADER_LEN, fp);
+  xSemaphoreGive(aviMutex);
+}
+
 /**
  * 保存帧数据到SD卡
  *
- * 将JPEG帧数据写入AVI文件，处理缓冲区管理和帧索引构建
+ * 将JPEG帧数据拷贝到SD写入缓冲区并构建帧索引，由写入任务异步写入AVI文件，调用方不会被SD卡阻塞
  *
  * @param frame_buf 帧数据缓冲区指针，包含JPEG编码的图像数据
  * @param len 帧数据长度（字节数）
  *
- * @note 函数会自动处理4字节对齐，添加AVI帧头，并管理环形缓冲区
- * @note 会记录写入SD卡的时间消耗和总处理时间
+ * @return true - 帧已进入写入队列
+ * @return false - 写入缓冲区不足（SD卡卡顿）或写入出错，整帧丢弃
+ *
+ * @note 函数会自动处理4字节对齐，添加AVI帧头
+ * @note 每ODML_IX_ENTRIES帧在movi中插入一个标准索引块，RIFF段将超过ODML_RIFF_MAX时开始新的AVIX段
+ * @note 会记录缓冲时间，写入时间、卡顿次数、缓冲区高水位和丢帧数在closeAvi时输出
  */
-void saveFrame(uint8_t *frame_buf, size_t len)
+bool saveFrame(uint8_t *frame_buf, size_t len)
 {
-  // save frame on SD card
+  // queue frame for the SD writer task
+  static const uint8_t zeros[4] = {0};
   uint32_t fTime = esp_timer_get_time() / 1000;
   // align end of jpeg on 4 byte boundary for AVI
   uint16_t filler = (4 - (len & 0x00000003)) & 0x00000003;
   size_t jpegSize = len + filler;
-  // add avi frame header
-  memcpy(iSDbuffer + highPoint, dcBuf, 4);
-  memcpy(iSDbuffer + highPoint + 4, &jpegSize, 4);
-  highPoint += CHUNK_HDR;
-  if (highPoint >= RAMSIZE)
+  if (l_writeError || l_aviFull)
+  {
+    return false;
+  }
+  // leave room for an index chunk and the header of a new RIFF
+  if (writeSpace() < jpegSize + CHUNK_HDR + ODML_IX_LEN(ODML_IX_ENTRIES) + ODML_RIFF_HDR)
+  {
+    // SD card is behind, drop the whole frame so the file stays consistent
+    l_droppedFrames++;
+    ESP_LOGD(TAG, "SD writer busy, frame dropped");
+    return false;
+  }
+  if (aviRiffFull(jpegSize + CHUNK_HDR, false) && !startAviRiff())
   {
-    // marker overflows buffer
-    highPoint -= RAMSIZE;
-    fwrite(iSDbuffer, 1, RAMSIZE, aviFile);
-    // push overflow to buffer start
-    memcpy(iSDbuffer, iSDbuffer + RAMSIZE, highPoint);
+    // recorder closes the file
+    ESP_LOGW(TAG, "AVI size limit reached");
+    l_aviFull = true;
+    return false;
   }
+  // add avi frame header
+  uint8_t hdr[CHUNK_HDR];
+  memcpy(hdr, dcBuf, 4);
+  memcpy(hdr + 4, &jpegSize, 4);
+  appendWrite(hdr, CHUNK_HDR);
   // add frame content
-  size_t jpegRemain = jpegSize;
-  uint32_t wTime = esp_timer_get_time() / 1000;
-  while (jpegRemain >= RAMSIZE - highPoint)
-  {
-    // write to SD when RAMSIZE is filled in buffer
-    memcpy(iSDbuffer + highPoint, frame_buf + jpegSize - jpegRemain, RAMSIZE - highPoint);
-    fwrite(iSDbuffer, 1, RAMSIZE, aviFile);
-    jpegRemain -= RAMSIZE - highPoint;
-    highPoint = 0;
-  }
-  wTime = esp_timer_get_time() / 1000 - wTime;
-  wTimeTot += wTime;
-  ESP_LOGD(TAG, "storage write to sdcard cost %u ms", wTime);
-  // whats left or small frame
-  memcpy(iSDbuffer + highPoint, frame_buf + jpegSize - jpegRemain, jpegRemain);
-  highPoint += jpegRemain;
+  appendWrite(frame_buf, len);
+  appendWrite(zeros, filler);
 
   buildAviIdx(jpegSize, true, false); // save avi index for frame
   vidSize += jpegSize + CHUNK_HDR;
   frameCnt++;
-  fTime = esp_timer_get_time() / 1000 - fTime - wTime;
+  if (aviIndexFull(false))
+  {
+    appendAviIndexChunk();
+  }
+  fTime = esp_timer_get_time() / 1000 - fTime;
   fTimeTot += fTime;
-  ESP_LOGD(TAG, "Frame saving time %u ms", fTime);
-  ESP_LOGD(TAG, "============================");
+  ESP_LOGD(TAG, "Frame buffering time %u ms", fTime);
+  return true;
+}
+
+bool isAviFull(void)
+{
+  return frameCnt >= MAXFRAMES || l_aviFull;
+}
+
+bool isWriteStopped(void)
+{
+  return l_writeError || l_aviFull;
 }
 
 /**
@@ -358,12 +985,13 @@ bool closeAvi(char *fileName)
   uint32_t vidDurationSecs = lround(vidDuration / 1000.0);
 
   cTime = esp_timer_get_time() / 1000;
-  // write remaining frame content to SD
-  fwrite(iSDbuffer, 1, highPoint, aviFile);
-  size_t readLen = 0;
+  // wait for the writer task to put remaining frame content on SD
+  flushWriter();
+  closeJournal(false);
   bool haveWav = false;
 #if INCLUDE_AUDIO
   // add wav file if exists
+  size_t readLen = 0;
   finishAudio(true);
   haveWav = haveWavFile();
   if (haveWav)
@@ -375,24 +1003,14 @@ bool closeAvi(char *fileName)
     } while (readLen > 0);
   }
 #endif
-  // save avi index
-  finalizeAviIndex(frameCnt, false);
-  do
+  if (frameCnt)
   {
-    readLen = writeAviIndex(iSDbuffer, RAMSIZE, false);
-    if (readLen)
-    {
-      fwrite(iSDbuffer, 1, readLen, aviFile);
-    }
-  } while (readLen > 0);
-  // save avi header at start of file
+    l_avgFrameSize = vidSize / frameCnt;
+  }
+  // save last index chunk and avi header
   float actualFPS = (1000.0f * (float)frameCnt) / ((float)vidDuration);
   uint8_t actualFPSint = (uint8_t)(lround(actualFPS));
-  xSemaphoreTake(aviMutex, portMAX_DELAY);
-  buildAviHdr(actualFPSint, fsizePtr, frameCnt, false);
-  xSemaphoreGive(aviMutex);
-  fseek(aviFile, 0, SEEK_SET);
-  fwrite(aviHeader, 1, AVI_HEADER_LEN, aviFile);
+  finishAvi(aviFile, actualFPSint, fsizePtr, frameCnt, false);
   fclose(aviFile);
   uint32_t hTime = esp_timer_get_time() / 1000;
   ESP_LOGI(TAG, "Final SD storage time %lu ms", (hTime - cTime));
@@ -409,6 +1027,7 @@ bool closeAvi(char *fileName)
     {
       ESP_LOGI(TAG, "Rename %s to %s: %d", AVITEMP, aviFileName);
     }
+    remove(AVIJOURNAL);
     if (fileName)
     {
       strcpy(fileName, aviFileName);
@@ -432,7 +1051,9 @@ bool closeAvi(char *fileName)
       ESP_LOGI(TAG, "Average frame buffering time: %u ms", fTimeTot / frameCnt);
       ESP_LOGI(TAG, "Average frame storage time: %u ms", wTimeTot / frameCnt);
     }
-    ESP_LOGI(TAG, "Average SD write speed: %u kB/s", ((vidSize / wTimeTot) * 1000) / 1024);
+    ESP_LOGI(TAG, "Average SD write speed: %u kB/s", ((vidSize / (wTimeTot ? wTimeTot : 1)) * 1000) / 1024);
+    ESP_LOGI(TAG, "SD writer: %u/%u buffers high watermark, %u stalls over %u ms, longest write %u ms, %u frames dropped, %u checkpoints",
+             l_queueHigh, SD_WRITE_BUF_COUNT, l_stallCnt, SD_STALL_MS, l_maxWriteMs, l_droppedFrames, l_checkpointCnt);
     ESP_LOGI(TAG, "File open / completion times: %u ms / %u ms", oTime, cTime);
     ESP_LOGI(TAG, "Busy: %u%%", min(100 * (wTimeTot + fTimeTot + dTimeTot + oTime + cTime) / vidDuration, (uint32_t)100));
     checkMemory("closeAvi");
@@ -462,12 +1083,328 @@ bool closeAvi(char *fileName)
   {
     // delete too small files if exist
     remove(AVITEMP);
+    remove(AVIJOURNAL);
     ESP_LOGI(TAG, "Insufficient capture duration: %u secs", vidDurationSecs);
     return false;
   }
 }
 
+/************   Timelapse ***********************/
+// one frame per interval appended to a long-running AVI with the timelapse index of avi.c,
+// written directly by the caller: a frame every few seconds does not need the SD writer task,
+// which stays free for motion capture running at the same time
+#define TL_CHECKPOINT_MS 30000 // 延时摄影检查点间隔，帧间隔更长时每帧都做检查点
+
+static FILE *l_tlFile = NULL;
+static char l_tlPartName[FILE_NAME_LEN]; // 日期时间文件名前缀
+static framesize_t l_tlFrameType;
+static uint8_t l_tlFPS;                  // 播放帧率
+static uint32_t l_tlFrames;              // 当前文件总帧数
+static uint32_t l_tlSize;                // 当前文件视频总大小
+static bool l_tlFull;                    // RIFF段数达到上限或写入出错，不再接收帧
+
+bool openTimelapse(uint8_t playFPS)
+{
+  dateFormat(l_tlPartName, sizeof(l_tlPartName), true);
+  if (access(l_tlPartName, F_OK) != 0 && mkdir(l_tlPartName, 0777) != 0)
+  {
+    ESP_LOGE(TAG, "Failed to create date folder");
+    return false;
+  }
+  dateFormat(l_tlPartName, sizeof(l_tlPartName), false);
+  remove(TLTEMP);
+  l_tlFile = fopen(TLTEMP, "wb+");
+  if (!l_tlFile)
+  {
+    ESP_LOGE(TAG, "Failed to open %s", TLTEMP);
+    return false;
+  }
+  // frames go straight to the card, the chunk headers are absorbed by the FAT sector buffer
+  setvbuf(l_tlFile, NULL, _IONBF, 0);
+  l_tlFPS = playFPS ? playFPS : 1;
+  l_tlFrameType = get_camera_frame_size();
+  l_tlFrames = l_tlSize = 0;
+  l_tlFull = false;
+  prepAviIndex(true);
+  xSemaphoreTake(aviMutex, portMAX_DELAY);
+  buildAviHdr(l_tlFPS, l_tlFrameType, 0, true);
+  memcpy(l_ck[1].hdr, aviHeader, AVI_HEADER_LEN);
+  xSemaphoreGive(aviMutex);
+  if (fwrite(l_ck[1].hdr, 1, AVI_HEADER_LEN, l_tlFile) != AVI_HEADER_LEN)
+  {
+    ESP_LOGE(TAG, "Failed to write %s", TLTEMP);
+    fclose(l_tlFile);
+    l_tlFile = NULL;
+    remove(TLTEMP);
+    return false;
+  }
+  openJournal(true, l_tlFPS, l_tlFrameType, l_tlPartName);
+  ESP_LOGI(TAG, "Started timelapse %s at %u fps playback", l_tlPartName, l_tlFPS);
+  return true;
+}
+
+/* 当前标准索引块写入延时摄影文件 */
+static bool writeTimelapseIndex()
+{
+  const uint8_t *chunk;
+  uint32_t len = aviIndexChunk(&chunk, true);
+  return fwrite(chunk, 1, len, l_tlFile) == len;
+}
+
+bool saveTimelapseFrame(const uint8_t *frame_buf, size_t len)
+{
+  static const uint8_t zeros[4] = {0};
+  if (!l_tlFile || l_tlFull)
+  {
+    return false;
+  }
+  uint16_t filler = (4 - (len & 0x00000003)) & 0x00000003;
+  uint32_t jpegSize = len + filler;
+  uint8_t hdr[ODML_RIFF_HDR];
+  bool ok = true;
+  if (aviRiffFull(jpegSize + CHUNK_HDR, true))
+  {
+    ok = writeTimelapseIndex();
+    if (ok && !aviNewRiff(hdr, true))
+    {
+      ESP_LOGW(TAG, "Timelapse size limit reached");
+      l_tlFull = true;
+      return false;
+    }
+    ok = ok && fwrite(hdr, 1, ODML_RIFF_HDR, l_tlFile) == ODML_RIFF_HDR;
+  }
+  memcpy(hdr, dcBuf, 4);
+  memcpy(hdr + 4, &jpegSize, 4);
+  ok = ok && fwrite(hdr, 1, CHUNK_HDR, l_tlFile) == CHUNK_HDR && fwrite(frame_buf, 1, len, l_tlFile) == len &&
+       fwrite(zeros, 1, filler, l_tlFile) == filler;
+  if (!ok)
+  {
+    // index no longer matches the file, keep what the last checkpoint covers
+    ESP_LOGE(TAG, "Timelapse write failed");
+    l_tlFull = true;
+    return false;
+  }
+  buildAviIdx(jpegSize, true, true);
+  l_tlSize += jpegSize + CHUNK_HDR;
+  l_tlFrames++;
+  if (aviIndexFull(true) && !writeTimelapseIndex())
+  {
+    ESP_LOGE(TAG, "Timelapse write failed");
+    l_tlFull = true;
+  }
+  if (l_ck[1].journal && esp_timer_get_time() / 1000 - l_ck[1].lastMs >= TL_CHECKPOINT_MS)
+  {
+    writeCheckpoint(l_tlFile, l_tlFrames, true);
+  }
+  return true;
+}
+
+bool isTimelapseFull(void)
+{
+  return l_tlFrames >= MAXFRAMES || l_tlFull;
+}
+
+bool closeTimelapse(char *fileName)
+{
+  if (!l_tlFile)
+  {
+    return false;
+  }
+  uint32_t tTime = esp_timer_get_time() / 1000;
+  closeJournal(true);
+  finishAvi(l_tlFile, l_tlFPS, l_tlFrameType, l_tlFrames, true);
+  fclose(l_tlFile);
+  l_tlFile = NULL;
+  if (!l_tlFrames)
+  {
+    remove(TLTEMP);
+    remove(TLJOURNAL);
+    ESP_LOGI(TAG, "Discard empty timelapse");
+    return false;
+  }
+  // named like a recording, with playback fps and duration, suffix marks timelapse
+  char tlFileName[FILE_NAME_LEN] = {0};
+  uint32_t durationSecs = lround((float)l_tlFrames / l_tlFPS);
+  snprintf(tlFileName, FILE_NAME_LEN - 1, "%s_%ux%u_%u_%lu_T.%s", l_tlPartName, frameData[l_tlFrameType].frameWidth,
+           frameData[l_tlFrameType].frameHeight, l_tlFPS, durationSecs, AVI_EXT);
+  if (rename(TLTEMP, tlFileName) != 0)
+  {
+    ESP_LOGE(TAG, "Rename %s to %s failed", TLTEMP, tlFileName);
+  }
+  remove(TLJOURNAL);
+  if (fileName)
+  {
+    strcpy(fileName, tlFileName);
+  }
+  ESP_LOGI(TAG, "Recorded timelapse %s: %u frames, %s, closed in %lu ms", tlFileName, l_tlFrames, fmtSize(l_tlSize),
+           esp_timer_get_time() / 1000 - tTime);
+  if (!checkFreeStorage())
+    doRecording = false;
+  return true;
+}
+
+/************   MP4 recording ***********************/
+// fragmented MP4: each fragment is a moof written into space reserved ahead of its mdat,
+// so only the current fragment's sample sizes are kept in memory
+#define MP4TEMP SD_MOUNT_POINT "/current.mp4"
+#define MP4_MAX_SAMPLES 128                            // 每个分片最多帧数，决定分片开头预留的moof空间
+#define MP4_HOLE_LEN (FMP4_MOOF_SIZE(MP4_MAX_SAMPLES) + FMP4_BOX_HDR) // moof加至少一个free box头
+#define MP4_PATCH_LEN (MP4_HOLE_LEN + FMP4_BOX_HDR)   // 预留空间加mdat头
+#define MP4_INIT_LEN 1024                              // 初始化段（ftyp + moov）最大字节数
+_Static_assert(MP4_PATCH_LEN <= SD_PATCH_BUF_SIZE, "fragment header does not fit a patch buffer");
+
+static fmp4Sample l_samples[MP4_MAX_SAMPLES]; // 当前分片每帧的大小和时长
+static uint32_t l_sampleCnt;                  // 当前分片帧数，0表示没有打开的分片
+static uint32_t l_fragSeq;                    // 分片序号
+static uint32_t l_fragPos;                    // 当前分片在文件中的位置
+static uint32_t l_fragBytes;                  // 当前分片mdat数据字节数
+static uint32_t l_fragStartTs;                // 当前分片第一帧时间戳 ms
+static uint32_t l_lastTs;                     // 上一帧时间戳 ms
+static uint64_t l_decodeTime;                 // 之前所有分片的总时长 ms
+static uint32_t l_mp4Frames;                  // 当前文件总帧数
+static uint32_t l_fragMs = 2000;              // 分片时长 ms
+static uint8_t l_mp4Patch[MP4_PATCH_LEN];     // 分片头，只在录像任务中使用
+
+/* 结束当前分片，生成moof和mdat头，回填到分片开头预留的位置 */
+static void closeFragment(uint32_t lastDuration)
+{
+  if (!l_sampleCnt)
+  {
+    return;
+  }
+  l_samples[l_sampleCnt - 1].duration = lastDuration;
+  memset(l_mp4Patch, 0, sizeof(l_mp4Patch));
+  size_t moofLen = fmp4_moof(l_mp4Patch, l_fragSeq, l_decodeTime, l_samples, l_sampleCnt, MP4_PATCH_LEN);
+  fmp4_box_header(l_mp4Patch + moofLen, MP4_HOLE_LEN - moofLen, "free");
+  fmp4_box_header(l_mp4Patch + MP4_HOLE_LEN, FMP4_BOX_HDR + l_fragBytes, "mdat");
+  patchWrite(l_fragPos, l_mp4Patch, MP4_PATCH_LEN, appendPos());
+  for (uint32_t i = 0; i < l_sampleCnt; i++)
+  {
+    l_decodeTime += l_samples[i].duration;
+  }
+  l_sampleCnt = 0;
+}
+
+/* 开始新分片，先写入占位：free box加一直到文件结尾的mdat，边写边读的播放器会跳过未完成的分片 */
+static void startFragment(uint32_t timestamp)
+{
+  memset(l_mp4Patch, 0, sizeof(l_mp4Patch));
+  fmp4_box_header(l_mp4Patch, MP4_HOLE_LEN, "free");
+  fmp4_box_header(l_mp4Patch + MP4_HOLE_LEN, 0, "mdat");
+  l_fragPos = appendPos();
+  appendWrite(l_mp4Patch, MP4_PATCH_LEN);
+  l_fragSeq++;
+  l_fragBytes = 0;
+  l_fragStartTs = timestamp;
+}
+
+bool openMp4(uint32_t preRollMs)
+{
+  if (!openRecordFile(MP4TEMP, preRollMs))
+  {
+    return false;
+  }
+  size_t len = fmp4_init_segment(l_curBuf->data, MP4_INIT_LEN, frameData[fsizePtr].frameWidth, frameData[fsizePtr].frameHeight);
+  l_curBuf->len = len;
+  l_sampleCnt = l_fragSeq = l_mp4Frames = 0;
+  l_decodeTime = 0;
+  // fragments are self-describing, the journal only keeps the name for recovery
+  openJournal(false, l_FPS, fsizePtr, partName);
+  closeJournal(false);
+  return true;
+}
+
+bool saveMp4Frame(uint8_t *frame_buf, size_t len, uint32_t timestamp)
+{
+  uint32_t fTime = esp_timer_get_time() / 1000;
+  bool newFragment = !l_sampleCnt || l_sampleCnt == MP4_MAX_SAMPLES || timestamp - l_fragStartTs >= l_fragMs;
+  if (l_writeError || writeSpace() < len + (newFragment ? MP4_PATCH_LEN : 0))
+  {
+    // SD card is behind, the next frame's timestamp covers the gap
+    l_droppedFrames++;
+    ESP_LOGD(TAG, "SD writer busy, frame dropped");
+    return false;
+  }
+  // duration of the previous frame is known once this one arrives
+  uint32_t duration = l_sampleCnt ? timestamp - l_lastTs : 0;
+  if (newFragment)
+  {
+    closeFragment(duration);
+    startFragment(timestamp);
+  }
+  else
+  {
+    l_samples[l_sampleCnt - 1].duration = duration;
+  }
+  appendWrite(frame_buf, len);
+  l_samples[l_sampleCnt].size = len;
+  l_samples[l_sampleCnt].duration = 0;
+  l_sampleCnt++;
+  l_fragBytes += len;
+  l_lastTs = timestamp;
+  l_mp4Frames++;
+  vidSize += len;
+  fTime = esp_timer_get_time() / 1000 - fTime;
+  fTimeTot += fTime;
+  return true;
+}
+
+bool closeMp4(char *fileName)
+{
+  cTime = esp_timer_get_time() / 1000;
+  closeFragment(1000 / (l_FPS ? l_FPS : 1));
+  flushWriter();
+  long mp4Len = ftell(aviFile);
+  if (mp4Len > 0 && ftruncate(fileno(aviFile), mp4Len) != 0)
+  {
+    ESP_LOGW(TAG, "Failed to truncate %s to %ld bytes", MP4TEMP, mp4Len);
+  }
+  fclose(aviFile);
+  aviFile = NULL;
+  if (l_mp4Frames)
+  {
+    l_avgFrameSize = vidSize / l_mp4Frames;
+  }
+  uint32_t durationSecs = lround(l_decodeTime / 1000.0);
+  if (durationSecs < MIN_SECIBDS)
+  {
+    remove(MP4TEMP);
+    remove(AVIJOURNAL);
+    ESP_LOGI(TAG, "Insufficient capture duration: %u secs", durationSecs);
+    return false;
+  }
+  char mp4FileName[FILE_NAME_LEN] = {0};
+  float actualFPS = 1000.0f * l_mp4Frames / l_decodeTime;
+  snprintf(mp4FileName, FILE_NAME_LEN - 1, "%s_%ux%u_%u_%lu.%s", partName, frameData[fsizePtr].frameWidth,
+           frameData[fsizePtr].frameHeight, (uint8_t)lround(actualFPS), durationSecs, MP4_EXT);
+  if (rename(MP4TEMP, mp4FileName) != 0)
+  {
+    ESP_LOGE(TAG, "Rename %s to %s failed", MP4TEMP, mp4FileName);
+  }
+  remove(AVIJOURNAL);
+  if (fileName)
+  {
+    strcpy(fileName, mp4FileName);
+  }
+  cTime = esp_timer_get_time() / 1000 - cTime;
+  ESP_LOGI(TAG, "******** MP4 recording stats ********");
+  ESP_LOGI(TAG, "Recorded %s", mp4FileName);
+  ESP_LOGI(TAG, "MP4 duration: %u secs. Number of frames: %u in %u fragments", durationSecs, l_mp4Frames, l_fragSeq);
+  ESP_LOGI(TAG, "Required FPS: %u. Actual FPS: %0.1f", l_FPS, actualFPS);
+  ESP_LOGI(TAG, "File size: %s", fmtSize(vidSize));
+  ESP_LOGI(TAG, "SD writer: %u/%u buffers high watermark, %u stalls over %u ms, longest write %u ms, %u frames dropped",
+           l_queueHigh, SD_WRITE_BUF_COUNT, l_stallCnt, SD_STALL_MS, l_maxWriteMs, l_droppedFrames);
+  ESP_LOGI(TAG, "File open / completion times: %u ms / %u ms", oTime, cTime);
+  ESP_LOGI(TAG, "*************************************");
+  if (!checkFreeStorage())
+    doRecording = false;
+  return true;
+}
 
+void storageSetFragmentDuration(uint8_t seconds)
+{
+  l_fragMs = seconds * 1000U;
+}
 
 fnameStruct *playbackFPS(const char *fname)
 {
@@ -509,7 +1446,7 @@ bool openSDfile(const char *streamFile)
     xSemaphoreGive(pbFileMutex);
     return false;
   }
-  fseek(playBack_fp, AVI_HEADER_LEN, SEEK_SET); // skip over header
+  fseek(playBack_fp, aviMoviStart(playBack_fp), SEEK_SET); // skip over header
   xSemaphoreGive(pbFileMutex);
 
   return true;
@@ -693,11 +1630,310 @@ static void playbackTask(void *parameter)
   vTaskDelete(NULL);
 }
 
+/* 检查pos处是否为完整的JPEG视频块，返回数据长度，0表示不是 */
+static uint32_t checkChunk(FILE *fp, uint32_t pos, uint32_t fileLen)
+{
+  uint8_t hdr[CHUNK_HDR + 2];
+  uint8_t tail[6];
+  uint32_t size;
+  if (pos + sizeof(hdr) > fileLen || fseek(fp, pos, SEEK_SET) != 0 || fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+  {
+    return 0;
+  }
+  memcpy(&size, hdr + 4, 4);
+  // preallocated space after the last frame holds stale data, accept only what saveFrame writes
+  if (memcmp(hdr, dcBuf, 4) != 0 || size < sizeof(tail) || (size & 3) || size > SD_WRITE_BUF_SIZE * SD_WRITE_BUF_COUNT ||
+      pos + CHUNK_HDR + size > fileLen || hdr[CHUNK_HDR] != 0xFF || hdr[CHUNK_HDR + 1] != 0xD8)
+  {
+    return 0;
+  }
+  // end of image marker is followed by at most 3 filler bytes
+  if (fseek(fp, pos + CHUNK_HDR + size - sizeof(tail), SEEK_SET) != 0 || fread(tail, 1, sizeof(tail), fp) != sizeof(tail))
+  {
+    return 0;
+  }
+  for (int i = 0; i < sizeof(tail) - 1; i++)
+  {
+    if (tail[i] == 0xFF && tail[i + 1] == 0xD9)
+    {
+      return size;
+    }
+  }
+  return 0;
+}
+
+/**
+ * 处理两帧之间的标准索引块或AVIX段头，与录像时一样更新索引状态，返回false表示都不是。
+ * 索引块用内存中重建的内容覆盖，检查点之后未写完的索引块也能恢复
+ */
+static bool recoverAviChunk(FILE *fp, uint32_t *pos, uint32_t fileLen, bool isTL)
+{
+  uint8_t hdr[ODML_RIFF_HDR];
+  const uint8_t *chunk;
+  uint8_t riff[ODML_RIFF_HDR];
+  uint32_t size;
+  if (*pos + ODML_RIFF_HDR > fileLen || fseek(fp, *pos, SEEK_SET) != 0 || fread(hdr, 1, ODML_RIFF_HDR, fp) != ODML_RIFF_HDR)
+  {
+    return false;
+  }
+  memcpy(&size, hdr + 4, 4);
+  uint32_t len = aviIndexLen(isTL);
+  if (!memcmp(hdr, "ix00", 4))
+  {
+    // chunk holds all frames since the previous one
+    if (!len || CHUNK_HDR + size != len || *pos + len > fileLen)
+    {
+      return false;
+    }
+    aviIndexChunk(&chunk, isTL);
+    fseek(fp, *pos, SEEK_SET);
+    fwrite(chunk, 1, len, fp);
+    *pos += len;
+    return true;
+  }
+  if (!memcmp(hdr, "RIFF", 4) && !memcmp(hdr + 8, "AVIXLIST", 8) && !memcmp(hdr + 20, "movi", 4) &&
+      !len && aviNewRiff(riff, isTL))
+  {
+    *pos += ODML_RIFF_HDR;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief 恢复断电前未关闭的录像
+ *
+ * 检查点之前的帧直接取日志中的索引项，之后的帧沿00dc块链逐个校验，
+ * 帧之间的标准索引块和AVIX段头按录像时的规则重建，
+ * 补写最后的索引块和文件头后按closeAvi的规则命名，耗时与检查点之后的帧数成正比。
+ * 没有日志或日志无效时丢弃临时文件。
+ *
+ * @param isTL 恢复延时摄影文件，否则恢复录像文件，两者的索引和日志互不影响
+ */
+static void recoverAvi(bool isTL)
+{
+  uint32_t rTime = esp_timer_get_time() / 1000;
+  const char *tempPath = isTL ? TLTEMP : AVITEMP;
+  aviJournalHdr jh;
+  FILE *jf = fopen(l_journalPath[isTL], "rb");
+  FILE *fp = NULL;
+  if (jf && fread(&jh, sizeof(jh), 1, jf) == 1 && jh.magic == JOURNAL_MAGIC && jh.fps && jh.frameType < FRAMESIZE_INVALID)
+  {
+    fp = fopen(tempPath, "r+b");
+  }
+  if (!fp)
+  {
+    ESP_LOGW(TAG, "Discard %s without checkpoint", tempPath);
+    if (jf)
+    {
+      fclose(jf);
+    }
+    remove(tempPath);
+    remove(l_journalPath[isTL]);
+    return;
+  }
+  jh.partName[sizeof(jh.partName) - 1] = 0;
+  fseek(fp, 0, SEEK_END);
+  uint32_t fileLen = ftell(fp);
+
+  // frames up to the last checkpoint
+  prepAviIndex(isTL);
+  uint32_t frames = 0;
+  uint32_t pos = AVI_HEADER_LEN; // next chunk
+  size_t n;
+  bool chain = true;
+  while (chain && (n = fread(iSDbuffer, ODML_IX_ENTRY, RAMSIZE / ODML_IX_ENTRY, jf)) > 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      uint32_t offset, size;
+      memcpy(&offset, iSDbuffer + i * ODML_IX_ENTRY, 4);
+      memcpy(&size, iSDbuffer + i * ODML_IX_ENTRY + 4, 4);
+      // index chunks and RIFF headers between frames are not journaled
+      while (pos + CHUNK_HDR < offset && recoverAviChunk(fp, &pos, fileLen, isTL))
+        ;
+      if (frames >= MAXFRAMES || aviIndexFull(isTL) || pos + CHUNK_HDR != offset || offset + size > fileLen)
+      {
+        chain = false;
+        break;
+      }
+      buildAviIdx(size, true, isTL);
+      pos += CHUNK_HDR + size;
+      frames++;
+    }
+  }
+  fclose(jf);
+  uint32_t journaled = frames;
+  // frames written after the last checkpoint
+  uint32_t size;
+  while (frames < MAXFRAMES)
+  {
+    if (!aviIndexFull(isTL) && (size = checkChunk(fp, pos, fileLen)) > 0)
+    {
+      buildAviIdx(size, true, isTL);
+      pos += CHUNK_HDR + size;
+      frames++;
+    }
+    else if (!recoverAviChunk(fp, &pos, fileLen, isTL))
+    {
+      break;
+    }
+  }
+
+  // a few timelapse frames still cover a long time, keep them
+  uint32_t durationSecs = lround((float)frames / jh.fps);
+  if (isTL ? !frames : durationSecs < MIN_SECIBDS)
+  {
+    fclose(fp);
+    remove(tempPath);
+    remove(l_journalPath[isTL]);
+    ESP_LOGI(TAG, "Discard %s, insufficient duration: %u frames", tempPath, frames);
+    return;
+  }
+  // drop partial frame and stale data after the last index chunk, as closeAvi does
+  finishAvi(fp, jh.fps, jh.frameType, frames, isTL);
+  fclose(fp);
+
+  char aviFileName[FILE_NAME_LEN] = {0};
+  snprintf(aviFileName, FILE_NAME_LEN - 1, "%s_%ux%u_%u_%lu%s.%s", jh.partName,
+           frameData[jh.frameType].frameWidth, frameData[jh.frameType].frameHeight, jh.fps, durationSecs,
+           isTL ? "_T" : "", AVI_EXT);
+  if (rename(tempPath, aviFileName) != 0)
+  {
+    ESP_LOGE(TAG, "Rename %s to %s failed", tempPath, aviFileName);
+  }
+  remove(l_journalPath[isTL]);
+  catalogAddFile(aviFileName, 0);
+  ESP_LOGI(TAG, "Recovered %s: %u frames, %u after last checkpoint, in %lu ms",
+           aviFileName, frames, frames - journaled, esp_timer_get_time() / 1000 - rTime);
+}
+
+/**
+ * @brief 恢复断电前未关闭的MP4录像
+ *
+ * 逐个读取顶层box，保留到最后一个完整分片（moof后跟有长度的mdat），
+ * 未完成分片的占位mdat长度为0，读到这里就停止。耗时与分片数成正比。
+ */
+static void recoverMp4()
+{
+  uint32_t rTime = esp_timer_get_time() / 1000;
+  aviJournalHdr jh;
+  FILE *jf = fopen(AVIJOURNAL, "rb");
+  bool haveName = jf && fread(&jh, sizeof(jh), 1, jf) == 1 && jh.magic == JOURNAL_MAGIC && jh.fps && jh.frameType < FRAMESIZE_INVALID;
+  if (jf)
+  {
+    fclose(jf);
+  }
+  FILE *fp = haveName ? fopen(MP4TEMP, "r+b") : NULL;
+  if (!fp)
+  {
+    ESP_LOGW(TAG, "Discard %s without journal", MP4TEMP);
+    remove(MP4TEMP);
+    remove(AVIJOURNAL);
+    return;
+  }
+  jh.partName[sizeof(jh.partName) - 1] = 0;
+  fseek(fp, 0, SEEK_END);
+  uint32_t fileLen = ftell(fp);
+
+  uint32_t pos = 0;
+  uint32_t end = 0;        // end of the last complete fragment
+  uint64_t endTime = 0;
+  uint64_t fragEnd = 0;
+  uint32_t fragments = 0;
+  bool haveMoof = false;
+  uint8_t hdr[FMP4_BOX_HDR];
+  while (fseek(fp, pos, SEEK_SET) == 0 && fread(hdr, 1, sizeof(hdr), fp) == sizeof(hdr))
+  {
+    uint32_t size = fmp4_box_size(hdr);
+    if (size < FMP4_BOX_HDR || size > fileLen - pos)
+    {
+      break;
+    }
+    if (!memcmp(hdr + 4, "moof", 4))
+    {
+      haveMoof = size <= sizeof(iSDbuffer) && fseek(fp, pos, SEEK_SET) == 0 && fread(iSDbuffer, 1, size, fp) == size &&
+                 fmp4_moof_end_time(iSDbuffer, size, &fragEnd);
+      if (!haveMoof)
+      {
+        break;
+      }
+    }
+    else if (!memcmp(hdr + 4, "mdat", 4))
+    {
+      if (!haveMoof)
+      {
+        break;
+      }
+      haveMoof = false;
+      end = pos + size;
+      endTime = fragEnd;
+      fragments++;
+    }
+    else if (memcmp(hdr + 4, "free", 4) && memcmp(hdr + 4, "ftyp", 4) && memcmp(hdr + 4, "moov", 4))
+    {
+      break;
+    }
+    pos += size;
+  }
+
+  uint32_t durationSecs = lround(endTime / 1000.0);
+  if (durationSecs < MIN_SECIBDS)
+  {
+    fclose(fp);
+    remove(MP4TEMP);
+    remove(AVIJOURNAL);
+    ESP_LOGI(TAG, "Discard %s, insufficient duration: %u fragments", MP4TEMP, fragments);
+    return;
+  }
+  // drop the unfinished fragment and stale data
+  fflush(fp);
+  ftruncate(fileno(fp), end);
+  fclose(fp);
+
+  char mp4FileName[FILE_NAME_LEN] = {0};
+  snprintf(mp4FileName, FILE_NAME_LEN - 1, "%s_%ux%u_%u_%lu.%s", jh.partName,
+           frameData[jh.frameType].frameWidth, frameData[jh.frameType].frameHeight, jh.fps, durationSecs, MP4_EXT);
+  if (rename(MP4TEMP, mp4FileName) != 0)
+  {
+    ESP_LOGE(TAG, "Rename %s to %s failed", MP4TEMP, mp4FileName);
+  }
+  remove(AVIJOURNAL);
+  catalogAddFile(mp4FileName, 0);
+  ESP_LOGI(TAG, "Recovered %s: %u fragments in %lu ms", mp4FileName, fragments, esp_timer_get_time() / 1000 - rTime);
+}
+
+/* 恢复断电前未关闭的录像和延时摄影，没有临时文件时删除残留的日志 */
+static void recoverRecording()
+{
+  if (access(AVITEMP, F_OK) == 0)
+  {
+    recoverAvi(false);
+  }
+  else if (access(MP4TEMP, F_OK) == 0)
+  {
+    recoverMp4();
+  }
+  else
+  {
+    remove(AVIJOURNAL);
+  }
+  if (access(TLTEMP, F_OK) == 0)
+  {
+    recoverAvi(true);
+  }
+  else
+  {
+    remove(TLJOURNAL);
+  }
+}
+
 bool storageInit()
 {
   // initialisation & prep for AVI capture
   aviMutex = xSemaphoreCreateMutex();
-  if (aviMutex == NULL)
+  l_spareMutex = xSemaphoreCreateMutex();
+  if (aviMutex == NULL || l_spareMutex == NULL)
   {
     ESP_LOGE(TAG, "Failed to create mutex");
     return false;
@@ -715,6 +1951,20 @@ bool storageInit()
     return false;
   }
 
+  // load the recording catalog first so that a recovered recording is added to it
+  if (!catalogInit())
+  {
+    ESP_LOGW(TAG, "Recording catalog not available");
+  }
+  // finish a recording interrupted by power loss before anything else uses the card
+  recoverRecording();
+
+  if (!sdWriterInit())
+  {
+    ESP_LOGE(TAG, "Failed to start SD writer");
+    return false;
+  }
+
   pbFileMutex = xSemaphoreCreateMutex();
   xTaskCreate(&playbackTask, "playbackTask", PLAYBACK_STACK_SIZE, NULL, PLAY_PRI, &playbackHandle);
 
@@ -726,3 +1976,8 @@ void storageSetFPS(uint8_t fps)
 {
   l_FPS = fps;
 }
+
+void storageSetMaxDuration(uint32_t seconds)
+{
+  l_maxSeconds = seconds;
+}
@@ -7,36 +7,70 @@
 #include <sys/stat.h>
 #include <string.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "esp_vfs_fat.h"
 #include "esp_log.h"
 
 #include "Utils.h"
 #include "utilsFS.h"
+#include "catalog.h"
 
 #define TAG "UtilsFS"
 
-int sdFreeSpaceMode;          // 0 - No Check, 1 - Delete oldest dir, 2 - Upload to ftp and then delete folder on SD
+int sdFreeSpaceMode;          // 0 - No Check, 1 - Delete oldest files, 2 - Upload to ftp and then delete file on SD
 int sdMinCardFreeSpace = 100; // Minimum amount of card free Megabytes before sdFreeSpaceMode action is enabled
+static int sdKeepDays = 0;    // Days to keep recordings when sdFreeSpaceMode is enabled, 0 - no limit
 
 static char *resetDir = "/~reset";
 static char *currentDir = "/~current";
 static char *previousDir = "/~previous";
 
+#define RETAIN_BATCH 8         // 每次扫描最旧文件夹时缓存的最旧文件数
+#define RETAIN_NAME_LEN 64     // 缓存的文件名最大长度
+#define RETAIN_MAX_DELETE 4    // 每次检查最多删除的文件数，关闭文件时不会因清理卡住太久
+#define CLOCK_VALID 1704067200 // 2024-01-01，时间早于此说明还未同步，不按保存天数删除
+
+static char l_oldestDir[FILE_NAME_LEN];                  // 正在清理的日期文件夹，空表示需要重新查找
+static char l_doneDir[RETAIN_NAME_LEN];                  // 已清理完的日期文件夹名，只查找比它新的文件夹
+static char l_oldFiles[RETAIN_BATCH][RETAIN_NAME_LEN];   // l_oldestDir中最旧的几个文件，按名称即时间排序
+static int l_oldFileCnt = 0;
+static int l_oldFileIdx = 0;
+static char l_lastFile[RETAIN_NAME_LEN];                 // 上一个处理过的文件名，重新扫描时只取比它新的文件
+static SemaphoreHandle_t l_retainMutex = NULL;           // 录像和延时摄影关闭文件时都会清理，保护上面的状态
+
+bool isDateDir(const char *name)
+{
+  if (strlen(name) != 8)
+  {
+    return false;
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    if (name[i] < '0' || name[i] > '9')
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
 /**
- * @brief 获取最旧的目录
+ * @brief 获取最旧的日期文件夹
  *
- * 遍历SD卡挂载点下的所有目录，排除系统目录和数据目录，
- * 通过比较目录名称找到最旧的目录（按字母顺序最小的目录名）。
+ * 遍历SD卡挂载点下的日期文件夹（YYYYMMDD），找到名称比after大的最小文件夹名，
+ * 系统目录、数据目录和配置目录不是日期文件夹，不会被选中。
  *
  * @param oldestDir 输出参数，用于存储找到的最旧目录完整路径
  *                  （格式：挂载点/目录名）
+ * @param after 只查找名称比它大的文件夹，空字符串表示不限制
  *
  * @return true  成功找到最旧目录
  * @return false 未找到符合条件的目录或打开目录失败
  */
-static bool getOldestDir(char *oldestDir)
+static bool getOldestDir(char *oldestDir, const char *after)
 {
-  bool find = false;
+  char oldest[RETAIN_NAME_LEN] = {0};
   DIR *dir = NULL;
   struct dirent *entry;
 
@@ -49,26 +83,119 @@ static bool getOldestDir(char *oldestDir)
 
   while ((entry = readdir(dir)) != NULL)
   {
-    if (entry->d_type != DT_DIR)
+    if (entry->d_type != DT_DIR || !isDateDir(entry->d_name) || strcmp(entry->d_name, after) <= 0)
     {
       continue;
     }
 
-    if (strstr(entry->d_name, "System") != NULL || strstr(entry->d_name, DATA_DIR) != NULL || strstr(entry->d_name, "SYSTEM") != NULL)
+    // 比较文件夹名称，找到最旧的目录
+    if (!oldest[0] || strcmp(oldest, entry->d_name) > 0)
     {
-      continue;
+      strcpy(oldest, entry->d_name);
     }
+  }
+  closedir(dir);
+  if (oldest[0])
+  {
+    snprintf(oldestDir, FILE_NAME_LEN, "%s/%s", SD_MOUNT_POINT, oldest);
+  }
+  return oldest[0] != 0;
+}
 
-    // 比较文件夹名称，找到最旧的目录
-    if (strlen(oldestDir) == 0 || strcmp(oldestDir, entry->d_name) > 0)
+/* 扫描l_oldestDir，按名称取比l_lastFile新的最旧RETAIN_BATCH个文件，没有文件返回false */
+static bool scanOldestFiles()
+{
+  DIR *dir = opendir(l_oldestDir);
+  struct dirent *entry;
+  l_oldFileCnt = l_oldFileIdx = 0;
+  if (dir == NULL)
+  {
+    return false;
+  }
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (entry->d_type != DT_REG || strlen(entry->d_name) >= RETAIN_NAME_LEN || strcmp(entry->d_name, l_lastFile) <= 0)
     {
-      strcpy(oldestDir, entry->d_name);
-      snprintf(oldestDir, FILE_NAME_LEN, "%s/%s", SD_MOUNT_POINT, entry->d_name);
-      find = true;
+      continue;
+    }
+    // insertion into the sorted batch, dropping the newest when full
+    int i = l_oldFileCnt < RETAIN_BATCH ? l_oldFileCnt++ : RETAIN_BATCH;
+    for (; i > 0 && strcmp(l_oldFiles[i - 1], entry->d_name) > 0; i--)
+    {
+      if (i < RETAIN_BATCH)
+      {
+        strcpy(l_oldFiles[i], l_oldFiles[i - 1]);
+      }
+    }
+    if (i < RETAIN_BATCH)
+    {
+      strcpy(l_oldFiles[i], entry->d_name);
     }
   }
   closedir(dir);
-  return find;
+  return l_oldFileCnt > 0;
+}
+
+/**
+ * @brief 获取最旧的录像或图片文件
+ *
+ * 只在最旧的日期文件夹清理完时扫描一次根目录，文件夹内每次扫描缓存最旧的RETAIN_BATCH个文件，
+ * 删除文件时不再为每个文件重新遍历整个SD卡。清理完的空文件夹随即删除。
+ * 返回的文件在调用dropOldestFile之前保持为最旧文件。
+ *
+ * @param path 输出文件完整路径
+ * @return true - 找到文件
+ * @return false - 没有可删除的文件
+ */
+static bool getOldestFile(char *path)
+{
+  for (int pass = 0; pass < 2; pass++)
+  {
+    while (l_oldestDir[0] || getOldestDir(l_oldestDir, l_doneDir))
+    {
+      if (l_oldFileIdx < l_oldFileCnt || scanOldestFiles())
+      {
+        snprintf(path, FILE_NAME_LEN, "%s/%s", l_oldestDir, l_oldFiles[l_oldFileIdx]);
+        return true;
+      }
+      // folder exhausted, remove it if empty and move on to the next one
+      if (rmdir(l_oldestDir) == 0)
+      {
+        ESP_LOGI(TAG, "Folder %s deleted", l_oldestDir);
+      }
+      strcpy(l_doneDir, l_oldestDir + strlen(SD_MOUNT_POINT) + 1);
+      l_oldestDir[0] = l_lastFile[0] = 0;
+    }
+    // files that failed to delete or were added to older folders are retried from the start
+    if (!l_doneDir[0])
+    {
+      break;
+    }
+    l_doneDir[0] = 0;
+  }
+  return false;
+}
+
+/* 最旧文件已处理，下次返回下一个文件 */
+static void dropOldestFile()
+{
+  strcpy(l_lastFile, l_oldFiles[l_oldFileIdx++]);
+}
+
+/* 从文件名（YYYYMMDD_HHMMSS...）得到录制时间，无法解析返回0 */
+static time_t fileTime(const char *path)
+{
+  struct tm tm = {0};
+  const char *name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  if (sscanf(name, "%4d%2d%2d_%2d%2d%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 3)
+  {
+    return 0;
+  }
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
 }
 
 /**
@@ -223,7 +350,12 @@ void deleteFolderOrFile(const char *deleteThis)
   if (S_ISREG(st.st_mode))
   {
     // is file
-    ESP_LOGI(TAG, "File %s size %s %sdeleted", deleteThis, fmtSize(st.st_size), remove(deleteThis) ? "" : "not "); // Remove the file
+    bool removed = remove(deleteThis) == 0; // Remove the file
+    ESP_LOGI(TAG, "File %s size %s %sdeleted", deleteThis, fmtSize(st.st_size), removed ? "" : "not ");
+    if (removed)
+    {
+      catalogRemove(deleteThis);
+    }
     deleteOthers(deleteThis);
   }
   else if (S_ISDIR(st.st_mode))
@@ -254,7 +386,12 @@ void deleteFolderOrFile(const char *deleteThis)
       stat(deleteFilepath, &st);
       if (S_ISREG(st.st_mode))
       {
-        ESP_LOGI(TAG, "FILE : %s Size : %s %sdeleted", deleteFilepath, fmtSize(st.st_size), remove(deleteFilepath) ? "not " : "");
+        bool removed = remove(deleteFilepath) == 0;
+        ESP_LOGI(TAG, "FILE : %s Size : %s %sdeleted", deleteFilepath, fmtSize(st.st_size), removed ? "" : "not ");
+        if (removed)
+        {
+          catalogRemove(deleteFilepath);
+        }
         deleteOthers(deleteFilepath);
       }
       else if (S_ISDIR(st.st_mode))
@@ -277,45 +414,88 @@ void deleteFolderOrFile(const char *deleteThis)
 }
 
 /**
- * 检查存储空间并确保有足够的空闲空间
+ * 检查存储空间和录像保存天数，按时间从旧到新逐个删除文件
  *
- * 函数会检查SD卡的总空间，如果空闲空间小于设定的最小值，会根据配置模式进行处理：
+ * 函数会检查SD卡的剩余空间，如果空闲空间小于设定的最小值，会根据配置模式进行处理：
  * - 普通模式：仅记录警告日志
- * - 清理模式：删除最旧的文件夹来释放空间
- * - 传输后清理模式：先传输文件夹内容再删除
+ * - 清理模式：删除最旧的文件来释放空间
+ * - 传输后清理模式：先传输文件再删除
+ * 清理模式下同时删除超过保存天数的文件。每次最多删除RETAIN_MAX_DELETE个文件，
+ * 每段录像关闭时调用一次，清理量与新写入的数据量相当，不会一次删除整天的录像。
  *
  * @return bool 空间检查结果
- *         - true: 空间充足或已成功清理出足够空间
- *         - false: 空间不足且未启用清理模式
+ *         - true: 空间充足或仍在清理中
+ *         - false: 空间不足且未启用清理模式或没有可删除的文件
  */
 bool checkFreeStorage()
 {
   // Check for sufficient space on storage
-  bool res = false;
-  size_t freeSize = getSDTotalSpace() / 1024; // in MB
-  if (!sdFreeSpaceMode && freeSize < sdMinCardFreeSpace)
-    ESP_LOGW(TAG, "Space left %uMB is less than minimum %uMB", freeSize, sdMinCardFreeSpace);
-  else
+  size_t freeSize = getSDFreeSpace() / 1024; // in MB
+  if (!sdFreeSpaceMode)
   {
-    // delete to make space
-    while (freeSize < sdMinCardFreeSpace)
+    if (freeSize < sdMinCardFreeSpace)
     {
-      char oldestDir[FILE_NAME_LEN];
-      getOldestDir(oldestDir);
-      ESP_LOGW(TAG, "Deleting oldest folder: %s %s", oldestDir, sdFreeSpaceMode == 2 ? "after uploading" : "");
+      ESP_LOGW(TAG, "Space left %uMB is less than minimum %uMB", freeSize, sdMinCardFreeSpace);
+      return false;
+    }
+    return true;
+  }
+  if (l_retainMutex)
+  {
+    xSemaphoreTake(l_retainMutex, portMAX_DELAY);
+  }
+  time_t now = time(NULL);
+  time_t expiry = (sdKeepDays && now > CLOCK_VALID) ? now - sdKeepDays * 86400 : 0;
+  char oldest[FILE_NAME_LEN];
+  int deleted = 0;
+  bool found = true;
+  while (deleted < RETAIN_MAX_DELETE && (found = getOldestFile(oldest)))
+  {
+    time_t fTime = fileTime(oldest);
+    bool expired = expiry && fTime && fTime < expiry;
+    if (freeSize >= sdMinCardFreeSpace && !expired)
+    {
+      break;
+    }
+    ESP_LOGW(TAG, "Deleting %s file: %s %s", expired ? "expired" : "oldest", oldest, sdFreeSpaceMode == 2 ? "after uploading" : "");
 #if INCLUDE_FTP_HFS
-      if (sdFreeSpaceMode == 2)
-        fsStartTransfer(oldestDir); // transfer and then delete oldest folder
+    if (sdFreeSpaceMode == 2)
+      fsStartTransfer(oldest); // transfer and then delete oldest file
 #endif
-      deleteFolderOrFile(oldestDir);
-      freeSize = getSDTotalSpace() / 1024;
+    if (remove(oldest) != 0)
+    {
+      ESP_LOGW(TAG, "Failed to delete %s", oldest);
     }
-    ESP_LOGI(TAG, "Storage free space: %lu MB", getSDTotalSpace() / 1024);
-    res = true;
+    else
+    {
+      catalogRemove(oldest);
+    }
+    deleteOthers(oldest);
+    dropOldestFile();
+    deleted++;
+    freeSize = getSDFreeSpace() / 1024;
+  }
+  if (deleted)
+  {
+    ESP_LOGI(TAG, "Storage free space: %u MB", freeSize);
+  }
+  if (l_retainMutex)
+  {
+    xSemaphoreGive(l_retainMutex);
   }
-  return res;
+  return found || freeSize >= sdMinCardFreeSpace;
 }
 
+void setRetention(bool autoDelete, int minFreeMB, int keepDays)
+{
+  if (!l_retainMutex)
+  {
+    l_retainMutex = xSemaphoreCreateMutex();
+  }
+  sdFreeSpaceMode = autoDelete ? 1 : 0;
+  sdMinCardFreeSpace = minFreeMB;
+  sdKeepDays = keepDays;
+}
 
 /**
  * @brief 列出指定目录下的所有文件和子目录
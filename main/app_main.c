@@ -27,6 +27,8 @@
 #include "EasyRTSPServer.h"
 #include "Utils.h"
 #include "storage.h"
+#include "recorder.h"
+#include "snapshot.h"
 #include "ha_mqtt_client.h"
 #include "WebServer.h"
 #include "paramCenter.h"
@@ -210,70 +212,58 @@ static bool time_sntp_init(void)
 
 #include "utilsFS.h"
 
-static TaskHandle_t save_picture_to_sdcardHandle = NULL;
-
-// 创建一个任务，定周期保存图片到SD卡
-void save_picture_to_sdcard(void *pvParameters)
+/**
+ * @brief 日夜切换时应用画质预设和补光灯
+ */
+static void camera_on_night(bool night, uint8_t luma)
 {
-    // 首先判断文件夹YYYY-MM-DD是否存在，不存在则创建
-    char folder_name[64] = {0};
-    char file_name[128] = {0};
-    int64_t tm1 = 0, tm2 = 0;
-
-    // 从参数中获取周期
-    int period = *(int *)pvParameters;
+    ESP_LOGI(TAG, "Light level %u, %s", luma, night ? "night" : "day");
+    set_camera_night_mode(night);
+}
 
-    while (1)
+/**
+ * @brief 运动事件转发给录像任务，运动强度为运动区域外接矩形占画面的百分比
+ */
+static void record_on_motion(bool motion, const MotionBlob *blobs, int count, int frameWidth, int frameHeight)
+{
+    uint32_t area = 0;
+    for (int i = 0; i < count; i++)
     {
-        tm1 = esp_timer_get_time(); // us
-
-        // 判断文件夹是否存在，不存在则创建
-        dateFormat(folder_name, sizeof(folder_name), true); // true表示创建当天的文件夹
-        if (access(folder_name, F_OK) != 0)
-        {
-            if (mkdir(folder_name, 0777) != 0)
-            {
-                ESP_LOGE(TAG, "Failed to create date folder");
-                return;
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Created folder: %s", folder_name);
-            }
-        }
-        
-
-        // 获取当前时间，生成文件名
-        dateFormat(file_name, sizeof(file_name), false); // true表示生成带有时间戳的文件名
-        strcat(file_name, ".jpg");                       // 添加.jpg后缀
-
-        // 从摄像头获取一帧图像数据
-        video_node *node = get_latest_video_frame();
-        if (!node)
-        {
-            ESP_LOGE(TAG, "Failed to get video frame");
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            continue;
-        }
+        area += blobs[i].w * blobs[i].h;
+    }
+    uint32_t frameArea = frameWidth * frameHeight;
+    uint32_t score = frameArea ? area * 100 / frameArea : 0;
+    recorderMotion(motion, score > 100 ? 100 : score);
+}
 
-        // 将图像数据保存到SD卡
-        FILE *f = fopen(file_name, "wb");
-        if (f == NULL)
-        {
-            ESP_LOGE(TAG, "Failed to open file for writing: %s", file_name);
-            put_video_frame(node);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            continue;
-        }
-        fwrite(node->data, 1, node->size, f);
-        fclose(f);
-        put_video_frame(node);
-        tm2 = esp_timer_get_time(); // us
-
-        ESP_LOGI(TAG, "Saved picture to SD card: %s, time: %lld ms", file_name, (tm2 - tm1) / 1000);
-        // 等待下一个周期
-        vTaskDelay(period / portTICK_PERIOD_MS);
+/**
+ * @brief 按存储配置启动运动触发或连续录像
+ */
+void start_recorder(void)
+{
+    recordConfig cfg = {
+        .enable = get_param_bool(CONFIG_STORAGE, STORAGE_RECORD),
+        .fps = get_param_uint8(CONFIG_STORAGE, STORAGE_RECORD_FPS),
+        .postRoll = get_param_uint8(CONFIG_STORAGE, STORAGE_POST_ROLL),
+        .maxSeconds = get_param_int32(CONFIG_STORAGE, STORAGE_MAX_SECONDS),
+        .preRoll = get_param_uint8(CONFIG_STORAGE, STORAGE_PRE_ROLL),
+        .preRollBytes = get_param_int32(CONFIG_STORAGE, STORAGE_PRE_ROLL_KB) * 1024,
+        .mp4 = get_param_bool(CONFIG_STORAGE, STORAGE_RECORD_MP4),
+        .fragSeconds = get_param_uint8(CONFIG_STORAGE, STORAGE_MP4_FRAGMENT),
+        .continuous = get_param_bool(CONFIG_STORAGE, STORAGE_CONTINUOUS),
+        .tlInterval = get_param_int32(CONFIG_STORAGE, STORAGE_TL_INTERVAL),
+        .tlFPS = get_param_uint8(CONFIG_STORAGE, STORAGE_TL_FPS),
+    };
+    setRecordConfig(&cfg);
+    setRetention(get_param_bool(CONFIG_STORAGE, STORAGE_AUTO_DELETE),
+                 get_param_int32(CONFIG_STORAGE, STORAGE_MIN_FREE_MB),
+                 get_param_int32(CONFIG_STORAGE, STORAGE_KEEP_DAYS));
+    if (!storageInit() || !startRecorder())
+    {
+        ESP_LOGE(TAG, "Recorder Init Failed");
+        return;
     }
+    addMotionEventCallback(record_on_motion);
 }
 
 /**
@@ -374,11 +364,23 @@ void app_main(void)
     // start rtsp server
     start_rtsp_server();
 
-    xTaskCreate(save_picture_to_sdcard, "save_picture_to_sdcard", 8192, (void *)&(int){360000}, 5, &save_picture_to_sdcardHandle);
+    // 录像目录在start_recorder中读入，之后再开始保存图片
+    start_recorder();
 
-    // 初始化运动检测
+    // 延时摄影把定时图片写入同一个AVI，关闭延时摄影时才每6分钟保存一张图片，连拍始终可用
+    if (startSnapshot())
+    {
+        setSnapshotPeriod(get_param_int32(CONFIG_STORAGE, STORAGE_TL_INTERVAL) ? 0 : 360000);
+    }
+
+    // 测光独立于运动检测，运动检测关闭时也更新日夜状态
     setNightSwitch(get_param_uint8(CONFIG_MOTION, MD_NIGHT_SWITCH));
+    addNightEventCallback(camera_on_night);
+    startExposureMeter();
+
+    // 初始化运动检测
     setDetectSensitivity(get_param_uint8(CONFIG_MOTION, MD_SENSITIVITY));
+    setMotionZones(get_param_string(CONFIG_MOTION, MD_ZONES));
     changeMotionDetectStatus(get_param_bool(CONFIG_MOTION, MD_ENABLE));
 
     checkMemory("init complete");
@@ -389,6 +391,7 @@ void app_main(void)
     while (1)
     {
         mqtt_publish_data();
+        mqtt_publish_rtsp_stats();
         vTaskDelay(60000 / portTICK_PERIOD_MS);
         if (count % 6 == 0)
         {
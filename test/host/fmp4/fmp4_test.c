@@ -0,0 +1,388 @@
+/*
+ * Host test of the fragmented MP4 boxes, no IDF needed.
+ *
+ * A recursive box walker checks that every container is filled exactly by its children, that the tree has
+ * the expected shape and that fixed-size boxes have their ISO/IEC 14496-12 size.
+ * The init segment is built into every buffer size short of its length and must report 0 without writing
+ * past the buffer. Moofs of 0 to 300 samples are read back field by field and through fmp4_moof_end_time,
+ * then a file laid out like storage.c does (patch hole before every fragment, an open fragment at the end)
+ * is walked at the top level like the recovery after a power loss.
+ * Finally corrupt moofs, with flipped bits, bad sizes and truncation, must not read outside the moof.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fmp4.h"
+
+#define MP4_MAX_SAMPLES 128 // as in storage.c
+#define MP4_HOLE_LEN (FMP4_MOOF_SIZE(MP4_MAX_SAMPLES) + FMP4_BOX_HDR)
+#define FRAGMENTS 40
+#define MUTATIONS 20000
+
+static const struct
+{
+  const char *type;
+  uint32_t size;
+} l_fixedSize[] = {
+    {"ftyp", 32}, {"mvhd", 108}, {"tkhd", 92}, {"mdhd", 32}, {"vmhd", 20}, {"url ", 12}, {"dref", 28},
+    {"jpeg", 86}, {"stsd", 102}, {"stts", 16}, {"stsc", 16}, {"stsz", 20}, {"stco", 16}, {"trex", 32},
+    {"mfhd", 16}, {"tfhd", 16}, {"tfdt", 20},
+};
+
+static uint32_t get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+  return ((uint64_t)get32(p) << 32) | get32(p + 4);
+}
+
+static void set32(uint8_t *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+/* cut the tfdt (at 48, 20 bytes) down to tfdtSize and fix the sizes of traf and moof, returns the new length */
+static size_t shrink_tfdt(uint8_t *moof, size_t len, uint32_t tfdtSize)
+{
+  uint32_t cut = 20 - tfdtSize;
+  memmove(moof + 48 + tfdtSize, moof + 68, len - 68);
+  set32(moof + 48, tfdtSize);
+  set32(moof + 24, get32(moof + 24) - cut);
+  set32(moof, len - cut);
+  return len - cut;
+}
+
+/* bytes in front of the children: full box header and entry count for the tables that hold boxes */
+static int child_offset(const uint8_t *type)
+{
+  static const char *containers[] = {"moov", "trak", "mdia", "minf", "dinf", "stbl", "mvex", "moof", "traf"};
+  for (size_t i = 0; i < sizeof(containers) / sizeof(containers[0]); i++)
+  {
+    if (!memcmp(type, containers[i], 4))
+    {
+      return 0;
+    }
+  }
+  return !memcmp(type, "stsd", 4) || !memcmp(type, "dref", 4) ? 8 : -1;
+}
+
+/* append the box tree of [buf, buf + len) to out as "type(child child) type", false if the sizes do not add up */
+static bool walk(const uint8_t *buf, size_t len, char *out, size_t outSize, const char **error)
+{
+  size_t pos = 0;
+  while (pos < len)
+  {
+    if (len - pos < FMP4_BOX_HDR)
+    {
+      *error = "box header cut short";
+      return false;
+    }
+    uint32_t size = get32(buf + pos);
+    const uint8_t *type = buf + pos + 4;
+    if (size < FMP4_BOX_HDR || size > len - pos)
+    {
+      *error = "box size outside its parent";
+      return false;
+    }
+    for (size_t i = 0; i < sizeof(l_fixedSize) / sizeof(l_fixedSize[0]); i++)
+    {
+      if (!memcmp(type, l_fixedSize[i].type, 4) && size != l_fixedSize[i].size)
+      {
+        *error = l_fixedSize[i].type;
+        return false;
+      }
+    }
+    snprintf(out + strlen(out), outSize - strlen(out), "%s%.4s", pos ? " " : "", type);
+    int children = child_offset(type);
+    if (children >= 0)
+    {
+      if (size < FMP4_BOX_HDR + (uint32_t)children)
+      {
+        *error = "container too short";
+        return false;
+      }
+      strncat(out, "(", outSize - strlen(out) - 1);
+      if (!walk(buf + pos + FMP4_BOX_HDR + children, size - FMP4_BOX_HDR - children, out, outSize, error))
+      {
+        return false;
+      }
+      strncat(out, ")", outSize - strlen(out) - 1);
+    }
+    pos += size;
+  }
+  return true;
+}
+
+static int test_init_segment(void)
+{
+  static const char shape[] = "ftyp moov(mvhd trak(tkhd mdia(mdhd hdlr minf(vmhd dinf(dref(url )) "
+                              "stbl(stsd(jpeg) stts stsc stsz stco)))) mvex(trex))";
+  uint8_t full[1024];
+  char tree[512] = "";
+  const char *error = "";
+  int failures = 0;
+
+  size_t len = fmp4_init_segment(full, sizeof(full), 1600, 1200);
+  if (!len || !walk(full, len, tree, sizeof(tree), &error) || strcmp(tree, shape))
+  {
+    printf("init segment %zu bytes: %s %s\n", len, tree, error);
+    return 1;
+  }
+  if (get32(full + 8) != get32(full + 16) || memcmp(full + 8, "isom", 4))
+  {
+    printf("init segment: ftyp major brand not repeated in the compatible brands\n");
+    failures++;
+  }
+  // every size short of the segment, in a buffer of exactly that size
+  for (size_t size = 0; size < len; size++)
+  {
+    uint8_t *buf = malloc(size ? size : 1);
+    if (fmp4_init_segment(buf, size, 1600, 1200) != 0)
+    {
+      printf("init segment in %zu bytes did not fail\n", size);
+      failures++;
+    }
+    free(buf);
+  }
+  printf("init segment %zu bytes: %s\n", len, failures ? "FAIL" : "ok");
+  return failures;
+}
+
+static int check_moof(const uint8_t *moof, size_t len, uint32_t seq, uint64_t decodeTime, const fmp4Sample *samples,
+                      uint32_t count, uint32_t dataOffset)
+{
+  char tree[128] = "";
+  const char *error = "";
+  uint64_t end = decodeTime, parsed = 0;
+  if (len != FMP4_MOOF_SIZE(count) || !walk(moof, len, tree, sizeof(tree), &error) ||
+      strcmp(tree, "moof(mfhd traf(tfhd tfdt trun))"))
+  {
+    printf("moof of %u samples, %zu bytes: %s %s\n", count, len, tree, error);
+    return 1;
+  }
+  // fixed layout: moof 0, mfhd 8, traf 24, tfhd 32, tfdt 48, trun 68
+  const uint8_t *trun = moof + 68;
+  bool ok = get32(moof + 20) == seq && get32(moof + 44) == 1 && moof[56] == 1 && get64(moof + 60) == decodeTime &&
+            get32(trun) == 20 + 8 * count && (get32(trun + 8) & 0xFFFFFF) == 0x000301 && get32(trun + 12) == count &&
+            get32(trun + 16) == dataOffset;
+  for (uint32_t i = 0; i < count && ok; i++)
+  {
+    ok = get32(trun + 20 + 8 * i) == samples[i].duration && get32(trun + 24 + 8 * i) == samples[i].size;
+    end += samples[i].duration;
+  }
+  if (!ok || !fmp4_moof_end_time(moof, len, &parsed) || parsed != end)
+  {
+    printf("moof of %u samples: fields %s, end time %llu, expected %llu\n", count, ok ? "ok" : "wrong",
+           (unsigned long long)parsed, (unsigned long long)end);
+    return 1;
+  }
+  return 0;
+}
+
+static int test_moof(void)
+{
+  static fmp4Sample samples[300];
+  int failures = 0;
+  for (uint32_t count = 0; count <= 300; count++)
+  {
+    uint8_t *moof = malloc(FMP4_MOOF_SIZE(count)); // exact size, ASan catches an overrun
+    // decode times past 2^32 ms need the 64-bit tfdt
+    uint64_t decodeTime = count % 2 ? (uint64_t)rand() * 3 : 0x100000000ull * (count % 5) + rand();
+    for (uint32_t i = 0; i < count; i++)
+    {
+      samples[i] = (fmp4Sample){20000 + rand() % 60000, rand() % 200};
+    }
+    size_t len = fmp4_moof(moof, count + 1, decodeTime, samples, count, MP4_HOLE_LEN + FMP4_BOX_HDR);
+    failures += check_moof(moof, len, count + 1, decodeTime, samples, count, MP4_HOLE_LEN + FMP4_BOX_HDR);
+    free(moof);
+  }
+  printf("moof 0..300 samples: %s\n", failures ? "FAIL" : "ok");
+  return failures;
+}
+
+/* a file as storage.c writes it: init segment, then per fragment a patch hole (moof + free) and the mdat */
+static uint8_t *build_file(size_t *fileLen, int fragments, bool open, uint64_t *endTime)
+{
+  size_t cap = 1024 + (fragments + 1) * (MP4_HOLE_LEN + FMP4_BOX_HDR + MP4_MAX_SAMPLES * 64);
+  uint8_t *file = malloc(cap);
+  fmp4Sample samples[MP4_MAX_SAMPLES];
+  uint64_t decodeTime = 0;
+  size_t len = fmp4_init_segment(file, 1024, 640, 480);
+
+  for (int f = 0; f < fragments; f++)
+  {
+    uint32_t count = 1 + rand() % MP4_MAX_SAMPLES, bytes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      samples[i] = (fmp4Sample){1 + rand() % 64, 30 + rand() % 40};
+      bytes += samples[i].size;
+    }
+    memset(file + len, 0, MP4_HOLE_LEN + FMP4_BOX_HDR);
+    size_t moofLen = fmp4_moof(file + len, f + 1, decodeTime, samples, count, MP4_HOLE_LEN + FMP4_BOX_HDR);
+    fmp4_box_header(file + len + moofLen, MP4_HOLE_LEN - moofLen, "free");
+    fmp4_box_header(file + len + MP4_HOLE_LEN, FMP4_BOX_HDR + bytes, "mdat");
+    len += MP4_HOLE_LEN + FMP4_BOX_HDR;
+    memset(file + len, 0xD8, bytes);
+    len += bytes;
+    for (uint32_t i = 0; i < count; i++)
+    {
+      decodeTime += samples[i].duration;
+    }
+  }
+  if (open)
+  {
+    // fragment still being written: placeholder hole and an mdat running to the end of the file
+    fmp4_box_header(file + len, MP4_HOLE_LEN, "free");
+    fmp4_box_header(file + len + MP4_HOLE_LEN, 0, "mdat");
+    len += MP4_HOLE_LEN + FMP4_BOX_HDR;
+    memset(file + len, 0xD8, 1000);
+    len += 1000;
+  }
+  *fileLen = len;
+  *endTime = decodeTime;
+  return file;
+}
+
+static int test_file(void)
+{
+  int failures = 0;
+  for (int open = 0; open < 2; open++)
+  {
+    size_t len;
+    uint64_t expected;
+    uint8_t *file = build_file(&len, FRAGMENTS, open, &expected);
+    uint64_t endTime = 0, fragEnd = 0;
+    size_t pos = 0, end = 0;
+    int fragments = 0;
+    bool haveMoof = false;
+    // top level walk of the recovery: a moof is only counted once its mdat is complete
+    while (pos + FMP4_BOX_HDR <= len)
+    {
+      uint32_t size = fmp4_box_size(file + pos);
+      if (size < FMP4_BOX_HDR || size > len - pos)
+      {
+        break;
+      }
+      if (!memcmp(file + pos + 4, "moof", 4))
+      {
+        haveMoof = fmp4_moof_end_time(file + pos, size, &fragEnd);
+      }
+      else if (!memcmp(file + pos + 4, "mdat", 4) && haveMoof)
+      {
+        haveMoof = false;
+        end = pos + size;
+        endTime = fragEnd;
+        fragments++;
+      }
+      pos += size;
+    }
+    size_t openLen = open ? MP4_HOLE_LEN + FMP4_BOX_HDR + 1000 : 0;
+    if (fragments != FRAGMENTS || endTime != expected || end != len - openLen)
+    {
+      printf("%s file: %d fragments to %zu ending at %llu ms, expected %d to %zu at %llu\n", open ? "open" : "closed",
+             fragments, end, (unsigned long long)endTime, FRAGMENTS, len - openLen, (unsigned long long)expected);
+      failures++;
+    }
+    free(file);
+  }
+  printf("file of %d fragments: %s\n", FRAGMENTS, failures ? "FAIL" : "ok");
+  return failures;
+}
+
+/* the result of a corrupt moof does not matter as long as nothing is read outside it */
+static int test_corrupt_moof(void)
+{
+  fmp4Sample samples[MP4_MAX_SAMPLES];
+  uint8_t moof[FMP4_MOOF_SIZE(MP4_MAX_SAMPLES)];
+  uint64_t endTime;
+  int failures = 0;
+
+  for (int i = 0; i < MP4_MAX_SAMPLES; i++)
+  {
+    samples[i] = (fmp4Sample){1000, 40};
+  }
+  size_t len = fmp4_moof(moof, 1, 0, samples, MP4_MAX_SAMPLES, 0);
+
+  // wrong length, wrong type, a trun count beyond the box, no durations in the trun
+  uint8_t bad[sizeof(moof)];
+  failures += fmp4_moof_end_time(moof, len - 1, &endTime) || fmp4_moof_end_time(moof, 7, &endTime);
+  memcpy(bad, moof, len);
+  memcpy(bad + 4, "mdat", 4);
+  failures += fmp4_moof_end_time(bad, len, &endTime);
+  memcpy(bad, moof, len);
+  bad[68 + 12] = 0x01;
+  failures += fmp4_moof_end_time(bad, len, &endTime);
+  memcpy(bad, moof, len);
+  bad[68 + 10] = 0x02;
+  failures += fmp4_moof_end_time(bad, len, &endTime);
+  if (failures)
+  {
+    printf("corrupt moof accepted\n");
+  }
+
+  // a version 0 tfdt carries a 32-bit time, an empty one is rejected
+  memcpy(bad, moof, len);
+  set32(bad + 60, 0x12345678);
+  set32(bad + 64, 0x9ABCDEF0);
+  memcpy(bad + 60, bad + 64, 4);
+  bad[56] = 0;
+  size_t v0Len = shrink_tfdt(bad, len, 16);
+  if (!fmp4_moof_end_time(bad, v0Len, &endTime) || endTime != 0x9ABCDEF0ull + MP4_MAX_SAMPLES * 40)
+  {
+    printf("version 0 tfdt not read as 32 bits\n");
+    failures++;
+  }
+  memcpy(bad, moof, len);
+  if (fmp4_moof_end_time(bad, shrink_tfdt(bad, len, 8), &endTime))
+  {
+    printf("empty tfdt accepted\n");
+    failures++;
+  }
+
+  for (int m = 0; m < MUTATIONS; m++)
+  {
+    size_t cut = m % 8 ? len : 1 + rand() % len;
+    uint8_t *copy = malloc(cut); // exact size, ASan catches a read past the moof
+    memcpy(copy, moof, cut);
+    if (cut < len && cut >= 4)
+    {
+      // truncated, with the moof size patched to match so the walk goes inside
+      set32(copy, cut);
+    }
+    for (int k = 0; k < 1 + rand() % 4; k++)
+    {
+      // header bytes of the inner boxes and the trun count are where a walker goes wrong
+      static const int hot[] = {8, 11, 24, 27, 32, 35, 48, 51, 56, 68, 71, 76, 78, 80, 83};
+      size_t at = rand() % 2 ? (size_t)hot[rand() % 15] : rand() % cut;
+      if (at < cut)
+      {
+        copy[at] ^= 1 << (rand() % 8);
+      }
+    }
+    fmp4_moof_end_time(copy, cut, &endTime);
+    free(copy);
+  }
+  printf("corrupt moof: %s\n", failures ? "FAIL" : "ok");
+  return failures;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  srand(1);
+  failures += test_init_segment();
+  failures += test_moof();
+  failures += test_file();
+  failures += test_corrupt_moof();
+  printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+  return failures != 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * Host test of the pre-roll ring buffer, no IDF needed.
+ *
+ * Random push, drop, trim and clear against a FIFO model of every pushed frame. The ring only ever
+ * removes from the front, so after each step it must hold exactly the newest count frames of the model,
+ * byte for byte, in order. Pushes that evict are also checked not to evict more than the wrap can waste,
+ * and timestamps start just below the 32-bit wrap so trim has to compare them as signed differences.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_ring.h"
+
+#define STEPS 200000
+#define MODEL_MAX 4096
+
+typedef struct
+{
+  uint32_t seq;
+  uint32_t timestamp;
+  size_t len;
+} modelFrame;
+
+static modelFrame l_model[MODEL_MAX];
+static int l_modelHead, l_modelCount;
+
+static uint8_t pattern(uint32_t seq, size_t i)
+{
+  return (uint8_t)(seq * 31 + i * 7 + (i >> 8));
+}
+
+static size_t record_size(size_t len)
+{
+  return 8 + ((len + 3) & ~(size_t)3);
+}
+
+static modelFrame *model_at(int i)
+{
+  return &l_model[(l_modelHead + i) % MODEL_MAX];
+}
+
+static void model_pop(void)
+{
+  l_modelHead = (l_modelHead + 1) % MODEL_MAX;
+  l_modelCount--;
+}
+
+/* walk a copy of the ring, drop only moves the indices so the buffer is left as it is */
+static int check(const FrameRing *ring, const char *op, int step)
+{
+  if (ring->count > (uint32_t)l_modelCount)
+  {
+    printf("step %d %s: ring has %u frames, only %d pushed\n", step, op, ring->count, l_modelCount);
+    return 1;
+  }
+  while ((uint32_t)l_modelCount > ring->count)
+  {
+    model_pop();
+  }
+  FrameRing walk = *ring;
+  size_t bytes = 0, used = 0;
+  for (int i = 0; i < l_modelCount; i++)
+  {
+    const modelFrame *m = model_at(i);
+    uint32_t timestamp;
+    size_t len;
+    const uint8_t *data = frame_ring_peek(&walk, &timestamp, &len);
+    if (!data || timestamp != m->timestamp || len != m->len || ((data - ring->buf) & 3) ||
+        data < ring->buf || data + len > ring->buf + ring->size)
+    {
+      printf("step %d %s: frame %d of %d is not frame %u\n", step, op, i, l_modelCount, m->seq);
+      return 1;
+    }
+    for (size_t k = 0; k < len; k++)
+    {
+      if (data[k] != pattern(m->seq, k))
+      {
+        printf("step %d %s: frame %u corrupted at byte %zu\n", step, op, m->seq, k);
+        return 1;
+      }
+    }
+    bytes += len;
+    used += record_size(len);
+    frame_ring_drop(&walk);
+  }
+  size_t extra;
+  if (frame_ring_peek(&walk, NULL, &extra) || ring->bytes != bytes || used > ring->size)
+  {
+    printf("step %d %s: %zu bytes counted, %zu held in %zu of %zu\n", step, op, ring->bytes, bytes, used,
+           ring->size);
+    return 1;
+  }
+  return 0;
+}
+
+static size_t used_bytes(void)
+{
+  size_t used = 0;
+  for (int i = 0; i < l_modelCount; i++)
+  {
+    used += record_size(model_at(i)->len);
+  }
+  return used;
+}
+
+static int run(size_t size, size_t maxLen, unsigned seed)
+{
+  uint8_t *buf = malloc(size); // exact size, ASan catches any write past it
+  uint8_t *data = malloc(maxLen * 2);
+  FrameRing ring;
+  uint32_t seq = 0, timestamp = 0xFFFFFFFFu - 20000;
+  int failures = 0, evictions = 0;
+
+  srand(seed);
+  frame_ring_init(&ring, buf, size);
+  l_modelHead = l_modelCount = 0;
+  for (int step = 0; step < STEPS && !failures; step++)
+  {
+    int op = rand() % 100;
+    const char *name;
+    if (op < 70)
+    {
+      // mostly frames of similar size like a running camera, now and then a much larger one
+      size_t len = rand() % 8 ? maxLen / 2 + rand() % (maxLen / 2) : rand() % (maxLen * 2);
+      uint32_t count = ring.count;
+      size_t before = ring.bytes;
+      name = "push";
+      timestamp += rand() % 100;
+      for (size_t k = 0; k < len; k++)
+      {
+        data[k] = pattern(seq, k);
+      }
+      bool stored = frame_ring_push(&ring, timestamp, data, len);
+      if (stored != (record_size(len) <= ring.size))
+      {
+        printf("step %d push: %zu bytes into %zu returned %d\n", step, len, ring.size, stored);
+        failures++;
+        break;
+      }
+      if (!stored)
+      {
+        // an oversized frame leaves the ring untouched
+        failures += ring.count != count || ring.bytes != before;
+        continue;
+      }
+      if (l_modelCount == MODEL_MAX)
+      {
+        model_pop();
+      }
+      *model_at(l_modelCount++) = (modelFrame){seq++, timestamp, len};
+      bool evicted = ring.count <= count;
+      failures += check(&ring, name, step);
+      // eviction stops as soon as the frame fits, at most one record is wasted at the end by the wrap
+      if (evicted && !failures && used_bytes() + 3 * record_size(maxLen * 2) <= ring.size)
+      {
+        printf("step %d push: evicted down to %zu of %zu bytes\n", step, used_bytes(), ring.size);
+        failures++;
+      }
+      evictions += evicted;
+      continue;
+    }
+    if (op < 80)
+    {
+      name = "drop";
+      frame_ring_drop(&ring);
+      if (l_modelCount)
+      {
+        model_pop();
+      }
+    }
+    else if (op < 99)
+    {
+      name = "trim";
+      uint32_t oldest = timestamp - rand() % 3000;
+      frame_ring_trim(&ring, oldest);
+      while (l_modelCount && (int32_t)(model_at(0)->timestamp - oldest) < 0)
+      {
+        model_pop();
+      }
+    }
+    else
+    {
+      name = "clear";
+      frame_ring_clear(&ring);
+      l_modelCount = 0;
+    }
+    // drop, trim and clear remove exactly what the model removed
+    if (ring.count != (uint32_t)l_modelCount)
+    {
+      printf("step %d %s: %u frames left, expected %d\n", step, name, ring.count, l_modelCount);
+      failures++;
+      break;
+    }
+    failures += check(&ring, name, step);
+  }
+  printf("%6zu byte ring, frames up to %5zu: %d pushes evicted\n", size, maxLen * 2, evictions);
+  free(buf);
+  free(data);
+  return failures;
+}
+
+int main(void)
+{
+  int failures = 0;
+
+  failures += run(4096, 200, 1);
+  failures += run(10001, 1500, 2); // size not a multiple of 4
+  failures += run(65536, 6000, 3);
+  failures += run(65536, 40000, 4); // frames close to the ring size, every push wraps
+  failures += run(16, 8, 5);        // room for one or two tiny records
+  printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+  return failures != 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Host test of the G.711 encoder, no IDF needed.
+ *
+ * The reference is the classic table search of the CCITT sample code that the encoder used before
+ * the clz segment lookup, in int so that it does not overflow near full scale.
+ * Checks every 16-bit input, the batched encoder with gain and saturation, in-place encoding,
+ * then times the batched encoder against the reference.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "g711_pcm_convert.h"
+
+#define SAMPLES 8003 // odd length to cover the scalar tail of the batch encoder
+#define REPS 2000
+
+unsigned char linear2alaw(short pcm_val);
+unsigned char linear2ulaw(int pcm_val);
+
+static const int seg_end[8] = {0xFF, 0x1FF, 0x3FF, 0x7FF, 0xFFF, 0x1FFF, 0x3FFF, 0x7FFF};
+
+static int search(int val)
+{
+    for (int i = 0; i < 8; i++) {
+        if (val <= seg_end[i])
+            return i;
+    }
+    return 8;
+}
+
+static unsigned char ref_alaw(int pcm_val)
+{
+    int mask = 0xD5;
+    if (pcm_val < 0) {
+        mask = 0x55;
+        pcm_val = -pcm_val - 8;
+    }
+    int seg = search(pcm_val);
+    if (seg >= 8)
+        return 0x7F ^ mask;
+    unsigned char aval = seg << 4;
+    aval |= (pcm_val >> (seg < 2 ? 4 : seg + 3)) & 0xF;
+    return aval ^ mask;
+}
+
+static unsigned char ref_ulaw(int pcm_val)
+{
+    int mask = 0xFF;
+    if (pcm_val < 0) {
+        pcm_val = 0x84 - pcm_val;
+        mask = 0x7F;
+    } else {
+        pcm_val += 0x84;
+    }
+    int seg = search(pcm_val);
+    if (seg >= 8)
+        return 0x7F ^ mask;
+    return ((seg << 4) | ((pcm_val >> (seg + 3)) & 0xF)) ^ mask;
+}
+
+static int ref_encode(unsigned char *out, const short *pcm, int samples, enum g711type type, int gain)
+{
+    for (int i = 0; i < samples; i++) {
+        int s = pcm[i] * gain;
+        s = s > 32767 ? 32767 : (s < -32768 ? -32768 : s);
+        out[i] = type == G711ALAW ? ref_alaw(s) : ref_ulaw(s);
+    }
+    return samples;
+}
+
+static double now_us(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+int main(void)
+{
+    static short pcm[SAMPLES];
+    static unsigned char expect[SAMPLES], got[SAMPLES];
+    int failures = 0;
+
+    for (int v = -32768; v <= 32767; v++) {
+        if (linear2alaw(v) != ref_alaw(v) || linear2ulaw(v) != ref_ulaw(v)) {
+            if (failures++ < 5)
+                printf("scalar mismatch at %d: a %02x/%02x u %02x/%02x\n", v,
+                       linear2alaw(v), ref_alaw(v), linear2ulaw(v), ref_ulaw(v));
+        }
+    }
+
+    // quiet and full-scale input, with the default gain some samples saturate
+    static const int gains[] = {1, GAIN};
+    for (int type = G711ALAW; type <= G711ULAW; type++) {
+        for (int g = 0; g < 2; g++) {
+            for (int shift = 0; shift < 8; shift += 3) {
+                for (int i = 0; i < SAMPLES; i++)
+                    pcm[i] = (short)((i * 2654435761u) >> 16) >> shift;
+                ref_encode(expect, pcm, SAMPLES, type, gains[g]);
+                G711EnCodeGain((char *)got, (char *)pcm, sizeof(pcm), type, gains[g]);
+                if (memcmp(expect, got, SAMPLES)) {
+                    failures++;
+                    printf("batch mismatch: type %d gain %d shift %d\n", type, gains[g], shift);
+                }
+                G711EnCodeGain((char *)pcm, (char *)pcm, sizeof(pcm), type, gains[g]);
+                if (memcmp(expect, pcm, SAMPLES)) {
+                    failures++;
+                    printf("in-place mismatch: type %d gain %d shift %d\n", type, gains[g], shift);
+                }
+            }
+        }
+    }
+    printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+
+    for (int i = 0; i < SAMPLES; i++)
+        pcm[i] = (short)((i * 2654435761u) >> 16) >> 3;
+    for (int type = G711ALAW; type <= G711ULAW; type++) {
+        volatile int sink = 0;
+        double t0 = now_us();
+        for (int r = 0; r < REPS; r++)
+            sink += ref_encode(expect, pcm, SAMPLES, type, GAIN) + expect[r % SAMPLES];
+        double t1 = now_us();
+        for (int r = 0; r < REPS; r++)
+            sink += G711EnCode((char *)got, (char *)pcm, sizeof(pcm), type) + got[r % SAMPLES];
+        double t2 = now_us();
+        printf("%s: search %.2f ns/sample, clz batch %.2f ns/sample, x%.2f\n", type == G711ALAW ? "A-law" : "u-law",
+               (t1 - t0) * 1000 / REPS / SAMPLES, (t2 - t1) * 1000 / REPS / SAMPLES, (t1 - t0) / (t2 - t1));
+    }
+    return failures != 0;
+}
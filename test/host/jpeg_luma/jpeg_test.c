@@ -0,0 +1,200 @@
+/*
+ * Host test of the luma-only JPEG decoder, run under AddressSanitizer, no IDF needed.
+ *
+ * - Full scale and the 1/8 DC thumbnail must be bit-exact with libjpeg (islow IDCT, grayscale output),
+ *   kept here as FNV-1a hashes of the libjpeg output so the test itself does not need libjpeg.
+ * - 1/2 and 1/4 reduced IDCTs are compared with the box average of the full scale output.
+ * - Malformed Huffman tables and randomly corrupted frames must be rejected without touching
+ *   memory out of bounds.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "jpeg_luma.h"
+
+#define MUTATIONS 2000
+
+typedef struct
+{
+  const char *file;
+  int width;
+  int height;
+  uint32_t fullHash;  // libjpeg at 1/1
+  uint32_t thumbHash; // libjpeg at 1/8, (W + 7) / 8 x (H + 7) / 8
+} refImage;
+
+static const refImage l_refs[] = {
+    {"ref/320x240_420.jpg", 320, 240, 0x181643b1, 0xd7daedc2},
+    {"ref/333x257_420_rst.jpg", 333, 257, 0xf31eeba2, 0x32a1db8f},
+    {"ref/240x176_422_rst.jpg", 240, 176, 0x0ae94f1e, 0xca85ea2b},
+    {"ref/160x120_444.jpg", 160, 120, 0x40bd282b, 0xd999f492},
+    {"ref/200x150_gray.jpg", 200, 150, 0x257cec28, 0xeaf7c3f2},
+};
+
+static uint32_t fnv1a(const uint8_t *p, size_t n)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++)
+  {
+    h = (h ^ p[i]) * 16777619u;
+  }
+  return h;
+}
+
+static uint8_t *load(const char *file, size_t *len)
+{
+  FILE *fp = fopen(file, "rb");
+  if (!fp)
+  {
+    return NULL;
+  }
+  fseek(fp, 0, SEEK_END);
+  *len = ftell(fp);
+  rewind(fp);
+  uint8_t *buf = malloc(*len);
+  if (fread(buf, 1, *len, fp) != *len)
+  {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  return buf;
+}
+
+/* max and mean difference between a reduced decode and the box average of the full decode */
+static void compare_scaled(const uint8_t *full, int width, int height, const uint8_t *scaled, int scale,
+                           int *maxDiff, double *meanDiff)
+{
+  int w = (width + scale - 1) / scale, h = (height + scale - 1) / scale;
+  long total = 0;
+  *maxDiff = 0;
+  for (int y = 0; y < h; y++)
+  {
+    for (int x = 0; x < w; x++)
+    {
+      int sum = 0, n = 0;
+      for (int yy = y * scale; yy < (y + 1) * scale && yy < height; yy++)
+      {
+        for (int xx = x * scale; xx < (x + 1) * scale && xx < width; xx++)
+        {
+          sum += full[yy * width + xx];
+          n++;
+        }
+      }
+      int d = abs(scaled[y * w + x] - (sum + n / 2) / n);
+      *maxDiff = d > *maxDiff ? d : *maxDiff;
+      total += d;
+    }
+  }
+  *meanDiff = (double)total / (w * h);
+}
+
+/* a DHT declaring more codes of one length than fit, must be rejected before the lookup is filled */
+static int test_bad_dht(JpegLuma *ctx)
+{
+  static const uint8_t counts[][16] = {
+      {2, 200},                // 2 one-bit codes use the whole code space
+      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255}, // fits
+      {3},                     // 3 one-bit codes
+      {0, 0, 9},               // 9 three-bit codes
+  };
+  static const esp_err_t expect[] = {ESP_ERR_INVALID_ARG, -1, ESP_ERR_INVALID_ARG, ESP_ERR_INVALID_ARG};
+  uint8_t jpeg[300], out[64];
+  int failures = 0;
+
+  for (size_t t = 0; t < sizeof(counts) / sizeof(counts[0]); t++)
+  {
+    int n = 0, nvals = 0;
+    for (int i = 0; i < 16; i++)
+    {
+      nvals += counts[t][i];
+    }
+    int segLen = 2 + 1 + 16 + nvals;
+    jpeg[n++] = 0xFF;
+    jpeg[n++] = 0xD8;
+    jpeg[n++] = 0xFF;
+    jpeg[n++] = 0xC4;
+    jpeg[n++] = segLen >> 8;
+    jpeg[n++] = segLen & 0xFF;
+    jpeg[n++] = 0x00; // dc table 0
+    memcpy(jpeg + n, counts[t], 16);
+    n += 16;
+    for (int i = 0; i < nvals; i++)
+    {
+      jpeg[n++] = i;
+    }
+    jpeg[n++] = 0xFF;
+    jpeg[n++] = 0xD9;
+    esp_err_t ret = jpeg_luma_decode(ctx, jpeg, n, out, 8, 8);
+    // a valid table still fails for lack of a frame, just not as a corrupt table
+    if (expect[t] >= 0 ? ret != expect[t] : ret == ESP_OK)
+    {
+      failures++;
+      printf("bad dht %zu: returned 0x%x\n", t, ret);
+    }
+  }
+  return failures;
+}
+
+int main(void)
+{
+  JpegLuma *ctx = jpeg_luma_create();
+  int failures = test_bad_dht(ctx);
+
+  srand(1);
+  for (size_t r = 0; r < sizeof(l_refs) / sizeof(l_refs[0]); r++)
+  {
+    const refImage *ref = &l_refs[r];
+    size_t len;
+    uint8_t *jpeg = load(ref->file, &len);
+    if (!jpeg)
+    {
+      printf("cannot read %s\n", ref->file);
+      failures++;
+      continue;
+    }
+    int w = ref->width, h = ref->height;
+    uint8_t *full = malloc(w * h), *scaled = malloc(w * h);
+
+    esp_err_t ret = jpeg_luma_decode(ctx, jpeg, len, full, w, h);
+    bool ok = ret == ESP_OK && fnv1a(full, w * h) == ref->fullHash;
+    int tw = (w + 7) / 8, th = (h + 7) / 8;
+    ret = jpeg_luma_decode(ctx, jpeg, len, scaled, tw, th);
+    ok = ok && ret == ESP_OK && fnv1a(scaled, tw * th) == ref->thumbHash;
+    printf("%-24s 1/1 and 1/8 %s", ref->file, ok ? "bit-exact" : "MISMATCH");
+    failures += !ok;
+
+    for (int scale = 2; scale <= 4; scale *= 2)
+    {
+      int maxDiff;
+      double meanDiff;
+      ret = jpeg_luma_decode(ctx, jpeg, len, scaled, (w + scale - 1) / scale, (h + scale - 1) / scale);
+      compare_scaled(full, w, h, scaled, scale, &maxDiff, &meanDiff);
+      ok = ret == ESP_OK && maxDiff <= 24 && meanDiff < 1.5;
+      printf(", 1/%d max %d mean %.2f%s", scale, maxDiff, meanDiff, ok ? "" : " FAIL");
+      failures += !ok;
+    }
+    printf("\n");
+
+    // flipped bytes and truncation anywhere, the result does not matter as long as memory stays in bounds
+    uint8_t *bad = malloc(len);
+    for (int m = 0; m < MUTATIONS; m++)
+    {
+      memcpy(bad, jpeg, len);
+      for (int k = 0; k < 1 + rand() % 4; k++)
+      {
+        bad[rand() % len] ^= 1 << (rand() % 8);
+      }
+      jpeg_luma_decode(ctx, bad, m % 8 ? len : (size_t)rand() % len, scaled, m % 2 ? w : (w + 7) / 8, m % 2 ? h : (h + 7) / 8);
+    }
+    free(bad);
+    free(full);
+    free(scaled);
+    free(jpeg);
+  }
+  jpeg_luma_destroy(ctx);
+  printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+  return failures != 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * Host benchmark of the mic_dsp stage, no IDF needed.
+ *
+ * Runs 20 s of synthetic 8 kHz capture through the default configuration in 20 ms chunks:
+ * a -1800 dc offset of the MEMS mic, a noise floor, and 2 s speech-like bursts from 150 to 9000
+ * amplitude every other 2 s. Prints the time per sample and the level of each 2 s segment,
+ * and fails if dc is left, a sample clips, or by the end of a segment the gate has not closed
+ * or the agc has not levelled the burst.
+ *
+ * dsp_bench in.wav out.wav processes a 16-bit mono wav instead and writes the result.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "mic_dsp.h"
+
+#define SAMPLE_RATE 8000
+#define SECONDS 20
+#define CHUNK (SAMPLE_RATE / 50) // 20 ms, same as the capture task
+#define SEGMENT (2 * SAMPLE_RATE)
+#define TAIL (SAMPLE_RATE / 2) // end of a segment where the gate and agc have settled
+#define REPS 200
+#define WAV_HEADER 44
+
+static double now_us(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+/* sum of uniforms, roughly gaussian with standard deviation sigma */
+static double noise(double sigma)
+{
+  double s = 0;
+  for (int i = 0; i < 12; i++)
+  {
+    s += rand() / (double)RAND_MAX;
+  }
+  return (s - 6) * sigma;
+}
+
+static int synth(int16_t *pcm)
+{
+  static const int amp[] = {150, 600, 2500, 9000, 300};
+  int n = SAMPLE_RATE * SECONDS;
+  srand(1);
+  for (int i = 0; i < n; i++)
+  {
+    double t = (double)i / SAMPLE_RATE;
+    double x = -1800 + noise(12);
+    int seg = i / SEGMENT;
+    if (seg % 2)
+    {
+      x += amp[(seg / 2) % 5] * (sin(2 * M_PI * 220 * t) + 0.5 * sin(2 * M_PI * 660 * t + 1)) * (0.6 + 0.4 * sin(2 * M_PI * 3 * t));
+    }
+    pcm[i] = x > 32767 ? 32767 : (x < -32768 ? -32768 : (int16_t)x);
+  }
+  return n;
+}
+
+static void run(MicDsp *dsp, const MicDspConfig *cfg, int16_t *work, const int16_t *pcm, int n)
+{
+  memcpy(work, pcm, n * sizeof(int16_t));
+  mic_dsp_init(dsp, cfg, SAMPLE_RATE);
+  for (int i = 0; i + CHUNK <= n; i += CHUNK)
+  {
+    mic_dsp_process(dsp, work + i, CHUNK);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static int16_t pcm[SAMPLE_RATE * 60 * 10], work[SAMPLE_RATE * 60 * 10];
+  unsigned char header[WAV_HEADER];
+  bool synthetic = argc < 3;
+  int n;
+
+  if (synthetic)
+  {
+    n = synth(pcm);
+  }
+  else
+  {
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp || fread(header, 1, WAV_HEADER, fp) != WAV_HEADER)
+    {
+      fprintf(stderr, "cannot read %s\n", argv[1]);
+      return 2;
+    }
+    n = fread(pcm, sizeof(int16_t), sizeof(pcm) / sizeof(int16_t), fp);
+    fclose(fp);
+  }
+
+  MicDsp dsp;
+  MicDspConfig cfg;
+  mic_dsp_default_config(&cfg);
+  double t0 = now_us();
+  for (int r = 0; r < REPS; r++)
+  {
+    run(&dsp, &cfg, work, pcm, n);
+  }
+  double us = (now_us() - t0) / REPS;
+  printf("%d samples: %.3f ms per pass, %.2f ns/sample, realtime x%.0f\n", n, us / 1000, us * 1000 / n,
+         n / (double)SAMPLE_RATE * 1e6 / us);
+
+  int failures = 0;
+  for (int s = 0; s < n / SEGMENT; s++)
+  {
+    long long sum = 0, sumAbs = 0, tailAbs = 0;
+    int peak = 0;
+    for (int i = s * SEGMENT; i < (s + 1) * SEGMENT; i++)
+    {
+      int a = abs(work[i]);
+      sum += work[i];
+      sumAbs += a;
+      tailAbs += i >= (s + 1) * SEGMENT - TAIL ? a : 0;
+      peak = a > peak ? a : peak;
+    }
+    int mean = sum / SEGMENT, meanAbs = sumAbs / SEGMENT, tail = tailAbs / TAIL;
+    bool ok = true;
+    if (synthetic)
+    {
+      // dc gone and no clipping; by the end of a segment the gate has closed or the agc has levelled the burst
+      ok = abs(mean) < 64 && peak < 32767;
+      ok = ok && (s % 2 ? tail > cfg.agcLevel / 4 && tail < cfg.agcLevel * 2 : tail < 8);
+      failures += !ok;
+    }
+    printf("segment %2d mean %6d mean abs %6d last 0.5s %6d peak %6d%s\n", s, mean, meanAbs, tail, peak, ok ? "" : "  FAIL");
+  }
+
+  if (synthetic)
+  {
+    printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+  }
+  else
+  {
+    FILE *fp = fopen(argv[2], "wb");
+    if (!fp)
+    {
+      fprintf(stderr, "cannot write %s\n", argv[2]);
+      return 2;
+    }
+    fwrite(header, 1, WAV_HEADER, fp);
+    fwrite(work, sizeof(int16_t), n, fp);
+    fclose(fp);
+  }
+  return failures != 0;
+}
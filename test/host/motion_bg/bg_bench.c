@@ -0,0 +1,132 @@
+/*
+ * Host benchmark of the motion detection kernels, no IDF needed.
+ *
+ * Compares per frame:
+ *   framediff  per-pixel |cur - prev| > threshold, the loop checkMotion used before the kernels
+ *   swar diff  the word-parallel frame difference that motion_bg_update superseded
+ *   background motion_bg_update, which also learns every pixel of the model
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "motion_kernel.h"
+
+#define THRESHOLD 15 // DETECT_CHANGE_THRESHOLD
+#define LANE_MASK 0x00FF00FFu
+#define LANE_BIAS 0x01000100u
+#define LANE_SIGN 0x80008000u
+#define FLUSH_WORDS 128
+
+static double now_us(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static uint32_t framediff(const uint8_t *cur, const uint8_t *prev, int n)
+{
+  uint32_t changes = 0;
+  for (int i = 0; i < n; i++)
+  {
+    changes += abs(cur[i] - prev[i]) > THRESHOLD;
+  }
+  return changes;
+}
+
+/* the superseded kernel, both buffers 4-byte aligned */
+static uint32_t swar_diff(const uint8_t *cur, const uint8_t *prev, int n)
+{
+  const uint32_t hiAdd = (0x7EFFu - THRESHOLD) * 0x00010001u;
+  const uint32_t loBase = (0x80FFu - THRESHOLD) * 0x00010001u;
+  uint32_t changes = 0;
+  int words = n >> 2;
+
+  while (words > 0)
+  {
+    int chunk = words < FLUSH_WORDS ? words : FLUSH_WORDS;
+    uint32_t acc = 0;
+    for (int w = 0; w < chunk; w++, cur += 4, prev += 4)
+    {
+      uint32_t a, b;
+      memcpy(&a, cur, 4);
+      memcpy(&b, prev, 4);
+      uint32_t de = ((a & LANE_MASK) | LANE_BIAS) - (b & LANE_MASK);
+      uint32_t dodd = (((a >> 8) & LANE_MASK) | LANE_BIAS) - ((b >> 8) & LANE_MASK);
+      acc += ((((de + hiAdd) | (loBase - de)) & LANE_SIGN) >> 15) + ((((dodd + hiAdd) | (loBase - dodd)) & LANE_SIGN) >> 15);
+    }
+    changes += (acc & 0xFFFF) + (acc >> 16);
+    words -= chunk;
+  }
+  return changes + framediff(cur, prev, n & 3);
+}
+
+static void bench(int width, int height, int reps)
+{
+  int n = width * height;
+  uint8_t *base = aligned_alloc(16, (n + 15) & ~15);
+  uint8_t *cur = aligned_alloc(16, (n + 15) & ~15);
+  uint8_t *prev = aligned_alloc(16, (n + 15) & ~15);
+  uint8_t *fgMask = malloc(n);
+  void *bgBuf = malloc(motion_bg_buffer_size(n));
+  uint16_t mask[MOTION_GRID_ROWS];
+  MotionZones zones;
+  MotionBg bg;
+  const MotionBgConfig cfg = {THRESHOLD, 3, 4, 6};
+  volatile uint32_t sink = 0;
+
+  srand(1);
+  for (int i = 0; i < n; i++)
+  {
+    base[i] = 40 + rand() % 160;
+  }
+  for (int r = 0; r < MOTION_GRID_ROWS; r++)
+  {
+    mask[r] = 0xFFFF;
+  }
+  motion_zones_init(&zones, mask, width, height);
+  motion_bg_init(&bg, bgBuf, width, height);
+
+  double t[3] = {0};
+  for (int f = 0; f < reps; f++)
+  {
+    // sensor noise of a few levels and a square subject moving 2 pixels per frame
+    memcpy(prev, cur, n);
+    for (int i = 0; i < n; i++)
+    {
+      cur[i] = base[i] + (rand() & 7) - 4;
+    }
+    int size = height / 4, x0 = (f * 2) % (width - size);
+    for (int y = height / 3; y < height / 3 + size; y++)
+    {
+      memset(cur + y * width + x0, 220, size);
+    }
+    double t0 = now_us();
+    sink += framediff(cur, prev, n);
+    double t1 = now_us();
+    sink += swar_diff(cur, prev, n);
+    double t2 = now_us();
+    sink += motion_bg_update(&bg, &cfg, cur, &zones, fgMask);
+    double t3 = now_us();
+    t[0] += t1 - t0;
+    t[1] += t2 - t1;
+    t[2] += t3 - t2;
+  }
+  printf("%3dx%-3d framediff %7.1f us  swar diff %7.1f us  background %7.1f us (%.1f ns/pixel)\n", width, height,
+         t[0] / reps, t[1] / reps, t[2] / reps, t[2] / reps * 1000 / n);
+  free(base);
+  free(cur);
+  free(prev);
+  free(fgMask);
+  free(bgBuf);
+}
+
+int main(void)
+{
+  bench(100, 75, 4000);  // DC thumbnail of a large frame
+  bench(160, 120, 2000); // QQVGA luma decode
+  bench(240, 240, 1000);
+  return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * Host precision/recall benchmark of motion detection on labelled synthetic clips, no IDF needed.
+ *
+ * Five 300-frame clips at the 100x75 DC thumbnail size, each frame labelled motion or not:
+ *   aec   static scene with exposure steps and a slow ramp, no motion
+ *   slow  a subject crossing at 0.4 pixel per frame
+ *   fast  a subject crossing at 3 pixels per frame, three times with gaps
+ *   tree  a swaying 30x30 patch of foliage noise, no motion
+ *   stop  a subject walks in, stands through an exposure step, walks out
+ * Each frame is scored for the frame difference against the previous frame and for the background
+ * model with blob filtering, both with the checkMotion thresholds at motionVal 8.
+ * Fails if the background model falls below MIN_SCORE precision or recall over all clips.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "motion_kernel.h"
+#include "motion_blob.h"
+
+#define W 100
+#define H 75
+#define FRAMES 300
+#define THRESHOLD 15        // DETECT_CHANGE_THRESHOLD
+#define MOTION_VAL 8        // default sensitivity of checkMotion
+#define MIN_BLOB_PERMILLE 2 // DETECT_MIN_BLOB_PERMILLE
+#define SUBJECT 20          // subject size in pixels
+#define SUBJECT_LUMA 45     // subject brighter than the scene
+#define MIN_SCORE 0.8       // overall precision and recall the background model must keep
+
+typedef enum
+{
+  CLIP_AEC,
+  CLIP_SLOW,
+  CLIP_FAST,
+  CLIP_TREE,
+  CLIP_STOP,
+  CLIP_COUNT
+} clipType;
+
+static const char *clipNames[CLIP_COUNT] = {"aec", "slow", "fast", "tree", "stop"};
+
+static uint64_t l_rng = 7;
+
+static double uniform(void)
+{
+  l_rng ^= l_rng << 13;
+  l_rng ^= l_rng >> 7;
+  l_rng ^= l_rng << 17;
+  return ((l_rng >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double gauss(double sigma)
+{
+  return sigma * sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+}
+
+/* scene * gain with sensor noise, optional subject at (sx, sy) and foliage patch */
+static void render(uint8_t *out, const float *scene, double gain, int sx, int sy, bool subject, bool tree)
+{
+  for (int y = 0; y < H; y++)
+  {
+    for (int x = 0; x < W; x++)
+    {
+      double v = scene[y * W + x];
+      if (subject && x >= sx && x < sx + SUBJECT && y >= sy && y < sy + SUBJECT)
+      {
+        v += SUBJECT_LUMA;
+      }
+      v = v * gain + gauss(2);
+      if (tree && x >= 60 && x < 90 && y >= 10 && y < 40)
+      {
+        v += gauss(14);
+      }
+      out[y * W + x] = v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+    }
+  }
+}
+
+/* renders frame t of a clip, returns its label */
+static bool clip_frame(clipType clip, int t, const float *scene, uint8_t *out)
+{
+  static double gain = 1.0;
+  int x = 0;
+  bool motion = false;
+
+  switch (clip)
+  {
+  case CLIP_AEC:
+    if (t == 0)
+    {
+      gain = 1.0;
+    }
+    else if (t % 60 == 30)
+    {
+      gain *= 1.15;
+    }
+    else if (t % 60 == 0)
+    {
+      gain /= 1.15;
+    }
+    if (t > 150 && t < 250)
+    {
+      gain *= 1.004;
+    }
+    render(out, scene, gain, 0, 0, false, false);
+    return false;
+  case CLIP_SLOW:
+    render(out, scene, 1.0, lround(5 + 0.4 * (t - 50)), 30, t >= 50, false);
+    return t >= 50;
+  case CLIP_FAST:
+    x = -20 + 3 * (t % 100 - 30);
+    render(out, scene, 1.0, x, 25, t % 100 >= 30, false);
+    return t % 100 >= 30 && x < W;
+  case CLIP_TREE:
+    render(out, scene, 1.0, 0, 0, false, true);
+    return false;
+  case CLIP_STOP:
+    if (t < 30)
+    {
+      x = -25;
+    }
+    else if (t < 80)
+    {
+      x = lround(-25 + 1.2 * (t - 30));
+      motion = true;
+    }
+    else if (t < 220)
+    {
+      x = 35;
+    }
+    else
+    {
+      x = lround(35 + 1.2 * (t - 220));
+      motion = x < W;
+    }
+    render(out, scene, t >= 150 && t < 200 ? 1.12 : 1.0, x, 30, true, false);
+    return motion;
+  default:
+    return false;
+  }
+}
+
+static int framediff(const uint8_t *cur, const uint8_t *prev, const MotionZones *zones)
+{
+  int changes = 0;
+  for (int r = 0; r < MOTION_GRID_ROWS; r++)
+  {
+    for (int c = 0; c < MOTION_GRID_COLS; c++)
+    {
+      if (!(zones->mask[r] & MOTION_ZONE_BIT(c)))
+      {
+        continue;
+      }
+      for (int y = zones->cellY[r]; y < zones->cellY[r + 1]; y++)
+      {
+        for (int x = zones->cellX[c]; x < zones->cellX[c + 1]; x++)
+        {
+          changes += abs(cur[y * W + x] - prev[y * W + x]) > THRESHOLD;
+        }
+      }
+    }
+  }
+  return changes;
+}
+
+/* counts: true positives, false positives, false negatives */
+static void score(int *counts, bool detected, bool label)
+{
+  if (detected && label)
+  {
+    counts[0]++;
+  }
+  else if (detected)
+  {
+    counts[1]++;
+  }
+  else if (label)
+  {
+    counts[2]++;
+  }
+}
+
+static void report(const char *clip, const char *detector, const int *c)
+{
+  printf("%-5s %-10s %4d %4d %4d  %.2f  %.2f\n", clip, detector, c[0], c[1], c[2],
+         c[0] + c[1] ? (double)c[0] / (c[0] + c[1]) : 1.0, c[0] + c[2] ? (double)c[0] / (c[0] + c[2]) : 1.0);
+}
+
+int main(void)
+{
+  static float scene[W * H];
+  static uint8_t frames[2][W * H], fgMask[W * H];
+  void *bgBuf = malloc(motion_bg_buffer_size(W * H));
+  void *blobWork = malloc(motion_blob_work_size(W, H));
+  const MotionBgConfig cfg = {THRESHOLD, 3, 4, 6}; // DETECT_SIGMA_K, DETECT_LEARN_SHIFT, DETECT_ABSORB_SHIFT
+  uint16_t mask[MOTION_GRID_ROWS];
+  MotionZones zones;
+  int total[2][3] = {{0}};
+
+  // the bottom row of cells is masked, like a timestamp overlay
+  for (int r = 0; r < MOTION_GRID_ROWS; r++)
+  {
+    mask[r] = r < MOTION_GRID_ROWS - 1 ? 0xFFFF : 0;
+  }
+  motion_zones_init(&zones, mask, W, H);
+  int moveThreshold = zones.activePixels * (11 - MOTION_VAL) / 100;
+  uint32_t minBlobArea = W * H * MIN_BLOB_PERMILLE / 1000;
+
+  for (int y = 0; y < H; y++)
+  {
+    for (int x = 0; x < W; x++)
+    {
+      float v = 90 + 40 * sin(x / 7.0) * cos(y / 9.0) + gauss(15);
+      scene[y * W + x] = v < 10 ? 10 : (v > 230 ? 230 : v);
+    }
+  }
+
+  printf("clip  detector     TP   FP   FN  prec  recall\n");
+  for (int clip = 0; clip < CLIP_COUNT; clip++)
+  {
+    MotionBg bg;
+    int counts[2][3] = {{0}};
+    motion_bg_init(&bg, bgBuf, W, H);
+    for (int t = 0; t < FRAMES; t++)
+    {
+      uint8_t *cur = frames[t & 1], *prev = frames[!(t & 1)];
+      bool label = clip_frame(clip, t, scene, cur);
+      bool diffDetect = t && framediff(cur, prev, &zones) > moveThreshold;
+      uint32_t blobArea = 0;
+      MotionBlob blobs[MOTION_MAX_BLOBS];
+      motion_bg_update(&bg, &cfg, cur, &zones, fgMask);
+      motion_blob_find(fgMask, W, H, blobWork, minBlobArea, blobs, MOTION_MAX_BLOBS, &blobArea);
+      score(counts[0], diffDetect, label);
+      score(counts[1], blobArea > (uint32_t)moveThreshold, label);
+    }
+    report(clipNames[clip], "framediff", counts[0]);
+    report(clipNames[clip], "background", counts[1]);
+    for (int k = 0; k < 2; k++)
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        total[k][i] += counts[k][i];
+      }
+    }
+  }
+  report("all", "framediff", total[0]);
+  report("all", "background", total[1]);
+  free(bgBuf);
+  free(blobWork);
+  int *c = total[1];
+  bool ok = c[0] >= MIN_SCORE * (c[0] + c[1]) && c[0] >= MIN_SCORE * (c[0] + c[2]);
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return !ok;
+}
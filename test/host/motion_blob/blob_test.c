@@ -0,0 +1,261 @@
+/*
+ * Host test of the connected component labelling, no IDF needed.
+ *
+ * The reference is a plain 8-connected flood fill started at every unvisited pixel in raster order.
+ * Its components are sorted by area, ties kept in order of their first pixel like motion_blob_find,
+ * so count, total area, bounding boxes and centroids must match exactly.
+ * Masks cover random noise at several densities, the checkerboard that needs the most provisional labels,
+ * combs and spirals whose labels only merge far below where they started, and 1-pixel wide frames.
+ * Then times both on random detection-size masks.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "motion_blob.h"
+
+#define RANDOM_MASKS 400
+#define REPS 200
+
+static double now_us(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+typedef struct
+{
+  uint32_t area, first;
+  uint64_t sumX, sumY;
+  int x0, y0, x1, y1;
+} refBlob;
+
+static int cmp_ref(const void *a, const void *b)
+{
+  const refBlob *p = a, *q = b;
+  if (p->area != q->area)
+  {
+    return p->area < q->area ? 1 : -1;
+  }
+  return p->first < q->first ? -1 : 1;
+}
+
+/* flood fill every component, returns the number found */
+static int flood_fill(const uint8_t *mask, int width, int height, refBlob *out, int *stack, uint8_t *seen)
+{
+  int count = 0;
+  memset(seen, 0, width * height);
+  for (int start = 0; start < width * height; start++)
+  {
+    if (!mask[start] || seen[start])
+    {
+      continue;
+    }
+    refBlob *b = &out[count++];
+    *b = (refBlob){0, start, 0, 0, width, height, 0, 0};
+    int top = 0;
+    stack[top++] = start;
+    seen[start] = 1;
+    while (top)
+    {
+      int p = stack[--top], x = p % width, y = p / width;
+      b->area++;
+      b->sumX += x;
+      b->sumY += y;
+      b->x0 = x < b->x0 ? x : b->x0;
+      b->x1 = x > b->x1 ? x : b->x1;
+      b->y0 = y < b->y0 ? y : b->y0;
+      b->y1 = y > b->y1 ? y : b->y1;
+      for (int dy = -1; dy <= 1; dy++)
+      {
+        for (int dx = -1; dx <= 1; dx++)
+        {
+          int nx = x + dx, ny = y + dy;
+          if (nx >= 0 && nx < width && ny >= 0 && ny < height && mask[ny * width + nx] && !seen[ny * width + nx])
+          {
+            seen[ny * width + nx] = 1;
+            stack[top++] = ny * width + nx;
+          }
+        }
+      }
+    }
+  }
+  return count;
+}
+
+static int check(const char *name, const uint8_t *mask, int width, int height, uint32_t minArea, int maxBlobs)
+{
+  int n = width * height;
+  void *work = malloc(motion_blob_work_size(width, height)); // exact size, ASan catches an overrun
+  refBlob *ref = malloc(n * sizeof(refBlob));
+  int *stack = malloc(n * sizeof(int));
+  uint8_t *seen = malloc(n);
+  MotionBlob blobs[MOTION_MAX_BLOBS + 1];
+  uint32_t total = 0, refTotal = 0;
+  int failures = 0;
+
+  int found = flood_fill(mask, width, height, ref, stack, seen);
+  qsort(ref, found, sizeof(refBlob), cmp_ref);
+  int refCount = 0;
+  while (refCount < found && ref[refCount].area >= minArea)
+  {
+    refTotal += ref[refCount++].area;
+  }
+  if (refCount > (maxBlobs < MOTION_MAX_BLOBS ? maxBlobs : MOTION_MAX_BLOBS))
+  {
+    refCount = maxBlobs < MOTION_MAX_BLOBS ? maxBlobs : MOTION_MAX_BLOBS;
+  }
+
+  int count = motion_blob_find(mask, width, height, work, minArea, blobs, maxBlobs, &total);
+  if (count != refCount || total != refTotal)
+  {
+    printf("%s %dx%d min %u: %d blobs %u pixels, expected %d blobs %u pixels\n", name, width, height, minArea,
+           count, total, refCount, refTotal);
+    failures++;
+  }
+  for (int i = 0; i < count && i < refCount && !failures; i++)
+  {
+    const refBlob *r = &ref[i];
+    const MotionBlob *b = &blobs[i];
+    if (b->area != r->area || b->x != r->x0 || b->y != r->y0 || b->w != r->x1 - r->x0 + 1 ||
+        b->h != r->y1 - r->y0 + 1 || b->cx != r->sumX / r->area || b->cy != r->sumY / r->area)
+    {
+      printf("%s %dx%d blob %d: %u at %u,%u %ux%u c %u,%u, expected %u at %d,%d %dx%d c %u,%u\n", name, width, height,
+             i, b->area, b->x, b->y, b->w, b->h, b->cx, b->cy, r->area, r->x0, r->y0, r->x1 - r->x0 + 1,
+             r->y1 - r->y0 + 1, (unsigned)(r->sumX / r->area), (unsigned)(r->sumY / r->area));
+      failures++;
+    }
+  }
+  free(work);
+  free(ref);
+  free(stack);
+  free(seen);
+  return failures;
+}
+
+static void random_mask(uint8_t *mask, int n, int percent)
+{
+  for (int i = 0; i < n; i++)
+  {
+    // any non-zero value is foreground
+    mask[i] = rand() % 100 < percent ? 1 + rand() % 255 : 0;
+  }
+}
+
+/* vertical teeth joined only on the bottom row, every tooth gets its own label until the last row */
+static void comb_mask(uint8_t *mask, int width, int height)
+{
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      mask[y * width + x] = y == height - 1 || x % 2 == 0;
+    }
+  }
+}
+
+/* one square spiral, long runs that turn back towards where they started */
+static void spiral_mask(uint8_t *mask, int width, int height)
+{
+  memset(mask, 0, width * height);
+  int x0 = 0, y0 = 0, x1 = width - 1, y1 = height - 1;
+  while (x0 <= x1 && y0 <= y1)
+  {
+    // top, right and bottom side, the left side stops short of the top to leave the way in
+    for (int x = x0; x <= x1; x++)
+    {
+      mask[y0 * width + x] = mask[y1 * width + x] = 1;
+    }
+    for (int y = y0; y <= y1; y++)
+    {
+      mask[y * width + x1] = 1;
+    }
+    for (int y = y0 + 2; y <= y1; y++)
+    {
+      mask[y * width + x0] = 1;
+    }
+    if (y0 + 2 <= y1 && x0 + 1 <= x1)
+    {
+      mask[(y0 + 2) * width + x0 + 1] = 1; // link to the next ring inside
+    }
+    x0 += 2;
+    y0 += 2;
+    x1 -= 2;
+    y1 -= 2;
+  }
+}
+
+static void bench(int width, int height)
+{
+  int n = width * height;
+  uint8_t *mask = malloc(n);
+  void *work = malloc(motion_blob_work_size(width, height));
+  refBlob *ref = malloc(n * sizeof(refBlob));
+  int *stack = malloc(n * sizeof(int));
+  uint8_t *seen = malloc(n);
+  MotionBlob blobs[MOTION_MAX_BLOBS];
+  volatile uint32_t sink = 0;
+  double t[2] = {0};
+
+  for (int r = 0; r < REPS; r++)
+  {
+    random_mask(mask, n, r % 2 ? 5 : 40);
+    double t0 = now_us();
+    sink += flood_fill(mask, width, height, ref, stack, seen);
+    double t1 = now_us();
+    sink += motion_blob_find(mask, width, height, work, 4, blobs, MOTION_MAX_BLOBS, NULL);
+    t[0] += t1 - t0;
+    t[1] += now_us() - t1;
+  }
+  printf("%3dx%-3d flood fill %7.1f us  two-pass %7.1f us\n", width, height, t[0] / REPS, t[1] / REPS);
+  free(mask);
+  free(work);
+  free(ref);
+  free(stack);
+  free(seen);
+}
+
+int main(void)
+{
+  static const int sizes[][2] = {{1, 1}, {1, 37}, {37, 1}, {2, 2}, {7, 5}, {33, 17}, {100, 75}, {160, 120}, {240, 240}};
+  static uint8_t mask[240 * 240];
+  int failures = 0;
+
+  srand(1);
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+  {
+    int w = sizes[s][0], h = sizes[s][1], n = w * h;
+
+    memset(mask, 0, n);
+    failures += check("empty", mask, w, h, 1, MOTION_MAX_BLOBS);
+    memset(mask, 1, n);
+    failures += check("full", mask, w, h, 1, MOTION_MAX_BLOBS);
+    for (int i = 0; i < n; i++)
+    {
+      mask[i] = (i % w) % 2 == 0 && (i / w) % 2 == 0; // isolated pixels, the most provisional labels
+    }
+    failures += check("checker", mask, w, h, 1, MOTION_MAX_BLOBS);
+    comb_mask(mask, w, h);
+    failures += check("comb", mask, w, h, 1, MOTION_MAX_BLOBS);
+    spiral_mask(mask, w, h);
+    failures += check("spiral", mask, w, h, 1, MOTION_MAX_BLOBS);
+    for (int r = 0; r < RANDOM_MASKS; r++)
+    {
+      random_mask(mask, n, 5 + r % 60);
+      failures += check("random", mask, w, h, r % 4 ? 1 + rand() % 20 : 1, 1 + r % MOTION_MAX_BLOBS);
+    }
+    // asking for more blobs than the output can hold is capped at MOTION_MAX_BLOBS
+    random_mask(mask, n, 20);
+    failures += check("capped", mask, w, h, 1, MOTION_MAX_BLOBS + 1);
+  }
+  printf("labelling checked on %zu sizes\n", sizeof(sizes) / sizeof(sizes[0]));
+
+  bench(100, 75);
+  bench(160, 120);
+  bench(240, 240);
+  printf("%s: %d failures\n", failures ? "FAIL" : "PASS", failures);
+  return failures != 0;
+}